@@ -0,0 +1,336 @@
+#include "aabb_tree.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static inline float min_float(float a, float b) {
+    return a < b ? a : b;
+}
+
+static inline float max_float(float a, float b) {
+    return a > b ? a : b;
+}
+
+static inline int max_int(int a, int b) {
+    return a > b ? a : b;
+}
+
+static aabb_t aabb_union(aabb_t a, aabb_t b) {
+    return (aabb_t){
+        min_float(a.min_x, b.min_x), min_float(a.min_y, b.min_y),
+        max_float(a.max_x, b.max_x), max_float(a.max_y, b.max_y),
+    };
+}
+
+static float aabb_perimeter(aabb_t box) {
+    return 2 * ((box.max_x - box.min_x) + (box.max_y - box.min_y));
+}
+
+static bool aabb_contains(aabb_t outer, aabb_t inner) {
+    return outer.min_x <= inner.min_x && outer.min_y <= inner.min_y &&
+           inner.max_x <= outer.max_x && inner.max_y <= outer.max_y;
+}
+
+static bool aabb_overlaps(aabb_t a, aabb_t b) {
+    return a.min_x <= b.max_x && b.min_x <= a.max_x && a.min_y <= b.max_y && b.min_y <= a.max_y;
+}
+
+static bool is_leaf(aabb_node_t *node) {
+    return node->left == AABB_NULL_NODE;
+}
+
+void aabb_tree_init(aabb_tree_t *tree, float margin) {
+    memset(tree, 0, sizeof(aabb_tree_t));
+    tree->root = AABB_NULL_NODE;
+    tree->free_list = AABB_NULL_NODE;
+    tree->margin = margin;
+}
+
+void aabb_tree_free(aabb_tree_t *tree) {
+    free(tree->nodes);
+    free(tree->stack);
+}
+
+/*
+ * Grows the node array and puts the new nodes in front of the free list.
+ */
+static void grow(aabb_tree_t *tree, int capacity) {
+    int old_capacity = tree->capacity;
+    tree->capacity = capacity;
+    tree->nodes = realloc(tree->nodes, capacity * sizeof(aabb_node_t));
+    for (int i = old_capacity; i < capacity; i++) {
+        tree->nodes[i].parent = i + 1 < capacity ? i + 1 : tree->free_list;
+        tree->nodes[i].height = -1;
+    }
+    tree->free_list = old_capacity;
+
+    // The query stack never holds more entries than there are nodes
+    tree->stack = realloc(tree->stack, capacity * sizeof(int));
+}
+
+void aabb_tree_reserve(aabb_tree_t *tree, int leaf_count) {
+    // A tree with n leaves has n - 1 inner nodes
+    if (2 * leaf_count > tree->capacity) {
+        grow(tree, 2 * leaf_count);
+    }
+}
+
+static int alloc_node(aabb_tree_t *tree) {
+    if (tree->free_list == AABB_NULL_NODE) {
+        grow(tree, tree->capacity ? tree->capacity * 2 : 64);
+    }
+
+    int idx = tree->free_list;
+    aabb_node_t *node = &tree->nodes[idx];
+    tree->free_list = node->parent;
+    node->parent = AABB_NULL_NODE;
+    node->left = AABB_NULL_NODE;
+    node->right = AABB_NULL_NODE;
+    node->height = 0;
+    node->data = -1;
+    return idx;
+}
+
+static void free_node(aabb_tree_t *tree, int idx) {
+    tree->nodes[idx].parent = tree->free_list;
+    tree->nodes[idx].height = -1;
+    tree->free_list = idx;
+}
+
+static void replace_child(aabb_tree_t *tree, int parent, int old_child, int new_child) {
+    if (parent == AABB_NULL_NODE) {
+        tree->root = new_child;
+    } else if (tree->nodes[parent].left == old_child) {
+        tree->nodes[parent].left = new_child;
+    } else {
+        tree->nodes[parent].right = new_child;
+    }
+}
+
+/*
+ * Rotates the subtree at `idx` if one child is more than one level higher than
+ * the other, and returns the new root of the subtree.
+ */
+static int balance(aabb_tree_t *tree, int idx_a) {
+    aabb_node_t *a = &tree->nodes[idx_a];
+    if (is_leaf(a) || a->height < 2) {
+        return idx_a;
+    }
+
+    int idx_b = a->left;
+    int idx_c = a->right;
+    aabb_node_t *b = &tree->nodes[idx_b];
+    aabb_node_t *c = &tree->nodes[idx_c];
+    int diff = c->height - b->height;
+
+    if (diff > 1) {
+        // Rotate C up
+        int idx_f = c->left;
+        int idx_g = c->right;
+        aabb_node_t *f = &tree->nodes[idx_f];
+        aabb_node_t *g = &tree->nodes[idx_g];
+
+        c->left = idx_a;
+        c->parent = a->parent;
+        a->parent = idx_c;
+        replace_child(tree, c->parent, idx_a, idx_c);
+
+        if (f->height > g->height) {
+            c->right = idx_f;
+            a->right = idx_g;
+            g->parent = idx_a;
+            a->box = aabb_union(b->box, g->box);
+            c->box = aabb_union(a->box, f->box);
+            a->height = 1 + max_int(b->height, g->height);
+            c->height = 1 + max_int(a->height, f->height);
+        } else {
+            c->right = idx_g;
+            a->right = idx_f;
+            f->parent = idx_a;
+            a->box = aabb_union(b->box, f->box);
+            c->box = aabb_union(a->box, g->box);
+            a->height = 1 + max_int(b->height, f->height);
+            c->height = 1 + max_int(a->height, g->height);
+        }
+        return idx_c;
+    }
+
+    if (diff < -1) {
+        // Rotate B up
+        int idx_d = b->left;
+        int idx_e = b->right;
+        aabb_node_t *d = &tree->nodes[idx_d];
+        aabb_node_t *e = &tree->nodes[idx_e];
+
+        b->left = idx_a;
+        b->parent = a->parent;
+        a->parent = idx_b;
+        replace_child(tree, b->parent, idx_a, idx_b);
+
+        if (d->height > e->height) {
+            b->right = idx_d;
+            a->left = idx_e;
+            e->parent = idx_a;
+            a->box = aabb_union(c->box, e->box);
+            b->box = aabb_union(a->box, d->box);
+            a->height = 1 + max_int(c->height, e->height);
+            b->height = 1 + max_int(a->height, d->height);
+        } else {
+            b->right = idx_e;
+            a->left = idx_d;
+            d->parent = idx_a;
+            a->box = aabb_union(c->box, d->box);
+            b->box = aabb_union(a->box, e->box);
+            a->height = 1 + max_int(c->height, d->height);
+            b->height = 1 + max_int(a->height, e->height);
+        }
+        return idx_b;
+    }
+
+    return idx_a;
+}
+
+/*
+ * Rebalances and refits the boxes and heights from `idx` up to the root.
+ */
+static void refit(aabb_tree_t *tree, int idx) {
+    while (idx != AABB_NULL_NODE) {
+        idx = balance(tree, idx);
+        aabb_node_t *node = &tree->nodes[idx];
+        aabb_node_t *left = &tree->nodes[node->left];
+        aabb_node_t *right = &tree->nodes[node->right];
+        node->height = 1 + max_int(left->height, right->height);
+        node->box = aabb_union(left->box, right->box);
+        idx = node->parent;
+    }
+}
+
+/*
+ * Cost of making `child` the sibling of a leaf with `box`, beyond what the
+ * ancestors of `child` grow anyway.
+ */
+static float descend_cost(aabb_tree_t *tree, int child, aabb_t box, float inherited_cost) {
+    aabb_node_t *node = &tree->nodes[child];
+    float perimeter = aabb_perimeter(aabb_union(box, node->box));
+    if (is_leaf(node)) {
+        return perimeter + inherited_cost;
+    }
+    return perimeter - aabb_perimeter(node->box) + inherited_cost;
+}
+
+static void insert_leaf(aabb_tree_t *tree, int leaf) {
+    if (tree->root == AABB_NULL_NODE) {
+        tree->root = leaf;
+        tree->nodes[leaf].parent = AABB_NULL_NODE;
+        return;
+    }
+
+    // Find the best sibling, using the perimeter as the cost of a box
+    aabb_t box = tree->nodes[leaf].box;
+    int idx = tree->root;
+    while (!is_leaf(&tree->nodes[idx])) {
+        aabb_node_t *node = &tree->nodes[idx];
+        float perimeter = aabb_perimeter(node->box);
+        float combined_perimeter = aabb_perimeter(aabb_union(node->box, box));
+
+        // Cost of a new parent for this node and the leaf
+        float cost = 2 * combined_perimeter;
+        // Cost of pushing the leaf further down the tree
+        float inherited_cost = 2 * (combined_perimeter - perimeter);
+        float left_cost = descend_cost(tree, node->left, box, inherited_cost);
+        float right_cost = descend_cost(tree, node->right, box, inherited_cost);
+
+        if (cost < left_cost && cost < right_cost) {
+            break;
+        }
+        idx = left_cost < right_cost ? node->left : node->right;
+    }
+
+    int sibling = idx;
+    int old_parent = tree->nodes[sibling].parent;
+    // May move the node array
+    int new_parent = alloc_node(tree);
+    aabb_node_t *parent = &tree->nodes[new_parent];
+    parent->parent = old_parent;
+    parent->box = aabb_union(box, tree->nodes[sibling].box);
+    parent->height = tree->nodes[sibling].height + 1;
+    parent->left = sibling;
+    parent->right = leaf;
+    replace_child(tree, old_parent, sibling, new_parent);
+    tree->nodes[sibling].parent = new_parent;
+    tree->nodes[leaf].parent = new_parent;
+
+    refit(tree, new_parent);
+}
+
+static void remove_leaf(aabb_tree_t *tree, int leaf) {
+    if (leaf == tree->root) {
+        tree->root = AABB_NULL_NODE;
+        return;
+    }
+
+    int parent = tree->nodes[leaf].parent;
+    int grandparent = tree->nodes[parent].parent;
+    int sibling = tree->nodes[parent].left == leaf ? tree->nodes[parent].right : tree->nodes[parent].left;
+
+    replace_child(tree, grandparent, parent, sibling);
+    tree->nodes[sibling].parent = grandparent;
+    free_node(tree, parent);
+
+    refit(tree, grandparent);
+}
+
+static aabb_t enlarge(aabb_t box, float margin) {
+    return (aabb_t){box.min_x - margin, box.min_y - margin, box.max_x + margin, box.max_y + margin};
+}
+
+int aabb_tree_insert(aabb_tree_t *tree, aabb_t box, int data) {
+    int leaf = alloc_node(tree);
+    tree->nodes[leaf].box = enlarge(box, tree->margin);
+    tree->nodes[leaf].data = data;
+    insert_leaf(tree, leaf);
+    return leaf;
+}
+
+void aabb_tree_remove(aabb_tree_t *tree, int leaf) {
+    remove_leaf(tree, leaf);
+    free_node(tree, leaf);
+}
+
+bool aabb_tree_move(aabb_tree_t *tree, int leaf, aabb_t box) {
+    if (aabb_contains(tree->nodes[leaf].box, box)) {
+        return false;
+    }
+
+    remove_leaf(tree, leaf);
+    tree->nodes[leaf].box = enlarge(box, tree->margin);
+    insert_leaf(tree, leaf);
+    return true;
+}
+
+void aabb_tree_query(aabb_tree_t *tree, aabb_t box, aabb_query_func_t func, void *udata) {
+    if (tree->root == AABB_NULL_NODE) {
+        return;
+    }
+
+    int count = 0;
+    tree->stack[count++] = tree->root;
+
+    while (count > 0) {
+        aabb_node_t *node = &tree->nodes[tree->stack[--count]];
+        if (!aabb_overlaps(node->box, box)) {
+            continue;
+        }
+
+        if (is_leaf(node)) {
+            func(udata, node->data);
+        } else {
+            tree->stack[count++] = node->left;
+            tree->stack[count++] = node->right;
+        }
+    }
+}
+
+int aabb_tree_height(aabb_tree_t *tree) {
+    return tree->root == AABB_NULL_NODE ? 0 : tree->nodes[tree->root].height;
+}
@@ -0,0 +1,85 @@
+#ifndef AABB_TREE_H
+#define AABB_TREE_H
+
+#include <stdbool.h>
+
+#define AABB_NULL_NODE -1
+
+typedef struct aabb_t {
+    float min_x;
+    float min_y;
+    float max_x;
+    float max_y;
+} aabb_t;
+
+typedef struct aabb_node_t {
+    // Enlarged by the tree's margin for leaves
+    aabb_t box;
+    // Next free node while the node is unused
+    int parent;
+    int left;
+    int right;
+    // 0 for leaves, -1 for unused nodes
+    int height;
+    int data;
+} aabb_node_t;
+
+/*
+ * Dynamic bounding volume tree for moving objects with varying sizes, like the
+ * player circles. Every object is a leaf whose box is enlarged by `margin`, so
+ * an object that moves a little stays in its leaf, and only objects that leave
+ * their enlarged box are reinserted. Insertion picks the sibling that grows the
+ * tree's boxes the least, and rotations keep the tree balanced, so queries are
+ * O(log n) plus the number of results.
+ *
+ * Leaves are addressed by the node index returned from `aabb_tree_insert`,
+ * which stays valid until the leaf is removed. Nodes are pooled in one array.
+ */
+typedef struct aabb_tree_t {
+    aabb_node_t *nodes;
+    int capacity;
+    int root;
+    int free_list;
+    float margin;
+    // Scratch stack for queries, as large as the node array
+    int *stack;
+} aabb_tree_t;
+
+typedef void (*aabb_query_func_t)(void *udata, int data);
+
+void aabb_tree_init(aabb_tree_t *tree, float margin);
+void aabb_tree_free(aabb_tree_t *tree);
+
+/*
+ * Makes room for `leaf_count` leaves, so inserting that many objects doesn't
+ * allocate memory.
+ */
+void aabb_tree_reserve(aabb_tree_t *tree, int leaf_count);
+
+/*
+ * Adds an object with the given box and returns its leaf. `data` is passed to
+ * query callbacks.
+ */
+int aabb_tree_insert(aabb_tree_t *tree, aabb_t box, int data);
+void aabb_tree_remove(aabb_tree_t *tree, int leaf);
+
+/*
+ * Updates the box of the object. The leaf is only reinserted if the box is no
+ * longer contained in the enlarged box of the leaf.
+ *
+ * Returns true if the leaf was reinserted.
+ */
+bool aabb_tree_move(aabb_tree_t *tree, int leaf, aabb_t box);
+
+/*
+ * Calls `func` with the data of every leaf whose enlarged box overlaps `box`.
+ * The callback must not modify the tree.
+ */
+void aabb_tree_query(aabb_tree_t *tree, aabb_t box, aabb_query_func_t func, void *udata);
+
+/*
+ * Returns the height of the tree, 0 for an empty tree or a single leaf.
+ */
+int aabb_tree_height(aabb_tree_t *tree);
+
+#endif // AABB_TREE_H
@@ -3,91 +3,262 @@
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
-#include <sys/event.h>
 #include <errno.h>
-#include <sys/time.h>
+#include <signal.h>
+#include <time.h>
 #include <stdbool.h>
 
+#include "event_loop.h"
+#include "food.h"
 #include "geometry.h"
+#include "interest.h"
+#include "log.h"
+#include "metrics.h"
+#include "metrics_server.h"
+#include "movement.h"
 #include "protocol.h"
 #include "networking.h"
+#include "player_cells.h"
+#include "player_table.h"
+#include "profiler.h"
+#include "rng.h"
+#include "server_io.h"
+#include "session.h"
+#include "tick_scheduler.h"
 
-#define MAX_EVENTS 5
-#define MAX_PLAYERS 64
+#define MAX_EVENTS 1024
+#define DEFAULT_MAX_PLAYERS 64
+#define MAX_PLAYERS_LIMIT 16384
+#if MAX_PLAYERS_LIMIT > 65535
+#error "The maximum number of players doesn't fit into the session header"
+#endif
+#define MAX_IO_THREADS 64
+#define SERVER_ADDR "127.0.0.1"
+#define SERVER_PORT 2000
 // Has to be greater than 1
 #define TICKS_PER_SEC 20
+// Ticks that are missed beyond this are skipped instead of being run
+// back-to-back
+#define MAX_CATCH_UP_TICKS 3
+#define TICK_STATS_INTERVAL_SEC 10
+// When a tick takes longer than the tick interval, the log records of this
+// many seconds before it are dumped, at most once per interval
+#define FLIGHT_RECORDER_SEC 5
+#define FLIGHT_RECORDER_INTERVAL_SEC 60
 #define FIELD_HEIGHT 1000
 #define FIELD_WIDTH 1000
+#if FIELD_WIDTH > MAX_FIELD_SIZE || FIELD_HEIGHT > MAX_FIELD_SIZE
+#error "Positions on the field don't fit into cell deltas"
+#endif
 
 #define START_MASS 10
+// Distance a player moves per tick
+#define PLAYER_SPEED 0.5
+// Cells that were split off can merge again after this many ticks
+#define MERGE_TICKS (10 * TICKS_PER_SEC)
 
-// TODO: Add way to disconnect players that don't join in time to prevent denial
-// of service attacks
-typedef struct player_t {
-    int sock;
-    int id;
-    int mass;
-    char *name;
-    rejoin_token_t rejoin_token;
-    vec2_t pos;
-    vec2_t target;
-    bool joined;
-} player_t;
+#define DEFAULT_FOOD_COUNT 1000
+// Above this density a player gains area from the pellets it eats faster than
+// it sweeps new area by moving, so its growth is unbounded
+#define MAX_FOOD_LIMIT 5000
+#define FOOD_MASS 1
+// Food batches are split into messages of at most this size, which also fit
+// into a single UDP datagram
+#define FOOD_MESSAGE_LEN 8192
+// Same for the cell positions of a tick
+#define CELL_MESSAGE_LEN 8192
+#if CELL_MESSAGE_LEN < MIN_CELL_DELTA_MESSAGE_LEN
+#error "Cell delta messages are too short for some deltas"
+#endif
+// Same for the list of players that a joining player gets
+#define PLAYERS_MESSAGE_LEN 8192
+#if PLAYERS_MESSAGE_LEN < MIN_CURRENT_PLAYERS_MESSAGE_LEN
+#error "Player list messages are too short for some players"
+#endif
+// Messages are built in a buffer of this size, and then copied into a frame of
+// their actual size
+#define MESSAGE_BUF_LEN 8192
+#if FOOD_MESSAGE_LEN > MESSAGE_BUF_LEN || CELL_MESSAGE_LEN > MESSAGE_BUF_LEN || PLAYERS_MESSAGE_LEN > MESSAGE_BUF_LEN
+#error "Some messages don't fit into the message buffer"
+#endif
+// Cell deltas are sent against a full snapshot this often, so a client that
+// missed a delta is back in sync after at most a second
+#define KEYFRAME_TICKS TICKS_PER_SEC
 
+// Phases of a tick, in the order they run
+#define TICK_PHASE_INPUTS 0
+#define TICK_PHASE_MOVE 1
+#define TICK_PHASE_CELLS 2
+#define TICK_PHASE_FOOD 3
+#define TICK_PHASE_FOOD_SEND 4
+#define TICK_PHASE_EAT 5
+#define TICK_PHASE_POSITIONS 6
+#define TICK_PHASE_FLUSH 7
+#define TICK_PHASE_COUNT 8
+
+static const char *const tick_phase_names[TICK_PHASE_COUNT] = {
+    "inputs", "move", "cells", "food", "food_send", "eat", "positions", "flush",
+};
+
+/*
+ * State of the simulation thread. Sockets are owned by the I/O threads, the
+ * simulation only knows players by their connection id.
+ */
 typedef struct context_t {
-    int kq;
+    // NULL while replaying a session, then outputs are serialized but dropped
+    server_io_t *io;
+    // Set while recording a session
+    session_writer_t *recording;
+    // Set while replaying a session, which then provides the inputs
+    session_reader_t *replay;
+    // All randomness of the game comes from here, so that a session can be
+    // replayed
+    rng_t rng;
     int next_player_id;
-    player_t *players[MAX_PLAYERS];
+    player_table_t players;
+    player_cells_t cells;
+    // Which cells every player sees
+    interest_t interest;
+    // The cells that were last sent to every player, by slot
+    cell_snapshot_t *sent_cells;
+    // Reused for the visible cells of a player and their deltas
+    cell_position_t *visible_cells;
+    cell_delta_t *cell_deltas;
+    // Reused for building every outgoing message, see `message_frame`
+    uint8_t *message_buf;
+    // Movement kernel for the CPU the server runs on
+    move_func_t move;
+    food_grid_t food;
+    // Eaten food is replaced, so there is always this much on the field
+    int food_count;
+    // Time the simulation thread spent exchanging inputs and outputs with the
+    // I/O threads, since the last stats report
+    long long io_nsec;
+    uint32_t tick;
+    // Tick phases since the last stats report
+    profiler_t profiler;
+    // Reused for taking the I/O threads' phases
+    profiler_t io_profiler;
+    // Shard 0 is the simulation thread's, the others the I/O threads'
+    metrics_t metrics;
 } context_t;
 
-// TODO: Is there a way to handle this better? Putting it into a header would
-// make it look like this is a public function.
-static void broadcast_bytes(uint8_t *buf, int buf_len, context_t *ctx);
-
-static vec2_t generate_player_pos(void) {
-    float x = rand() % FIELD_WIDTH;
-    float y = rand() % FIELD_HEIGHT;
+static vec2_t generate_player_pos(context_t *ctx) {
+    float x = rng_range(&ctx->rng, FIELD_WIDTH);
+    float y = rng_range(&ctx->rng, FIELD_HEIGHT);
     return (vec2_t){x, y};
 }
 
-static player_t *player_new(int sock) {
-    player_t *p = calloc(1, sizeof(player_t));
-    p->sock = sock;
-    p->joined = false;
-    return p;
+static void spawn_food(context_t *ctx) {
+    while (ctx->food.count < ctx->food_count) {
+        float x = rng_float(&ctx->rng) * FIELD_WIDTH;
+        float y = rng_float(&ctx->rng) * FIELD_HEIGHT;
+        food_spawn(&ctx->food, x, y);
+    }
 }
 
-static void player_free(player_t *p) {
-    if (p->name) {
-        free(p->name);
+/*
+ * Copies the first `len` bytes of the message buffer into a new frame of
+ * exactly that size, which the caller has to release. The send queue limits
+ * count frame lengths, so frames must not take up much more memory than that.
+ */
+static frame_t *message_frame(int len, context_t *ctx) {
+    frame_t *frame = frame_new(len);
+    memcpy(frame->data, ctx->message_buf, len);
+    frame->len = len;
+    return frame;
+}
+
+/*
+ * Serializes the message into a new frame, which the caller has to release.
+ * `capacity` is at most `MESSAGE_BUF_LEN`.
+ *
+ * Returns NULL if the message could not be serialized.
+ */
+static frame_t *serialize_message_frame(generic_message_t *msg, int capacity, context_t *ctx) {
+    int len = serialize_message(msg, ctx->message_buf, capacity);
+    if (len <= 0) {
+        return NULL;
     }
-    free(p);
+    return message_frame(len, ctx);
 }
 
 static int generate_player_id(context_t *ctx) {
     return ctx->next_player_id++;
 }
 
-static int get_player_count(context_t *ctx) {
-    int count = 0;
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (ctx->players[i] && ctx->players[i]->joined) {
-            count++;
+/*
+ * Sends the frame to the player and releases it. If the player can't keep up,
+ * `droppable` frames are skipped, and the player is disconnected when too many
+ * bytes are queued.
+ */
+static void send_frame(frame_t *frame, bool droppable, player_t *player, context_t *ctx) {
+    if (ctx->io) {
+        server_io_send(ctx->io, player->conn_id, frame, droppable);
+    }
+    frame_release(frame);
+}
+
+static void send_message(generic_message_t *msg, int capacity, bool droppable, player_t *player, context_t *ctx) {
+    frame_t *frame = serialize_message_frame(msg, capacity, ctx);
+    if (frame) {
+        send_frame(frame, droppable, player, ctx);
+    }
+}
+
+static void broadcast_message(generic_message_t *msg, int capacity, bool droppable, context_t *ctx) {
+    // The message is serialized once, and every send queue only references the
+    // frame
+    frame_t *frame = serialize_message_frame(msg, capacity, ctx);
+    if (frame) {
+        if (ctx->io) {
+            server_io_broadcast(ctx->io, frame, droppable);
         }
+        frame_release(frame);
     }
-    return count;
 }
 
-static int connect_player(int sock, context_t *ctx) {
-    struct kevent change = {0};
-    int ret, idx = 0;
+/*
+ * Sends the food to the player, or to all players if `player` is NULL, split
+ * into as many messages as needed.
+ */
+static void send_spawned_food(food_position_t *foods, int count, player_t *player, context_t *ctx) {
+    int per_message = SPAWNED_FOOD_PER_MESSAGE(FOOD_MESSAGE_LEN);
 
-    while (idx < MAX_PLAYERS && ctx->players[idx]) {
-        idx++;
+    for (int offset = 0; offset < count; offset += per_message) {
+        int chunk = count - offset < per_message ? count - offset : per_message;
+        spawned_food_message_t spawned_food_msg = {
+            .message_type = MSG_SPAWNED_FOOD,
+            .food_count = chunk,
+            .food_positions = foods + offset,
+        };
+        if (player) {
+            send_message((generic_message_t *)&spawned_food_msg, FOOD_MESSAGE_LEN, false, player, ctx);
+        } else {
+            broadcast_message((generic_message_t *)&spawned_food_msg, FOOD_MESSAGE_LEN, false, ctx);
+        }
+    }
+}
+
+static void broadcast_eaten_food(uint32_t *food_ids, int count, context_t *ctx) {
+    int per_message = EATEN_FOOD_PER_MESSAGE(FOOD_MESSAGE_LEN);
+
+    for (int offset = 0; offset < count; offset += per_message) {
+        int chunk = count - offset < per_message ? count - offset : per_message;
+        eaten_food_message_t eaten_food_msg = {
+            .message_type = MSG_EATEN_FOOD,
+            .food_count = chunk,
+            .food_ids = food_ids + offset,
+        };
+        broadcast_message((generic_message_t *)&eaten_food_msg, FOOD_MESSAGE_LEN, false, ctx);
     }
+}
+
+static void connect_player(uint32_t conn_id, context_t *ctx) {
+    player_t *player = player_table_add(&ctx->players, conn_id);
 
-    if (idx == MAX_PLAYERS) {
-        printf("player tried to connect while game was full\n");
+    if (!player) {
+        log_warn_ratelimited("connection %u tried to join while the game was full", conn_id);
 
         join_error_message_t join_error_msg = {
             .message_type = MSG_JOIN_ERROR,
@@ -95,363 +266,841 @@ static int connect_player(int sock, context_t *ctx) {
             .error_message_length = strlen(GAME_FULL_ERROR_MSG),
             .error_message = GAME_FULL_ERROR_MSG,
         };
+        frame_t *frame = serialize_message_frame((generic_message_t *)&join_error_msg, 256, ctx);
+        if (frame) {
+            if (ctx->io) {
+                server_io_send(ctx->io, conn_id, frame, false);
+            }
+            frame_release(frame);
+        }
 
-        uint8_t send_buf[65535] = {0};
-        int send_len = serialize_message((generic_message_t *)&join_error_msg, send_buf, sizeof(send_buf));
-        if (send_len > 0) {
-            send_all(sock, send_buf, send_len);
+        if (ctx->io) {
+            server_io_close(ctx->io, conn_id);
         }
+    }
+}
 
-        close(sock);
-        return -1;
+/*
+ * Removes the player from the game. The connection has to be closed already or
+ * be closed by the caller.
+ */
+static void remove_player(player_t *player, context_t *ctx) {
+    if (player->joined) {
+        player_leave_message_t player_leave_msg = {
+            .message_type = MSG_PLAYER_LEAVE,
+            .player_id = player->id,
+        };
+        broadcast_message((generic_message_t *)&player_leave_msg, 64, false, ctx);
+        player_cells_remove_all(&ctx->cells, player);
     }
 
-    player_t *player = player_new(sock);
+    player_table_remove(&ctx->players, player);
+}
+
+static void join_player(player_t *player, join_message_t *msg, context_t *ctx) {
+    char *name = msg->name ? msg->name : DEFAULT_PLAYER_NAME;
+    int name_len = msg->name ? msg->name_length : DEFAULT_PLAYER_NAME_LENGTH;
+
+    player->id = generate_player_id(ctx);
+    // The name points into the received message and isn't terminated
+    player->name = malloc(name_len + 1);
+    memcpy(player->name, name, name_len);
+    player->name[name_len] = '\0';
+    // TODO: Generate rejoin token with cryptographic randomness
+    memset(player->rejoin_token, 0, REJOIN_TOKEN_LEN);
+    player_table_join(&ctx->players, player);
+    // The slot may have seen cells for its previous player
+    interest_clear(&ctx->interest, player - ctx->players.slots);
+    // The player gets a keyframe first
+    ctx->sent_cells[player - ctx->players.slots].synced = false;
+
+    vec2_t pos = generate_player_pos(ctx);
+    player_cells_spawn(&ctx->cells, &ctx->players, player, pos.x, pos.y, START_MASS);
+}
+
+/*
+ * Lets the cells of players eat each other. A player that lost its last cell
+ * gets the cell of a new player somewhere else.
+ */
+static void eat_players(context_t *ctx) {
+    cell_pool_t *pool = &ctx->cells.pool;
+    player_eating_update(&ctx->cells.eating, pool);
+    int eat_count = player_eating_resolve(&ctx->cells.eating, pool, &ctx->players);
+
+    for (int i = 0; i < eat_count; i++) {
+        player_eat_t *eat = &ctx->cells.eating.eats[i];
+        cell_t *prey = cell_pool_get(pool, eat->prey);
+        player_t *owner = &ctx->players.slots[prey->owner];
 
-    EV_SET(&change, sock, EVFILT_READ, EV_ADD, 0, 0, player);
-    ret = kevent(ctx->kq, &change, 1, NULL, 0, NULL);
-    if (ret == -1) {
-        perror("adding player to kqueue failed, closing socket");
-        player_free(player);
-        close(sock);
-    } else {
-        ctx->players[idx] = player;
+        pool->mass[cell_pool_get(pool, eat->eater)->idx] += pool->mass[prey->idx];
+        player_cells_remove(&ctx->cells, owner, eat->prey);
+        if (owner->cell_count == 0) {
+            vec2_t pos = generate_player_pos(ctx);
+            player_cells_spawn(&ctx->cells, &ctx->players, owner, pos.x, pos.y, START_MASS);
+        }
     }
+}
+
+/*
+ * Returns the total mass of the player's cells, and stores their center of
+ * mass at `*x` and `*y`.
+ */
+static int player_center(player_t *player, context_t *ctx, float *x, float *y) {
+    cell_pool_t *pool = &ctx->cells.pool;
+    float sum_x = 0, sum_y = 0;
+    int mass = 0;
 
-    return ret;
+    for (int i = 0; i < player->cell_count; i++) {
+        int idx = cell_pool_get(pool, player->cells[i])->idx;
+        sum_x += pool->pos_x[idx] * pool->mass[idx];
+        sum_y += pool->pos_y[idx] * pool->mass[idx];
+        mass += pool->mass[idx];
+    }
+    if (mass > 0) {
+        *x = sum_x / mass;
+        *y = sum_y / mass;
+    }
+    return mass;
 }
 
-static void disconnect_player(player_t *player, context_t *ctx) {
-    struct kevent change = {0};
+/*
+ * Sends every player the cells in its view, as deltas against the cells that
+ * were sent to it in the previous tick, split into as many messages as
+ * needed. Unlike a broadcast of all cells, this grows with the players times
+ * the cells around each of them, not with the square of the players, and
+ * cells that didn't change cost nothing.
+ */
+static void send_cell_deltas(context_t *ctx) {
+    cell_pool_t *pool = &ctx->cells.pool;
+
+    interest_build(&ctx->interest, pool);
+    for (int p = 0; p < ctx->players.joined_count; p++) {
+        player_t *player = player_table_joined(&ctx->players, p);
+        int slot = player - ctx->players.slots;
+        // A player without cells, whose respawn failed, sees the whole field
+        float x = FIELD_WIDTH / 2.0f, y = FIELD_HEIGHT / 2.0f;
+        float size = FIELD_WIDTH > FIELD_HEIGHT ? FIELD_WIDTH : FIELD_HEIGHT;
+        int mass = player_center(player, ctx, &x, &y);
+        if (mass > 0) {
+            size = player_view_size(mass);
+        }
+        interest_set_t *visible = interest_update(&ctx->interest, pool, slot, x, y, size);
+
+        // Visible handles are sorted, like the cells of a snapshot have to be
+        for (int i = 0; i < visible->count; i++) {
+            int handle = visible->handles[i];
+            int idx = cell_pool_get(pool, handle)->idx;
+            ctx->visible_cells[i] = (cell_position_t){
+                .cell_id = handle,
+                .player_id = ctx->players.slots[pool->cells[handle].owner].id,
+                .x = pool->pos_x[idx],
+                .y = pool->pos_y[idx],
+                .mass = pool->mass[idx],
+            };
+        }
+
+        cell_snapshot_t *sent = &ctx->sent_cells[slot];
+        bool keyframe = !sent->synced || ctx->tick - sent->keyframe_tick >= KEYFRAME_TICKS;
+        int delta_count = cell_delta_diff(keyframe ? NULL : sent, ctx->visible_cells, visible->count,
+                                          ctx->cell_deltas);
 
-    int idx = 0;
-    while (idx < MAX_PLAYERS && ctx->players[idx] != player) {
-        idx++;
+        // The deltas are written straight into the message buffer, each
+        // message filled up as far as they go. Without any deltas, one empty
+        // message still tells the client that its cells are those of this
+        // tick.
+        uint8_t flags = keyframe ? CELL_DELTA_KEYFRAME : 0;
+        uint16_t chunk = 0;
+        message_builder_t builder;
+        cell_delta_builder_begin(&builder, ctx->message_buf, CELL_MESSAGE_LEN, ctx->tick, sent->tick, chunk++, flags);
+        for (int i = 0; i < delta_count; i++) {
+            if (cell_delta_builder_append(&builder, &ctx->cell_deltas[i])) {
+                continue;
+            }
+            send_frame(message_frame(message_builder_finish(&builder), ctx), true, player, ctx);
+            // Every delta fits into an empty message
+            cell_delta_builder_begin(&builder, ctx->message_buf, CELL_MESSAGE_LEN, ctx->tick, sent->tick, chunk++,
+                                     flags);
+            cell_delta_builder_append(&builder, &ctx->cell_deltas[i]);
+        }
+        cell_delta_builder_add_flags(&builder, CELL_DELTA_LAST);
+        send_frame(message_frame(message_builder_finish(&builder), ctx), true, player, ctx);
+
+        cell_snapshot_store(sent, ctx->tick, ctx->visible_cells, visible->count);
+        if (keyframe) {
+            sent->keyframe_tick = ctx->tick;
+        }
     }
+}
 
-    if (idx < MAX_PLAYERS) {
-        EV_SET(&change, player->sock, EVFILT_READ, EV_DELETE, 0, 0, NULL);
-        kevent(ctx->kq, &change, 1, NULL, 0, NULL);
+static void handle_player_message(generic_message_t *generic_msg, player_t *player, context_t *ctx) {
+    if (!player->joined && generic_msg->message_type == MSG_JOIN) {
+        join_player(player, (join_message_t *)generic_msg, ctx);
 
-        // This has to happen before broadcasting the player leave message,
-        // otherwise an infinite loop is created, if sending to the player
-        // fails.
-        ctx->players[idx] = NULL;
+        join_ack_message_t join_ack_msg = {
+            .message_type = MSG_JOIN_ACK,
+            .player_id = player->id,
+        };
+        memcpy(join_ack_msg.rejoin_token, player->rejoin_token, REJOIN_TOKEN_LEN);
+        send_message((generic_message_t *)&join_ack_msg, 64, false, player, ctx);
+
+        // Broadcasts are only sent to subscribed connections, so the player
+        // gets its own join message, just like before
+        if (ctx->io) {
+            server_io_subscribe(ctx->io, player->conn_id);
+        }
 
-        if (player->joined) {
-            uint8_t send_buf[64] = {0};
-            player_leave_message_t player_leave_msg = {
-                .message_type = MSG_PLAYER_LEAVE,
+        player_join_message_t player_join_msg = {
+            .message_type = MSG_PLAYER_JOIN,
+            .player_info = {
                 .player_id = player->id,
-            };
-            int send_len = serialize_message((generic_message_t *)&player_leave_msg, send_buf, sizeof(send_buf));
-            broadcast_bytes(send_buf, send_len, ctx);
+                .name_length = strlen(player->name),
+                .name = player->name,
+            },
+        };
+        broadcast_message((generic_message_t *)&player_join_msg, 64 + strlen(player->name), false, ctx);
+
+        // The list is split into as many messages as it takes, like the deltas
+        // of a tick, and the client adds the players of each one
+        message_builder_t builder;
+        current_players_builder_begin(&builder, ctx->message_buf, PLAYERS_MESSAGE_LEN);
+        for (int i = 0; i < ctx->players.joined_count; i++) {
+            player_t *other = player_table_joined(&ctx->players, i);
+            if (current_players_builder_append(&builder, other->id, other->name, strlen(other->name))) {
+                continue;
+            }
+            send_frame(message_frame(message_builder_finish(&builder), ctx), false, player, ctx);
+            // Every player fits into an empty message
+            current_players_builder_begin(&builder, ctx->message_buf, PLAYERS_MESSAGE_LEN);
+            current_players_builder_append(&builder, other->id, other->name, strlen(other->name));
         }
+        send_frame(message_frame(message_builder_finish(&builder), ctx), false, player, ctx);
 
-        // TODO: Send message to client so it knows the disconnect isn't abnormal, but explicitly performed by server
-        close(player->sock);
+        // Food that is spawned or eaten later in this tick is broadcast at the
+        // end of the tick
+        food_position_t *foods = malloc(ctx->food.count * sizeof(food_position_t));
+        food_collect(&ctx->food, foods);
+        send_spawned_food(foods, ctx->food.count, player, ctx);
+        free(foods);
+    } else if (player->joined) {
+        switch (generic_msg->message_type) {
+            case MSG_LEAVE:
+            {
+                // TODO: Send message to client so it knows the disconnect isn't abnormal, but explicitly performed by server
+                if (ctx->io) {
+                    server_io_close(ctx->io, player->conn_id);
+                }
+                remove_player(player, ctx);
+                break;
+            }
+            case MSG_SET_TARGET:
+            {
+                set_target_message_t *msg = (set_target_message_t *)generic_msg;
+                if (msg->x < 0) msg->x = 0;
+                else if (msg->x > FIELD_WIDTH) msg->x = FIELD_WIDTH;
+                if (msg->y < 0) msg->y = 0;
+                else if (msg->y > FIELD_HEIGHT) msg->y = FIELD_HEIGHT;
+                player_cells_set_target(&ctx->cells, player, msg->x, msg->y);
+                break;
+            }
+            case MSG_SPLIT:
+            {
+                player_cells_split(&ctx->cells, &ctx->players, player);
+                break;
+            }
+        }
+    }
+}
 
-        player_free(player);
-    } else {
-        printf("tried to disconnect player that wasn't in player list\n");
+static bool poll_input(context_t *ctx, io_input_t *input) {
+    if (ctx->replay) {
+        return session_reader_next(ctx->replay, ctx->tick, input);
     }
+    return server_io_poll_input(ctx->io, input);
 }
 
-static void join_player(player_t *player, join_message_t *msg, context_t *ctx) {
-    char *name = msg->name ? msg->name : DEFAULT_PLAYER_NAME;
-    int name_len = msg->name ? msg->name_length : DEFAULT_PLAYER_NAME_LENGTH;
+/*
+ * Applies everything the I/O threads received since the last tick. The inputs
+ * are drained in a fixed order, so the simulation only depends on the order of
+ * the inputs, not on the timing of the I/O threads.
+ */
+static void handle_inputs(context_t *ctx) {
+    io_input_t input;
+    player_t *player;
+    uint64_t arena_buf[8];
+    message_arena_t arena;
+    generic_message_t *msg;
 
-    player->id = generate_player_id(ctx);
-    player->mass = START_MASS;
-    player->name = malloc(name_len + 1);
-    strcpy(player->name, name);
-    // TODO: Generate rejoin token with cryptographic randomness
-    memset(player->rejoin_token, 0, REJOIN_TOKEN_LEN);
-    player->pos = generate_player_pos();
-    player->target = player->pos;
-    player->joined = true;
+    message_arena_init(&arena, arena_buf, sizeof(arena_buf));
+    while (poll_input(ctx, &input)) {
+        if (ctx->recording) {
+            session_writer_input(ctx->recording, ctx->tick, &input);
+        }
+
+        switch (input.type) {
+            case INPUT_CONNECT:
+                connect_player(input.conn_id, ctx);
+                break;
+
+            case INPUT_MESSAGE:
+                player = player_table_get(&ctx->players, input.conn_id);
+                // The player may have left or been rejected already. The I/O
+                // thread validated the message, so it always decodes.
+                message_arena_reset(&arena);
+                if (player && decode_message(input.data, input.len, &arena, &msg) != 0) {
+                    handle_player_message(msg, player, ctx);
+                }
+                break;
+
+            case INPUT_DISCONNECT:
+                player = player_table_get(&ctx->players, input.conn_id);
+                if (player) {
+                    remove_player(player, ctx);
+                }
+                break;
+        }
+    }
 }
 
-static void send_bytes(uint8_t *buf, int buf_len, player_t *player, context_t *ctx) {
-    if (buf_len <= 0) {
-        return;
+static void tick(context_t *ctx) {
+    profiler_t *profiler = &ctx->profiler;
+
+    profiler_start(profiler);
+    handle_inputs(ctx);
+    ctx->io_nsec += profiler_lap(profiler, TICK_PHASE_INPUTS);
+
+    ctx->tick++;
+    cell_pool_t *pool = &ctx->cells.pool;
+    ctx->move(pool->pos_x, pool->pos_y, pool->target_x, pool->target_y, pool->speed, pool->count);
+    profiler_lap(profiler, TICK_PHASE_MOVE);
+    player_cells_update(&ctx->cells, &ctx->players);
+    profiler_lap(profiler, TICK_PHASE_CELLS);
+
+    for (int i = 0; i < pool->count; i++) {
+        int eaten = food_eat(&ctx->food, pool->pos_x[i], pool->pos_y[i], player_radius(pool->mass[i]));
+        pool->mass[i] += eaten * FOOD_MASS;
     }
+    spawn_food(ctx);
+    profiler_lap(profiler, TICK_PHASE_FOOD);
+
+    // Clients have to remove eaten food before they add the new food
+    broadcast_eaten_food(ctx->food.eaten, ctx->food.eaten_count, ctx);
+    send_spawned_food(ctx->food.spawned, ctx->food.spawned_count, NULL, ctx);
+    food_clear_changes(&ctx->food);
+    profiler_lap(profiler, TICK_PHASE_FOOD_SEND);
 
-    if (send_all(player->sock, buf, buf_len) == -1) {
-        printf("Error when sending to socket: errno %d -- %s\n", errno, strerror(errno));
-        printf("Closing socket\n");
-        // TODO: Handle disconnects in such a way, that there isn't the risk of
-        // trying to send to a player that was disconnected (e.g. when sending
-        // two messages to a player in during one tick).
-        // This could be done by setting a flag on the player struct and
-        // disconnecting players that have the flag set during each tick.
-        // Sending a message to players that have that flag set should also be
-        // skipped.
-        disconnect_player(player, ctx);
+    eat_players(ctx);
+    profiler_lap(profiler, TICK_PHASE_EAT);
+    send_cell_deltas(ctx);
+    profiler_lap(profiler, TICK_PHASE_POSITIONS);
+
+    // Hands this tick's outputs to the I/O threads
+    if (ctx->io) {
+        server_io_flush(ctx->io);
     }
+    ctx->io_nsec += profiler_lap(profiler, TICK_PHASE_FLUSH);
+    profiler_stop(profiler);
 }
 
-static void broadcast_bytes(uint8_t *buf, int buf_len, context_t *ctx) {
-    if (buf_len <= 0) {
+/*
+ * Prints the tick stats and how the time since the last report was split
+ * between waiting, exchanging data with the I/O threads and simulating.
+ */
+static void report_stats(tick_scheduler_t *scheduler, context_t *ctx, int io_thread_count,
+                         long long elapsed_nsec) {
+    tick_stats_t stats;
+    tick_scheduler_take_stats(scheduler, &stats);
+    long long io_busy_nsec = server_io_take_busy_nsec(ctx->io);
+    long long io_nsec = ctx->io_nsec;
+    ctx->io_nsec = 0;
+
+    if (stats.ticks == 0) {
         return;
     }
+    log_info("ticks: %llu, missed: %llu, duration avg %.2f ms max %.2f ms, jitter avg %.2f ms max %.2f ms",
+             (unsigned long long)stats.ticks, (unsigned long long)stats.missed_ticks,
+             stats.duration_sum_nsec / 1e6 / stats.ticks, stats.duration_max_nsec / 1e6,
+             stats.jitter_sum_nsec / 1e6 / stats.ticks, stats.jitter_max_nsec / 1e6);
 
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        player_t *player = ctx->players[i];
-        if (player && player->joined) {
-            send_bytes(buf, buf_len, player, ctx);
-        }
+    // Everything outside of ticks counts as idle, which includes busy-polling
+    double sim_share = (double)(stats.duration_sum_nsec - io_nsec) / elapsed_nsec;
+    double io_share = (double)io_nsec / elapsed_nsec;
+    log_info("simulation thread: idle %.1f%%, io %.1f%%, sim %.1f%%; io threads: busy %.1f%%",
+             100 * (1 - sim_share - io_share), 100 * io_share, 100 * sim_share,
+             100.0 * io_busy_nsec / elapsed_nsec / io_thread_count);
+}
+
+/*
+ * Logs the percentiles of the tick phases and of the I/O threads' events
+ * since the last call.
+ */
+static void report_profile(context_t *ctx) {
+    profiler_report(&ctx->profiler, "tick");
+    profiler_reset(&ctx->profiler);
+
+    server_io_take_profile(ctx->io, &ctx->io_profiler);
+    profiler_report(&ctx->io_profiler, "io  ");
+    profiler_reset(&ctx->io_profiler);
+}
+
+/*
+ * Logs a tick that took longer than the tick interval, and dumps what was
+ * logged before it, unless that was done recently.
+ */
+static void report_overrun(context_t *ctx, long long duration_nsec, long long now, long long *last_dump_nsec) {
+    log_warn_ratelimited("tick %u took %.2f ms", ctx->tick, duration_nsec / 1e6);
+
+    if (*last_dump_nsec == 0 || now - *last_dump_nsec >= FLIGHT_RECORDER_INTERVAL_SEC * 1000000000LL) {
+        log_dump_recent(FLIGHT_RECORDER_SEC);
+        *last_dump_nsec = now;
     }
 }
 
-static void handle_player_message(uint8_t *recv_buf, uint16_t recv_len, player_t *player, context_t *ctx) {
-    uint8_t send_buf[65535];
-    int send_len;
-    generic_message_t *generic_msg = NULL;
+/*
+ * Returns the timeout for waiting on the simulation thread's loop. Without a
+ * busy-poll window, the thread blocks until the tick timer fires. Otherwise it
+ * blocks until the window before the next deadline starts, and then spins, so
+ * that the tick starts without the latency of being woken up.
+ */
+static int wait_timeout_msec(tick_scheduler_t *scheduler, long long busy_poll_nsec) {
+    if (busy_poll_nsec == 0) {
+        return -1;
+    }
 
-    // TODO: Use returned len
-    (void) deserialize_message(recv_buf, recv_len, &generic_msg);
-    if (generic_msg) {
-        if (!player->joined && generic_msg->message_type == MSG_JOIN) {
-            join_player(player, (join_message_t *)generic_msg, ctx);
+    long long remaining = tick_scheduler_time_until_next(scheduler, monotonic_nsec());
+    if (remaining <= busy_poll_nsec) {
+        return 0;
+    }
+    // Rounding down wakes us up at the latest when the window starts
+    return (remaining - busy_poll_nsec) / 1000000;
+}
 
-            join_ack_message_t join_ack_msg = {
-                .message_type = MSG_JOIN_ACK,
-                .player_id = player->id,
-            };
-            memcpy(join_ack_msg.rejoin_token, player->rejoin_token, REJOIN_TOKEN_LEN);
-            send_len = serialize_message(
-                    (generic_message_t *)&join_ack_msg, send_buf, sizeof(send_buf));
-            send_bytes(send_buf, send_len, player, ctx);
-
-            player_join_message_t player_join_msg = {
-                .message_type = MSG_PLAYER_JOIN,
-                .player_info = {
-                    .player_id = player->id,
-                    .name_length = strlen(player->name),
-                    .name = player->name,
-                },
-            };
-            send_len = serialize_message(
-                    (generic_message_t *)&player_join_msg, send_buf, sizeof(send_buf));
-            broadcast_bytes(send_buf, send_len, ctx);
-
-            int player_count = get_player_count(ctx);
-            current_players_message_t current_players_msg = {
-                .message_type = MSG_CURRENT_PLAYERS,
-                .player_count = player_count,
-                .player_infos = calloc(player_count, sizeof(player_info_t)),
-            };
-            int info_idx = 0;
-            for (int i = 0; i < MAX_PLAYERS; i++) {
-                if (ctx->players[i] && ctx->players[i]->joined) {
-                    current_players_msg.player_infos[info_idx].player_id = ctx->players[i]->id;
-                    current_players_msg.player_infos[info_idx].name_length =
-                        strlen(ctx->players[i]->name);
-                    current_players_msg.player_infos[info_idx].name = ctx->players[i]->name;
-                    info_idx++;
-                }
-            }
-            send_len = serialize_message(
-                    (generic_message_t *)&current_players_msg, send_buf, sizeof(send_buf));
-            send_bytes(send_buf, send_len, player, ctx);
-            free(current_players_msg.player_infos);
-        } else if (player->joined) {
-            switch (generic_msg->message_type) {
-                case MSG_LEAVE:
-                {
-                    disconnect_player(player, ctx);
-                    break;
-                }
-                case MSG_SET_TARGET:
-                {
-                    set_target_message_t *msg = (set_target_message_t *)generic_msg;
-                    if (msg->x < 0) msg->x = 0;
-                    else if (msg->x > FIELD_WIDTH) msg->x = FIELD_WIDTH;
-                    if (msg->y < 0) msg->y = 0;
-                    else if (msg->y > FIELD_HEIGHT) msg->y = FIELD_HEIGHT;
-                    player->target.x = msg->x;
-                    player->target.y = msg->y;
-                    break;
-                }
-            }
-        }
+static int default_io_thread_count(void) {
+    // One core is taken by the simulation thread
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    if (cpus < 1) {
+        return 1;
+    }
+    if (cpus > MAX_IO_THREADS) {
+        return MAX_IO_THREADS;
+    }
+    return cpus;
+}
+
+// Set by SIGINT and SIGTERM, so that the server can report its stats before
+// it exits
+static volatile sig_atomic_t stop_requested;
 
-        message_free(generic_msg);
+static void request_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+/*
+ * Updates the gauges of the simulation thread after a round of ticks.
+ */
+static void update_metrics(context_t *ctx) {
+    metrics_shard_t *metrics = &ctx->metrics.shards[0];
+    metrics_set_gauge(&metrics->players_connected, player_table_count(&ctx->players));
+    metrics_set_gauge(&metrics->players_joined, ctx->players.joined_count);
+}
+
+/*
+ * Sets up a game with no players. The seed determines everything random in
+ * the game, including the initial food.
+ */
+static void context_init(context_t *ctx, int max_players, int food_count, uint64_t seed) {
+    ctx->next_player_id = 1;
+    rng_seed(&ctx->rng, seed);
+    player_table_init(&ctx->players, max_players);
+    player_cells_init(&ctx->cells, max_players, FIELD_WIDTH, FIELD_HEIGHT, PLAYER_SPEED, MERGE_TICKS);
+    interest_init(&ctx->interest, FIELD_WIDTH, FIELD_HEIGHT, INTEREST_CELL_SIZE, ctx->cells.pool.capacity,
+                  max_players);
+    ctx->sent_cells = malloc(max_players * sizeof(cell_snapshot_t));
+    for (int i = 0; i < max_players; i++) {
+        cell_snapshot_init(&ctx->sent_cells[i]);
     }
+    ctx->visible_cells = malloc(ctx->cells.pool.capacity * sizeof(cell_position_t));
+    // A delta for every cell that was visible before and every one that is now
+    ctx->cell_deltas = malloc(2 * ctx->cells.pool.capacity * sizeof(cell_delta_t));
+    ctx->message_buf = malloc(MESSAGE_BUF_LEN);
+    profiler_init(&ctx->profiler, TICK_PHASE_COUNT, tick_phase_names);
+    server_io_profiler_init(&ctx->io_profiler);
+    const char *move_name;
+    ctx->move = move_select(&move_name);
+    printf("Using the %s movement kernel\n", move_name);
+
+    // Nobody is there yet to be told about the initial food
+    food_grid_init(&ctx->food, FIELD_WIDTH, FIELD_HEIGHT, FOOD_CELL_SIZE);
+    ctx->food_count = food_count;
+    spawn_food(ctx);
+    food_clear_changes(&ctx->food);
 }
 
-static void tick(context_t *ctx) {
-    uint8_t send_buf[65535];
-    int send_len;
+static void context_free(context_t *ctx) {
+    profiler_free(&ctx->profiler);
+    profiler_free(&ctx->io_profiler);
+    for (int i = 0; i < ctx->players.capacity; i++) {
+        cell_snapshot_free(&ctx->sent_cells[i]);
+    }
+    free(ctx->sent_cells);
+    player_table_free(&ctx->players);
+    player_cells_free(&ctx->cells);
+    interest_free(&ctx->interest);
+    free(ctx->visible_cells);
+    free(ctx->cell_deltas);
+    free(ctx->message_buf);
+    food_grid_free(&ctx->food);
+}
 
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        player_t *player = ctx->players[i];
-        if (player) {
-            vec2_t diff = vec2_sub(player->target, player->pos);
-            if (vec2_abs(diff) > 1) {
-                player->pos = vec2_add(player->pos, vec2_scale(vec2_norm(diff), 0.5));
-            }
-            printf("player %d: (%.1f, %.1f)\n", player->id, player->pos.x, player->pos.y);
-        }
+static uint32_t checksum_bytes(uint32_t hash, const void *data, size_t len) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 16777619;
     }
+    return hash;
+}
 
-    // TODO: Add eat logic
+/*
+ * Returns an FNV-1a hash of the cells and the food. A replayed session ends
+ * with the same checksum as the recorded one, unless the simulation stopped
+ * being deterministic.
+ */
+static uint32_t state_checksum(context_t *ctx) {
+    cell_pool_t *pool = &ctx->cells.pool;
+    uint32_t hash = 2166136261;
 
-    int player_count = get_player_count(ctx);
-    int player_idx = 0;
-    player_positions_message_t player_pos_msg = {
-        .message_type = MSG_PLAYER_POSITIONS,
-        .player_count = player_count,
-        .player_positions = calloc(player_count, sizeof(player_position_t)),
-    };
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        player_t *player = ctx->players[i];
-        if (player) {
-            player_pos_msg.player_positions[player_idx].player_id = player->id;
-            player_pos_msg.player_positions[player_idx].x = player->pos.x;
-            player_pos_msg.player_positions[player_idx].y = player->pos.y;
-            player_pos_msg.player_positions[player_idx].mass = player->mass;
-            player_idx++;
-        }
+    hash = checksum_bytes(hash, &ctx->tick, sizeof(ctx->tick));
+    hash = checksum_bytes(hash, pool->handles, pool->count * sizeof(int));
+    hash = checksum_bytes(hash, pool->pos_x, pool->count * sizeof(float));
+    hash = checksum_bytes(hash, pool->pos_y, pool->count * sizeof(float));
+    hash = checksum_bytes(hash, pool->mass, pool->count * sizeof(int));
+    hash = checksum_bytes(hash, &ctx->food.next_id, sizeof(ctx->food.next_id));
+    return hash;
+}
+
+/*
+ * Runs a recorded session as fast as possible, without sockets, and reports
+ * how long the tick phases took. The outputs are serialized as usual, but
+ * dropped.
+ */
+static int replay_session(const char *path, int log_level) {
+    session_reader_t reader;
+    context_t ctx = {0};
+
+    if (session_reader_open(&reader, path) == -1) {
+        printf("Couldn't read session %s: errno %d -- %s\n", path, errno, strerror(errno));
+        return 1;
+    }
+    if (log_start(stdout, log_level) == -1) {
+        printf("Couldn't start the log writer\n");
+        session_reader_close(&reader);
+        return 1;
+    }
+    context_init(&ctx, reader.header.max_players, reader.header.food_count, reader.header.seed);
+    ctx.replay = &reader;
+    log_info("Replaying %s with seed %llu, %d players and %d food", path, (unsigned long long)reader.header.seed,
+             reader.header.max_players, reader.header.food_count);
+
+    long long start = monotonic_nsec();
+    while (!reader.done || ctx.tick < reader.end_tick) {
+        tick(&ctx);
+    }
+    long long elapsed_nsec = monotonic_nsec() - start;
+
+    if (reader.truncated) {
+        log_warn("The session ended without an end record, replayed it up to its last input");
+    }
+    log_info("Replayed %u ticks in %.3f s (%.0f ticks/s), %d players left, state checksum %08x", ctx.tick,
+             elapsed_nsec / 1e9, ctx.tick / (elapsed_nsec / 1e9), player_table_count(&ctx.players),
+             state_checksum(&ctx));
+    profiler_report(&ctx.profiler, "tick");
+
+    log_stop();
+    context_free(&ctx);
+    session_reader_close(&reader);
+    return 0;
+}
+
+static void print_usage(char *program) {
+    printf("Usage: %s [-t io_threads] [-b listen_backlog] [-p max_players] [-f food_count] [-r] [-u] "
+           "[-B busy_poll_usec] [-m metrics_port] [-w session_file] [-R session_file] [-v]\n", program);
+    printf("  -r  give every I/O thread its own SO_REUSEPORT listening socket\n");
+    printf("  -u  also accept players over UDP on the same port\n");
+    printf("  -B  spin for this long before every tick instead of sleeping, for lower tick jitter\n");
+    printf("  -m  serve metrics in the Prometheus text format on this local port at /metrics\n");
+    printf("  -w  record the session, i.e. the seed and all inputs, to this file\n");
+    printf("  -R  replay a recorded session as fast as possible without sockets, then exit\n");
+    printf("  -v  also print debug logs, if they were compiled in with LOG_MIN_LEVEL=0\n");
+}
+
+static void close_server_socks(int *listen_socks, int listen_sock_count, int udp_sock) {
+    for (int i = 0; i < listen_sock_count; i++) {
+        close(listen_socks[i]);
+    }
+    if (udp_sock != -1) {
+        close(udp_sock);
     }
-    send_len = serialize_message((generic_message_t *)&player_pos_msg, send_buf, sizeof(send_buf));
-    broadcast_bytes(send_buf, send_len, ctx);
-    free(player_pos_msg.player_positions);
 }
 
-int main(void) {
-    int server_sock, client_sock, kq, running = 1, event_count, i;
-    struct sockaddr_in server_addr;
-    uint8_t client_message[2000] = {0};
-    ssize_t bytes_received;
-    struct kevent change = {0}, events[MAX_EVENTS] = {0};
-    struct timespec timeout = {0};
+int main(int argc, char **argv) {
+    int event_count, i, opt;
+    int io_thread_count = default_io_thread_count();
+    int listen_backlog = SOMAXCONN;
+    int max_players = DEFAULT_MAX_PLAYERS;
+    int food_count = DEFAULT_FOOD_COUNT;
+    bool reuseport = false;
+    bool udp = false;
+    int udp_sock = -1;
+    int listen_socks[MAX_IO_THREADS];
+    int listen_sock_count;
+    event_loop_t *loop;
+    event_t events[MAX_EVENTS];
     long tick_nsec = 1e9 / TICKS_PER_SEC;
-    context_t ctx = { .next_player_id = 1 };
+    tick_scheduler_t scheduler;
+    long long last_stats_nsec;
+    long long busy_poll_nsec = 0;
+    long long last_dump_nsec = 0;
+    int log_level = LOG_LEVEL_INFO;
+    int metrics_port = 0;
+    metrics_server_t *metrics_server = NULL;
+    const char *record_path = NULL;
+    int exit_code = 0;
+    const char *replay_path = NULL;
+    session_writer_t recording;
+    context_t ctx = {0};
+
+    while ((opt = getopt(argc, argv, "t:b:p:f:ruB:m:w:R:vh")) != -1) {
+        switch (opt) {
+            case 't':
+                io_thread_count = atoi(optarg);
+                if (io_thread_count < 1 || io_thread_count > MAX_IO_THREADS) {
+                    printf("Number of I/O threads has to be between 1 and %d\n", MAX_IO_THREADS);
+                    return 1;
+                }
+                break;
+            case 'b':
+                listen_backlog = atoi(optarg);
+                if (listen_backlog < 1) {
+                    printf("Listen backlog has to be positive\n");
+                    return 1;
+                }
+                break;
+            case 'p':
+                max_players = atoi(optarg);
+                if (max_players < 1 || max_players > MAX_PLAYERS_LIMIT) {
+                    printf("Maximum number of players has to be between 1 and %d\n", MAX_PLAYERS_LIMIT);
+                    return 1;
+                }
+                break;
+            case 'f':
+                food_count = atoi(optarg);
+                if (food_count < 0 || food_count > MAX_FOOD_LIMIT) {
+                    printf("Amount of food has to be between 0 and %d\n", MAX_FOOD_LIMIT);
+                    return 1;
+                }
+                break;
+            case 'r':
+                reuseport = true;
+                break;
+            case 'u':
+                udp = true;
+                break;
+            case 'B':
+                busy_poll_nsec = atol(optarg) * 1000L;
+                if (busy_poll_nsec < 0 || busy_poll_nsec >= tick_nsec) {
+                    printf("Busy-poll window has to be between 0 and the tick interval\n");
+                    return 1;
+                }
+                break;
+            case 'm':
+                metrics_port = atoi(optarg);
+                if (metrics_port < 1 || metrics_port > 65535) {
+                    printf("Metrics port has to be between 1 and 65535\n");
+                    return 1;
+                }
+                break;
+            case 'w':
+                record_path = optarg;
+                break;
+            case 'R':
+                replay_path = optarg;
+                break;
+            case 'v':
+                log_level = LOG_LEVEL_DEBUG;
+                break;
+            default:
+                print_usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (replay_path) {
+        return replay_session(replay_path, log_level);
+    }
 
     // Ignore SIGPIPE signal, which would cause a process exit when we try to
     // send or receive on a broken stream
     signal(SIGPIPE, SIG_IGN);
+    // The tick timer wakes up the simulation thread even if an I/O thread got
+    // the signal
+    signal(SIGINT, request_stop);
+    signal(SIGTERM, request_stop);
 
-    // Seed random generator
-    // TODO: Replace with `arc4random` for better randomness
-    srand(time(NULL));
-
-    server_sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_sock == -1) {
-        printf("Error while creating socket\n");
-        return 1;
+    // With `SO_REUSEPORT`, the kernel spreads the connections over one
+    // listening socket per I/O thread, instead of all threads being woken up
+    // for every connection on a shared socket
+    listen_sock_count = reuseport ? io_thread_count : 1;
+    for (i = 0; i < listen_sock_count; i++) {
+        listen_socks[i] = listen_tcp(SERVER_ADDR, SERVER_PORT, listen_backlog, reuseport);
+        if (listen_socks[i] == -1) {
+            printf("Couldn't listen on port %d: errno %d -- %s\n", SERVER_PORT, errno, strerror(errno));
+            close_server_socks(listen_socks, i, -1);
+            return 1;
+        }
     }
-    printf("Socket created successfully\n");
+    printf("Listening for incoming connections on %d socket(s)...\n", listen_sock_count);
 
-    if (setsockopt(server_sock, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int)) == -1) {
-        // Non-fatal error, continue execution
-        printf("Setting REUSEADDR failed on socket: errno %d -- %s\n", errno, strerror(errno));
+    if (udp) {
+        udp_sock = bind_udp(SERVER_ADDR, SERVER_PORT);
+        if (udp_sock == -1) {
+            printf("Couldn't bind UDP port %d: errno %d -- %s\n", SERVER_PORT, errno, strerror(errno));
+            close_server_socks(listen_socks, listen_sock_count, -1);
+            return 1;
+        }
+        printf("Listening for UDP packets\n");
     }
 
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(2000);
-    server_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
-
-    if (bind(server_sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1) {
-        printf("Couldn't bind to the port: errno %d -- %s\n", errno, strerror(errno));
-        close(server_sock);
+    // The main thread is the simulation thread, its loop only drives the tick
+    // timer. Connections are handled by the I/O threads.
+    loop = event_loop_new();
+    if (!loop) {
+        perror("creating event loop failed");
+        close_server_socks(listen_socks, listen_sock_count, udp_sock);
         return 1;
     }
-    printf("Bound the socket\n");
 
-    if (listen(server_sock, 0) == -1) {
-        printf("Error while listening\n");
-        close(server_sock);
+    // The scheduler is initialized before the timer is armed, so the timer
+    // never fires before the deadline of a tick
+    tick_scheduler_init(&scheduler, tick_nsec, MAX_CATCH_UP_TICKS, monotonic_nsec());
+    last_stats_nsec = monotonic_nsec();
+
+    if (event_loop_set_timer(loop, tick_nsec, NULL) == -1) {
+        perror("adding timer to event loop failed");
+        close_server_socks(listen_socks, listen_sock_count, udp_sock);
+        event_loop_free(loop);
         return 1;
     }
-    printf("Listening for incoming connections...\n");
 
-    kq = kqueue();
-    if (kq == -1) {
-        perror("creating kqueue failed");
-        close(server_sock);
+    // Only needs to differ between runs, the game doesn't have to be
+    // unpredictable
+    session_header_t header = {
+        .seed = time(NULL),
+        .max_players = max_players,
+        .food_count = food_count,
+    };
+    context_init(&ctx, max_players, food_count, header.seed);
+    if (record_path) {
+        if (session_writer_open(&recording, record_path, &header) == -1) {
+            printf("Couldn't record the session to %s: errno %d -- %s\n", record_path, errno, strerror(errno));
+            context_free(&ctx);
+            close_server_socks(listen_socks, listen_sock_count, udp_sock);
+            event_loop_free(loop);
+            return 1;
+        }
+        ctx.recording = &recording;
+        printf("Recording the session to %s\n", record_path);
+    }
+    // Writes to stdout as well, so it stays ordered with the prints above
+    if (log_start(stdout, log_level) == -1) {
+        printf("Couldn't start the log writer\n");
+        close_server_socks(listen_socks, listen_sock_count, udp_sock);
+        event_loop_free(loop);
         return 1;
     }
-    ctx.kq = kq;
-
 
-    EV_SET(&change, server_sock, EVFILT_READ, EV_ADD, 0, 0, NULL);
-    if (kevent(kq, &change, 1, NULL, 0, NULL) == -1) {
-        perror("adding server socket to kqueue failed");
-        close(server_sock);
-        close(kq);
-        return 1;
+    metrics_init(&ctx.metrics, io_thread_count + 1);
+    if (metrics_port) {
+        metrics_server = metrics_server_start(&ctx.metrics, SERVER_ADDR, metrics_port);
+        if (!metrics_server) {
+            printf("Couldn't serve metrics on port %d: errno %d -- %s\n", metrics_port, errno, strerror(errno));
+            log_stop();
+            close_server_socks(listen_socks, listen_sock_count, udp_sock);
+            event_loop_free(loop);
+            return 1;
+        }
+        log_info("Serving metrics on port %d", metrics_port);
     }
 
-    uintptr_t timer_ident = -1;
-    EV_SET(&change, timer_ident, EVFILT_TIMER, EV_ADD, NOTE_NSECONDS | NOTE_CRITICAL, tick_nsec, NULL);
-    if (kevent(kq, &change, 1, NULL, 0, NULL) == -1) {
-        perror("adding timer event to kqueue failed");
-        close(server_sock);
-        close(kq);
+    ctx.io = server_io_start(listen_socks, listen_sock_count, udp_sock, io_thread_count, &ctx.metrics);
+    if (!ctx.io) {
+        if (metrics_server) {
+            metrics_server_stop(metrics_server);
+        }
+        log_stop();
+        close_server_socks(listen_socks, listen_sock_count, udp_sock);
+        event_loop_free(loop);
         return 1;
     }
+    log_info("Started %d I/O threads", io_thread_count);
 
-    while (running) {
-        event_count = kevent(kq, NULL, 0, events, MAX_EVENTS, &timeout);
+    while (!stop_requested) {
+        event_count = event_loop_wait(loop, events, MAX_EVENTS, wait_timeout_msec(&scheduler, busy_poll_nsec));
         if (event_count < 0) {
             if (errno == EINTR) {
                 continue;
             }
-            perror("waiting for kqueue events failed");
-            return 1;
+            // Shut down as usual, so the players are disconnected and the
+            // recording is complete
+            log_error("waiting for events failed: %s", strerror(errno));
+            exit_code = 1;
+            break;
         }
 
-        for (i = 0; i < event_count; i++) {
-            if (events[i].filter == EVFILT_TIMER && events[i].ident == timer_ident) {
-                for (int ticks = events[i].data; ticks > 0; ticks--) {
-                    tick(&ctx);
-                }
-            } else if ((int)events[i].ident == server_sock) {
-                client_sock = accept(server_sock, NULL, NULL);
-                printf("got client_sock: %d\n", client_sock);
-                if (client_sock < 0) {
-                    printf("Couldn't accept connection...\n");
-                    continue;
-                }
-                if (connect_player(client_sock, &ctx) == -1) {
-                    // In case something gets added after the if statement later
-                    continue;
-                }
-            } else {
-                player_t *player = (player_t *)events[i].udata;
-                printf("player socket ready: %d\n", player->sock);
-                // TODO: First read the message header in a non-blocking way to
-                // determine the message size (e.g. when only one byte is
-                // available but we try reading two bytes, it would block)
-                bytes_received = recv(player->sock, client_message, sizeof(client_message), 0);
-                // Be careful when handling errno, because calls to printf can overwrite it
-                if (bytes_received == -1 && errno != EINTR) {
-                    printf("Error when receiving from socket: errno %d -- %s\n", errno, strerror(errno));
-                    printf("Closing socket\n");
-                    disconnect_player(player, &ctx);
-                    continue;
-                }
-                // Closed orderly by peer
-                if (bytes_received == 0) {
-                    disconnect_player(player, &ctx);
-                    continue;
-                }
-
-                handle_player_message(client_message, bytes_received, player, &ctx);
+        // The timer only wakes us up, the scheduler decides how many ticks
+        // are due
+        uint64_t missed_ticks = scheduler.stats.missed_ticks;
+        int ticks = tick_scheduler_poll(&scheduler, monotonic_nsec());
+        metrics_add(&ctx.metrics.shards[0].ticks_missed, scheduler.stats.missed_ticks - missed_ticks);
+        for (; ticks > 0; ticks--) {
+            long long tick_start = monotonic_nsec();
+            tick_scheduler_tick_started(&scheduler, tick_start);
+            tick(&ctx);
+            long long tick_end = monotonic_nsec();
+            tick_scheduler_tick_finished(&scheduler, tick_end);
+            metrics_observe_tick(&ctx.metrics.shards[0], tick_end - tick_start);
+            if (tick_end - tick_start > tick_nsec) {
+                report_overrun(&ctx, tick_end - tick_start, tick_end, &last_dump_nsec);
             }
         }
+        update_metrics(&ctx);
+
+        long long now = monotonic_nsec();
+        if (now - last_stats_nsec >= TICK_STATS_INTERVAL_SEC * 1000000000LL) {
+            report_stats(&scheduler, &ctx, io_thread_count, now - last_stats_nsec);
+            report_profile(&ctx);
+            last_stats_nsec = now;
+        }
     }
 
-    for (i = 0; i < MAX_PLAYERS; i++) {
-        if (ctx.players[i]) {
-            disconnect_player(ctx.players[i], &ctx);
+    log_info("Stopping");
+    report_stats(&scheduler, &ctx, io_thread_count, monotonic_nsec() - last_stats_nsec);
+    report_profile(&ctx);
+    server_io_stop(ctx.io);
+    if (metrics_server) {
+        metrics_server_stop(metrics_server);
+    }
+    metrics_free(&ctx.metrics);
+    log_stop();
+    if (ctx.recording) {
+        if (session_writer_close(ctx.recording, ctx.tick) == -1) {
+            printf("Couldn't write the session to %s: errno %d -- %s\n", record_path, errno, strerror(errno));
+        } else {
+            printf("Recorded %u ticks, state checksum %08x\n", ctx.tick, state_checksum(&ctx));
         }
     }
-    close(server_sock);
-    close(kq);
+    context_free(&ctx);
+    close_server_socks(listen_socks, listen_sock_count, udp_sock);
+    event_loop_free(loop);
 
-    return 0;
+    return exit_code;
 }
@@ -0,0 +1,160 @@
+#include "../protocol.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Decodes the messages that dominate the traffic, position targets on the
+ * server and cell deltas and food on the clients, with `deserialize_message`
+ * and with `decode_message`. Reports the time and the allocations per message
+ * and fails if `decode_message` allocates.
+ */
+
+// Bytes of messages decoded per message type and decoder
+#define BENCH_BYTES (1 << 26)
+#define CELL_COUNT 300
+#define FOOD_COUNT 500
+#define FIELD_SIZE 1000
+
+// The benchmark is linked with `--wrap=malloc` etc., so allocations can be
+// counted
+static long long alloc_count;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    alloc_count++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    alloc_count++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    alloc_count++;
+    return __real_realloc(ptr, size);
+}
+
+static long long now_nsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static float random_float(float max) {
+    return (float)rand() / RAND_MAX * max;
+}
+
+static int serialize_set_target(uint8_t *buf, int len) {
+    set_target_message_t msg = {
+        .message_type = MSG_SET_TARGET,
+        .x = random_float(FIELD_SIZE),
+        .y = random_float(FIELD_SIZE),
+    };
+    return serialize_message((generic_message_t *)&msg, buf, len);
+}
+
+static int serialize_cell_keyframe(uint8_t *buf, int len) {
+    cell_position_t cells[CELL_COUNT];
+    cell_delta_t deltas[CELL_COUNT];
+
+    for (int i = 0; i < CELL_COUNT; i++) {
+        cells[i] = (cell_position_t){
+            .cell_id = i * 3 + 1,
+            .player_id = i / 4 + 1,
+            .x = random_float(FIELD_SIZE),
+            .y = random_float(FIELD_SIZE),
+            .mass = 10 + rand() % 1000,
+        };
+    }
+    cell_delta_message_t msg = {
+        .message_type = MSG_CELL_DELTA,
+        .tick = 1,
+        .flags = CELL_DELTA_KEYFRAME | CELL_DELTA_LAST,
+        .delta_count = cell_delta_diff(NULL, cells, CELL_COUNT, deltas),
+        .deltas = deltas,
+    };
+    return serialize_message((generic_message_t *)&msg, buf, len);
+}
+
+static int serialize_spawned_food(uint8_t *buf, int len) {
+    food_position_t foods[FOOD_COUNT];
+
+    for (int i = 0; i < FOOD_COUNT; i++) {
+        foods[i] = (food_position_t){
+            .food_id = i,
+            .x = random_float(FIELD_SIZE),
+            .y = random_float(FIELD_SIZE),
+        };
+    }
+    spawned_food_message_t msg = {
+        .message_type = MSG_SPAWNED_FOOD,
+        .food_count = FOOD_COUNT,
+        .food_positions = foods,
+    };
+    return serialize_message((generic_message_t *)&msg, buf, len);
+}
+
+/*
+ * Runs both decoders on the message. Returns false if `decode_message`
+ * allocated or a decoder rejected the message.
+ */
+static bool bench_message(const char *name, uint8_t *buf, int len, message_arena_t *arena) {
+    generic_message_t *msg;
+    long long start, allocs;
+    int iterations = BENCH_BYTES / len;
+    bool ok = true;
+
+    allocs = alloc_count;
+    start = now_nsec();
+    for (int i = 0; i < iterations; i++) {
+        if (deserialize_message(buf, len, &msg) != len) {
+            ok = false;
+            break;
+        }
+        message_free(msg);
+    }
+    double deserialize_nsec = (double)(now_nsec() - start) / iterations;
+    double deserialize_allocs = (double)(alloc_count - allocs) / iterations;
+
+    allocs = alloc_count;
+    start = now_nsec();
+    for (int i = 0; i < iterations; i++) {
+        message_arena_reset(arena);
+        if (decode_message(buf, len, arena, &msg) != len) {
+            ok = false;
+            break;
+        }
+    }
+    double decode_nsec = (double)(now_nsec() - start) / iterations;
+    long long decode_allocs = alloc_count - allocs;
+
+    printf("%-10s %5d bytes x %7d  deserialize: %8.1f ns %4.1f allocs  decode: %8.1f ns %4.1f allocs  (%.1fx)\n", name,
+           len, iterations, deserialize_nsec, deserialize_allocs, decode_nsec, (double)decode_allocs / iterations,
+           deserialize_nsec / decode_nsec);
+    return ok && decode_allocs == 0;
+}
+
+int main(void) {
+    static uint8_t buf[65535];
+    message_arena_t arena;
+    bool ok = true;
+
+    srand(1);
+    message_arena_init(&arena, malloc(MESSAGE_ARENA_LEN), MESSAGE_ARENA_LEN);
+
+    ok &= bench_message("set_target", buf, serialize_set_target(buf, sizeof(buf)), &arena);
+    ok &= bench_message("cell_delta", buf, serialize_cell_keyframe(buf, sizeof(buf)), &arena);
+    ok &= bench_message("food", buf, serialize_spawned_food(buf, sizeof(buf)), &arena);
+
+    free(arena.buf);
+    if (!ok) {
+        printf("decode_message allocated or failed\n");
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,135 @@
+#include "../movement.h"
+#include "../player_eating.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Resolves player-vs-player eating for growing numbers of clustered players
+ * with one cell each,
+ * with the broadphase and with a brute force search over all pairs. Players
+ * are packed into clusters that overlap heavily, and more players bring more
+ * clusters, so the work per player stays the same for the broadphase while it
+ * grows linearly for the brute force search.
+ *
+ * Eats are only resolved, not applied, so the load stays the same over the
+ * run. Both searches have to find the same eats in the same order.
+ */
+
+#define CLUSTER_PLAYERS 200
+#define CLUSTER_RADIUS 300
+#define CLUSTER_SPACING 800
+#define TICKS 20
+// The brute force search is skipped for more players, it would take too long
+#define MAX_BRUTE_FORCE_PLAYERS 5000
+
+static long long now_nsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static float random_float(float max) {
+    return (float)rand() / RAND_MAX * max;
+}
+
+static int brute_force(cell_pool_t *pool, player_table_t *players, player_eat_t *eats, bool *eaten) {
+    int count = 0;
+    for (int i = 0; i < pool->count; i++) {
+        for (int j = 0; j < pool->count; j++) {
+            if (i != j && player_can_eat(pool, i, j)) {
+                eats[count++] = (player_eat_t){pool->handles[i], pool->handles[j]};
+            }
+        }
+    }
+    return player_eating_order(eats, count, eaten, pool, players);
+}
+
+/*
+ * Returns false if the searches disagree.
+ */
+static bool run(int player_count) {
+    player_table_t players;
+    cell_pool_t pool;
+    player_eating_t eating;
+    // Every player overlaps at most the players of its own cluster
+    player_eat_t *eats = malloc((size_t)player_count * CLUSTER_PLAYERS * sizeof(player_eat_t));
+    bool *eaten = calloc(player_count, sizeof(bool));
+    int clusters = (player_count + CLUSTER_PLAYERS - 1) / CLUSTER_PLAYERS;
+    int clusters_per_row = ceil(sqrt(clusters));
+    long long broadphase_nsec = 0, brute_force_nsec = 0, eat_count = 0;
+    bool matches = true;
+
+    player_table_init(&players, player_count);
+    cell_pool_init(&pool, player_count);
+    player_eating_init(&eating, player_count);
+    for (int i = 0; i < player_count; i++) {
+        player_t *player = player_table_add(&players, i);
+        player->id = i;
+        player_table_join(&players, player);
+
+        int cluster = i / CLUSTER_PLAYERS;
+        float angle = random_float(2 * M_PI), distance = random_float(CLUSTER_RADIUS);
+        float x = (cluster % clusters_per_row + 0.5) * CLUSTER_SPACING + cosf(angle) * distance;
+        float y = (cluster / clusters_per_row + 0.5) * CLUSTER_SPACING + sinf(angle) * distance;
+        int handle = cell_pool_alloc(&pool, player - players.slots);
+        int idx = pool.cells[handle].idx;
+        pool.pos_x[idx] = x;
+        pool.pos_y[idx] = y;
+        pool.target_x[idx] = x + random_float(100) - 50;
+        pool.target_y[idx] = y + random_float(100) - 50;
+        pool.speed[idx] = 0.5;
+        pool.mass[idx] = 10 + rand() % 90;
+        player_eating_add(&eating, &pool, handle);
+    }
+    move_func_t move = move_select(NULL);
+
+    for (int tick = 0; tick < TICKS; tick++) {
+        move(pool.pos_x, pool.pos_y, pool.target_x, pool.target_y, pool.speed, player_count);
+
+        long long start = now_nsec();
+        player_eating_update(&eating, &pool);
+        int count = player_eating_resolve(&eating, &pool, &players);
+        broadphase_nsec += now_nsec() - start;
+        eat_count += count;
+
+        if (player_count > MAX_BRUTE_FORCE_PLAYERS) {
+            continue;
+        }
+        start = now_nsec();
+        int expected = brute_force(&pool, &players, eats, eaten);
+        brute_force_nsec += now_nsec() - start;
+        if (expected != count || memcmp(eats, eating.eats, count * sizeof(player_eat_t)) != 0) {
+            matches = false;
+        }
+    }
+
+    printf("players: %6d, eats per tick: %6.1f, tree height: %2d, broadphase: %8.3f ms", player_count,
+           (double)eat_count / TICKS, aabb_tree_height(&eating.tree), broadphase_nsec / 1e6 / TICKS);
+    if (player_count <= MAX_BRUTE_FORCE_PLAYERS) {
+        printf(", brute force: %9.3f ms%s", brute_force_nsec / 1e6 / TICKS, matches ? "" : " MISMATCH");
+    }
+    printf("\n");
+
+    player_eating_free(&eating);
+    cell_pool_free(&pool);
+    player_table_free(&players);
+    free(eats);
+    free(eaten);
+    return matches;
+}
+
+int main(int argc, char **argv) {
+    int counts[] = {1000, 2000, 5000, 10000, 20000, 50000};
+    int max_players = argc > 1 ? atoi(argv[1]) : 50000;
+    bool matches = true;
+
+    srand(1);
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]) && counts[i] <= max_players; i++) {
+        matches &= run(counts[i]);
+    }
+    return matches ? 0 : 1;
+}
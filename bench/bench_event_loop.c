@@ -0,0 +1,238 @@
+#include "../event_loop.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+/*
+ * Simulates the server loop: `n_clients` connections send a message at the
+ * same time, and the loop has to receive all of them and answer every
+ * connection, like a broadcast. Runs once with readiness events, where the
+ * caller receives and sends with its own syscalls per socket, and once with
+ * completions (`EVENT_RECV` and `event_loop_send`), where the backend does.
+ * This binary is linked against one event loop backend, so run it once per
+ * backend to compare them (`make bench-event-loop`).
+ */
+
+#define DEFAULT_CLIENTS 2000
+#define DEFAULT_ROUNDS 500
+#define MAX_EVENTS 1024
+#define REPLY_LEN 64
+
+// Only the syscalls of the simulated server are counted, not the ones of the
+// clients
+static bool counting;
+static long long syscall_count;
+
+#ifdef __linux__
+// On Linux, the benchmark is linked with `--wrap=epoll_wait` etc., so the
+// syscalls can be counted
+#define SYSCALLS_COUNTED 1
+
+long __real_syscall(long number, ...);
+int __real_epoll_wait(int epfd, struct epoll_event *events, int max_events, int timeout);
+int __real_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+ssize_t __real_read(int fd, void *buf, size_t count);
+ssize_t __real_write(int fd, const void *buf, size_t count);
+ssize_t __real_recv(int fd, void *buf, size_t len, int flags);
+ssize_t __real_send(int fd, const void *buf, size_t len, int flags);
+ssize_t __real_sendmsg(int fd, const struct msghdr *msg, int flags);
+
+static void count_syscall(void) {
+    if (counting) {
+        syscall_count++;
+    }
+}
+
+long __wrap_syscall(long number, ...) {
+    long args[6];
+    va_list ap;
+
+    // Like the libc wrapper, pass on as many arguments as any syscall takes
+    va_start(ap, number);
+    for (int i = 0; i < 6; i++) {
+        args[i] = va_arg(ap, long);
+    }
+    va_end(ap);
+    count_syscall();
+    return __real_syscall(number, args[0], args[1], args[2], args[3], args[4], args[5]);
+}
+
+int __wrap_epoll_wait(int epfd, struct epoll_event *events, int max_events, int timeout) {
+    count_syscall();
+    return __real_epoll_wait(epfd, events, max_events, timeout);
+}
+
+int __wrap_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) {
+    count_syscall();
+    return __real_epoll_ctl(epfd, op, fd, event);
+}
+
+ssize_t __wrap_read(int fd, void *buf, size_t count) {
+    count_syscall();
+    return __real_read(fd, buf, count);
+}
+
+ssize_t __wrap_write(int fd, const void *buf, size_t count) {
+    count_syscall();
+    return __real_write(fd, buf, count);
+}
+
+ssize_t __wrap_recv(int fd, void *buf, size_t len, int flags) {
+    count_syscall();
+    return __real_recv(fd, buf, len, flags);
+}
+
+ssize_t __wrap_send(int fd, const void *buf, size_t len, int flags) {
+    count_syscall();
+    return __real_send(fd, buf, len, flags);
+}
+
+ssize_t __wrap_sendmsg(int fd, const struct msghdr *msg, int flags) {
+    count_syscall();
+    return __real_sendmsg(fd, msg, flags);
+}
+#else
+#define SYSCALLS_COUNTED 0
+#endif
+
+static long long now_nsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Receives the message of every client and answers it, with readiness events
+ * or with completions. Returns false on errors.
+ */
+static bool bench_loop(bool completions, int n_clients, int n_rounds) {
+    static uint8_t reply[REPLY_LEN];
+    struct iovec reply_iov = {.iov_base = reply, .iov_len = REPLY_LEN};
+    int *server_fds = calloc(n_clients, sizeof(int));
+    int *client_fds = calloc(n_clients, sizeof(int));
+    event_t events[MAX_EVENTS];
+    long long waits = 0, delivered = 0;
+    uint8_t buf[64];
+
+    event_loop_t *loop = event_loop_new();
+    if (!loop) {
+        perror("creating event loop failed");
+        return false;
+    }
+
+    for (int i = 0; i < n_clients; i++) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+            perror("socketpair failed (is the fd limit high enough?)");
+            return false;
+        }
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+        server_fds[i] = fds[0];
+        client_fds[i] = fds[1];
+        if (event_loop_add(loop, fds[0], completions ? EVENT_RECV : EVENT_READ, &server_fds[i]) == -1) {
+            perror("registering fd failed");
+            return false;
+        }
+    }
+
+    syscall_count = 0;
+    long long start = now_nsec();
+
+    for (int round = 0; round < n_rounds; round++) {
+        for (int i = 0; i < n_clients; i++) {
+            // The replies of the last round have arrived completely
+            if ((round > 0 && read(client_fds[i], buf, REPLY_LEN) != REPLY_LEN) || write(client_fds[i], "x", 1) != 1) {
+                perror("client failed");
+                return false;
+            }
+        }
+
+        // With completions, a client is done once its reply was sent
+        int pending = n_clients;
+        counting = true;
+        while (pending > 0) {
+            int event_count = event_loop_wait(loop, events, MAX_EVENTS, -1);
+            if (event_count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("waiting for events failed");
+                return false;
+            }
+            waits++;
+
+            for (int i = 0; i < event_count; i++) {
+                int fd = *(int *)events[i].udata;
+                delivered++;
+
+                if (!completions) {
+                    while (recv(fd, buf, sizeof(buf), 0) > 0) {
+                    }
+                    if (send(fd, reply, REPLY_LEN, 0) != REPLY_LEN) {
+                        perror("send failed");
+                        return false;
+                    }
+                    pending--;
+                } else if (events[i].events & EVENT_RECV) {
+                    if (events[i].result <= 0 || event_loop_send(loop, fd, &reply_iov, 1) == -1) {
+                        perror("receive or send failed");
+                        return false;
+                    }
+                } else {
+                    if (events[i].result != REPLY_LEN) {
+                        fprintf(stderr, "sending failed: %d\n", events[i].result);
+                        return false;
+                    }
+                    pending--;
+                }
+            }
+        }
+        counting = false;
+    }
+
+    long long elapsed = now_nsec() - start;
+
+    printf("%s:\n", completions ? "completions" : "readiness");
+    printf("  avg round: %.1f us\n", elapsed / 1e3 / n_rounds);
+    printf("  events/s: %.0f\n", delivered / (elapsed / 1e9));
+    printf("  events per wait: %.1f\n", (double)delivered / waits);
+    if (SYSCALLS_COUNTED) {
+        printf("  syscalls per round: %.1f (%.2f per client)\n", (double)syscall_count / n_rounds,
+               (double)syscall_count / n_rounds / n_clients);
+    }
+
+    for (int i = 0; i < n_clients; i++) {
+        event_loop_remove(loop, server_fds[i]);
+        close(server_fds[i]);
+        close(client_fds[i]);
+    }
+    event_loop_free(loop);
+    free(server_fds);
+    free(client_fds);
+
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int n_clients = argc > 1 ? atoi(argv[1]) : DEFAULT_CLIENTS;
+    int n_rounds = argc > 2 ? atoi(argv[2]) : DEFAULT_ROUNDS;
+
+    printf("backend: %s\n", EVENT_LOOP_BACKEND);
+    printf("clients: %d, rounds: %d\n", n_clients, n_rounds);
+    if (!bench_loop(false, n_clients, n_rounds) || !bench_loop(true, n_clients, n_rounds)) {
+        return 1;
+    }
+    return 0;
+}
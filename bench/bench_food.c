@@ -0,0 +1,136 @@
+#include "../food.h"
+#include "../movement.h"
+#include "../protocol.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Runs the food part of the tick on a crowded field: every player eats the
+ * pellets it overlaps, the eaten pellets are respawned elsewhere, and both
+ * changes are serialized into batched messages. Players keep their mass, so
+ * the load stays the same over the run.
+ *
+ * In the first tick every player lands on untouched food, so it is reported
+ * separately from the steady state.
+ */
+
+#define FIELD_SIZE 10000
+#define DEFAULT_FOOD 200000
+#define DEFAULT_PLAYERS 1000
+#define TICKS 200
+#define TICK_BUDGET_MSEC 1.0
+
+static long long now_nsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static float random_float(float max) {
+    return (float)rand() / RAND_MAX * max;
+}
+
+static void spawn_food(food_grid_t *grid, int count) {
+    while (grid->count < count) {
+        food_spawn(grid, random_float(FIELD_SIZE), random_float(FIELD_SIZE));
+    }
+}
+
+static int serialize_changes(food_grid_t *grid, uint8_t *buf) {
+    int bytes = 0;
+
+    for (int offset = 0; offset < grid->eaten_count; offset += MAX_EATEN_FOOD_PER_MESSAGE) {
+        int chunk = grid->eaten_count - offset;
+        eaten_food_message_t msg = {
+            .message_type = MSG_EATEN_FOOD,
+            .food_count = chunk < MAX_EATEN_FOOD_PER_MESSAGE ? chunk : MAX_EATEN_FOOD_PER_MESSAGE,
+            .food_ids = grid->eaten + offset,
+        };
+        bytes += serialize_message((generic_message_t *)&msg, buf, 65535);
+    }
+    for (int offset = 0; offset < grid->spawned_count; offset += MAX_SPAWNED_FOOD_PER_MESSAGE) {
+        int chunk = grid->spawned_count - offset;
+        spawned_food_message_t msg = {
+            .message_type = MSG_SPAWNED_FOOD,
+            .food_count = chunk < MAX_SPAWNED_FOOD_PER_MESSAGE ? chunk : MAX_SPAWNED_FOOD_PER_MESSAGE,
+            .food_positions = grid->spawned + offset,
+        };
+        bytes += serialize_message((generic_message_t *)&msg, buf, 65535);
+    }
+    return bytes;
+}
+
+int main(int argc, char **argv) {
+    int food_count = argc > 1 ? atoi(argv[1]) : DEFAULT_FOOD;
+    int player_count = argc > 2 ? atoi(argv[2]) : DEFAULT_PLAYERS;
+    float *pos_x = malloc(player_count * sizeof(float));
+    float *pos_y = malloc(player_count * sizeof(float));
+    float *target_x = malloc(player_count * sizeof(float));
+    float *target_y = malloc(player_count * sizeof(float));
+    float *speed = malloc(player_count * sizeof(float));
+    int *mass = malloc(player_count * sizeof(int));
+    static uint8_t buf[65535];
+    food_grid_t grid;
+    long long first_nsec = 0, total_nsec = 0, max_nsec = 0, eaten = 0, bytes = 0;
+
+    srand(1);
+    food_grid_init(&grid, FIELD_SIZE, FIELD_SIZE, FOOD_CELL_SIZE);
+    spawn_food(&grid, food_count);
+    food_clear_changes(&grid);
+
+    for (int i = 0; i < player_count; i++) {
+        pos_x[i] = target_x[i] = random_float(FIELD_SIZE);
+        pos_y[i] = target_y[i] = random_float(FIELD_SIZE);
+        speed[i] = 0.5;
+        mass[i] = 10 + rand() % 90;
+    }
+    move_func_t move = move_select(NULL);
+
+    for (int tick = 0; tick < TICKS; tick++) {
+        // Players wander around, so they keep running into fresh food
+        for (int i = 0; i < player_count; i++) {
+            if (rand() % 20 == 0) {
+                target_x[i] = random_float(FIELD_SIZE);
+                target_y[i] = random_float(FIELD_SIZE);
+            }
+        }
+        move(pos_x, pos_y, target_x, target_y, speed, player_count);
+
+        long long start = now_nsec();
+        for (int i = 0; i < player_count; i++) {
+            food_eat(&grid, pos_x[i], pos_y[i], player_radius(mass[i]));
+        }
+        eaten += grid.eaten_count;
+        spawn_food(&grid, food_count);
+        bytes += serialize_changes(&grid, buf);
+        food_clear_changes(&grid);
+        long long elapsed = now_nsec() - start;
+
+        if (tick == 0) {
+            first_nsec = elapsed;
+            continue;
+        }
+        total_nsec += elapsed;
+        if (elapsed > max_nsec) {
+            max_nsec = elapsed;
+        }
+    }
+
+    double avg_msec = total_nsec / 1e6 / (TICKS - 1);
+    printf("food: %d, players: %d, grid: %dx%d cells, ticks: %d\n", food_count, player_count, grid.cols,
+           grid.rows, TICKS);
+    printf("eaten per tick: %.1f, message bytes per tick: %.0f\n", (double)eaten / TICKS, (double)bytes / TICKS);
+    printf("first tick: %.3f ms\n", first_nsec / 1e6);
+    printf("tick: avg %.3f ms, max %.3f ms (budget %.1f ms)\n", avg_msec, max_nsec / 1e6, TICK_BUDGET_MSEC);
+
+    food_grid_free(&grid);
+    free(pos_x);
+    free(pos_y);
+    free(target_x);
+    free(target_y);
+    free(speed);
+    free(mass);
+    return avg_msec <= TICK_BUDGET_MSEC ? 0 : 1;
+}
@@ -0,0 +1,147 @@
+#include "../movement.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Runs every movement kernel the CPU supports on the same random players and
+ * checks that the positions are bit-for-bit identical to the scalar kernel
+ * after every step. Exits with 1 on a mismatch.
+ */
+
+#define FIELD_SIZE 1000
+#define STEPS 100
+
+typedef struct kernel_t {
+    const char *name;
+    move_func_t func;
+} kernel_t;
+
+typedef struct bodies_t {
+    float *pos_x;
+    float *pos_y;
+    float *target_x;
+    float *target_y;
+    float *speed;
+} bodies_t;
+
+static long long now_nsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static float random_float(float max) {
+    return (float)rand() / RAND_MAX * max;
+}
+
+static void bodies_init(bodies_t *bodies, int count) {
+    bodies->pos_x = malloc(count * sizeof(float));
+    bodies->pos_y = malloc(count * sizeof(float));
+    bodies->target_x = malloc(count * sizeof(float));
+    bodies->target_y = malloc(count * sizeof(float));
+    bodies->speed = malloc(count * sizeof(float));
+}
+
+static void bodies_copy(bodies_t *dst, bodies_t *src, int count) {
+    memcpy(dst->pos_x, src->pos_x, count * sizeof(float));
+    memcpy(dst->pos_y, src->pos_y, count * sizeof(float));
+    memcpy(dst->target_x, src->target_x, count * sizeof(float));
+    memcpy(dst->target_y, src->target_y, count * sizeof(float));
+    memcpy(dst->speed, src->speed, count * sizeof(float));
+}
+
+static void bodies_free(bodies_t *bodies) {
+    free(bodies->pos_x);
+    free(bodies->pos_y);
+    free(bodies->target_x);
+    free(bodies->target_y);
+    free(bodies->speed);
+}
+
+static void bodies_retarget(bodies_t *bodies, int count) {
+    for (int i = 0; i < count; i++) {
+        bodies->target_x[i] = random_float(FIELD_SIZE);
+        bodies->target_y[i] = random_float(FIELD_SIZE);
+    }
+}
+
+static long long run_kernel(kernel_t *kernel, bodies_t *bodies, int count) {
+    long long start = now_nsec();
+    kernel->func(bodies->pos_x, bodies->pos_y, bodies->target_x, bodies->target_y, bodies->speed, count);
+    return now_nsec() - start;
+}
+
+int main(void) {
+    const int counts[] = {1000, 10000, 100000};
+    kernel_t kernels[3];
+    int kernel_count = 0;
+    const char *selected;
+
+    kernels[kernel_count++] = (kernel_t){"scalar", move_scalar};
+#ifdef MOVEMENT_X86
+    __builtin_cpu_init();
+    kernels[kernel_count++] = (kernel_t){"sse", move_sse};
+    if (__builtin_cpu_supports("avx2")) {
+        kernels[kernel_count++] = (kernel_t){"avx2", move_avx2};
+    }
+#endif
+    move_select(&selected);
+    printf("selected kernel: %s\n", selected);
+
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        int count = counts[c];
+        bodies_t initial, reference, bodies;
+        bodies_init(&initial, count);
+        bodies_init(&reference, count);
+        bodies_init(&bodies, count);
+
+        srand(count);
+        for (int i = 0; i < count; i++) {
+            initial.pos_x[i] = random_float(FIELD_SIZE);
+            initial.pos_y[i] = random_float(FIELD_SIZE);
+            // Some players sit on their target, which the kernels must not
+            // move
+            initial.target_x[i] = i % 16 == 0 ? initial.pos_x[i] : random_float(FIELD_SIZE);
+            initial.target_y[i] = i % 16 == 0 ? initial.pos_y[i] : random_float(FIELD_SIZE);
+            initial.speed[i] = 0.5 + random_float(20);
+        }
+
+        printf("\nplayers: %d, steps: %d\n", count, STEPS);
+        for (int k = 0; k < kernel_count; k++) {
+            long long elapsed = 0;
+            bodies_copy(&reference, &initial, count);
+            bodies_copy(&bodies, &initial, count);
+
+            for (int step = 0; step < STEPS; step++) {
+                // New targets now and then, so the players don't just park
+                if (step % 20 == 19) {
+                    srand(count * STEPS + step);
+                    bodies_retarget(&reference, count);
+                    srand(count * STEPS + step);
+                    bodies_retarget(&bodies, count);
+                }
+                move_scalar(reference.pos_x, reference.pos_y, reference.target_x, reference.target_y,
+                            reference.speed, count);
+                elapsed += run_kernel(&kernels[k], &bodies, count);
+
+                if (memcmp(reference.pos_x, bodies.pos_x, count * sizeof(float)) != 0 ||
+                    memcmp(reference.pos_y, bodies.pos_y, count * sizeof(float)) != 0) {
+                    printf("%s: positions differ from the scalar kernel in step %d\n", kernels[k].name, step);
+                    return 1;
+                }
+            }
+
+            printf("%-6s  %8.1f players/ms  %8.3f ms/step  (matches scalar)\n", kernels[k].name,
+                   (double)count * STEPS / (elapsed / 1e6), elapsed / 1e6 / STEPS);
+        }
+
+        bodies_free(&initial);
+        bodies_free(&reference);
+        bodies_free(&bodies);
+    }
+
+    return 0;
+}
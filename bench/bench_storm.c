@@ -0,0 +1,237 @@
+#include "../event_loop.h"
+#include "../networking.h"
+#include "../protocol.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/*
+ * Connection storm against a running server: `n_clients` clients connect and
+ * join as fast as possible, with at most `concurrency` of them in flight at
+ * once. Every client disconnects as soon as it got the answer to its join, so
+ * the game doesn't fill up.
+ *
+ * Reports the rate of established connections and the latency from starting
+ * the connect until the join was acknowledged.
+ */
+
+#define DEFAULT_CLIENTS 2000
+#define DEFAULT_CONCURRENCY 32
+#define DEFAULT_PORT 2000
+#define MAX_EVENTS 1024
+
+typedef struct storm_client_t {
+    int sock;
+    bool connected;
+    long long start_nsec;
+    uint8_t buf[3];
+    int buf_len;
+} storm_client_t;
+
+typedef struct storm_t {
+    event_loop_t *loop;
+    struct sockaddr_in addr;
+    uint8_t join_buf[64];
+    int join_len;
+    int started;
+    int finished;
+    int n_clients;
+    int connected;
+    int acked;
+    int rejected;
+    int failed;
+    long long *latencies;
+} storm_t;
+
+static long long now_nsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_latencies(const void *a, const void *b) {
+    long long lhs = *(const long long *)a;
+    long long rhs = *(const long long *)b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+static double percentile_msec(long long *sorted, int count, double q) {
+    if (count == 0) {
+        return 0;
+    }
+    return sorted[(int)(q * (count - 1))] / 1e6;
+}
+
+static void start_client(storm_t *storm, storm_client_t *client) {
+    memset(client, 0, sizeof(storm_client_t));
+    storm->started++;
+    client->start_nsec = now_nsec();
+
+    client->sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (client->sock == -1 || set_nonblocking(client->sock) == -1) {
+        perror("creating client socket failed");
+        exit(1);
+    }
+
+    if (connect(client->sock, (struct sockaddr *)&storm->addr, sizeof(storm->addr)) == -1
+            && errno != EINPROGRESS) {
+        perror("connect failed");
+        exit(1);
+    }
+
+    if (event_loop_add(storm->loop, client->sock, EVENT_READ | EVENT_WRITE, client) == -1) {
+        perror("registering client socket failed");
+        exit(1);
+    }
+}
+
+/*
+ * Closes the client's connection. The client is reused for the next connection
+ * after the current batch of events, since the new socket may get the same fd
+ * as the old one, which later events of the batch may still refer to.
+ */
+static void finish_client(storm_t *storm, storm_client_t *client) {
+    event_loop_remove(storm->loop, client->sock);
+    close(client->sock);
+    client->sock = -1;
+    storm->finished++;
+}
+
+static void handle_connected(storm_t *storm, storm_client_t *client) {
+    int err = 0;
+    socklen_t err_len = sizeof(err);
+
+    if (getsockopt(client->sock, SOL_SOCKET, SO_ERROR, &err, &err_len) == -1 || err != 0) {
+        storm->failed++;
+        finish_client(storm, client);
+        return;
+    }
+
+    client->connected = true;
+    storm->connected++;
+    if (send_all(client->sock, storm->join_buf, storm->join_len) == -1) {
+        storm->failed++;
+        finish_client(storm, client);
+    }
+}
+
+static void handle_readable(storm_t *storm, storm_client_t *client) {
+    while (client->buf_len < (int)sizeof(client->buf)) {
+        int received = recv(client->sock, client->buf + client->buf_len, sizeof(client->buf) - client->buf_len, 0);
+        if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (received <= 0) {
+            storm->failed++;
+            finish_client(storm, client);
+            return;
+        }
+        client->buf_len += received;
+    }
+
+    // The answer to a join is the first message the server sends
+    if (client->buf[2] == MSG_JOIN_ACK) {
+        storm->latencies[storm->acked++] = now_nsec() - client->start_nsec;
+    } else {
+        storm->rejected++;
+    }
+    finish_client(storm, client);
+}
+
+int main(int argc, char **argv) {
+    int n_clients = argc > 1 ? atoi(argv[1]) : DEFAULT_CLIENTS;
+    int concurrency = argc > 2 ? atoi(argv[2]) : DEFAULT_CONCURRENCY;
+    int port = argc > 3 ? atoi(argv[3]) : DEFAULT_PORT;
+    event_t events[MAX_EVENTS];
+    storm_t storm = {0};
+
+    if (concurrency > n_clients) {
+        concurrency = n_clients;
+    }
+
+    storm.n_clients = n_clients;
+    storm.latencies = calloc(n_clients, sizeof(long long));
+    storm.addr.sin_family = AF_INET;
+    storm.addr.sin_port = htons(port);
+    storm.addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    join_message_t join_msg = {
+        .message_type = MSG_JOIN,
+        .name_length = 5,
+        .name = "storm",
+    };
+    storm.join_len = serialize_message((generic_message_t *)&join_msg, storm.join_buf, sizeof(storm.join_buf));
+
+    storm.loop = event_loop_new();
+    if (!storm.loop) {
+        perror("creating event loop failed");
+        return 1;
+    }
+
+    storm_client_t *clients = calloc(concurrency, sizeof(storm_client_t));
+    long long start = now_nsec();
+    for (int i = 0; i < concurrency; i++) {
+        start_client(&storm, &clients[i]);
+    }
+
+    while (storm.finished < n_clients) {
+        int event_count = event_loop_wait(storm.loop, events, MAX_EVENTS, -1);
+        if (event_count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("waiting for events failed");
+            return 1;
+        }
+
+        for (int i = 0; i < event_count; i++) {
+            storm_client_t *client = events[i].udata;
+            // The client may have been finished by an earlier event of this
+            // batch
+            if (client->sock == -1) {
+                continue;
+            }
+
+            if (!client->connected) {
+                if (events[i].events & (EVENT_WRITE | EVENT_ERROR)) {
+                    handle_connected(&storm, client);
+                }
+            } else if (events[i].events & EVENT_READ) {
+                handle_readable(&storm, client);
+            }
+        }
+
+        for (int i = 0; i < concurrency && storm.started < n_clients; i++) {
+            if (clients[i].sock == -1) {
+                start_client(&storm, &clients[i]);
+            }
+        }
+    }
+
+    long long elapsed = now_nsec() - start;
+    qsort(storm.latencies, storm.acked, sizeof(long long), compare_latencies);
+
+    printf("backend: %s\n", EVENT_LOOP_BACKEND);
+    printf("clients: %d, concurrency: %d\n", n_clients, concurrency);
+    printf("joined: %d, rejected: %d, failed: %d\n", storm.acked, storm.rejected, storm.failed);
+    printf("accepts/s: %.0f\n", storm.connected / (elapsed / 1e9));
+    printf("joins/s: %.0f\n", storm.acked / (elapsed / 1e9));
+    printf("join latency: p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+           percentile_msec(storm.latencies, storm.acked, 0.5),
+           percentile_msec(storm.latencies, storm.acked, 0.9),
+           percentile_msec(storm.latencies, storm.acked, 0.99),
+           percentile_msec(storm.latencies, storm.acked, 1.0));
+
+    event_loop_free(storm.loop);
+    free(clients);
+    free(storm.latencies);
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include "cell_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void *alloc_column(int capacity, size_t elem_size) {
+    // Aligned for vector loads, and the size has to be a multiple of the
+    // alignment
+    size_t size = ((capacity * elem_size + 31) / 32) * 32;
+    return aligned_alloc(32, size);
+}
+
+void cell_pool_init(cell_pool_t *pool, int capacity) {
+    pool->capacity = capacity;
+    pool->cells = calloc(capacity, sizeof(cell_t));
+    pool->free_handles = malloc(capacity * sizeof(int));
+    pool->handles = malloc(capacity * sizeof(int));
+    pool->count = 0;
+    pool->pos_x = alloc_column(capacity, sizeof(float));
+    pool->pos_y = alloc_column(capacity, sizeof(float));
+    pool->target_x = alloc_column(capacity, sizeof(float));
+    pool->target_y = alloc_column(capacity, sizeof(float));
+    pool->speed = alloc_column(capacity, sizeof(float));
+    pool->mass = alloc_column(capacity, sizeof(int));
+    pool->boost_x = alloc_column(capacity, sizeof(float));
+    pool->boost_y = alloc_column(capacity, sizeof(float));
+
+    // Lower handles are handed out first
+    pool->free_count = capacity;
+    for (int i = 0; i < capacity; i++) {
+        pool->free_handles[i] = capacity - 1 - i;
+    }
+}
+
+void cell_pool_free(cell_pool_t *pool) {
+    free(pool->cells);
+    free(pool->free_handles);
+    free(pool->handles);
+    free(pool->pos_x);
+    free(pool->pos_y);
+    free(pool->target_x);
+    free(pool->target_y);
+    free(pool->speed);
+    free(pool->mass);
+    free(pool->boost_x);
+    free(pool->boost_y);
+}
+
+int cell_pool_alloc(cell_pool_t *pool, int owner) {
+    if (pool->free_count == 0) {
+        return -1;
+    }
+
+    int handle = pool->free_handles[--pool->free_count];
+    cell_t *cell = &pool->cells[handle];
+    memset(cell, 0, sizeof(cell_t));
+    cell->owner = owner;
+    cell->idx = pool->count;
+    pool->handles[pool->count++] = handle;
+    return handle;
+}
+
+void cell_pool_release(cell_pool_t *pool, int handle) {
+    // Swap-remove from the dense array and the body columns
+    int idx = pool->cells[handle].idx;
+    int last = --pool->count;
+    pool->handles[idx] = pool->handles[last];
+    pool->cells[pool->handles[idx]].idx = idx;
+    pool->pos_x[idx] = pool->pos_x[last];
+    pool->pos_y[idx] = pool->pos_y[last];
+    pool->target_x[idx] = pool->target_x[last];
+    pool->target_y[idx] = pool->target_y[last];
+    pool->speed[idx] = pool->speed[last];
+    pool->mass[idx] = pool->mass[last];
+    pool->boost_x[idx] = pool->boost_x[last];
+    pool->boost_y[idx] = pool->boost_y[last];
+
+    pool->free_handles[pool->free_count++] = handle;
+}
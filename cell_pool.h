@@ -0,0 +1,63 @@
+#ifndef CELL_POOL_H
+#define CELL_POOL_H
+
+#include <stdbool.h>
+
+typedef struct cell_t {
+    // Slot of the player that owns the cell
+    int owner;
+    // Index in the pool's dense array and columns
+    int idx;
+    // Leaf of the cell in the broadphase tree of `player_eating_t`
+    int proxy;
+    // Set once the merge timer of the cell expired
+    bool can_merge;
+} cell_t;
+
+/*
+ * Fixed-capacity storage for the cells of all players. It works like the
+ * player table: cells live in a slab that is allocated once and are referred
+ * to by their index in it, the handle, which stays valid until the cell is
+ * released. Free handles are kept on a stack, so allocating and releasing a
+ * cell is O(1) and never allocates memory.
+ *
+ * Live cells are also kept in a dense array without gaps, with the state the
+ * simulation touches every tick in structure-of-arrays columns parallel to it,
+ * so the movement kernels can stream through them (see `movement.h`).
+ * Releasing a cell moves the last cell into its place.
+ */
+typedef struct cell_pool_t {
+    int capacity;
+    cell_t *cells;
+    int *free_handles;
+    int free_count;
+    // Handles of the live cells
+    int *handles;
+    int count;
+    // Body columns, indexed like `handles`
+    float *pos_x;
+    float *pos_y;
+    float *target_x;
+    float *target_y;
+    float *speed;
+    int *mass;
+    // Extra velocity of cells that were just split off
+    float *boost_x;
+    float *boost_y;
+} cell_pool_t;
+
+void cell_pool_init(cell_pool_t *pool, int capacity);
+void cell_pool_free(cell_pool_t *pool);
+
+/*
+ * Allocates a cell for the player in the slot and returns its handle, or -1 if
+ * the pool is full. Its body columns are uninitialized.
+ */
+int cell_pool_alloc(cell_pool_t *pool, int owner);
+void cell_pool_release(cell_pool_t *pool, int handle);
+
+static inline cell_t *cell_pool_get(cell_pool_t *pool, int handle) {
+    return &pool->cells[handle];
+}
+
+#endif // CELL_POOL_H
@@ -0,0 +1,110 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*
+ * Thin abstraction over the OS readiness notification primitives. The backend
+ * is selected at build time (see the Makefile): `event_loop_kqueue.c` on MacOS
+ * and BSDs, `event_loop_epoll.c` on Linux, or `event_loop_uring.c` on Linux
+ * with io_uring.
+ *
+ * All file descriptors are registered edge-triggered, so a consumer has to
+ * drain a descriptor (e.g. read until `EAGAIN`) before waiting again, otherwise
+ * it will not be notified about the remaining data.
+ *
+ * Sockets can also be registered for completions instead of readiness: the
+ * loop accepts connections and receives and sends bytes itself and reports
+ * the results. The io_uring backend hands these operations to the kernel and
+ * submits all of them with the next wait, so e.g. sending to every connection
+ * costs one syscall. The other backends perform them with one syscall each.
+ */
+
+#define EVENT_READ 1
+#define EVENT_WRITE 2
+#define EVENT_TIMER 4
+#define EVENT_ERROR 8
+// The loop was woken up by `event_loop_notify`
+#define EVENT_NOTIFY 16
+// Completions, see `event_loop_add` and `event_loop_send`
+#define EVENT_ACCEPT 32
+#define EVENT_RECV 64
+#define EVENT_SEND 128
+
+typedef struct event_loop_t event_loop_t;
+
+typedef struct event_t {
+    // Combination of `EVENT_*` flags
+    int events;
+    int fd;
+    void *udata;
+    // Number of timer expirations since the last timer event. Only set for
+    // `EVENT_TIMER` events.
+    uint64_t timer_expirations;
+    // Only set for completions: the accepted socket, the number of bytes
+    // received (0 if the peer closed the connection) or sent, or a negative
+    // errno
+    int result;
+    // The received bytes of an `EVENT_RECV`, valid until the next wait
+    uint8_t *data;
+} event_t;
+
+event_loop_t *event_loop_new(void);
+void event_loop_free(event_loop_t *loop);
+
+/*
+ * Registers `fd` for the given `EVENT_READ`/`EVENT_WRITE` interests. `udata` is
+ * handed back in every event for `fd`.
+ *
+ * Instead of readiness, a listening socket can be registered with
+ * `EVENT_ACCEPT`, in which case every accepted connection is reported as an
+ * `EVENT_ACCEPT` with the non-blocking socket (or a negative errno if accepting
+ * failed). A connected socket can be registered with `EVENT_RECV`, in which
+ * case received bytes are reported as `EVENT_RECV` until one reports the end
+ * of the stream or an error.
+ *
+ * Returns 0 on success and -1 on error (with `errno` set).
+ */
+int event_loop_add(event_loop_t *loop, int fd, int events, void *udata);
+
+/*
+ * Removes `fd` from the loop. This has to be called before closing `fd`. A
+ * pending send is cancelled, but its `EVENT_SEND` is still reported, since the
+ * sent bytes have to stay valid until then.
+ */
+int event_loop_remove(event_loop_t *loop, int fd);
+
+/*
+ * Sends the bytes of `iov` on `fd`, which has to be registered with
+ * `EVENT_RECV`, and reports the number of bytes that were sent, which can be
+ * fewer than requested, as an `EVENT_SEND`. Only one send per fd can be
+ * pending, and `iov` and the bytes it points to have to stay valid until its
+ * event.
+ *
+ * Returns 0 on success and -1 on error (with `errno` set).
+ */
+int event_loop_send(event_loop_t *loop, int fd, const struct iovec *iov, int iov_count);
+
+/*
+ * Arms a periodic timer that fires every `interval_nsec` nanoseconds. There is
+ * only one timer per loop; calling this again replaces the previous timer.
+ */
+int event_loop_set_timer(event_loop_t *loop, long interval_nsec, void *udata);
+
+/*
+ * Wakes up the thread waiting on the loop with an `EVENT_NOTIFY` event. This is
+ * the only function that may be called from other threads. Multiple calls
+ * before the loop is woken up may be coalesced into one event.
+ */
+int event_loop_notify(event_loop_t *loop);
+
+/*
+ * Waits for events and stores at most `max_events` of them in `events`.
+ * `timeout_msec` of -1 blocks indefinitely, 0 returns immediately.
+ *
+ * Returns the number of events or -1 on error (with `errno` set).
+ */
+int event_loop_wait(event_loop_t *loop, event_t *events, int max_events, int timeout_msec);
+
+#endif // EVENT_LOOP_H
@@ -0,0 +1,260 @@
+#include "event_loop.h"
+#include "event_loop_ops.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+struct event_loop_t {
+    int epfd;
+    int timer_fd;
+    void *timer_udata;
+    int notify_fd;
+    // `epoll_data_t` can only hold either the fd or a pointer, so we store the
+    // fd and look up the registration in this table, which is indexed by fd.
+    op_reg_t **regs_by_fd;
+    int regs_capacity;
+    struct epoll_event *epoll_events;
+    int epoll_events_capacity;
+    ops_t ops;
+};
+
+static int ensure_regs_capacity(event_loop_t *loop, int fd) {
+    if (fd < loop->regs_capacity) {
+        return 0;
+    }
+
+    int new_capacity = loop->regs_capacity ? loop->regs_capacity : 64;
+    while (new_capacity <= fd) {
+        new_capacity *= 2;
+    }
+
+    op_reg_t **regs_by_fd = realloc(loop->regs_by_fd, new_capacity * sizeof(op_reg_t *));
+    if (!regs_by_fd) {
+        return -1;
+    }
+    memset(regs_by_fd + loop->regs_capacity, 0, (new_capacity - loop->regs_capacity) * sizeof(op_reg_t *));
+    loop->regs_by_fd = regs_by_fd;
+    loop->regs_capacity = new_capacity;
+    return 0;
+}
+
+static op_reg_t *find_reg(event_loop_t *loop, int fd) {
+    return fd >= 0 && fd < loop->regs_capacity ? loop->regs_by_fd[fd] : NULL;
+}
+
+event_loop_t *event_loop_new(void) {
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+        return NULL;
+    }
+
+    // The eventfd is created up front, so that `event_loop_notify` never races
+    // with its creation
+    int notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (notify_fd == -1) {
+        close(epfd);
+        return NULL;
+    }
+
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = notify_fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, notify_fd, &ev) == -1) {
+        close(notify_fd);
+        close(epfd);
+        return NULL;
+    }
+
+    event_loop_t *loop = calloc(1, sizeof(event_loop_t));
+    loop->epfd = epfd;
+    loop->timer_fd = -1;
+    loop->notify_fd = notify_fd;
+    return loop;
+}
+
+void event_loop_free(event_loop_t *loop) {
+    if (loop->timer_fd != -1) {
+        close(loop->timer_fd);
+    }
+    close(loop->notify_fd);
+    close(loop->epfd);
+    for (int fd = 0; fd < loop->regs_capacity; fd++) {
+        free(loop->regs_by_fd[fd]);
+    }
+    ops_free(&loop->ops);
+    free(loop->regs_by_fd);
+    free(loop->epoll_events);
+    free(loop);
+}
+
+int event_loop_add(event_loop_t *loop, int fd, int events, void *udata) {
+    struct epoll_event ev = {0};
+
+    if (ensure_regs_capacity(loop, fd) == -1) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (loop->regs_by_fd[fd]) {
+        errno = EEXIST;
+        return -1;
+    }
+
+    ev.events = EPOLLET | EPOLLRDHUP;
+    if (events & (EVENT_READ | EVENT_ACCEPT | EVENT_RECV)) ev.events |= EPOLLIN;
+    if (events & (EVENT_WRITE | EVENT_RECV)) ev.events |= EPOLLOUT;
+    ev.data.fd = fd;
+
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        return -1;
+    }
+    loop->regs_by_fd[fd] = ops_reg_new(fd, events, udata);
+    return 0;
+}
+
+int event_loop_remove(event_loop_t *loop, int fd) {
+    op_reg_t *reg = find_reg(loop, fd);
+    if (reg) {
+        loop->regs_by_fd[fd] = NULL;
+        ops_remove(&loop->ops, reg);
+    }
+    return epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+int event_loop_send(event_loop_t *loop, int fd, const struct iovec *iov, int iov_count) {
+    op_reg_t *reg = find_reg(loop, fd);
+    if (!reg) {
+        errno = ENOENT;
+        return -1;
+    }
+    return ops_send(&loop->ops, reg, iov, iov_count);
+}
+
+int event_loop_set_timer(event_loop_t *loop, long interval_nsec, void *udata) {
+    struct itimerspec spec = {0};
+    struct epoll_event ev = {0};
+
+    if (loop->timer_fd == -1) {
+        loop->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (loop->timer_fd == -1) {
+            return -1;
+        }
+
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = loop->timer_fd;
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->timer_fd, &ev) == -1) {
+            close(loop->timer_fd);
+            loop->timer_fd = -1;
+            return -1;
+        }
+    }
+
+    spec.it_interval.tv_sec = interval_nsec / 1000000000L;
+    spec.it_interval.tv_nsec = interval_nsec % 1000000000L;
+    spec.it_value = spec.it_interval;
+    loop->timer_udata = udata;
+
+    return timerfd_settime(loop->timer_fd, 0, &spec, NULL);
+}
+
+int event_loop_notify(event_loop_t *loop) {
+    uint64_t one = 1;
+    if (write(loop->notify_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        return -1;
+    }
+    return 0;
+}
+
+int event_loop_wait(event_loop_t *loop, event_t *events, int max_events, int timeout_msec) {
+    int event_count, n_events = 0;
+
+    if (max_events > loop->epoll_events_capacity) {
+        free(loop->epoll_events);
+        loop->epoll_events = malloc(max_events * sizeof(struct epoll_event));
+        loop->epoll_events_capacity = max_events;
+    }
+
+    ops_begin_wait(&loop->ops);
+    // Registrations with work left don't get another edge
+    if (loop->ops.ready_head) {
+        timeout_msec = 0;
+    }
+
+    event_count = epoll_wait(loop->epfd, loop->epoll_events, max_events, timeout_msec);
+    if (event_count < 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < event_count; i++) {
+        struct epoll_event *epev = &loop->epoll_events[i];
+        int fd = epev->data.fd;
+        event_t *ev = &events[n_events];
+
+        if (fd == loop->timer_fd) {
+            uint64_t expirations = 0;
+            // The timerfd is non-blocking, so a spurious wakeup just yields
+            // `EAGAIN`, in which case there is nothing to report.
+            if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+                continue;
+            }
+            ev->events = EVENT_TIMER;
+            ev->fd = -1;
+            ev->udata = loop->timer_udata;
+            ev->timer_expirations = expirations;
+            ev->result = 0;
+            ev->data = NULL;
+            n_events++;
+            continue;
+        }
+
+        if (fd == loop->notify_fd) {
+            uint64_t count;
+            // Reset the counter, so that the next notification triggers a new
+            // edge
+            (void)!read(fd, &count, sizeof(count));
+            ev->events = EVENT_NOTIFY;
+            ev->fd = -1;
+            ev->udata = NULL;
+            ev->timer_expirations = 0;
+            ev->result = 0;
+            ev->data = NULL;
+            n_events++;
+            continue;
+        }
+
+        op_reg_t *reg = find_reg(loop, fd);
+        if (!reg) {
+            continue;
+        }
+
+        if (reg->events & (EVENT_ACCEPT | EVENT_RECV)) {
+            // Errors surface in the next accept, receive or send
+            if (epev->events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
+                ops_readable(&loop->ops, reg);
+            }
+            if (epev->events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+                ops_writable(&loop->ops, reg);
+            }
+            continue;
+        }
+
+        ev->events = 0;
+        if (epev->events & (EPOLLIN | EPOLLRDHUP)) ev->events |= EVENT_READ;
+        if (epev->events & EPOLLOUT) ev->events |= EVENT_WRITE;
+        if (epev->events & (EPOLLERR | EPOLLHUP)) ev->events |= EVENT_READ | EVENT_ERROR;
+        ev->fd = fd;
+        ev->udata = reg->udata;
+        ev->timer_expirations = 0;
+        ev->result = 0;
+        ev->data = NULL;
+        n_events++;
+    }
+
+    n_events += ops_run(&loop->ops, events + n_events, max_events - n_events);
+
+    return n_events;
+}
@@ -0,0 +1,228 @@
+#include "event_loop.h"
+#include "event_loop_ops.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/event.h>
+#include <sys/time.h>
+
+#define TIMER_IDENT ((uintptr_t)-1)
+#define NOTIFY_IDENT ((uintptr_t)-2)
+
+struct event_loop_t {
+    int kq;
+    void *timer_udata;
+    struct kevent *kevents;
+    int kevents_capacity;
+    // The registrations are also the udata of their kevents, this table is
+    // only needed to find them by fd
+    op_reg_t **regs_by_fd;
+    int regs_capacity;
+    ops_t ops;
+};
+
+static int ensure_regs_capacity(event_loop_t *loop, int fd) {
+    if (fd < loop->regs_capacity) {
+        return 0;
+    }
+
+    int new_capacity = loop->regs_capacity ? loop->regs_capacity : 64;
+    while (new_capacity <= fd) {
+        new_capacity *= 2;
+    }
+
+    op_reg_t **regs_by_fd = realloc(loop->regs_by_fd, new_capacity * sizeof(op_reg_t *));
+    if (!regs_by_fd) {
+        return -1;
+    }
+    memset(regs_by_fd + loop->regs_capacity, 0, (new_capacity - loop->regs_capacity) * sizeof(op_reg_t *));
+    loop->regs_by_fd = regs_by_fd;
+    loop->regs_capacity = new_capacity;
+    return 0;
+}
+
+static op_reg_t *find_reg(event_loop_t *loop, int fd) {
+    return fd >= 0 && fd < loop->regs_capacity ? loop->regs_by_fd[fd] : NULL;
+}
+
+event_loop_t *event_loop_new(void) {
+    int kq = kqueue();
+    if (kq == -1) {
+        return NULL;
+    }
+
+    struct kevent change;
+    EV_SET(&change, NOTIFY_IDENT, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, NULL);
+    if (kevent(kq, &change, 1, NULL, 0, NULL) == -1) {
+        close(kq);
+        return NULL;
+    }
+
+    event_loop_t *loop = calloc(1, sizeof(event_loop_t));
+    loop->kq = kq;
+    return loop;
+}
+
+void event_loop_free(event_loop_t *loop) {
+    close(loop->kq);
+    for (int fd = 0; fd < loop->regs_capacity; fd++) {
+        free(loop->regs_by_fd[fd]);
+    }
+    ops_free(&loop->ops);
+    free(loop->regs_by_fd);
+    free(loop->kevents);
+    free(loop);
+}
+
+int event_loop_add(event_loop_t *loop, int fd, int events, void *udata) {
+    struct kevent changes[2];
+    int n_changes = 0;
+
+    if (ensure_regs_capacity(loop, fd) == -1) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (loop->regs_by_fd[fd]) {
+        errno = EEXIST;
+        return -1;
+    }
+    op_reg_t *reg = ops_reg_new(fd, events, udata);
+
+    // `EV_CLEAR` gives us the same edge-triggered semantics as `EPOLLET`
+    if (events & (EVENT_READ | EVENT_ACCEPT | EVENT_RECV)) {
+        EV_SET(&changes[n_changes++], fd, EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, reg);
+    }
+    if (events & (EVENT_WRITE | EVENT_RECV)) {
+        EV_SET(&changes[n_changes++], fd, EVFILT_WRITE, EV_ADD | EV_CLEAR, 0, 0, reg);
+    }
+
+    if (kevent(loop->kq, changes, n_changes, NULL, 0, NULL) == -1) {
+        free(reg);
+        return -1;
+    }
+    loop->regs_by_fd[fd] = reg;
+    return 0;
+}
+
+int event_loop_remove(event_loop_t *loop, int fd) {
+    struct kevent changes[2];
+    op_reg_t *reg = find_reg(loop, fd);
+
+    if (reg) {
+        loop->regs_by_fd[fd] = NULL;
+        ops_remove(&loop->ops, reg);
+    }
+
+    // Deleting a filter that was never added fails with `ENOENT`, so delete
+    // the filters one by one and ignore that.
+    EV_SET(&changes[0], fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+    EV_SET(&changes[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+    kevent(loop->kq, &changes[0], 1, NULL, 0, NULL);
+    kevent(loop->kq, &changes[1], 1, NULL, 0, NULL);
+    return 0;
+}
+
+int event_loop_send(event_loop_t *loop, int fd, const struct iovec *iov, int iov_count) {
+    op_reg_t *reg = find_reg(loop, fd);
+    if (!reg) {
+        errno = ENOENT;
+        return -1;
+    }
+    return ops_send(&loop->ops, reg, iov, iov_count);
+}
+
+int event_loop_set_timer(event_loop_t *loop, long interval_nsec, void *udata) {
+    struct kevent change;
+
+    loop->timer_udata = udata;
+    EV_SET(&change, TIMER_IDENT, EVFILT_TIMER, EV_ADD, NOTE_NSECONDS | NOTE_CRITICAL, interval_nsec, udata);
+    return kevent(loop->kq, &change, 1, NULL, 0, NULL);
+}
+
+int event_loop_notify(event_loop_t *loop) {
+    struct kevent change;
+
+    EV_SET(&change, NOTIFY_IDENT, EVFILT_USER, 0, NOTE_TRIGGER, 0, NULL);
+    return kevent(loop->kq, &change, 1, NULL, 0, NULL);
+}
+
+int event_loop_wait(event_loop_t *loop, event_t *events, int max_events, int timeout_msec) {
+    struct timespec timeout, *timeout_ptr = NULL;
+    int event_count, n_events = 0;
+
+    if (max_events > loop->kevents_capacity) {
+        free(loop->kevents);
+        loop->kevents = malloc(max_events * sizeof(struct kevent));
+        loop->kevents_capacity = max_events;
+    }
+
+    ops_begin_wait(&loop->ops);
+    // Registrations with work left don't get another edge
+    if (loop->ops.ready_head) {
+        timeout_msec = 0;
+    }
+
+    if (timeout_msec >= 0) {
+        timeout.tv_sec = timeout_msec / 1000;
+        timeout.tv_nsec = (timeout_msec % 1000) * 1000000L;
+        timeout_ptr = &timeout;
+    }
+
+    event_count = kevent(loop->kq, NULL, 0, loop->kevents, max_events, timeout_ptr);
+    if (event_count < 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < event_count; i++) {
+        struct kevent *kev = &loop->kevents[i];
+        event_t *ev = &events[n_events];
+
+        ev->fd = (int)kev->ident;
+        ev->udata = kev->udata;
+        ev->timer_expirations = 0;
+        ev->result = 0;
+        ev->data = NULL;
+
+        if (kev->filter == EVFILT_USER) {
+            ev->events = EVENT_NOTIFY;
+            ev->fd = -1;
+            n_events++;
+            continue;
+        } else if (kev->filter == EVFILT_TIMER) {
+            ev->events = EVENT_TIMER;
+            ev->fd = -1;
+            ev->timer_expirations = kev->data;
+            n_events++;
+            continue;
+        }
+
+        op_reg_t *reg = kev->udata;
+        if (reg->events & (EVENT_ACCEPT | EVENT_RECV)) {
+            // Errors surface in the next accept, receive or send
+            if (kev->filter == EVFILT_WRITE) {
+                ops_writable(&loop->ops, reg);
+            } else {
+                ops_readable(&loop->ops, reg);
+            }
+            continue;
+        }
+
+        ev->udata = reg->udata;
+        if (kev->filter == EVFILT_WRITE) {
+            ev->events = EVENT_WRITE;
+        } else {
+            ev->events = EVENT_READ;
+        }
+
+        if (kev->flags & (EV_EOF | EV_ERROR)) {
+            ev->events |= EVENT_ERROR;
+        }
+        n_events++;
+    }
+
+    n_events += ops_run(&loop->ops, events + n_events, max_events - n_events);
+
+    return n_events;
+}
@@ -0,0 +1,300 @@
+#ifndef EVENT_LOOP_OPS_H
+#define EVENT_LOOP_OPS_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#include "event_loop.h"
+#include "networking.h"
+
+/*
+ * Completions on top of readiness notifications, shared by the epoll and
+ * kqueue backends. The backend marks a registration readable or writable when
+ * its socket becomes so, and `ops_run` then accepts, receives and sends with
+ * one syscall each until the socket would block, and reports the results.
+ *
+ * Registrations with work left are kept on a ready list, so work that didn't
+ * fit into one wait (because the events or the receive pool ran out) is picked
+ * up by the next one without waiting for another edge.
+ */
+
+// Bytes that the receives of one wait can take up. The received bytes stay
+// valid until the next wait, so the pool is only reset then.
+#define OPS_RECV_POOL_LEN (256 * 1024)
+// Bytes that one receive takes up at most
+#define OPS_RECV_LEN 4096
+
+typedef struct op_reg_t {
+    int fd;
+    int events;
+    void *udata;
+    bool readable;
+    bool writable;
+    // Set once a receive reported the end of the stream or an error
+    bool recv_done;
+    bool sending;
+    // Set when the pending send finished, until it is reported
+    bool send_completed;
+    int send_result;
+    struct msghdr send_msg;
+    // Set when the fd was removed. The registration is only kept until its
+    // pending send is reported.
+    bool removed;
+    bool ready;
+    struct op_reg_t *prev_ready;
+    struct op_reg_t *next_ready;
+} op_reg_t;
+
+typedef struct ops_t {
+    op_reg_t *ready_head;
+    op_reg_t *ready_tail;
+    uint8_t *recv_pool;
+    int recv_pool_used;
+} ops_t;
+
+static op_reg_t *ops_reg_new(int fd, int events, void *udata) {
+    op_reg_t *reg = calloc(1, sizeof(op_reg_t));
+    reg->fd = fd;
+    reg->events = events;
+    reg->udata = udata;
+    return reg;
+}
+
+static void ops_mark_ready(ops_t *ops, op_reg_t *reg) {
+    if (reg->ready) {
+        return;
+    }
+    reg->ready = true;
+    reg->prev_ready = ops->ready_tail;
+    reg->next_ready = NULL;
+    if (ops->ready_tail) {
+        ops->ready_tail->next_ready = reg;
+    } else {
+        ops->ready_head = reg;
+    }
+    ops->ready_tail = reg;
+}
+
+static void ops_unmark_ready(ops_t *ops, op_reg_t *reg) {
+    if (!reg->ready) {
+        return;
+    }
+    reg->ready = false;
+    if (reg->prev_ready) {
+        reg->prev_ready->next_ready = reg->next_ready;
+    } else {
+        ops->ready_head = reg->next_ready;
+    }
+    if (reg->next_ready) {
+        reg->next_ready->prev_ready = reg->prev_ready;
+    } else {
+        ops->ready_tail = reg->prev_ready;
+    }
+}
+
+static void ops_free(ops_t *ops) {
+    // Registrations that weren't removed are freed by the backend
+    op_reg_t *reg = ops->ready_head;
+    while (reg) {
+        op_reg_t *next = reg->next_ready;
+        if (reg->removed) {
+            free(reg);
+        }
+        reg = next;
+    }
+    free(ops->recv_pool);
+}
+
+static void ops_readable(ops_t *ops, op_reg_t *reg) {
+    reg->readable = true;
+    ops_mark_ready(ops, reg);
+}
+
+static void ops_writable(ops_t *ops, op_reg_t *reg) {
+    reg->writable = true;
+    if (reg->sending) {
+        ops_mark_ready(ops, reg);
+    }
+}
+
+static void ops_try_send(op_reg_t *reg) {
+    ssize_t sent;
+
+    do {
+        sent = sendmsg(reg->fd, &reg->send_msg, 0);
+    } while (sent == -1 && errno == EINTR);
+
+    if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        // Retried on the next edge
+        reg->writable = false;
+        return;
+    }
+    reg->send_completed = true;
+    reg->send_result = sent == -1 ? -errno : (int)sent;
+}
+
+static int ops_send(ops_t *ops, op_reg_t *reg, const struct iovec *iov, int iov_count) {
+    if (!(reg->events & EVENT_RECV)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (reg->sending) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    reg->sending = true;
+    reg->send_msg = (struct msghdr){
+        .msg_iov = (struct iovec *)iov,
+        .msg_iovlen = iov_count,
+    };
+    // There is nothing to batch the send with, so it goes out right away
+    ops_try_send(reg);
+    if (reg->send_completed) {
+        ops_mark_ready(ops, reg);
+    }
+    return 0;
+}
+
+/*
+ * Frees the registration, unless its pending send still has to be reported.
+ */
+static void ops_remove(ops_t *ops, op_reg_t *reg) {
+    reg->removed = true;
+    if (reg->sending) {
+        if (!reg->send_completed) {
+            reg->send_completed = true;
+            reg->send_result = -ECANCELED;
+        }
+        ops_mark_ready(ops, reg);
+        return;
+    }
+    ops_unmark_ready(ops, reg);
+    free(reg);
+}
+
+/*
+ * Has to be called at the start of every wait, since it invalidates the bytes
+ * of earlier receives.
+ */
+static void ops_begin_wait(ops_t *ops) {
+    ops->recv_pool_used = 0;
+}
+
+static bool ops_has_work(op_reg_t *reg) {
+    if (reg->sending && (reg->send_completed || reg->writable)) {
+        return true;
+    }
+    if (reg->removed || !reg->readable) {
+        return false;
+    }
+    return (reg->events & EVENT_ACCEPT) || ((reg->events & EVENT_RECV) && !reg->recv_done);
+}
+
+static void ops_report(event_t *ev, int events, op_reg_t *reg, int result, uint8_t *data) {
+    ev->events = events;
+    ev->fd = reg->fd;
+    ev->udata = reg->udata;
+    ev->timer_expirations = 0;
+    ev->result = result;
+    ev->data = data;
+}
+
+/*
+ * Performs the work of one registration until its socket would block, and
+ * stores at most `max_events` events.
+ *
+ * Returns the number of events.
+ */
+static int ops_run_reg(ops_t *ops, op_reg_t *reg, event_t *events, int max_events) {
+    int n_events = 0;
+
+    if (reg->sending && !reg->send_completed && reg->writable) {
+        ops_try_send(reg);
+    }
+    if (reg->send_completed && n_events < max_events) {
+        ops_report(&events[n_events++], EVENT_SEND, reg, reg->send_result, NULL);
+        reg->sending = false;
+        reg->send_completed = false;
+    }
+
+    while (!reg->removed && reg->readable && n_events < max_events) {
+        if (reg->events & EVENT_ACCEPT) {
+            int sock = accept_nonblocking(reg->fd);
+            if (sock == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                // Also on errors, since the socket is edge-triggered and
+                // the next connection triggers a new edge
+                reg->readable = false;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    ops_report(&events[n_events++], EVENT_ACCEPT, reg, -errno, NULL);
+                }
+                break;
+            }
+            ops_report(&events[n_events++], EVENT_ACCEPT, reg, sock, NULL);
+        } else if ((reg->events & EVENT_RECV) && !reg->recv_done) {
+            if (OPS_RECV_POOL_LEN - ops->recv_pool_used < OPS_RECV_LEN) {
+                // Continued in the next wait, when the pool is free again
+                break;
+            }
+            uint8_t *data = ops->recv_pool + ops->recv_pool_used;
+            ssize_t received = recv(reg->fd, data, OPS_RECV_LEN, 0);
+            if (received == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    reg->readable = false;
+                    break;
+                }
+                reg->recv_done = true;
+                ops_report(&events[n_events++], EVENT_RECV, reg, -errno, NULL);
+                break;
+            }
+            ops->recv_pool_used += received;
+            ops_report(&events[n_events++], EVENT_RECV, reg, (int)received, data);
+            if (received == 0) {
+                reg->recv_done = true;
+            }
+        } else {
+            reg->readable = false;
+        }
+    }
+
+    return n_events;
+}
+
+/*
+ * Performs the work of the ready registrations and stores at most
+ * `max_events` events.
+ *
+ * Returns the number of events.
+ */
+static int ops_run(ops_t *ops, event_t *events, int max_events) {
+    int n_events = 0;
+    op_reg_t *reg = ops->ready_head;
+
+    if (reg && !ops->recv_pool) {
+        ops->recv_pool = malloc(OPS_RECV_POOL_LEN);
+    }
+
+    while (reg && n_events < max_events) {
+        op_reg_t *next = reg->next_ready;
+        n_events += ops_run_reg(ops, reg, events + n_events, max_events - n_events);
+        if (!ops_has_work(reg)) {
+            ops_unmark_ready(ops, reg);
+            if (reg->removed && !reg->sending) {
+                free(reg);
+            }
+        }
+        reg = next;
+    }
+
+    return n_events;
+}
+
+#endif // EVENT_LOOP_OPS_H
@@ -0,0 +1,932 @@
+// For `POLLRDHUP`
+#define _GNU_SOURCE
+
+#include "event_loop.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <time.h>
+
+/*
+ * io_uring backend, written directly against the kernel ABI to not pull in
+ * liburing as a dependency.
+ *
+ * Fds that are registered for readiness get a multishot `IORING_OP_POLL_ADD`
+ * request, which posts one completion per readiness change (the equivalent of
+ * `EPOLLET`). Listening sockets registered with `EVENT_ACCEPT` get a multishot
+ * `IORING_OP_ACCEPT`, and sockets registered with `EVENT_RECV` a multishot
+ * `IORING_OP_RECV` that receives into buffers the kernel picks from a
+ * registered buffer ring (Linux 6.0). Sends are `IORING_OP_SENDMSG` requests,
+ * which wait for room in the socket buffer in the kernel.
+ *
+ * All requests are only queued as SQEs and submitted together with the next
+ * wait, so one loop iteration costs a single `io_uring_enter` no matter how
+ * many fds were added or removed and how many sends were queued.
+ */
+
+#define RING_ENTRIES 4096
+// Buffers of the buffer ring that multishot receives pick from. Received bytes
+// stay valid until the next wait, so at most this many receives can be
+// reported per wait. A receive that finds no buffer is re-armed and picks up
+// the bytes in the next wait.
+#define RECV_BUFFER_COUNT 4096
+#define RECV_BUFFER_LEN 512
+#define RECV_BUFFER_GROUP 0
+
+// The request a completion belongs to is stored in the low bits of its user
+// data, next to the registration, which is at least 8-byte aligned
+#define OP_POLL 0
+#define OP_ACCEPT 1
+#define OP_RECV 2
+#define OP_SEND 3
+#define OP_MASK 3
+
+// Accepts that failed because the process ran out of fds or memory are only
+// re-armed after this long, since until then they would fail right away again
+#define ACCEPT_BACKOFF_MSEC 100
+// Re-arms that found the submission queue full are retried after this long
+#define REARM_RETRY_MSEC 1
+
+typedef struct registration_t {
+    int fd;
+    int events;
+    void *udata;
+    bool is_timer;
+    bool is_notify;
+    // Requests of the registration whose final completion is still due
+    int pending_requests;
+    bool sending;
+    struct msghdr send_msg;
+    // Set when the fd was removed. The registration is freed once the kernel
+    // posted the final completions of all its requests; until then it is on
+    // the loop's list of removed registrations.
+    bool removed;
+    struct registration_t *prev_removed;
+    struct registration_t *next_removed;
+    // Set while the multishot request that the kernel terminated still has to
+    // be re-armed, which a wait retries once `rearm_at_nsec` has passed. Until
+    // then the registration is on the loop's re-arm list.
+    bool rearm_queued;
+    long long rearm_at_nsec;
+    struct registration_t *prev_rearm;
+    struct registration_t *next_rearm;
+} registration_t;
+
+struct event_loop_t {
+    int ring_fd;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    _Atomic unsigned *sq_head;
+    _Atomic unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    // Tail of the SQEs that were prepared, but not yet published to the kernel
+    unsigned sq_local_tail;
+
+    _Atomic unsigned *cq_head;
+    _Atomic unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    registration_t **regs_by_fd;
+    int regs_capacity;
+    registration_t *timer_reg;
+    registration_t *notify_reg;
+    // Removed registrations whose requests haven't completed yet
+    registration_t *removed_regs;
+    registration_t *rearm_regs;
+
+    // Only set up once a socket is registered with `EVENT_RECV`
+    struct io_uring_buf_ring *buf_ring;
+    uint16_t buf_ring_tail;
+    uint8_t *recv_buffers;
+    // Buffers that were reported since the last wait, which returns them to
+    // the ring
+    uint16_t *used_buffers;
+    int used_buffer_count;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+                              void *arg, size_t arg_size) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static unsigned pending_submissions(event_loop_t *loop) {
+    return loop->sq_local_tail - atomic_load_explicit(loop->sq_tail, memory_order_relaxed);
+}
+
+static void publish_submissions(event_loop_t *loop) {
+    atomic_store_explicit(loop->sq_tail, loop->sq_local_tail, memory_order_release);
+}
+
+static int submit(event_loop_t *loop, unsigned min_complete, unsigned flags, void *arg, size_t arg_size) {
+    unsigned to_submit;
+    int ret;
+
+    publish_submissions(loop);
+    to_submit = loop->sq_local_tail - atomic_load_explicit(loop->sq_head, memory_order_acquire);
+
+    do {
+        ret = sys_io_uring_enter(loop->ring_fd, to_submit, min_complete, flags, arg, arg_size);
+    } while (ret == -1 && errno == EINTR && min_complete == 0);
+
+    return ret;
+}
+
+static struct io_uring_sqe *get_sqe(event_loop_t *loop) {
+    unsigned head = atomic_load_explicit(loop->sq_head, memory_order_acquire);
+
+    if (loop->sq_local_tail - head >= loop->sq_entries) {
+        // The submission queue is full, so flush it to the kernel first
+        if (submit(loop, 0, 0, NULL, 0) == -1) {
+            return NULL;
+        }
+        head = atomic_load_explicit(loop->sq_head, memory_order_acquire);
+        if (loop->sq_local_tail - head >= loop->sq_entries) {
+            errno = EBUSY;
+            return NULL;
+        }
+    }
+
+    unsigned idx = loop->sq_local_tail & *loop->sq_mask;
+    struct io_uring_sqe *sqe = &loop->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    loop->sq_array[idx] = idx;
+    loop->sq_local_tail++;
+    return sqe;
+}
+
+static uint64_t request_user_data(registration_t *reg, int op) {
+    return (uint64_t)(uintptr_t)reg | op;
+}
+
+static int queue_poll_add(event_loop_t *loop, registration_t *reg) {
+    struct io_uring_sqe *sqe = get_sqe(loop);
+    if (!sqe) {
+        return -1;
+    }
+
+    uint32_t poll_mask = 0;
+    if (reg->events & EVENT_READ) poll_mask |= POLLIN | POLLRDHUP;
+    if (reg->events & EVENT_WRITE) poll_mask |= POLLOUT;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = reg->fd;
+    sqe->poll32_events = poll_mask;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = request_user_data(reg, OP_POLL);
+    reg->pending_requests++;
+    return 0;
+}
+
+static int queue_accept(event_loop_t *loop, registration_t *reg) {
+    struct io_uring_sqe *sqe = get_sqe(loop);
+    if (!sqe) {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = reg->fd;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = request_user_data(reg, OP_ACCEPT);
+    reg->pending_requests++;
+    return 0;
+}
+
+static int queue_recv(event_loop_t *loop, registration_t *reg) {
+    struct io_uring_sqe *sqe = get_sqe(loop);
+    if (!sqe) {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = reg->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RECV_BUFFER_GROUP;
+    sqe->user_data = request_user_data(reg, OP_RECV);
+    reg->pending_requests++;
+    return 0;
+}
+
+/*
+ * Queues the multishot request that produces the events of `reg`.
+ */
+static int queue_multishot(event_loop_t *loop, registration_t *reg) {
+    if (reg->events & EVENT_ACCEPT) {
+        return queue_accept(loop, reg);
+    }
+    if (reg->events & EVENT_RECV) {
+        return queue_recv(loop, reg);
+    }
+    return queue_poll_add(loop, reg);
+}
+
+static int queue_send(event_loop_t *loop, registration_t *reg) {
+    struct io_uring_sqe *sqe = get_sqe(loop);
+    if (!sqe) {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = reg->fd;
+    sqe->addr = (uint64_t)(uintptr_t)&reg->send_msg;
+    sqe->len = 1;
+    sqe->user_data = request_user_data(reg, OP_SEND);
+    reg->pending_requests++;
+    return 0;
+}
+
+static int queue_poll_remove(event_loop_t *loop, registration_t *reg) {
+    struct io_uring_sqe *sqe = get_sqe(loop);
+    if (!sqe) {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = request_user_data(reg, OP_POLL);
+    // Completions with a user data of 0 are ignored
+    sqe->user_data = 0;
+    return 0;
+}
+
+static int queue_cancel(event_loop_t *loop, registration_t *reg, int op) {
+    struct io_uring_sqe *sqe = get_sqe(loop);
+    if (!sqe) {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = request_user_data(reg, op);
+    sqe->user_data = 0;
+    return 0;
+}
+
+/*
+ * Turns the requests of `reg` that were queued, but not yet submitted, into
+ * no-ops. They refer to the fd by number, which the caller is about to close
+ * and which might be reused by the time they are submitted. The no-ops still
+ * complete with the user data of the request.
+ */
+static void neutralize_queued_requests(event_loop_t *loop, registration_t *reg) {
+    unsigned tail = atomic_load_explicit(loop->sq_tail, memory_order_relaxed);
+
+    for (; tail != loop->sq_local_tail; tail++) {
+        struct io_uring_sqe *sqe = &loop->sqes[tail & *loop->sq_mask];
+        if ((sqe->user_data & ~(uint64_t)OP_MASK) == (uint64_t)(uintptr_t)reg) {
+            uint64_t user_data = sqe->user_data;
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_NOP;
+            sqe->user_data = user_data;
+        }
+    }
+}
+
+static void provide_buffer(event_loop_t *loop, uint16_t bid) {
+    struct io_uring_buf *buf = &loop->buf_ring->bufs[loop->buf_ring_tail & (RECV_BUFFER_COUNT - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(loop->recv_buffers + bid * RECV_BUFFER_LEN);
+    buf->len = RECV_BUFFER_LEN;
+    buf->bid = bid;
+    loop->buf_ring_tail++;
+}
+
+static void publish_buffers(event_loop_t *loop) {
+    atomic_store_explicit((_Atomic uint16_t *)&loop->buf_ring->tail, loop->buf_ring_tail, memory_order_release);
+}
+
+static int setup_buf_ring(event_loop_t *loop) {
+    size_t ring_size = RECV_BUFFER_COUNT * sizeof(struct io_uring_buf);
+    struct io_uring_buf_ring *buf_ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE,
+                                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf_ring == MAP_FAILED) {
+        return -1;
+    }
+
+    struct io_uring_buf_reg buf_reg = {
+        .ring_addr = (uint64_t)(uintptr_t)buf_ring,
+        .ring_entries = RECV_BUFFER_COUNT,
+        .bgid = RECV_BUFFER_GROUP,
+    };
+    if (sys_io_uring_register(loop->ring_fd, IORING_REGISTER_PBUF_RING, &buf_reg, 1) == -1) {
+        int saved_errno = errno;
+        munmap(buf_ring, ring_size);
+        errno = saved_errno;
+        return -1;
+    }
+
+    loop->buf_ring = buf_ring;
+    loop->buf_ring_tail = 0;
+    loop->recv_buffers = malloc(RECV_BUFFER_COUNT * RECV_BUFFER_LEN);
+    loop->used_buffers = malloc(RECV_BUFFER_COUNT * sizeof(uint16_t));
+    loop->used_buffer_count = 0;
+    for (int bid = 0; bid < RECV_BUFFER_COUNT; bid++) {
+        provide_buffer(loop, bid);
+    }
+    publish_buffers(loop);
+    return 0;
+}
+
+/*
+ * Hands the buffers of the receives reported by the last wait back to the
+ * kernel.
+ */
+static void recycle_buffers(event_loop_t *loop) {
+    if (loop->used_buffer_count == 0) {
+        return;
+    }
+    for (int i = 0; i < loop->used_buffer_count; i++) {
+        provide_buffer(loop, loop->used_buffers[i]);
+    }
+    loop->used_buffer_count = 0;
+    publish_buffers(loop);
+}
+
+static void unlink_removed(event_loop_t *loop, registration_t *reg) {
+    if (reg->prev_removed) {
+        reg->prev_removed->next_removed = reg->next_removed;
+    } else {
+        loop->removed_regs = reg->next_removed;
+    }
+    if (reg->next_removed) {
+        reg->next_removed->prev_removed = reg->prev_removed;
+    }
+}
+
+static long long now_nsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void unlink_rearm(event_loop_t *loop, registration_t *reg) {
+    if (reg->prev_rearm) {
+        reg->prev_rearm->next_rearm = reg->next_rearm;
+    } else {
+        loop->rearm_regs = reg->next_rearm;
+    }
+    if (reg->next_rearm) {
+        reg->next_rearm->prev_rearm = reg->prev_rearm;
+    }
+    reg->rearm_queued = false;
+}
+
+/*
+ * Re-arms the multishot request of `reg` after the kernel terminated it. If
+ * that has to wait `delay_msec` or the submission queue is full, the
+ * registration goes on the re-arm list instead, since it would silently stop
+ * producing events otherwise.
+ */
+static void rearm(event_loop_t *loop, registration_t *reg, int delay_msec) {
+    if (delay_msec == 0) {
+        if (queue_multishot(loop, reg) == 0) {
+            return;
+        }
+        delay_msec = REARM_RETRY_MSEC;
+    }
+
+    reg->rearm_at_nsec = now_nsec() + delay_msec * 1000000LL;
+    if (!reg->rearm_queued) {
+        reg->rearm_queued = true;
+        reg->prev_rearm = NULL;
+        reg->next_rearm = loop->rearm_regs;
+        if (loop->rearm_regs) {
+            loop->rearm_regs->prev_rearm = reg;
+        }
+        loop->rearm_regs = reg;
+    }
+}
+
+/*
+ * Retries the re-arms that are due.
+ *
+ * Returns the milliseconds until the next retry, or -1 if none is left.
+ */
+static int retry_rearms(event_loop_t *loop) {
+    long long now = now_nsec(), next_nsec = -1;
+    registration_t *reg = loop->rearm_regs;
+
+    while (reg) {
+        registration_t *next = reg->next_rearm;
+        if (reg->rearm_at_nsec <= now) {
+            if (queue_multishot(loop, reg) == 0) {
+                unlink_rearm(loop, reg);
+                reg = next;
+                continue;
+            }
+            reg->rearm_at_nsec = now + REARM_RETRY_MSEC * 1000000LL;
+        }
+        if (next_nsec == -1 || reg->rearm_at_nsec < next_nsec) {
+            next_nsec = reg->rearm_at_nsec;
+        }
+        reg = next;
+    }
+
+    if (next_nsec == -1) {
+        return -1;
+    }
+    // Rounded up, so the wait doesn't time out just before the retry is due
+    return (int)((next_nsec - now + 999999) / 1000000);
+}
+
+static int ensure_regs_capacity(event_loop_t *loop, int fd) {
+    if (fd < loop->regs_capacity) {
+        return 0;
+    }
+
+    int new_capacity = loop->regs_capacity ? loop->regs_capacity : 64;
+    while (new_capacity <= fd) {
+        new_capacity *= 2;
+    }
+
+    registration_t **regs_by_fd = realloc(loop->regs_by_fd, new_capacity * sizeof(registration_t *));
+    if (!regs_by_fd) {
+        return -1;
+    }
+    memset(regs_by_fd + loop->regs_capacity, 0, (new_capacity - loop->regs_capacity) * sizeof(registration_t *));
+    loop->regs_by_fd = regs_by_fd;
+    loop->regs_capacity = new_capacity;
+    return 0;
+}
+
+event_loop_t *event_loop_new(void) {
+    struct io_uring_params params = {0};
+    event_loop_t *loop;
+    int ring_fd;
+
+    ring_fd = sys_io_uring_setup(RING_ENTRIES, &params);
+    if (ring_fd == -1) {
+        return NULL;
+    }
+
+    // We need `IORING_ENTER_EXT_ARG` for waits with a timeout (Linux 5.11)
+    if (!(params.features & IORING_FEAT_EXT_ARG)) {
+        close(ring_fd);
+        errno = ENOSYS;
+        return NULL;
+    }
+
+    loop = calloc(1, sizeof(event_loop_t));
+    loop->ring_fd = ring_fd;
+    loop->sq_entries = params.sq_entries;
+
+    loop->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    loop->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (loop->cq_ring_size > loop->sq_ring_size) {
+            loop->sq_ring_size = loop->cq_ring_size;
+        }
+        loop->cq_ring_size = loop->sq_ring_size;
+    }
+
+    loop->sq_ring = mmap(NULL, loop->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring_fd, IORING_OFF_SQ_RING);
+    if (loop->sq_ring == MAP_FAILED) {
+        goto fail;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        loop->cq_ring = loop->sq_ring;
+    } else {
+        loop->cq_ring = mmap(NULL, loop->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             ring_fd, IORING_OFF_CQ_RING);
+        if (loop->cq_ring == MAP_FAILED) {
+            goto fail;
+        }
+    }
+
+    loop->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    loop->sqes = mmap(NULL, loop->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring_fd, IORING_OFF_SQES);
+    if (loop->sqes == MAP_FAILED) {
+        goto fail;
+    }
+
+    loop->sq_head = (_Atomic unsigned *)((char *)loop->sq_ring + params.sq_off.head);
+    loop->sq_tail = (_Atomic unsigned *)((char *)loop->sq_ring + params.sq_off.tail);
+    loop->sq_mask = (unsigned *)((char *)loop->sq_ring + params.sq_off.ring_mask);
+    loop->sq_array = (unsigned *)((char *)loop->sq_ring + params.sq_off.array);
+    loop->sq_local_tail = atomic_load_explicit(loop->sq_tail, memory_order_relaxed);
+
+    loop->cq_head = (_Atomic unsigned *)((char *)loop->cq_ring + params.cq_off.head);
+    loop->cq_tail = (_Atomic unsigned *)((char *)loop->cq_ring + params.cq_off.tail);
+    loop->cq_mask = (unsigned *)((char *)loop->cq_ring + params.cq_off.ring_mask);
+    loop->cqes = (struct io_uring_cqe *)((char *)loop->cq_ring + params.cq_off.cqes);
+
+    // The eventfd is created up front, so that `event_loop_notify` never races
+    // with its creation
+    int notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (notify_fd == -1) {
+        goto fail;
+    }
+    loop->notify_reg = calloc(1, sizeof(registration_t));
+    loop->notify_reg->fd = notify_fd;
+    loop->notify_reg->events = EVENT_READ;
+    loop->notify_reg->is_notify = true;
+    if (queue_poll_add(loop, loop->notify_reg) == -1) {
+        close(notify_fd);
+        free(loop->notify_reg);
+        goto fail;
+    }
+
+    return loop;
+
+fail:
+    if (loop->sqes && loop->sqes != MAP_FAILED) {
+        munmap(loop->sqes, loop->sqes_size);
+    }
+    if (loop->sq_ring && loop->sq_ring != MAP_FAILED) {
+        munmap(loop->sq_ring, loop->sq_ring_size);
+    }
+    if (loop->cq_ring && loop->cq_ring != MAP_FAILED && loop->cq_ring != loop->sq_ring) {
+        munmap(loop->cq_ring, loop->cq_ring_size);
+    }
+    close(ring_fd);
+    free(loop);
+    return NULL;
+}
+
+void event_loop_free(event_loop_t *loop) {
+    // Closing the ring cancels all outstanding poll requests, so the
+    // registrations can be freed right away
+    for (int fd = 0; fd < loop->regs_capacity; fd++) {
+        free(loop->regs_by_fd[fd]);
+    }
+    while (loop->removed_regs) {
+        registration_t *next = loop->removed_regs->next_removed;
+        free(loop->removed_regs);
+        loop->removed_regs = next;
+    }
+    if (loop->timer_reg) {
+        close(loop->timer_reg->fd);
+        free(loop->timer_reg);
+    }
+    close(loop->notify_reg->fd);
+    free(loop->notify_reg);
+
+    munmap(loop->sqes, loop->sqes_size);
+    if (loop->cq_ring != loop->sq_ring) {
+        munmap(loop->cq_ring, loop->cq_ring_size);
+    }
+    munmap(loop->sq_ring, loop->sq_ring_size);
+    close(loop->ring_fd);
+    if (loop->buf_ring) {
+        munmap(loop->buf_ring, RECV_BUFFER_COUNT * sizeof(struct io_uring_buf));
+        free(loop->recv_buffers);
+        free(loop->used_buffers);
+    }
+    free(loop->regs_by_fd);
+    free(loop);
+}
+
+int event_loop_add(event_loop_t *loop, int fd, int events, void *udata) {
+    if (ensure_regs_capacity(loop, fd) == -1) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (loop->regs_by_fd[fd]) {
+        errno = EEXIST;
+        return -1;
+    }
+
+    if ((events & EVENT_RECV) && !loop->buf_ring && setup_buf_ring(loop) == -1) {
+        return -1;
+    }
+
+    registration_t *reg = calloc(1, sizeof(registration_t));
+    reg->fd = fd;
+    reg->events = events;
+    reg->udata = udata;
+
+    if (queue_multishot(loop, reg) == -1) {
+        free(reg);
+        return -1;
+    }
+    loop->regs_by_fd[fd] = reg;
+    return 0;
+}
+
+int event_loop_remove(event_loop_t *loop, int fd) {
+    if (fd >= loop->regs_capacity || !loop->regs_by_fd[fd]) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    registration_t *reg = loop->regs_by_fd[fd];
+    loop->regs_by_fd[fd] = NULL;
+    if (reg->rearm_queued) {
+        unlink_rearm(loop, reg);
+    }
+    if (reg->pending_requests == 0) {
+        // E.g. a receive that reported the end of the stream
+        free(reg);
+        return 0;
+    }
+
+    reg->removed = true;
+    reg->next_removed = loop->removed_regs;
+    if (loop->removed_regs) {
+        loop->removed_regs->prev_removed = reg;
+    }
+    loop->removed_regs = reg;
+
+    neutralize_queued_requests(loop, reg);
+    // Cancelling requests that already completed or were neutralized just
+    // fails with `ENOENT`
+    if (reg->events & EVENT_ACCEPT) {
+        return queue_cancel(loop, reg, OP_ACCEPT);
+    }
+    if (reg->events & EVENT_RECV) {
+        if (queue_cancel(loop, reg, OP_RECV) == -1) {
+            return -1;
+        }
+        return reg->sending ? queue_cancel(loop, reg, OP_SEND) : 0;
+    }
+    return queue_poll_remove(loop, reg);
+}
+
+int event_loop_send(event_loop_t *loop, int fd, const struct iovec *iov, int iov_count) {
+    if (fd < 0 || fd >= loop->regs_capacity || !loop->regs_by_fd[fd]) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    registration_t *reg = loop->regs_by_fd[fd];
+    if (!(reg->events & EVENT_RECV)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (reg->sending) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    reg->send_msg = (struct msghdr){
+        .msg_iov = (struct iovec *)iov,
+        .msg_iovlen = iov_count,
+    };
+    if (queue_send(loop, reg) == -1) {
+        return -1;
+    }
+    reg->sending = true;
+    return 0;
+}
+
+int event_loop_set_timer(event_loop_t *loop, long interval_nsec, void *udata) {
+    struct itimerspec spec = {0};
+
+    if (!loop->timer_reg) {
+        int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer_fd == -1) {
+            return -1;
+        }
+
+        registration_t *reg = calloc(1, sizeof(registration_t));
+        reg->fd = timer_fd;
+        reg->events = EVENT_READ;
+        reg->is_timer = true;
+        if (queue_poll_add(loop, reg) == -1) {
+            close(timer_fd);
+            free(reg);
+            return -1;
+        }
+        loop->timer_reg = reg;
+    }
+
+    spec.it_interval.tv_sec = interval_nsec / 1000000000L;
+    spec.it_interval.tv_nsec = interval_nsec % 1000000000L;
+    spec.it_value = spec.it_interval;
+    loop->timer_reg->udata = udata;
+
+    return timerfd_settime(loop->timer_reg->fd, 0, &spec, NULL);
+}
+
+int event_loop_notify(event_loop_t *loop) {
+    uint64_t one = 1;
+    if (write(loop->notify_reg->fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        return -1;
+    }
+    return 0;
+}
+
+static void report(event_t *ev, int events, registration_t *reg, int result, uint8_t *data) {
+    ev->events = events;
+    ev->fd = reg->fd;
+    ev->udata = reg->udata;
+    ev->timer_expirations = 0;
+    ev->result = result;
+    ev->data = data;
+}
+
+/*
+ * Turns a poll completion into an event. Returns false if there is nothing to
+ * report.
+ */
+static bool handle_poll(event_loop_t *loop, registration_t *reg, int res, bool more, event_t *ev) {
+    if (!more) {
+        // The kernel terminated the multishot request (e.g. on CQ overflow),
+        // so it has to be re-armed
+        rearm(loop, reg, 0);
+    }
+
+    if (res == -ECANCELED) {
+        return false;
+    }
+
+    if (reg->is_notify) {
+        uint64_t count;
+        (void)!read(reg->fd, &count, sizeof(count));
+        report(ev, EVENT_NOTIFY, reg, 0, NULL);
+        ev->fd = -1;
+        ev->udata = NULL;
+        return true;
+    }
+
+    if (reg->is_timer) {
+        uint64_t expirations = 0;
+        if (read(reg->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+            return false;
+        }
+        report(ev, EVENT_TIMER, reg, 0, NULL);
+        ev->fd = -1;
+        ev->timer_expirations = expirations;
+        return true;
+    }
+
+    int events = 0;
+    if (res < 0) {
+        events = EVENT_READ | EVENT_ERROR;
+    } else {
+        if (res & (POLLIN | POLLRDHUP)) events |= EVENT_READ;
+        if (res & POLLOUT) events |= EVENT_WRITE;
+        if (res & (POLLERR | POLLHUP)) events |= EVENT_READ | EVENT_ERROR;
+    }
+    report(ev, events, reg, 0, NULL);
+    return true;
+}
+
+/*
+ * Turns a receive completion into an event. Returns false if there is nothing
+ * to report.
+ */
+static bool handle_recv(event_loop_t *loop, registration_t *reg, struct io_uring_cqe *cqe, event_t *ev) {
+    bool more = cqe->flags & IORING_CQE_F_MORE;
+
+    if (cqe->res == -ENOBUFS) {
+        // The buffers of this wait are used up, the bytes stay in the socket
+        // until the receive is re-armed with the next wait
+        rearm(loop, reg, 0);
+        return false;
+    }
+    if (cqe->res <= 0) {
+        // The end of the stream or an error, which also ends the receive
+        report(ev, EVENT_RECV, reg, cqe->res, NULL);
+        return true;
+    }
+
+    uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    if (!more) {
+        rearm(loop, reg, 0);
+    }
+    report(ev, EVENT_RECV, reg, cqe->res, loop->recv_buffers + bid * RECV_BUFFER_LEN);
+    return true;
+}
+
+int event_loop_wait(event_loop_t *loop, event_t *events, int max_events, int timeout_msec) {
+    unsigned head, tail;
+    int n_events = 0;
+
+    // The bytes of the receives reported by the last wait are no longer used
+    recycle_buffers(loop);
+
+    int rearm_msec = retry_rearms(loop);
+    if (rearm_msec >= 0 && (timeout_msec < 0 || rearm_msec < timeout_msec)) {
+        timeout_msec = rearm_msec;
+    }
+
+    head = atomic_load_explicit(loop->cq_head, memory_order_relaxed);
+    tail = atomic_load_explicit(loop->cq_tail, memory_order_acquire);
+
+    if (head == tail && timeout_msec != 0) {
+        // Nothing is ready yet, so submit and wait in the same syscall
+        struct __kernel_timespec ts;
+        struct io_uring_getevents_arg arg = {0};
+        unsigned flags = IORING_ENTER_GETEVENTS;
+        int ret;
+
+        if (timeout_msec > 0) {
+            ts.tv_sec = timeout_msec / 1000;
+            ts.tv_nsec = (timeout_msec % 1000) * 1000000LL;
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+            flags |= IORING_ENTER_EXT_ARG;
+            ret = submit(loop, 1, flags, &arg, sizeof(arg));
+        } else {
+            ret = submit(loop, 1, flags, NULL, 0);
+        }
+        if (ret == -1 && errno != ETIME) {
+            return -1;
+        }
+    } else if (pending_submissions(loop) > 0 || head == tail) {
+        // Entering with `IORING_ENTER_GETEVENTS` also lets the kernel run
+        // pending task work, which might post more completions
+        if (submit(loop, 0, IORING_ENTER_GETEVENTS, NULL, 0) == -1) {
+            return -1;
+        }
+    }
+
+    tail = atomic_load_explicit(loop->cq_tail, memory_order_acquire);
+
+    while (head != tail && n_events < max_events) {
+        struct io_uring_cqe *cqe = &loop->cqes[head & *loop->cq_mask];
+        registration_t *reg = (registration_t *)(uintptr_t)(cqe->user_data & ~(uint64_t)OP_MASK);
+        int op = cqe->user_data & OP_MASK;
+        bool more = cqe->flags & IORING_CQE_F_MORE;
+        event_t *ev = &events[n_events];
+        head++;
+
+        if (!reg) {
+            continue;
+        }
+
+        if (!more) {
+            reg->pending_requests--;
+        }
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+            // Handed back to the kernel with the next wait
+            loop->used_buffers[loop->used_buffer_count++] = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        }
+
+        if (reg->removed) {
+            // Pending sends are reported anyway, so the caller knows when it
+            // can release the bytes
+            if (op == OP_SEND) {
+                reg->sending = false;
+                report(ev, EVENT_SEND, reg, cqe->res, NULL);
+                n_events++;
+            }
+            if (reg->pending_requests == 0) {
+                unlink_removed(loop, reg);
+                free(reg);
+            }
+            continue;
+        }
+
+        switch (op) {
+            case OP_POLL:
+                n_events += handle_poll(loop, reg, cqe->res, more, ev);
+                break;
+
+            case OP_ACCEPT:
+                if (!more) {
+                    bool out_of_resources = cqe->res == -EMFILE || cqe->res == -ENFILE || cqe->res == -ENOBUFS ||
+                                            cqe->res == -ENOMEM;
+                    rearm(loop, reg, out_of_resources ? ACCEPT_BACKOFF_MSEC : 0);
+                }
+                report(ev, EVENT_ACCEPT, reg, cqe->res, NULL);
+                n_events++;
+                break;
+
+            case OP_RECV:
+                n_events += handle_recv(loop, reg, cqe, ev);
+                break;
+
+            case OP_SEND:
+                reg->sending = false;
+                report(ev, EVENT_SEND, reg, cqe->res, NULL);
+                n_events++;
+                break;
+        }
+    }
+
+    atomic_store_explicit(loop->cq_head, head, memory_order_release);
+
+    return n_events;
+}
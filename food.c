@@ -0,0 +1,109 @@
+#include "food.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+void food_grid_init(food_grid_t *grid, float width, float height, float cell_size) {
+    memset(grid, 0, sizeof(food_grid_t));
+    grid->cell_size = cell_size;
+    grid->cols = ceilf(width / cell_size);
+    grid->rows = ceilf(height / cell_size);
+    grid->cells = calloc(grid->cols * grid->rows, sizeof(food_cell_t));
+    grid->next_id = 1;
+}
+
+void food_grid_free(food_grid_t *grid) {
+    for (int i = 0; i < grid->cols * grid->rows; i++) {
+        free(grid->cells[i].foods);
+    }
+    free(grid->cells);
+    free(grid->spawned);
+    free(grid->eaten);
+}
+
+static int clamp_cell(int cell, int max) {
+    if (cell < 0) {
+        return 0;
+    }
+    if (cell >= max) {
+        return max - 1;
+    }
+    return cell;
+}
+
+uint32_t food_spawn(food_grid_t *grid, float x, float y) {
+    int col = clamp_cell(x / grid->cell_size, grid->cols);
+    int row = clamp_cell(y / grid->cell_size, grid->rows);
+    food_cell_t *cell = &grid->cells[row * grid->cols + col];
+    food_position_t food = {.food_id = grid->next_id++, .x = x, .y = y};
+
+    if (cell->count == cell->capacity) {
+        cell->capacity = cell->capacity ? cell->capacity * 2 : 8;
+        cell->foods = realloc(cell->foods, cell->capacity * sizeof(food_position_t));
+    }
+    cell->foods[cell->count++] = food;
+    grid->count++;
+
+    if (grid->spawned_count == grid->spawned_capacity) {
+        grid->spawned_capacity = grid->spawned_capacity ? grid->spawned_capacity * 2 : 64;
+        grid->spawned = realloc(grid->spawned, grid->spawned_capacity * sizeof(food_position_t));
+    }
+    grid->spawned[grid->spawned_count++] = food;
+
+    return food.food_id;
+}
+
+static void record_eaten(food_grid_t *grid, uint32_t food_id) {
+    if (grid->eaten_count == grid->eaten_capacity) {
+        grid->eaten_capacity = grid->eaten_capacity ? grid->eaten_capacity * 2 : 64;
+        grid->eaten = realloc(grid->eaten, grid->eaten_capacity * sizeof(uint32_t));
+    }
+    grid->eaten[grid->eaten_count++] = food_id;
+}
+
+int food_eat(food_grid_t *grid, float x, float y, float radius) {
+    int min_col = clamp_cell((x - radius) / grid->cell_size, grid->cols);
+    int max_col = clamp_cell((x + radius) / grid->cell_size, grid->cols);
+    int min_row = clamp_cell((y - radius) / grid->cell_size, grid->rows);
+    int max_row = clamp_cell((y + radius) / grid->cell_size, grid->rows);
+    float radius_sq = radius * radius;
+    int eaten = 0;
+
+    for (int row = min_row; row <= max_row; row++) {
+        for (int col = min_col; col <= max_col; col++) {
+            food_cell_t *cell = &grid->cells[row * grid->cols + col];
+            int i = 0;
+            while (i < cell->count) {
+                float dx = cell->foods[i].x - x;
+                float dy = cell->foods[i].y - y;
+                if (dx * dx + dy * dy < radius_sq) {
+                    record_eaten(grid, cell->foods[i].food_id);
+                    // Swap-remove, the moved pellet is checked next
+                    cell->foods[i] = cell->foods[--cell->count];
+                    eaten++;
+                } else {
+                    i++;
+                }
+            }
+        }
+    }
+
+    grid->count -= eaten;
+    return eaten;
+}
+
+void food_collect(food_grid_t *grid, food_position_t *foods) {
+    for (int i = 0; i < grid->cols * grid->rows; i++) {
+        food_cell_t *cell = &grid->cells[i];
+        if (cell->count > 0) {
+            memcpy(foods, cell->foods, cell->count * sizeof(food_position_t));
+            foods += cell->count;
+        }
+    }
+}
+
+void food_clear_changes(food_grid_t *grid) {
+    grid->spawned_count = 0;
+    grid->eaten_count = 0;
+}
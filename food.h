@@ -0,0 +1,68 @@
+#ifndef FOOD_H
+#define FOOD_H
+
+#include <stdint.h>
+
+#include "protocol.h"
+
+/*
+ * The food pellets on the field, stored in a uniform grid. Every cell keeps its
+ * pellets in one contiguous array, so finding the pellets a player overlaps
+ * only touches the few cells its radius covers, and scans them linearly.
+ *
+ * Spawned and eaten pellets are recorded until `food_clear_changes` is called,
+ * so that each tick can send them as one batch.
+ */
+
+// About the diameter of a mid-sized player, so a player covers few cells and
+// the grid stays small enough for the cache
+#define FOOD_CELL_SIZE 64
+
+typedef struct food_cell_t {
+    food_position_t *foods;
+    int count;
+    int capacity;
+} food_cell_t;
+
+typedef struct food_grid_t {
+    float cell_size;
+    int cols;
+    int rows;
+    food_cell_t *cells;
+    // Number of pellets on the field
+    int count;
+    uint32_t next_id;
+
+    // Changes since the last `food_clear_changes`
+    food_position_t *spawned;
+    int spawned_count;
+    int spawned_capacity;
+    uint32_t *eaten;
+    int eaten_count;
+    int eaten_capacity;
+} food_grid_t;
+
+void food_grid_init(food_grid_t *grid, float width, float height, float cell_size);
+void food_grid_free(food_grid_t *grid);
+
+/*
+ * Places a new pellet, which has to be on the field, and returns its id.
+ */
+uint32_t food_spawn(food_grid_t *grid, float x, float y);
+
+/*
+ * Removes all pellets whose center lies within the circle.
+ *
+ * Returns the number of removed pellets.
+ */
+int food_eat(food_grid_t *grid, float x, float y, float radius);
+
+/*
+ * Copies all pellets on the field into `foods`, which must have room for
+ * `grid->count` entries.
+ */
+void food_collect(food_grid_t *grid, food_position_t *foods);
+
+void food_clear_changes(food_grid_t *grid);
+
+#endif // FOOD_H
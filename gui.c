@@ -21,6 +21,8 @@
 
 #define WINDOW_WIDTH 600
 #define WINDOW_HEIGHT 600
+// TODO: Get the field size from server
+#define FIELD_SIZE 1000
 
 #define STATE_ENTER_NAME 1
 #define STATE_JOINING 2
@@ -30,20 +32,23 @@
 
 typedef struct player_state_t {
     uint32_t id;
-    uint32_t mass;
     char *name;
-    Vector2 pos;
 } player_state_t;
 
 player_state_t *player_state_new(uint32_t id, char *name) {
     player_state_t *player_state = calloc(1, sizeof(player_state_t));
     player_state->id = id;
     player_state->name = name;
-    player_state->mass = -1;
-    player_state->pos = (Vector2){-1, -1};
     return player_state;
 }
 
+/*
+ * Copies a name of a decoded message, which points into the receive buffer.
+ */
+char *copy_name(char *name, int name_length) {
+    return name ? strndup(name, name_length) : NULL;
+}
+
 void player_state_free(player_state_t *player_state) {
     if (player_state->name) {
         free(player_state->name);
@@ -75,20 +80,53 @@ void draw_fps(void) {
 
 // TODO: Remove these in favor of new for-each function for tree, that accepts context
 uint32_t global_own_player_id;
-float global_field_to_window_scale_factor;
 
-void draw_player_pos(void *player_state_void_ptr) {
-    player_state_t *player_state = player_state_void_ptr;
+// Cells and food are drawn in field coordinates, which the camera maps to the
+// window
+void draw_cell(cell_position_t *cell) {
+    Color color = cell->player_id == global_own_player_id ? DARKBLUE : RED;
+    DrawCircleV((Vector2){cell->x, cell->y}, player_radius(cell->mass), color);
+}
+
+void draw_food(void *food_pos_void_ptr) {
+    Vector2 *food_pos = food_pos_void_ptr;
+    DrawCircleV(*food_pos, FOOD_RADIUS, GREEN);
+}
 
-    Color color = player_state->id == global_own_player_id ? DARKBLUE : RED;
-    Vector2 window_pos = Vector2Scale(player_state->pos, global_field_to_window_scale_factor);
-    DrawCircleV(window_pos, 50, color);
+/*
+ * Points the camera at the center of mass of the own cells, zoomed so that the
+ * window shows the view the server sends cells for. Shows the whole field as
+ * long as there are no own cells.
+ */
+void update_camera(Camera2D *camera, cell_position_t *cells, int cell_count) {
+    Vector2 center = {0, 0};
+    uint32_t mass = 0;
+
+    for (int cell_idx = 0; cell_idx < cell_count; cell_idx++) {
+        if (cells[cell_idx].player_id == global_own_player_id) {
+            center.x += cells[cell_idx].x * cells[cell_idx].mass;
+            center.y += cells[cell_idx].y * cells[cell_idx].mass;
+            mass += cells[cell_idx].mass;
+        }
+    }
+
+    camera->offset = (Vector2){WINDOW_WIDTH / 2.0f, WINDOW_HEIGHT / 2.0f};
+    if (mass > 0) {
+        camera->target = Vector2Scale(center, 1.0f / mass);
+        camera->zoom = WINDOW_WIDTH / player_view_size(mass);
+    } else {
+        camera->target = (Vector2){FIELD_SIZE / 2.0f, FIELD_SIZE / 2.0f};
+        camera->zoom = (float)WINDOW_WIDTH / FIELD_SIZE;
+    }
 }
 
 int main(void) {
     struct sockaddr_in server_addr = {0};
     uint8_t send_buf[SEND_BUF_LEN] = {0};
     uint8_t recv_buf[RECV_BUF_LEN] = {0};
+    // Decoded messages only live until the next one is decoded
+    message_arena_t arena;
+    message_arena_init(&arena, malloc(MESSAGE_ARENA_LEN), MESSAGE_ARENA_LEN);
 
     int recv_buf_idx = 0;
     int n_bytes;
@@ -98,15 +136,16 @@ int main(void) {
 
     rejoin_token_t rejoin_token = {0};
     uint32_t own_player_id = 0;
-    // Start the position outside of the field
-    Vector2 previous_display_target = {-1, -1};
+    // Start the target outside of the field
+    Vector2 previous_target = {-1, -1};
+    Camera2D camera = {0};
 
     tree_t *player_states = tree_new();
-
-    // TODO: Get the field size from server
-    float field_to_window_scale_factor = (float)(WINDOW_WIDTH) / 1000.0;
-    global_field_to_window_scale_factor = field_to_window_scale_factor;
-    float window_to_field_scale_factor = 1 / field_to_window_scale_factor;
+    // Cells of the latest tick, which the server sends as deltas
+    cell_snapshot_t cells;
+    cell_snapshot_init(&cells);
+    // Positions of the food pellets by food id
+    tree_t *food_states = tree_new();
 
     SetTargetFPS(TARGET_FPS);
 
@@ -174,20 +213,16 @@ int main(void) {
                 recv_buf_idx += n_bytes;
 
                 generic_message_t *generic_msg = NULL;
-                int msg_bytes = deserialize_message(recv_buf, recv_buf_idx, &generic_msg);
-
-                if (generic_msg) {
-                    assert(msg_bytes <= recv_buf_idx);
-
-                    int bytes_left_in_buffer = recv_buf_idx - msg_bytes;
-
-                    // Move the rest of the buffer over
-                    memmove(recv_buf, recv_buf + msg_bytes, bytes_left_in_buffer);
-                    recv_buf_idx = bytes_left_in_buffer;
+                int msg_bytes;
+                int consumed = 0;
 
-                    // Zero the rest of the buffer just to be safe.
-                    // This is just overhead if everything works as expected.
-                    memset(recv_buf + bytes_left_in_buffer, 0, msg_bytes);
+                // The server sends several messages per tick, so handle all
+                // complete messages in the buffer. They are decoded in place,
+                // so the buffer is only moved after the last one.
+                message_arena_reset(&arena);
+                while ((msg_bytes = decode_message(recv_buf + consumed, recv_buf_idx - consumed, &arena, &generic_msg)) > 0) {
+                    assert(consumed + msg_bytes <= recv_buf_idx);
+                    consumed += msg_bytes;
 
                     if (generic_msg->message_type == MSG_JOIN_ACK) {
                         join_ack_message_t *join_ack_msg = (join_ack_message_t *)generic_msg;
@@ -197,46 +232,64 @@ int main(void) {
 
                         TraceLog(LOG_INFO, "Joined game with player id %d", own_player_id);
 
+                        // Clear the previous player states, since the server
+                        // sends the current players and all food right after
+                        // this message
+                        clear_player_states(player_states);
+                        tree_clear(food_states, free);
+
                         got_join_ack = 1;
                     } else if (generic_msg->message_type == MSG_CURRENT_PLAYERS) {
                         current_players_message_t *current_players_msg = (current_players_message_t *)generic_msg;
 
-                        // Clear the previous player states, since this meassge acts as an initialization
-                        clear_player_states(player_states);
-
+                        // Long lists come in several messages, so the players
+                        // are added to those that are already known
                         for (int player_idx = 0; player_idx < current_players_msg->player_count; player_idx++) {
                             player_info_t player_info = current_players_msg->player_infos[player_idx];
 
-                            player_state_t *player_state = player_state_new(player_info.player_id, player_info.name);
-                            tree_insert(player_states, player_info.player_id, (void *)player_state);
-
-                            // Prevent freeing the name later
-                            player_info.name = NULL;
+                            player_state_t *player_state = player_state_new(player_info.player_id, copy_name(player_info.name, player_info.name_length));
+                            player_state_t *prev_player_state = tree_insert(player_states, player_info.player_id, (void *)player_state);
+                            if (prev_player_state != no_node_sentinel) {
+                                player_state_free(prev_player_state);
+                            }
                         }
 
                         got_current_players = 1;
-                    } else if (generic_msg->message_type == MSG_PLAYER_POSITIONS) {
-                        player_positions_message_t *player_positions_msg = (player_positions_message_t *)generic_msg;
-                        for (int player_idx = 0; player_idx < player_positions_msg->player_count; player_idx++) {
-                            player_position_t player_pos = player_positions_msg->player_positions[player_idx];
-
-                            player_state_t *player_state = tree_get(player_states, player_pos.player_id);
-                            if (player_state != no_node_sentinel) {
-                                player_state->pos = (Vector2){player_pos.x, player_pos.y};
-                                player_state->mass = player_pos.mass;
+                    } else if (generic_msg->message_type == MSG_CELL_DELTA) {
+                        // Deltas that don't apply are skipped until the next
+                        // keyframe, meanwhile the last cells stay on screen
+                        if (cell_delta_apply(&cells, (cell_delta_message_t *)generic_msg) == -1) {
+                            TraceLog(LOG_DEBUG, "Cells out of sync, waiting for a keyframe");
+                        }
+                    } else if (generic_msg->message_type == MSG_SPAWNED_FOOD) {
+                        spawned_food_message_t *spawned_food_msg = (spawned_food_message_t *)generic_msg;
+                        for (int food_idx = 0; food_idx < spawned_food_msg->food_count; food_idx++) {
+                            food_position_t food_pos = spawned_food_msg->food_positions[food_idx];
+
+                            Vector2 *food_state = malloc(sizeof(Vector2));
+                            *food_state = (Vector2){food_pos.x, food_pos.y};
+                            Vector2 *prev_food_state = tree_insert(food_states, food_pos.food_id, food_state);
+                            if (prev_food_state != no_node_sentinel) {
+                                free(prev_food_state);
+                            }
+                        }
+                    } else if (generic_msg->message_type == MSG_EATEN_FOOD) {
+                        eaten_food_message_t *eaten_food_msg = (eaten_food_message_t *)generic_msg;
+                        for (int food_idx = 0; food_idx < eaten_food_msg->food_count; food_idx++) {
+                            Vector2 *food_state = tree_remove(food_states, eaten_food_msg->food_ids[food_idx]);
+                            if (food_state != no_node_sentinel) {
+                                free(food_state);
                             }
                         }
                     } else if (generic_msg->message_type == MSG_PLAYER_JOIN) {
                         player_join_message_t *player_join_msg = (player_join_message_t *)generic_msg;
 
-                        player_state_t *player_state = player_state_new(player_join_msg->player_info.player_id, player_join_msg->player_info.name);
+                        player_info_t player_info = player_join_msg->player_info;
+                        player_state_t *player_state = player_state_new(player_info.player_id, copy_name(player_info.name, player_info.name_length));
                         player_state_t *prev_player_state = tree_insert(player_states, player_join_msg->player_info.player_id, player_state);
                         if (prev_player_state != no_node_sentinel) {
                             player_state_free(prev_player_state);
                         }
-
-                        // Prevent freeing the name later
-                        player_join_msg->player_info.name = NULL;
                     } else if (generic_msg->message_type == MSG_PLAYER_LEAVE) {
                         player_leave_message_t *player_leave_msg = (player_leave_message_t *)generic_msg;
 
@@ -252,8 +305,12 @@ int main(void) {
 
                     // TODO: Handle game full
 
-                    message_free(generic_msg);
+                    message_arena_reset(&arena);
                 }
+
+                // Move the rest of the buffer over
+                memmove(recv_buf, recv_buf + consumed, recv_buf_idx - consumed);
+                recv_buf_idx -= consumed;
             }
         }
 
@@ -315,25 +372,46 @@ int main(void) {
 
             case STATE_INGAME:
             {
+                update_camera(&camera, cells.cells, cells.count);
+
                 Vector2 mouse_pos = GetMousePosition();
                 int is_inside_window = mouse_pos.x >= 0 && mouse_pos.x <= WINDOW_WIDTH && mouse_pos.y >= 0 && mouse_pos.y <= WINDOW_HEIGHT;
-                if (is_inside_window && !Vector2Equals(previous_display_target, mouse_pos)) {
+                // The target under the mouse moves with the camera, but small
+                // moves aren't worth a message
+                Vector2 target = GetScreenToWorld2D(mouse_pos, camera);
+                if (is_inside_window && Vector2Distance(previous_target, target) > 1) {
                     set_target_message_t set_target_msg = {
                         .message_type = MSG_SET_TARGET,
-                        .x = mouse_pos.x * window_to_field_scale_factor,
-                        .y = mouse_pos.y * window_to_field_scale_factor,
+                        .x = target.x,
+                        .y = target.y,
                     };
 
                     int msg_len = serialize_message((generic_message_t *)&set_target_msg, send_buf, SEND_BUF_LEN);
                     // TODO: Handle error
                     send_all(sock, send_buf, msg_len);
 
-                    previous_display_target = mouse_pos;
+                    previous_target = target;
                 }
 
-                DrawText("Welcome to AgarIO", 0, 0, 24, WHITE);
+                if (IsKeyPressed(KEY_SPACE)) {
+                    split_message_t split_msg = {
+                        .message_type = MSG_SPLIT,
+                    };
+
+                    int msg_len = serialize_message((generic_message_t *)&split_msg, send_buf, SEND_BUF_LEN);
+                    // TODO: Handle error
+                    send_all(sock, send_buf, msg_len);
+                }
+
+                BeginMode2D(camera);
+                DrawRectangleLines(0, 0, FIELD_SIZE, FIELD_SIZE, WHITE);
+                tree_for_each_value(food_states, draw_food);
+                for (int cell_idx = 0; cell_idx < cells.count; cell_idx++) {
+                    draw_cell(&cells.cells[cell_idx]);
+                }
+                EndMode2D();
 
-                tree_for_each_value(player_states, draw_player_pos);
+                DrawText("Welcome to AgarIO", 0, 0, 24, WHITE);
 
                 break;
             }
@@ -0,0 +1,111 @@
+#include "hdr_histogram.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HALF_COUNT (HDR_SUB_BUCKET_COUNT / 2)
+#define MAX_VALUE ((1LL << HDR_MAX_VALUE_BITS) - 1)
+
+/*
+ * Values below `HDR_SUB_BUCKET_COUNT` have their own bucket. Larger values are
+ * shifted right until they are in [HALF_COUNT, HDR_SUB_BUCKET_COUNT), so
+ * every shift adds `HALF_COUNT` buckets.
+ */
+static int bucket_of(long long value) {
+    if (value < HDR_SUB_BUCKET_COUNT) {
+        return value;
+    }
+    int shift = 63 - __builtin_clzll(value) - (HDR_SUB_BUCKET_BITS - 1);
+    return shift * HALF_COUNT + (value >> shift);
+}
+
+static long long bucket_max_value(int bucket) {
+    if (bucket < HDR_SUB_BUCKET_COUNT) {
+        return bucket;
+    }
+    int shift = bucket / HALF_COUNT - 1;
+    long long sub_bucket = bucket - shift * HALF_COUNT;
+    return ((sub_bucket + 1) << shift) - 1;
+}
+
+void hdr_histogram_init(hdr_histogram_t *histogram) {
+    histogram->counts = calloc(HDR_BUCKET_COUNT, sizeof(uint64_t));
+    hdr_histogram_reset(histogram);
+}
+
+void hdr_histogram_free(hdr_histogram_t *histogram) {
+    free(histogram->counts);
+    histogram->counts = NULL;
+}
+
+void hdr_histogram_record(hdr_histogram_t *histogram, long long value) {
+    if (value < 0) {
+        value = 0;
+    } else if (value > MAX_VALUE) {
+        value = MAX_VALUE;
+    }
+
+    histogram->counts[bucket_of(value)]++;
+    histogram->total_count++;
+    histogram->sum += value;
+    if (value < histogram->min) {
+        histogram->min = value;
+    }
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+long long hdr_histogram_percentile(hdr_histogram_t *histogram, double percentile) {
+    if (histogram->total_count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = ceil(percentile / 100 * histogram->total_count);
+    if (rank < 1) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < HDR_BUCKET_COUNT; i++) {
+        seen += histogram->counts[i];
+        if (seen >= rank) {
+            long long value = bucket_max_value(i);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+double hdr_histogram_mean(hdr_histogram_t *histogram) {
+    if (histogram->total_count == 0) {
+        return 0;
+    }
+    return (double)histogram->sum / histogram->total_count;
+}
+
+void hdr_histogram_merge(hdr_histogram_t *dst, hdr_histogram_t *src) {
+    if (src->total_count == 0) {
+        return;
+    }
+
+    for (int i = 0; i < HDR_BUCKET_COUNT; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->total_count += src->total_count;
+    dst->sum += src->sum;
+    if (src->min < dst->min) {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+void hdr_histogram_reset(hdr_histogram_t *histogram) {
+    memset(histogram->counts, 0, HDR_BUCKET_COUNT * sizeof(uint64_t));
+    histogram->total_count = 0;
+    histogram->min = MAX_VALUE;
+    histogram->max = 0;
+    histogram->sum = 0;
+}
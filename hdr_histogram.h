@@ -0,0 +1,56 @@
+#ifndef HDR_HISTOGRAM_H
+#define HDR_HISTOGRAM_H
+
+#include <stdint.h>
+
+/*
+ * Histogram of non-negative integer values (e.g. nanoseconds) with buckets
+ * whose width grows with the value, like the HDR histogram. Values below
+ * `HDR_SUB_BUCKET_COUNT` are counted exactly, larger values end up in one of
+ * `HDR_SUB_BUCKET_COUNT / 2` buckets per power of two, so percentiles have a
+ * relative error below 2 / `HDR_SUB_BUCKET_COUNT`.
+ *
+ * Recording is a few instructions and never allocates, so it can be done on
+ * every tick.
+ */
+
+#define HDR_SUB_BUCKET_BITS 7
+#define HDR_SUB_BUCKET_COUNT (1 << HDR_SUB_BUCKET_BITS)
+// Larger values are recorded as the largest trackable value, which is about
+// 18 minutes in nanoseconds
+#define HDR_MAX_VALUE_BITS 40
+#define HDR_BUCKET_COUNT ((HDR_MAX_VALUE_BITS - HDR_SUB_BUCKET_BITS + 1) * (HDR_SUB_BUCKET_COUNT / 2) \
+                          + HDR_SUB_BUCKET_COUNT / 2)
+
+typedef struct hdr_histogram_t {
+    uint64_t *counts;
+    uint64_t total_count;
+    long long min;
+    long long max;
+    long long sum;
+} hdr_histogram_t;
+
+void hdr_histogram_init(hdr_histogram_t *histogram);
+void hdr_histogram_free(hdr_histogram_t *histogram);
+
+/*
+ * Negative values are recorded as 0.
+ */
+void hdr_histogram_record(hdr_histogram_t *histogram, long long value);
+
+/*
+ * Returns the largest value that falls into the same bucket as the value at
+ * the given percentile (0-100), or 0 if the histogram is empty.
+ */
+long long hdr_histogram_percentile(hdr_histogram_t *histogram, double percentile);
+
+double hdr_histogram_mean(hdr_histogram_t *histogram);
+
+/*
+ * Adds the values of `src` to `dst`.
+ */
+void hdr_histogram_merge(hdr_histogram_t *dst, hdr_histogram_t *src);
+
+void hdr_histogram_reset(hdr_histogram_t *histogram);
+
+#endif // HDR_HISTOGRAM_H
@@ -0,0 +1,145 @@
+#include "interest.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "protocol.h"
+
+void interest_init(interest_t *interest, float width, float height, float cell_size, int pool_capacity,
+                   int max_players) {
+    memset(interest, 0, sizeof(interest_t));
+    interest->cell_size = cell_size;
+    interest->cols = ceilf(width / cell_size);
+    interest->rows = ceilf(height / cell_size);
+    interest->starts = calloc(interest->cols * interest->rows + 1, sizeof(int));
+    interest->entries = malloc(pool_capacity * sizeof(int));
+    interest->grid_cells = malloc(pool_capacity * sizeof(int));
+    interest->sets = calloc(max_players, sizeof(interest_set_t));
+    interest->set_count = max_players;
+}
+
+void interest_free(interest_t *interest) {
+    for (int i = 0; i < interest->set_count; i++) {
+        free(interest->sets[i].handles);
+    }
+    free(interest->sets);
+    free(interest->next.handles);
+    free(interest->starts);
+    free(interest->entries);
+    free(interest->grid_cells);
+}
+
+static int clamp_cell(int cell, int max) {
+    if (cell < 0) {
+        return 0;
+    }
+    if (cell >= max) {
+        return max - 1;
+    }
+    return cell;
+}
+
+void interest_build(interest_t *interest, cell_pool_t *pool) {
+    int grid_cell_count = interest->cols * interest->rows;
+    int *starts = interest->starts;
+    int max_mass = 0;
+
+    // Counting sort: count the cells per grid cell, turn the counts into start
+    // offsets, then place every cell at the offset of its grid cell
+    memset(starts, 0, (grid_cell_count + 1) * sizeof(int));
+    for (int i = 0; i < pool->count; i++) {
+        int col = clamp_cell(pool->pos_x[i] / interest->cell_size, interest->cols);
+        int row = clamp_cell(pool->pos_y[i] / interest->cell_size, interest->rows);
+        interest->grid_cells[i] = row * interest->cols + col;
+        starts[interest->grid_cells[i] + 1]++;
+        if (pool->mass[i] > max_mass) {
+            max_mass = pool->mass[i];
+        }
+    }
+    for (int i = 0; i < grid_cell_count; i++) {
+        starts[i + 1] += starts[i];
+    }
+    for (int i = 0; i < pool->count; i++) {
+        interest->entries[starts[interest->grid_cells[i]]++] = i;
+    }
+    // Placing advanced every start to the start of the next grid cell
+    for (int i = grid_cell_count; i > 0; i--) {
+        starts[i] = starts[i - 1];
+    }
+    starts[0] = 0;
+
+    interest->max_radius = player_radius(max_mass);
+}
+
+static int compare_handles(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+static bool set_contains(interest_set_t *set, int handle) {
+    return bsearch(&handle, set->handles, set->count, sizeof(int), compare_handles) != NULL;
+}
+
+static void set_push(interest_set_t *set, int handle) {
+    if (set->count == set->capacity) {
+        set->capacity = set->capacity ? set->capacity * 2 : 64;
+        set->handles = realloc(set->handles, set->capacity * sizeof(int));
+    }
+    set->handles[set->count++] = handle;
+}
+
+/*
+ * Returns whether the circle overlaps the rectangle. Compares the bounding
+ * box of the circle, which lets cells in the corners in a little early.
+ */
+static bool overlaps(float x, float y, float radius, float min_x, float min_y, float max_x, float max_y) {
+    return x + radius >= min_x && x - radius <= max_x && y + radius >= min_y && y - radius <= max_y;
+}
+
+interest_set_t *interest_update(interest_t *interest, cell_pool_t *pool, int slot, float x, float y, float size) {
+    interest_set_t *set = &interest->sets[slot];
+    interest_set_t *next = &interest->next;
+    float half = size / 2;
+    float outer_half = half + size * INTEREST_MARGIN;
+
+    float reach = outer_half + interest->max_radius;
+    int min_col = clamp_cell((x - reach) / interest->cell_size, interest->cols);
+    int max_col = clamp_cell((x + reach) / interest->cell_size, interest->cols);
+    int min_row = clamp_cell((y - reach) / interest->cell_size, interest->rows);
+    int max_row = clamp_cell((y + reach) / interest->cell_size, interest->rows);
+
+    next->count = 0;
+    for (int row = min_row; row <= max_row; row++) {
+        for (int col = min_col; col <= max_col; col++) {
+            int grid_cell = row * interest->cols + col;
+            for (int i = interest->starts[grid_cell]; i < interest->starts[grid_cell + 1]; i++) {
+                int idx = interest->entries[i];
+                float radius = player_radius(pool->mass[idx]);
+                float cell_x = pool->pos_x[idx];
+                float cell_y = pool->pos_y[idx];
+                if (!overlaps(cell_x, cell_y, radius, x - outer_half, y - outer_half, x + outer_half,
+                              y + outer_half)) {
+                    continue;
+                }
+
+                int handle = pool->handles[idx];
+                if (overlaps(cell_x, cell_y, radius, x - half, y - half, x + half, y + half)
+                        || set_contains(set, handle)) {
+                    set_push(next, handle);
+                }
+            }
+        }
+    }
+    qsort(next->handles, next->count, sizeof(int), compare_handles);
+
+    // The old set becomes the buffer for the next update
+    interest_set_t old = *set;
+    *set = *next;
+    *next = old;
+    return set;
+}
+
+void interest_clear(interest_t *interest, int slot) {
+    interest->sets[slot].count = 0;
+}
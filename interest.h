@@ -0,0 +1,77 @@
+#ifndef INTEREST_H
+#define INTEREST_H
+
+#include "cell_pool.h"
+
+/*
+ * Area of interest management: every player only gets the cells that overlap
+ * its view, a square around its cells that grows with its mass (see
+ * `player_view_size`).
+ *
+ * The cells are sorted into a uniform grid once per tick, so a view only looks
+ * at the grid cells it covers. A cell enters a view when it overlaps the view,
+ * but only leaves it when it doesn't overlap the view grown by a margin
+ * anymore, so that cells at the border don't flicker in and out. Clients
+ * replace all cells with those of each new tick, so entering and leaving
+ * needs no messages of its own.
+ */
+
+// Much smaller than a view, which covers a few dozen grid cells
+#define INTEREST_CELL_SIZE 100
+// Fraction of the view size by which a visible cell can move beyond the view
+// before it leaves
+#define INTEREST_MARGIN 0.1f
+
+typedef struct interest_set_t {
+    // Handles of the visible cells, sorted
+    int *handles;
+    int count;
+    int capacity;
+} interest_set_t;
+
+typedef struct interest_t {
+    float cell_size;
+    int cols;
+    int rows;
+    // Pool indices of the cells sorted by grid cell. Those in grid cell `i` are
+    // `entries[starts[i]..starts[i + 1])`.
+    int *starts;
+    int *entries;
+    // Grid cell of every pool index
+    int *grid_cells;
+    // The grid only knows the centers of the cells, so queries are grown by
+    // the radius of the biggest cell
+    float max_radius;
+    // Visible cells by player slot
+    interest_set_t *sets;
+    int set_count;
+    // Where the next set of a player is built, swapped with the old one
+    interest_set_t next;
+} interest_t;
+
+void interest_init(interest_t *interest, float width, float height, float cell_size, int pool_capacity,
+                   int max_players);
+void interest_free(interest_t *interest);
+
+/*
+ * Sorts the cells of the pool into the grid. Has to be called after the cells
+ * moved, and before the views are updated.
+ */
+void interest_build(interest_t *interest, cell_pool_t *pool);
+
+/*
+ * Updates the cells that are visible for the player in `slot`, whose view is
+ * the square with side `size` around (`x`, `y`).
+ *
+ * Returns the visible cells, which stay valid until the next update of the
+ * slot.
+ */
+interest_set_t *interest_update(interest_t *interest, cell_pool_t *pool, int slot, float x, float y, float size);
+
+/*
+ * Forgets what the player in `slot` saw, e.g. because the slot was given to a
+ * new player.
+ */
+void interest_clear(interest_t *interest, int slot);
+
+#endif // INTEREST_H
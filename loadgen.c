@@ -0,0 +1,640 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "event_loop.h"
+#include "hdr_histogram.h"
+#include "networking.h"
+#include "protocol.h"
+
+/*
+ * Headless load generator: opens many non-blocking connections from one
+ * thread, joins a player on each of them and walks it around with
+ * `MSG_SET_TARGET`, like a crowd of GUI clients would.
+ *
+ * Per connection it measures
+ *  - the join latency, from starting the connect until the join was
+ *    acknowledged,
+ *  - the snapshot jitter, i.e. how far the time between the cell positions of
+ *    two ticks is off from the tick interval,
+ *  - the input-to-echo latency, from sending a target until the first cell
+ *    positions that show the player moving towards it.
+ *
+ * Prints a summary and writes all of it as JSON, so runs can be compared by
+ * scripts.
+ */
+
+#define DEFAULT_CLIENTS 100
+#define DEFAULT_CONCURRENCY 32
+#define DEFAULT_DURATION_SEC 10
+#define DEFAULT_INPUT_INTERVAL_MSEC 100
+// Has to match the server's tick rate, or the jitter is meaningless
+#define DEFAULT_TICK_MSEC 50
+#define DEFAULT_PORT 2000
+#define DEFAULT_REPORT_PATH "loadgen.json"
+#define SERVER_ADDR "127.0.0.1"
+#define MAX_EVENTS 1024
+// Drives the inputs, the connection ramp and the end of the run
+#define TIMER_INTERVAL_MSEC 5
+// Has to hold the biggest message the server sends, which is the list of all
+// players
+#define RECV_BUFFER_LEN 65536
+// Distance of a target from the player's position
+#define WALK_STEP 100
+// Targets are kept on the field, so the player can always reach them
+#define FIELD_SIZE 1000
+// An input that wasn't echoed after this long is given up on
+#define ECHO_TIMEOUT_MSEC 1000
+
+#define CLIENT_IDLE 0
+#define CLIENT_CONNECTING 1
+#define CLIENT_JOINING 2
+#define CLIENT_JOINED 3
+#define CLIENT_CLOSED 4
+
+typedef struct client_t {
+    int state;
+    int sock;
+    send_queue_t send_queue;
+    recv_buffer_t recv_buffer;
+    long long start_nsec;
+    uint32_t player_id;
+    // The cells the player sees, which the server sends as deltas
+    cell_snapshot_t cells;
+    // Of the random walk
+    unsigned int seed;
+
+    // Position of the player's first cell in the last snapshot, and how far
+    // it moved since the snapshot before
+    bool has_pos;
+    float x;
+    float y;
+    float dx;
+    float dy;
+    uint32_t last_tick;
+    long long last_snapshot_nsec;
+
+    long long next_input_nsec;
+    // The input that waits for its echo. The next input is only sent after
+    // it, so that echoes can't be mixed up.
+    bool echo_pending;
+    long long input_nsec;
+    float input_dir_x;
+    float input_dir_y;
+
+    long long join_latency_nsec;
+    int inputs_sent;
+    int snapshots;
+    long long jitter_sum_nsec;
+    long long jitter_max_nsec;
+    int echoes;
+    long long echo_sum_nsec;
+    long long echo_max_nsec;
+    int echo_timeouts;
+} client_t;
+
+typedef struct loadgen_t {
+    event_loop_t *loop;
+    struct sockaddr_in addr;
+    client_t *clients;
+    int n_clients;
+    int concurrency;
+    long long input_interval_nsec;
+    long long tick_nsec;
+    uint8_t join_buf[64];
+    int join_len;
+    // Holds the message that is being handled
+    message_arena_t arena;
+
+    // Clients that were started, and those of them that are still connecting
+    // or joining
+    int started;
+    int in_flight;
+    int joined;
+    int rejected;
+    int failed;
+    // Joined clients that were disconnected by the server
+    int disconnected;
+    unsigned long long messages_received;
+    unsigned long long bytes_received;
+
+    hdr_histogram_t join_latencies;
+    hdr_histogram_t snapshot_intervals;
+    hdr_histogram_t snapshot_jitters;
+    hdr_histogram_t echo_latencies;
+} loadgen_t;
+
+static long long now_nsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void close_client(loadgen_t *loadgen, client_t *client) {
+    if (client->state == CLIENT_CONNECTING || client->state == CLIENT_JOINING) {
+        loadgen->in_flight--;
+    }
+    event_loop_remove(loadgen->loop, client->sock);
+    close(client->sock);
+    send_queue_clear(&client->send_queue);
+    recv_buffer_free(&client->recv_buffer);
+    cell_snapshot_free(&client->cells);
+    client->state = CLIENT_CLOSED;
+}
+
+static void start_client(loadgen_t *loadgen, client_t *client) {
+    loadgen->started++;
+    loadgen->in_flight++;
+    client->state = CLIENT_CONNECTING;
+    client->start_nsec = now_nsec();
+    recv_buffer_init(&client->recv_buffer, RECV_BUFFER_LEN);
+    cell_snapshot_init(&client->cells);
+
+    client->sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (client->sock == -1 || set_nonblocking(client->sock) == -1) {
+        perror("creating client socket failed");
+        exit(1);
+    }
+
+    if (connect(client->sock, (struct sockaddr *)&loadgen->addr, sizeof(loadgen->addr)) == -1
+            && errno != EINPROGRESS) {
+        perror("connect failed");
+        exit(1);
+    }
+
+    if (event_loop_add(loadgen->loop, client->sock, EVENT_READ | EVENT_WRITE, client) == -1) {
+        perror("registering client socket failed");
+        exit(1);
+    }
+}
+
+static void handle_connected(loadgen_t *loadgen, client_t *client) {
+    int err = 0;
+    socklen_t err_len = sizeof(err);
+
+    if (getsockopt(client->sock, SOL_SOCKET, SO_ERROR, &err, &err_len) == -1 || err != 0) {
+        loadgen->failed++;
+        close_client(loadgen, client);
+        return;
+    }
+
+    client->state = CLIENT_JOINING;
+    if (send_queue_write(&client->send_queue, client->sock, loadgen->join_buf, loadgen->join_len) == -1) {
+        loadgen->failed++;
+        close_client(loadgen, client);
+    }
+}
+
+/*
+ * Sends the next target of the random walk. The walk turns around by at least
+ * 120 degrees on every step, so the player moves away from the new target
+ * until the server applied it, and towards it afterwards. That turn is what
+ * `handle_positions` looks for.
+ */
+static void send_input(loadgen_t *loadgen, client_t *client, long long now) {
+    float angle;
+    float random = (float)rand_r(&client->seed) / RAND_MAX;
+    bool moving = client->dx != 0 || client->dy != 0;
+
+    if (moving) {
+        angle = atan2f(client->dy, client->dx) + M_PI + (random - 0.5f) * 2 * M_PI / 3;
+    } else {
+        angle = random * 2 * M_PI;
+    }
+    float dir_x = cosf(angle);
+    float dir_y = sinf(angle);
+
+    // Without a position, the target is anywhere on the field
+    float x = client->has_pos ? client->x : (float)rand_r(&client->seed) / RAND_MAX * FIELD_SIZE;
+    float y = client->has_pos ? client->y : (float)rand_r(&client->seed) / RAND_MAX * FIELD_SIZE;
+    // Bounce off the borders of the field
+    if (x + WALK_STEP * dir_x < 0 || x + WALK_STEP * dir_x > FIELD_SIZE) {
+        dir_x = -dir_x;
+    }
+    if (y + WALK_STEP * dir_y < 0 || y + WALK_STEP * dir_y > FIELD_SIZE) {
+        dir_y = -dir_y;
+    }
+
+    set_target_message_t msg = {
+        .message_type = MSG_SET_TARGET,
+        .x = x + WALK_STEP * dir_x,
+        .y = y + WALK_STEP * dir_y,
+    };
+    uint8_t buf[16];
+    int len = serialize_message((generic_message_t *)&msg, buf, sizeof(buf));
+    if (send_queue_write(&client->send_queue, client->sock, buf, len) == -1) {
+        loadgen->disconnected++;
+        close_client(loadgen, client);
+        return;
+    }
+    client->inputs_sent++;
+    client->next_input_nsec = now + loadgen->input_interval_nsec;
+
+    // A bounce can undo the turn, and then the echo can't be told apart
+    if (client->has_pos && client->dx * dir_x + client->dy * dir_y <= 0) {
+        client->echo_pending = true;
+        client->input_nsec = now;
+        client->input_dir_x = dir_x;
+        client->input_dir_y = dir_y;
+    }
+}
+
+static void handle_join_ack(loadgen_t *loadgen, client_t *client, uint8_t *data, int len, long long now) {
+    generic_message_t *msg;
+    if (decode_message(data, len, &loadgen->arena, &msg) == 0) {
+        loadgen->failed++;
+        close_client(loadgen, client);
+        return;
+    }
+    client->player_id = ((join_ack_message_t *)msg)->player_id;
+
+    loadgen->in_flight--;
+    loadgen->joined++;
+    client->state = CLIENT_JOINED;
+    client->join_latency_nsec = now - client->start_nsec;
+    hdr_histogram_record(&loadgen->join_latencies, client->join_latency_nsec);
+    // Spread the inputs of all clients over the interval
+    client->next_input_nsec = now + rand_r(&client->seed) % loadgen->input_interval_nsec;
+}
+
+static void handle_positions(loadgen_t *loadgen, client_t *client, uint8_t *data, int len, long long now) {
+    generic_message_t *generic_msg;
+    if (decode_message(data, len, &loadgen->arena, &generic_msg) == 0) {
+        return;
+    }
+    cell_delta_message_t *msg = (cell_delta_message_t *)generic_msg;
+    if (cell_delta_apply(&client->cells, msg) == -1) {
+        return;
+    }
+
+    // The cells of a tick can be spread over several messages, of which only
+    // the first one counts as the arrival of the snapshot
+    if (client->snapshots == 0 || msg->tick != client->last_tick) {
+        if (client->snapshots > 0) {
+            long long interval = now - client->last_snapshot_nsec;
+            long long expected = (long long)(msg->tick - client->last_tick) * loadgen->tick_nsec;
+            long long jitter = llabs(interval - expected);
+            hdr_histogram_record(&loadgen->snapshot_intervals, interval);
+            hdr_histogram_record(&loadgen->snapshot_jitters, jitter);
+            client->jitter_sum_nsec += jitter;
+            if (jitter > client->jitter_max_nsec) {
+                client->jitter_max_nsec = jitter;
+            }
+        }
+        client->snapshots++;
+        client->last_tick = msg->tick;
+        client->last_snapshot_nsec = now;
+    }
+    // The player's cell may not have been updated yet
+    if (!client->cells.complete) {
+        return;
+    }
+
+    for (int i = 0; i < client->cells.count; i++) {
+        cell_position_t *cell = &client->cells.cells[i];
+        if (cell->player_id != client->player_id) {
+            continue;
+        }
+
+        if (client->has_pos) {
+            client->dx = cell->x - client->x;
+            client->dy = cell->y - client->y;
+        }
+        client->x = cell->x;
+        client->y = cell->y;
+        client->has_pos = true;
+
+        if (client->echo_pending && client->dx * client->input_dir_x + client->dy * client->input_dir_y > 0) {
+            long long latency = now - client->input_nsec;
+            hdr_histogram_record(&loadgen->echo_latencies, latency);
+            client->echoes++;
+            client->echo_sum_nsec += latency;
+            if (latency > client->echo_max_nsec) {
+                client->echo_max_nsec = latency;
+            }
+            client->echo_pending = false;
+        }
+        // Only the first cell is followed
+        break;
+    }
+}
+
+static void handle_message(loadgen_t *loadgen, client_t *client, uint8_t *data, int len, long long now) {
+    loadgen->messages_received++;
+    loadgen->bytes_received += len;
+    message_arena_reset(&loadgen->arena);
+
+    switch (data[2]) {
+        case MSG_JOIN_ACK:
+            handle_join_ack(loadgen, client, data, len, now);
+            break;
+        case MSG_JOIN_ERROR:
+            loadgen->rejected++;
+            close_client(loadgen, client);
+            break;
+        case MSG_KICK:
+            loadgen->disconnected++;
+            close_client(loadgen, client);
+            break;
+        case MSG_CELL_DELTA:
+            if (client->state == CLIENT_JOINED) {
+                handle_positions(loadgen, client, data, len, now);
+            }
+            break;
+    }
+}
+
+static void read_client(loadgen_t *loadgen, client_t *client) {
+    recv_buffer_t *recv_buffer = &client->recv_buffer;
+
+    // The socket may be edge-triggered, so we have to read until there is no
+    // more data
+    while (client->state != CLIENT_CLOSED) {
+        int received = recv_buffer_read(recv_buffer, client->sock);
+        if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (received <= 0) {
+            if (client->state == CLIENT_JOINED) {
+                loadgen->disconnected++;
+            } else {
+                loadgen->failed++;
+            }
+            close_client(loadgen, client);
+            return;
+        }
+
+        long long now = now_nsec();
+        while (client->state != CLIENT_CLOSED) {
+            uint8_t *data = recv_buffer_data(recv_buffer);
+            int msg_len = peek_message_length(data, recv_buffer_len(recv_buffer));
+            if (msg_len == 0 || msg_len > recv_buffer_len(recv_buffer)) {
+                break;
+            }
+            if (msg_len == -1) {
+                loadgen->disconnected++;
+                close_client(loadgen, client);
+                return;
+            }
+            handle_message(loadgen, client, data, msg_len, now);
+            recv_buffer_consume(recv_buffer, msg_len);
+        }
+    }
+}
+
+/*
+ * Sends the inputs that are due and starts connecting more clients, as far as
+ * the concurrency allows.
+ */
+static void handle_timer(loadgen_t *loadgen) {
+    long long now = now_nsec();
+
+    for (int i = 0; i < loadgen->started; i++) {
+        client_t *client = &loadgen->clients[i];
+        if (client->state != CLIENT_JOINED) {
+            continue;
+        }
+        if (client->echo_pending && now - client->input_nsec > ECHO_TIMEOUT_MSEC * 1000000LL) {
+            client->echo_timeouts++;
+            client->echo_pending = false;
+        }
+        if (!client->echo_pending && now >= client->next_input_nsec) {
+            send_input(loadgen, client, now);
+        }
+    }
+
+    while (loadgen->started < loadgen->n_clients && loadgen->in_flight < loadgen->concurrency) {
+        start_client(loadgen, &loadgen->clients[loadgen->started]);
+    }
+}
+
+static double nsec_to_msec(long long nsec) {
+    return nsec / 1e6;
+}
+
+static void write_latencies(FILE *file, const char *name, hdr_histogram_t *histogram) {
+    fprintf(file, "  \"%s\": {\"count\": %llu, \"mean_ms\": %.3f, \"p50_ms\": %.3f, \"p90_ms\": %.3f, "
+            "\"p99_ms\": %.3f, \"max_ms\": %.3f},\n", name, (unsigned long long)histogram->total_count,
+            hdr_histogram_mean(histogram) / 1e6, nsec_to_msec(hdr_histogram_percentile(histogram, 50)),
+            nsec_to_msec(hdr_histogram_percentile(histogram, 90)),
+            nsec_to_msec(hdr_histogram_percentile(histogram, 99)),
+            nsec_to_msec(hdr_histogram_percentile(histogram, 100)));
+}
+
+static void print_latencies(const char *name, hdr_histogram_t *histogram) {
+    printf("%s: p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms (%llu samples)\n", name,
+           nsec_to_msec(hdr_histogram_percentile(histogram, 50)),
+           nsec_to_msec(hdr_histogram_percentile(histogram, 90)),
+           nsec_to_msec(hdr_histogram_percentile(histogram, 99)),
+           nsec_to_msec(hdr_histogram_percentile(histogram, 100)), (unsigned long long)histogram->total_count);
+}
+
+static int write_report(loadgen_t *loadgen, const char *path, double elapsed_sec) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return -1;
+    }
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"clients\": %d,\n  \"concurrency\": %d,\n  \"duration_sec\": %.3f,\n", loadgen->n_clients,
+            loadgen->concurrency, elapsed_sec);
+    fprintf(file, "  \"input_interval_ms\": %.3f,\n  \"tick_ms\": %.3f,\n",
+            nsec_to_msec(loadgen->input_interval_nsec), nsec_to_msec(loadgen->tick_nsec));
+    fprintf(file, "  \"joined\": %d,\n  \"rejected\": %d,\n  \"failed\": %d,\n  \"disconnected\": %d,\n",
+            loadgen->joined, loadgen->rejected, loadgen->failed, loadgen->disconnected);
+    fprintf(file, "  \"messages_received\": %llu,\n  \"bytes_received\": %llu,\n", loadgen->messages_received,
+            loadgen->bytes_received);
+    write_latencies(file, "join_latency", &loadgen->join_latencies);
+    write_latencies(file, "snapshot_interval", &loadgen->snapshot_intervals);
+    write_latencies(file, "snapshot_jitter", &loadgen->snapshot_jitters);
+    write_latencies(file, "echo_latency", &loadgen->echo_latencies);
+
+    fprintf(file, "  \"connections\": [\n");
+    for (int i = 0; i < loadgen->started; i++) {
+        client_t *client = &loadgen->clients[i];
+        bool joined = client->join_latency_nsec > 0;
+        fprintf(file, "    {\"client\": %d, \"joined\": %s, \"player_id\": %u, \"join_latency_ms\": %.3f, "
+                "\"inputs\": %d, \"snapshots\": %d, \"jitter_mean_ms\": %.3f, \"jitter_max_ms\": %.3f, "
+                "\"echoes\": %d, \"echo_mean_ms\": %.3f, \"echo_max_ms\": %.3f, \"echo_timeouts\": %d}%s\n",
+                i, joined ? "true" : "false", client->player_id, nsec_to_msec(client->join_latency_nsec),
+                client->inputs_sent, client->snapshots,
+                client->snapshots > 1 ? nsec_to_msec(client->jitter_sum_nsec) / (client->snapshots - 1) : 0,
+                nsec_to_msec(client->jitter_max_nsec), client->echoes,
+                client->echoes > 0 ? nsec_to_msec(client->echo_sum_nsec) / client->echoes : 0,
+                nsec_to_msec(client->echo_max_nsec), client->echo_timeouts, i < loadgen->started - 1 ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+static void print_usage(char *program) {
+    printf("Usage: %s [-n clients] [-c concurrency] [-d duration_sec] [-i input_interval_msec] [-T tick_msec] "
+           "[-p port] [-s seed] [-o report.json]\n", program);
+    printf("  -c  connections that may be connecting or joining at the same time\n");
+    printf("  -T  tick interval of the server, which the snapshot jitter is measured against\n");
+    printf("  -s  seed of the random walks, which are the same for the same seed\n");
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    int port = DEFAULT_PORT;
+    int duration_sec = DEFAULT_DURATION_SEC;
+    unsigned int seed = 1;
+    const char *report_path = DEFAULT_REPORT_PATH;
+    event_t events[MAX_EVENTS];
+    loadgen_t loadgen = {
+        .n_clients = DEFAULT_CLIENTS,
+        .concurrency = DEFAULT_CONCURRENCY,
+        .input_interval_nsec = DEFAULT_INPUT_INTERVAL_MSEC * 1000000LL,
+        .tick_nsec = DEFAULT_TICK_MSEC * 1000000LL,
+    };
+
+    while ((opt = getopt(argc, argv, "n:c:d:i:T:p:s:o:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                loadgen.n_clients = atoi(optarg);
+                break;
+            case 'c':
+                loadgen.concurrency = atoi(optarg);
+                break;
+            case 'd':
+                duration_sec = atoi(optarg);
+                break;
+            case 'i':
+                loadgen.input_interval_nsec = atol(optarg) * 1000000LL;
+                break;
+            case 'T':
+                loadgen.tick_nsec = atol(optarg) * 1000000LL;
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 's':
+                seed = strtoul(optarg, NULL, 10);
+                break;
+            case 'o':
+                report_path = optarg;
+                break;
+            default:
+                print_usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (loadgen.n_clients < 1 || loadgen.concurrency < 1 || duration_sec < 1 || loadgen.input_interval_nsec < 1
+            || loadgen.tick_nsec < 1) {
+        printf("Clients, concurrency, duration and intervals have to be positive\n");
+        return 1;
+    }
+
+    loadgen.addr.sin_family = AF_INET;
+    loadgen.addr.sin_port = htons(port);
+    loadgen.addr.sin_addr.s_addr = inet_addr(SERVER_ADDR);
+
+    join_message_t join_msg = {
+        .message_type = MSG_JOIN,
+        .name_length = 7,
+        .name = "loadgen",
+    };
+    loadgen.join_len = serialize_message((generic_message_t *)&join_msg, loadgen.join_buf, sizeof(loadgen.join_buf));
+
+    loadgen.clients = calloc(loadgen.n_clients, sizeof(client_t));
+    for (int i = 0; i < loadgen.n_clients; i++) {
+        loadgen.clients[i].seed = seed + i;
+    }
+    message_arena_init(&loadgen.arena, malloc(MESSAGE_ARENA_LEN), MESSAGE_ARENA_LEN);
+    hdr_histogram_init(&loadgen.join_latencies);
+    hdr_histogram_init(&loadgen.snapshot_intervals);
+    hdr_histogram_init(&loadgen.snapshot_jitters);
+    hdr_histogram_init(&loadgen.echo_latencies);
+
+    loadgen.loop = event_loop_new();
+    if (!loadgen.loop) {
+        perror("creating event loop failed");
+        return 1;
+    }
+    if (event_loop_set_timer(loadgen.loop, TIMER_INTERVAL_MSEC * 1000000L, NULL) == -1) {
+        perror("adding timer to event loop failed");
+        return 1;
+    }
+
+    long long start = now_nsec();
+    long long end = start + duration_sec * 1000000000LL;
+    handle_timer(&loadgen);
+
+    while (now_nsec() < end) {
+        int event_count = event_loop_wait(loadgen.loop, events, MAX_EVENTS, -1);
+        if (event_count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("waiting for events failed");
+            return 1;
+        }
+
+        for (int i = 0; i < event_count; i++) {
+            if (events[i].events & EVENT_TIMER) {
+                handle_timer(&loadgen);
+                continue;
+            }
+
+            // Clients are never reused, so a client that was closed by an
+            // earlier event of this batch is still there
+            client_t *client = events[i].udata;
+            if (client->state == CLIENT_CONNECTING && events[i].events & (EVENT_WRITE | EVENT_ERROR)) {
+                handle_connected(&loadgen, client);
+            } else if (client->state != CLIENT_CLOSED && events[i].events & EVENT_WRITE) {
+                if (send_queue_flush(&client->send_queue, client->sock) == -1) {
+                    loadgen.disconnected++;
+                    close_client(&loadgen, client);
+                }
+            }
+            if (client->state != CLIENT_CLOSED && client->state != CLIENT_CONNECTING
+                    && events[i].events & EVENT_READ) {
+                read_client(&loadgen, client);
+            }
+        }
+    }
+    double elapsed_sec = (now_nsec() - start) / 1e9;
+
+    for (int i = 0; i < loadgen.started; i++) {
+        if (loadgen.clients[i].state != CLIENT_CLOSED) {
+            close_client(&loadgen, &loadgen.clients[i]);
+        }
+    }
+
+    printf("backend: %s\n", EVENT_LOOP_BACKEND);
+    printf("clients: %d, started: %d, joined: %d, rejected: %d, failed: %d, disconnected: %d\n", loadgen.n_clients,
+           loadgen.started, loadgen.joined, loadgen.rejected, loadgen.failed, loadgen.disconnected);
+    printf("received: %llu messages, %.1f MB/s\n", loadgen.messages_received,
+           loadgen.bytes_received / elapsed_sec / 1e6);
+    print_latencies("join latency", &loadgen.join_latencies);
+    print_latencies("snapshot interval", &loadgen.snapshot_intervals);
+    print_latencies("snapshot jitter", &loadgen.snapshot_jitters);
+    print_latencies("input-to-echo latency", &loadgen.echo_latencies);
+
+    int status = 0;
+    if (write_report(&loadgen, report_path, elapsed_sec) == -1) {
+        printf("Couldn't write the report to %s: errno %d -- %s\n", report_path, errno, strerror(errno));
+        status = 1;
+    } else {
+        printf("report: %s\n", report_path);
+    }
+
+    event_loop_free(loadgen.loop);
+    hdr_histogram_free(&loadgen.join_latencies);
+    hdr_histogram_free(&loadgen.snapshot_intervals);
+    hdr_histogram_free(&loadgen.snapshot_jitters);
+    hdr_histogram_free(&loadgen.echo_latencies);
+    free(loadgen.clients);
+    free(loadgen.arena.buf);
+
+    return status;
+}
@@ -0,0 +1,327 @@
+#include "log.h"
+#include "spsc_queue.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DRAIN_INTERVAL_NSEC 10000000
+// Seconds of the flight recorder that are dumped when the process crashes
+#define CRASH_DUMP_SEC 10
+
+typedef struct log_ring_t {
+    spsc_queue_t queue;
+    // Incremented by the owning thread, reset by the writer
+    atomic_ullong dropped;
+} log_ring_t;
+
+static const char *level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+static const int crash_signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+
+// Rings stay allocated after `log_stop`, since their threads may still log
+static _Atomic(log_ring_t *) rings[LOG_MAX_THREADS];
+static atomic_int ring_count;
+static _Thread_local log_ring_t *thread_ring;
+static _Thread_local bool thread_registered;
+static _Thread_local uint32_t thread_idx;
+// Includes the records of threads that didn't get a ring
+static atomic_ullong total_dropped;
+
+static struct {
+    FILE *out;
+    int fd;
+    atomic_int level;
+    atomic_bool running;
+    bool started;
+    pthread_t thread;
+    // Incremented after every pass over the rings
+    atomic_ullong passes;
+    // Oldest timestamp of a requested dump, or 0
+    atomic_llong dump_after_nsec;
+    // Ring of the most recent records
+    log_record_t *history;
+    uint64_t history_count;
+} writer;
+
+static long long clock_nsec(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static log_ring_t *register_thread(void) {
+    thread_registered = true;
+    int idx = atomic_fetch_add(&ring_count, 1);
+    if (idx >= LOG_MAX_THREADS) {
+        return NULL;
+    }
+
+    log_ring_t *ring = aligned_alloc(_Alignof(log_ring_t), sizeof(log_ring_t));
+    spsc_queue_init(&ring->queue, LOG_RING_CAPACITY, sizeof(log_record_t));
+    atomic_init(&ring->dropped, 0);
+    thread_idx = idx;
+    // Publishes the initialized ring to the writer
+    atomic_store_explicit(&rings[idx], ring, memory_order_release);
+    return ring;
+}
+
+void log_write(int level, const char *fmt, ...) {
+    if (!thread_registered) {
+        thread_ring = register_thread();
+    }
+    if (!thread_ring) {
+        atomic_fetch_add_explicit(&total_dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    log_record_t record;
+    record.timestamp_nsec = clock_nsec(CLOCK_REALTIME);
+    record.thread = thread_idx;
+    record.level = level;
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(record.message, LOG_MESSAGE_LEN, fmt, args);
+    va_end(args);
+
+    if (!spsc_queue_push(&thread_ring->queue, &record)) {
+        atomic_fetch_add_explicit(&thread_ring->dropped, 1, memory_order_relaxed);
+    }
+}
+
+bool log_limit_allow(log_limit_t *limit, uint32_t *suppressed) {
+    long long now = clock_nsec(CLOCK_MONOTONIC);
+    if (now - limit->window_start_nsec >= 1000000000LL) {
+        *suppressed = limit->suppressed;
+        limit->window_start_nsec = now;
+        limit->count = 0;
+        limit->suppressed = 0;
+    }
+
+    if (limit->count < LOG_RATE_LIMIT) {
+        limit->count++;
+        return true;
+    }
+    limit->suppressed++;
+    return false;
+}
+
+static void write_record(const log_record_t *record) {
+    time_t sec = record->timestamp_nsec / 1000000000LL;
+    struct tm tm;
+    localtime_r(&sec, &tm);
+    fprintf(writer.out, "%02d:%02d:%02d.%03d %-5s [%u] %s\n", tm.tm_hour, tm.tm_min, tm.tm_sec,
+            (int)(record->timestamp_nsec / 1000000 % 1000), level_names[record->level], record->thread,
+            record->message);
+}
+
+/*
+ * Moves the records of all rings into the flight recorder, and writes those
+ * of at least the output level. Returns whether anything was written.
+ */
+static bool drain(void) {
+    bool wrote = false;
+    int level = atomic_load_explicit(&writer.level, memory_order_relaxed);
+    log_record_t record;
+
+    for (int i = 0; i < LOG_MAX_THREADS; i++) {
+        log_ring_t *ring = atomic_load_explicit(&rings[i], memory_order_acquire);
+        if (!ring) {
+            continue;
+        }
+
+        while (spsc_queue_pop(&ring->queue, &record)) {
+            writer.history[writer.history_count++ % LOG_HISTORY_LEN] = record;
+            if (record.level >= level) {
+                write_record(&record);
+                wrote = true;
+            }
+        }
+
+        unsigned long long dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+        if (dropped > 0) {
+            atomic_fetch_add_explicit(&total_dropped, dropped, memory_order_relaxed);
+            fprintf(writer.out, "log: dropped %llu records of thread %d\n", dropped, i);
+            wrote = true;
+        }
+    }
+    return wrote;
+}
+
+static int compare_records(const void *a_ptr, const void *b_ptr) {
+    const log_record_t *a = a_ptr;
+    const log_record_t *b = b_ptr;
+    return a->timestamp_nsec < b->timestamp_nsec ? -1 : (a->timestamp_nsec > b->timestamp_nsec);
+}
+
+static void dump(long long after_nsec) {
+    uint64_t start = writer.history_count > LOG_HISTORY_LEN ? writer.history_count - LOG_HISTORY_LEN : 0;
+    log_record_t *records = malloc((writer.history_count - start) * sizeof(log_record_t));
+    int count = 0;
+    for (uint64_t i = start; i < writer.history_count; i++) {
+        log_record_t *record = &writer.history[i % LOG_HISTORY_LEN];
+        if (record->timestamp_nsec >= after_nsec) {
+            records[count++] = *record;
+        }
+    }
+
+    // The rings were drained one after the other
+    qsort(records, count, sizeof(log_record_t), compare_records);
+    fprintf(writer.out, "--- flight recorder: %d records ---\n", count);
+    for (int i = 0; i < count; i++) {
+        write_record(&records[i]);
+    }
+    fprintf(writer.out, "--- end of flight recorder ---\n");
+    free(records);
+}
+
+static void pass(void) {
+    bool wrote = drain();
+    long long dump_after_nsec = atomic_exchange(&writer.dump_after_nsec, 0);
+    if (dump_after_nsec != 0) {
+        dump(dump_after_nsec);
+        wrote = true;
+    }
+    if (wrote) {
+        fflush(writer.out);
+    }
+    atomic_fetch_add(&writer.passes, 1);
+}
+
+static void *writer_main(void *arg) {
+    (void)arg;
+    struct timespec interval = {0, DRAIN_INTERVAL_NSEC};
+
+    while (atomic_load(&writer.running)) {
+        pass();
+        nanosleep(&interval, NULL);
+    }
+    pass();
+    return NULL;
+}
+
+static void write_str(const char *str) {
+    // Nothing can be done about errors while crashing
+    ssize_t ret = write(writer.fd, str, strlen(str));
+    (void)ret;
+}
+
+static void write_crash_record(const log_record_t *record) {
+    write_str(level_names[record->level]);
+    write_str(" ");
+    write_str(record->message);
+    write_str("\n");
+}
+
+/*
+ * Only uses async-signal-safe functions. The writer may be adding records to
+ * the flight recorder at the same time, so this is best effort.
+ */
+static void dump_on_crash(int sig) {
+    long long after_nsec = clock_nsec(CLOCK_REALTIME) - CRASH_DUMP_SEC * 1000000000LL;
+    uint64_t end = writer.history_count;
+    uint64_t start = end > LOG_HISTORY_LEN ? end - LOG_HISTORY_LEN : 0;
+
+    write_str("--- crashed, flight recorder: ---\n");
+    for (uint64_t i = start; i < end; i++) {
+        log_record_t *record = &writer.history[i % LOG_HISTORY_LEN];
+        if (record->timestamp_nsec >= after_nsec) {
+            write_crash_record(record);
+        }
+    }
+    // The records the writer hasn't drained yet are the most recent ones,
+    // including those of the crashing thread. They are left in the rings.
+    for (int i = 0; i < LOG_MAX_THREADS; i++) {
+        log_ring_t *ring = atomic_load_explicit(&rings[i], memory_order_acquire);
+        const log_record_t *record;
+        if (!ring) {
+            continue;
+        }
+        for (size_t j = 0; (record = spsc_queue_peek(&ring->queue, j)); j++) {
+            write_crash_record(record);
+        }
+    }
+    write_str("--- end of flight recorder ---\n");
+
+    // The handler was reset, so this terminates the process as usual
+    raise(sig);
+}
+
+int log_start(FILE *out, int level) {
+    writer.out = out;
+    writer.fd = fileno(out);
+    atomic_store(&writer.level, level);
+    atomic_store(&writer.dump_after_nsec, 0);
+    writer.history = calloc(LOG_HISTORY_LEN, sizeof(log_record_t));
+    writer.history_count = 0;
+
+    atomic_store(&writer.running, true);
+    if (pthread_create(&writer.thread, NULL, writer_main, NULL) != 0) {
+        free(writer.history);
+        writer.history = NULL;
+        return -1;
+    }
+    writer.started = true;
+
+    struct sigaction action = {0};
+    action.sa_handler = dump_on_crash;
+    action.sa_flags = SA_RESETHAND;
+    sigemptyset(&action.sa_mask);
+    for (size_t i = 0; i < sizeof(crash_signals) / sizeof(crash_signals[0]); i++) {
+        sigaction(crash_signals[i], &action, NULL);
+    }
+    return 0;
+}
+
+void log_stop(void) {
+    if (!writer.started) {
+        return;
+    }
+
+    for (size_t i = 0; i < sizeof(crash_signals) / sizeof(crash_signals[0]); i++) {
+        signal(crash_signals[i], SIG_DFL);
+    }
+    atomic_store(&writer.running, false);
+    pthread_join(writer.thread, NULL);
+    writer.started = false;
+    free(writer.history);
+    writer.history = NULL;
+}
+
+void log_set_level(int level) {
+    atomic_store(&writer.level, level);
+}
+
+void log_flush(void) {
+    if (!writer.started) {
+        return;
+    }
+
+    // The pass that is running now may have missed the records, but the next
+    // one sees them
+    unsigned long long passes = atomic_load(&writer.passes);
+    struct timespec interval = {0, 1000000};
+    while (atomic_load(&writer.passes) < passes + 2) {
+        nanosleep(&interval, NULL);
+    }
+}
+
+void log_dump_recent(int seconds) {
+    atomic_store(&writer.dump_after_nsec, clock_nsec(CLOCK_REALTIME) - seconds * 1000000000LL);
+}
+
+uint64_t log_dropped(void) {
+    uint64_t dropped = atomic_load(&total_dropped);
+    // Records the writer didn't see yet
+    for (int i = 0; i < LOG_MAX_THREADS; i++) {
+        log_ring_t *ring = atomic_load_explicit(&rings[i], memory_order_acquire);
+        if (ring) {
+            dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+        }
+    }
+    return dropped;
+}
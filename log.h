@@ -0,0 +1,135 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Leveled logger for the server. A log call formats its message into a
+ * fixed-size record and pushes it into a lock-free ring buffer that belongs
+ * to the calling thread, so logging never takes a lock or touches stdio. A
+ * background writer thread drains the rings and writes the records out.
+ *
+ * If a ring is full, records are dropped and counted instead of blocking the
+ * thread. Records are ordered per thread; records of different threads can be
+ * interleaved out of order within one drain interval.
+ *
+ * The writer also keeps the most recent records, including those below the
+ * output level, in a flight recorder, which is dumped on request (e.g. on a
+ * tick overrun) and when the process crashes.
+ */
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+// Log calls below this level are compiled out, including the evaluation of
+// their arguments, e.g. `make agario LOG_MIN_LEVEL=0` keeps debug logs
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Longer messages are truncated
+#define LOG_MESSAGE_LEN 112
+// Records per thread that haven't been written yet
+#define LOG_RING_CAPACITY 1024
+#define LOG_MAX_THREADS 128
+// Records kept in the flight recorder
+#define LOG_HISTORY_LEN 8192
+// Messages per second and call site that rate-limited log calls let through
+#define LOG_RATE_LIMIT 10
+
+typedef struct log_record_t {
+    // `CLOCK_REALTIME`
+    int64_t timestamp_nsec;
+    uint32_t thread;
+    uint8_t level;
+    char message[LOG_MESSAGE_LEN];
+} log_record_t;
+
+/*
+ * State of a rate-limited call site. Every thread gets its own, so it needs
+ * no synchronization.
+ */
+typedef struct log_limit_t {
+    long long window_start_nsec;
+    uint32_t count;
+    uint32_t suppressed;
+} log_limit_t;
+
+/*
+ * Starts the writer thread, which writes records of at least `level` to
+ * `out`. Also installs handlers that dump the flight recorder when the
+ * process crashes.
+ *
+ * Returns -1 if the writer thread couldn't be started.
+ */
+int log_start(FILE *out, int level);
+
+/*
+ * Writes the remaining records and stops the writer thread.
+ */
+void log_stop(void);
+
+void log_set_level(int level);
+
+/*
+ * Blocks until the records that were logged before the call are written.
+ */
+void log_flush(void);
+
+/*
+ * Makes the writer write the records of the last `seconds` from the flight
+ * recorder, regardless of their level. Doesn't block.
+ */
+void log_dump_recent(int seconds);
+
+/*
+ * Returns the number of records that were dropped because a ring was full.
+ */
+uint64_t log_dropped(void);
+
+void log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/*
+ * Returns whether a rate-limited call may log now. If messages were
+ * suppressed since the last one that was let through, `suppressed` is set to
+ * their number.
+ */
+bool log_limit_allow(log_limit_t *limit, uint32_t *suppressed);
+
+#define LOG_AT(level, ...)                                                     \
+    do {                                                                       \
+        if ((level) >= LOG_MIN_LEVEL) {                                        \
+            log_write((level), __VA_ARGS__);                                   \
+        }                                                                      \
+    } while (0)
+
+#define LOG_RATE_LIMITED(level, ...)                                           \
+    do {                                                                       \
+        if ((level) >= LOG_MIN_LEVEL) {                                        \
+            static _Thread_local log_limit_t log_limit_;                       \
+            uint32_t log_suppressed_ = 0;                                      \
+            if (log_limit_allow(&log_limit_, &log_suppressed_)) {              \
+                if (log_suppressed_ > 0) {                                     \
+                    log_write((level), "(%u similar messages suppressed)",     \
+                              log_suppressed_);                                \
+                }                                                              \
+                log_write((level), __VA_ARGS__);                               \
+            }                                                                  \
+        }                                                                      \
+    } while (0)
+
+#define log_debug(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define log_info(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_warn(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define log_error(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+// For messages that a misbehaving client or an overload can trigger at a high
+// rate
+#define log_warn_ratelimited(...) LOG_RATE_LIMITED(LOG_LEVEL_WARN, __VA_ARGS__)
+#define log_error_ratelimited(...) LOG_RATE_LIMITED(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#endif // LOG_H
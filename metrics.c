@@ -0,0 +1,168 @@
+#include "metrics.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "protocol.h"
+
+static const long long tick_bucket_bounds_nsec[METRICS_TICK_BUCKETS] = {
+    250000, 500000, 1000000, 2500000, 5000000, 10000000, 25000000, 50000000, 100000000, 250000000,
+};
+
+static const char *disconnect_reason_names[DISCONNECT_REASON_COUNT] = {
+    "peer", "recv_error", "send_error", "too_slow", "invalid_message", "udp_timeout", "server", "shutdown",
+};
+
+typedef struct text_t {
+    char **buf;
+    int *capacity;
+    int len;
+} text_t;
+
+void metrics_init(metrics_t *metrics, int shard_count) {
+    metrics->shard_count = shard_count;
+    metrics->shards = aligned_alloc(_Alignof(metrics_shard_t), shard_count * sizeof(metrics_shard_t));
+    // All values are zero, atomics of these types have no other representation
+    memset(metrics->shards, 0, shard_count * sizeof(metrics_shard_t));
+}
+
+void metrics_free(metrics_t *metrics) {
+    free(metrics->shards);
+    metrics->shards = NULL;
+}
+
+void metrics_observe_tick(metrics_shard_t *shard, long long duration_nsec) {
+    int bucket = 0;
+    while (bucket < METRICS_TICK_BUCKETS && duration_nsec > tick_bucket_bounds_nsec[bucket]) {
+        bucket++;
+    }
+    metrics_add(&shard->tick_buckets[bucket], 1);
+    metrics_add(&shard->tick_count, 1);
+    metrics_add(&shard->tick_sum_nsec, duration_nsec);
+}
+
+static void append(text_t *text, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void append(text_t *text, const char *fmt, ...) {
+    va_list args;
+    while (1) {
+        int space = *text->capacity - text->len;
+        va_start(args, fmt);
+        int len = vsnprintf(*text->buf + text->len, space, fmt, args);
+        va_end(args);
+        if (len < space) {
+            text->len += len;
+            return;
+        }
+        *text->capacity = *text->capacity * 2 > text->len + len + 1 ? *text->capacity * 2 : text->len + len + 1;
+        *text->buf = realloc(*text->buf, *text->capacity);
+    }
+}
+
+static void append_header(text_t *text, const char *name, const char *type, const char *help) {
+    append(text, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/*
+ * Returns the sum of the value over all shards. `offset` is the offset of the
+ * value in a shard.
+ */
+static unsigned long long sum_counter(metrics_t *metrics, size_t offset) {
+    unsigned long long sum = 0;
+    for (int i = 0; i < metrics->shard_count; i++) {
+        atomic_ullong *counter = (atomic_ullong *)((char *)&metrics->shards[i] + offset);
+        sum += atomic_load_explicit(counter, memory_order_relaxed);
+    }
+    return sum;
+}
+
+static long long sum_gauge(metrics_t *metrics, size_t offset) {
+    long long sum = 0;
+    for (int i = 0; i < metrics->shard_count; i++) {
+        atomic_llong *gauge = (atomic_llong *)((char *)&metrics->shards[i] + offset);
+        sum += atomic_load_explicit(gauge, memory_order_relaxed);
+    }
+    return sum;
+}
+
+/*
+ * Appends a counter per message type. Types without a name are added up as
+ * `unknown`, and types that were never counted are left out.
+ */
+static void append_per_type(text_t *text, metrics_t *metrics, const char *name, const char *help, size_t offset) {
+    unsigned long long unknown = 0;
+
+    append_header(text, name, "counter", help);
+    for (int type = 0; type < METRICS_MESSAGE_TYPES; type++) {
+        unsigned long long value = sum_counter(metrics, offset + type * sizeof(atomic_ullong));
+        const char *type_name = message_type_name(type);
+        if (!type_name) {
+            unknown += value;
+        } else if (value > 0) {
+            append(text, "%s{type=\"%s\"} %llu\n", name, type_name, value);
+        }
+    }
+    if (unknown > 0) {
+        append(text, "%s{type=\"unknown\"} %llu\n", name, unknown);
+    }
+}
+
+int metrics_format(metrics_t *metrics, char **buf, int *capacity) {
+    text_t text = {buf, capacity, 0};
+    if (!*buf || *capacity == 0) {
+        *capacity = 4096;
+        *buf = realloc(*buf, *capacity);
+    }
+
+    append_header(&text, "agario_players_connected", "gauge", "Connections that have a player slot.");
+    append(&text, "agario_players_connected %lld\n",
+           sum_gauge(metrics, offsetof(metrics_shard_t, players_connected)));
+    append_header(&text, "agario_players_joined", "gauge", "Players that are on the field.");
+    append(&text, "agario_players_joined %lld\n", sum_gauge(metrics, offsetof(metrics_shard_t, players_joined)));
+
+    append_header(&text, "agario_connections_accepted_total", "counter", "Accepted TCP and UDP connections.");
+    append(&text, "agario_connections_accepted_total %llu\n",
+           sum_counter(metrics, offsetof(metrics_shard_t, connections_accepted)));
+    append_header(&text, "agario_disconnects_total", "counter", "Closed connections by reason.");
+    for (int reason = 0; reason < DISCONNECT_REASON_COUNT; reason++) {
+        append(&text, "agario_disconnects_total{reason=\"%s\"} %llu\n", disconnect_reason_names[reason],
+               sum_counter(metrics, offsetof(metrics_shard_t, disconnects) + reason * sizeof(atomic_ullong)));
+    }
+    append_header(&text, "agario_send_queue_bytes", "gauge", "Bytes waiting in the send queues of TCP connections.");
+    append(&text, "agario_send_queue_bytes %lld\n", sum_gauge(metrics, offsetof(metrics_shard_t, send_queue_bytes)));
+
+    append_per_type(&text, metrics, "agario_messages_received_total", "Received messages by type.",
+                    offsetof(metrics_shard_t, messages_received));
+    append_per_type(&text, metrics, "agario_received_bytes_total", "Received bytes by message type.",
+                    offsetof(metrics_shard_t, bytes_received));
+    append_per_type(&text, metrics, "agario_messages_sent_total", "Sent messages by type.",
+                    offsetof(metrics_shard_t, messages_sent));
+    append_per_type(&text, metrics, "agario_sent_bytes_total", "Sent bytes by message type.",
+                    offsetof(metrics_shard_t, bytes_sent));
+
+    append_header(&text, "agario_tick_duration_seconds", "histogram", "Time it took to run a tick.");
+    unsigned long long cumulative = 0;
+    for (int bucket = 0; bucket < METRICS_TICK_BUCKETS; bucket++) {
+        cumulative += sum_counter(metrics, offsetof(metrics_shard_t, tick_buckets) + bucket * sizeof(atomic_ullong));
+        append(&text, "agario_tick_duration_seconds_bucket{le=\"%g\"} %llu\n", tick_bucket_bounds_nsec[bucket] / 1e9,
+               cumulative);
+    }
+    // Read once, so that the +Inf bucket and the count agree. Ticks that were
+    // recorded after the buckets were read go into +Inf.
+    unsigned long long tick_count = sum_counter(metrics, offsetof(metrics_shard_t, tick_count));
+    if (tick_count < cumulative) {
+        tick_count = cumulative;
+    }
+    append(&text, "agario_tick_duration_seconds_bucket{le=\"+Inf\"} %llu\n", tick_count);
+    append(&text, "agario_tick_duration_seconds_sum %.9f\n",
+           sum_counter(metrics, offsetof(metrics_shard_t, tick_sum_nsec)) / 1e9);
+    append(&text, "agario_tick_duration_seconds_count %llu\n", tick_count);
+    append_header(&text, "agario_ticks_missed_total", "counter",
+                  "Ticks that were skipped because the server fell behind.");
+    append(&text, "agario_ticks_missed_total %llu\n", sum_counter(metrics, offsetof(metrics_shard_t, ticks_missed)));
+
+    return text.len;
+}
@@ -0,0 +1,85 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+
+/*
+ * Counters and gauges of the server, exported in the Prometheus text format.
+ *
+ * Every thread writes only to its own shard, so updating a value is a plain
+ * load and store without a lock prefix or cache line bouncing. A snapshot
+ * reads all shards with relaxed loads and adds them up, so it may mix values
+ * from slightly different points in time.
+ */
+
+#define METRICS_MESSAGE_TYPES 256
+
+// Why a connection was closed
+#define DISCONNECT_PEER 0
+#define DISCONNECT_RECV_ERROR 1
+#define DISCONNECT_SEND_ERROR 2
+// Its send queue grew beyond the high water mark
+#define DISCONNECT_TOO_SLOW 3
+#define DISCONNECT_INVALID_MESSAGE 4
+#define DISCONNECT_UDP_TIMEOUT 5
+// By the simulation, e.g. after a leave
+#define DISCONNECT_SERVER 6
+#define DISCONNECT_SHUTDOWN 7
+#define DISCONNECT_REASON_COUNT 8
+
+// Tick duration buckets, without the +Inf bucket
+#define METRICS_TICK_BUCKETS 10
+
+typedef struct metrics_shard_t {
+    _Alignas(64) atomic_ullong messages_received[METRICS_MESSAGE_TYPES];
+    atomic_ullong bytes_received[METRICS_MESSAGE_TYPES];
+    atomic_ullong messages_sent[METRICS_MESSAGE_TYPES];
+    atomic_ullong bytes_sent[METRICS_MESSAGE_TYPES];
+    atomic_ullong connections_accepted;
+    atomic_ullong disconnects[DISCONNECT_REASON_COUNT];
+    // Bytes waiting in the send queues of TCP connections
+    atomic_llong send_queue_bytes;
+
+    atomic_llong players_connected;
+    atomic_llong players_joined;
+    // Not cumulative, the last one counts the ticks above all bounds
+    atomic_ullong tick_buckets[METRICS_TICK_BUCKETS + 1];
+    atomic_ullong tick_count;
+    atomic_ullong tick_sum_nsec;
+    atomic_ullong ticks_missed;
+} metrics_shard_t;
+
+typedef struct metrics_t {
+    int shard_count;
+    metrics_shard_t *shards;
+} metrics_t;
+
+void metrics_init(metrics_t *metrics, int shard_count);
+void metrics_free(metrics_t *metrics);
+
+/*
+ * Must only be called by the thread that owns the value.
+ */
+static inline void metrics_add(atomic_ullong *counter, unsigned long long n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline void metrics_add_gauge(atomic_llong *gauge, long long delta) {
+    atomic_store_explicit(gauge, atomic_load_explicit(gauge, memory_order_relaxed) + delta, memory_order_relaxed);
+}
+
+static inline void metrics_set_gauge(atomic_llong *gauge, long long value) {
+    atomic_store_explicit(gauge, value, memory_order_relaxed);
+}
+
+void metrics_observe_tick(metrics_shard_t *shard, long long duration_nsec);
+
+/*
+ * Writes a snapshot of all shards in the Prometheus text format to `*buf`,
+ * which is grown as needed.
+ *
+ * Returns the length of the text.
+ */
+int metrics_format(metrics_t *metrics, char **buf, int *capacity);
+
+#endif // METRICS_H
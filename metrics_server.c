@@ -0,0 +1,144 @@
+#include "metrics_server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "log.h"
+#include "networking.h"
+
+#define REQUEST_LEN 4096
+// How often the thread checks whether it should stop
+#define POLL_INTERVAL_MSEC 100
+// A scraper that is slower than this is dropped, so it can't block the others
+#define CLIENT_TIMEOUT_SEC 2
+
+#define NOT_FOUND_RESPONSE "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+
+struct metrics_server_t {
+    metrics_t *metrics;
+    int sock;
+    pthread_t thread;
+    atomic_bool stopping;
+    char request[REQUEST_LEN];
+    char *text;
+    int text_capacity;
+};
+
+/*
+ * Reads until the end of the request headers. The body of a request is
+ * ignored.
+ *
+ * Returns false if the request didn't arrive completely.
+ */
+static bool read_request(metrics_server_t *server, int sock) {
+    int len = 0;
+    while (len < REQUEST_LEN - 1) {
+        ssize_t n = recv(sock, server->request + len, REQUEST_LEN - 1 - len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        len += n;
+        server->request[len] = 0;
+        if (strstr(server->request, "\r\n\r\n")) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void write_response(int sock, const char *data, int len) {
+    while (len > 0) {
+        ssize_t n = send(sock, data, len, 0);
+        if (n <= 0) {
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+static void serve(metrics_server_t *server, int sock) {
+    if (!read_request(server, sock)) {
+        return;
+    }
+
+    bool is_metrics = strncmp(server->request, "GET /metrics ", 13) == 0 || strncmp(server->request, "GET / ", 6) == 0;
+    if (!is_metrics) {
+        write_response(sock, NOT_FOUND_RESPONSE, strlen(NOT_FOUND_RESPONSE));
+        return;
+    }
+
+    int body_len = metrics_format(server->metrics, &server->text, &server->text_capacity);
+    char header[256];
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                              "Content-Length: %d\r\nConnection: close\r\n\r\n", body_len);
+    write_response(sock, header, header_len);
+    write_response(sock, server->text, body_len);
+}
+
+static void *metrics_server_main(void *arg) {
+    metrics_server_t *server = arg;
+    struct pollfd pollfd = {.fd = server->sock, .events = POLLIN};
+    struct timeval timeout = {.tv_sec = CLIENT_TIMEOUT_SEC};
+
+    while (!atomic_load(&server->stopping)) {
+        if (poll(&pollfd, 1, POLL_INTERVAL_MSEC) <= 0) {
+            continue;
+        }
+
+        int sock = accept(server->sock, NULL, NULL);
+        if (sock == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                log_warn_ratelimited("couldn't accept metrics connection: errno %d -- %s", errno, strerror(errno));
+            }
+            continue;
+        }
+
+        // Blocking with a timeout, since there is only one request at a time.
+        // The listening socket is non-blocking, which some systems inherit.
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK);
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        serve(server, sock);
+        close(sock);
+    }
+
+    return NULL;
+}
+
+metrics_server_t *metrics_server_start(metrics_t *metrics, const char *addr, int port) {
+    int sock = listen_tcp(addr, port, 16, false);
+    if (sock == -1) {
+        return NULL;
+    }
+
+    metrics_server_t *server = calloc(1, sizeof(metrics_server_t));
+    server->metrics = metrics;
+    server->sock = sock;
+    atomic_init(&server->stopping, false);
+    if (pthread_create(&server->thread, NULL, metrics_server_main, server) != 0) {
+        close(sock);
+        free(server);
+        return NULL;
+    }
+    return server;
+}
+
+void metrics_server_stop(metrics_server_t *server) {
+    atomic_store(&server->stopping, true);
+    pthread_join(server->thread, NULL);
+    close(server->sock);
+    free(server->text);
+    free(server);
+}
@@ -0,0 +1,22 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include "metrics.h"
+
+/*
+ * Minimal HTTP server on its own thread that answers `GET /metrics` with a
+ * snapshot of the metrics, for a Prometheus scraper. It handles one request
+ * at a time and never touches the simulation or I/O threads, except for
+ * reading their shards.
+ */
+typedef struct metrics_server_t metrics_server_t;
+
+/*
+ * Listens on `addr`:`port`.
+ *
+ * Returns NULL on error (with `errno` set).
+ */
+metrics_server_t *metrics_server_start(metrics_t *metrics, const char *addr, int port);
+void metrics_server_stop(metrics_server_t *server);
+
+#endif // METRICS_SERVER_H
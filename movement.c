@@ -0,0 +1,104 @@
+#include "movement.h"
+
+#include <math.h>
+#include <stddef.h>
+
+#ifdef MOVEMENT_X86
+#include <immintrin.h>
+#endif
+
+static inline void move_one(float *pos_x, float *pos_y, const float *target_x, const float *target_y,
+                            const float *speed, int i) {
+    float dx = target_x[i] - pos_x[i];
+    float dy = target_y[i] - pos_y[i];
+    float len = sqrtf(dx * dx + dy * dy);
+    if (len > 1) {
+        float factor = speed[i] / len;
+        pos_x[i] += dx * factor;
+        pos_y[i] += dy * factor;
+    }
+}
+
+void move_scalar(float *pos_x, float *pos_y, const float *target_x, const float *target_y,
+                 const float *speed, int count) {
+    for (int i = 0; i < count; i++) {
+        move_one(pos_x, pos_y, target_x, target_y, speed, i);
+    }
+}
+
+#ifdef MOVEMENT_X86
+
+__attribute__((target("sse2")))
+void move_sse(float *pos_x, float *pos_y, const float *target_x, const float *target_y,
+              const float *speed, int count) {
+    const __m128 one = _mm_set1_ps(1);
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m128 px = _mm_loadu_ps(pos_x + i);
+        __m128 py = _mm_loadu_ps(pos_y + i);
+        __m128 dx = _mm_sub_ps(_mm_loadu_ps(target_x + i), px);
+        __m128 dy = _mm_sub_ps(_mm_loadu_ps(target_y + i), py);
+        __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+        __m128 moving = _mm_cmpgt_ps(len, one);
+        // Lanes that don't move may divide by zero, their result is discarded
+        __m128 factor = _mm_div_ps(_mm_loadu_ps(speed + i), len);
+        __m128 nx = _mm_add_ps(px, _mm_mul_ps(dx, factor));
+        __m128 ny = _mm_add_ps(py, _mm_mul_ps(dy, factor));
+        // SSE2 has no blend instruction
+        _mm_storeu_ps(pos_x + i, _mm_or_ps(_mm_and_ps(moving, nx), _mm_andnot_ps(moving, px)));
+        _mm_storeu_ps(pos_y + i, _mm_or_ps(_mm_and_ps(moving, ny), _mm_andnot_ps(moving, py)));
+    }
+
+    for (; i < count; i++) {
+        move_one(pos_x, pos_y, target_x, target_y, speed, i);
+    }
+}
+
+__attribute__((target("avx2")))
+void move_avx2(float *pos_x, float *pos_y, const float *target_x, const float *target_y,
+               const float *speed, int count) {
+    const __m256 one = _mm256_set1_ps(1);
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m256 px = _mm256_loadu_ps(pos_x + i);
+        __m256 py = _mm256_loadu_ps(pos_y + i);
+        __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(target_x + i), px);
+        __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(target_y + i), py);
+        __m256 len = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+        __m256 moving = _mm256_cmp_ps(len, one, _CMP_GT_OQ);
+        __m256 factor = _mm256_div_ps(_mm256_loadu_ps(speed + i), len);
+        __m256 nx = _mm256_add_ps(px, _mm256_mul_ps(dx, factor));
+        __m256 ny = _mm256_add_ps(py, _mm256_mul_ps(dy, factor));
+        _mm256_storeu_ps(pos_x + i, _mm256_blendv_ps(px, nx, moving));
+        _mm256_storeu_ps(pos_y + i, _mm256_blendv_ps(py, ny, moving));
+    }
+
+    for (; i < count; i++) {
+        move_one(pos_x, pos_y, target_x, target_y, speed, i);
+    }
+}
+
+#endif // MOVEMENT_X86
+
+move_func_t move_select(const char **name) {
+    const char *selected = "scalar";
+    move_func_t func = move_scalar;
+
+#ifdef MOVEMENT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        selected = "avx2";
+        func = move_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        selected = "sse";
+        func = move_sse;
+    }
+#endif
+
+    if (name) {
+        *name = selected;
+    }
+    return func;
+}
@@ -0,0 +1,37 @@
+#ifndef MOVEMENT_H
+#define MOVEMENT_H
+
+/*
+ * Moves every entity `i < count` towards its target by `speed[i]`, unless it is
+ * already within a distance of 1 of the target:
+ *
+ *     d = target - pos
+ *     if |d| > 1: pos += d * (speed / |d|)
+ *
+ * The arrays are structure-of-arrays columns, so the kernels can process 4
+ * (SSE) or 8 (AVX2) entities per instruction. All kernels do the same IEEE
+ * single precision operations in the same order, so their results are
+ * bit-for-bit identical. This relies on `movement.c` being compiled with
+ * `-ffp-contract=off`, so the scalar code doesn't use fused multiply-adds.
+ */
+typedef void (*move_func_t)(float *pos_x, float *pos_y, const float *target_x, const float *target_y,
+                            const float *speed, int count);
+
+void move_scalar(float *pos_x, float *pos_y, const float *target_x, const float *target_y,
+                 const float *speed, int count);
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MOVEMENT_X86 1
+void move_sse(float *pos_x, float *pos_y, const float *target_x, const float *target_y,
+              const float *speed, int count);
+void move_avx2(float *pos_x, float *pos_y, const float *target_x, const float *target_y,
+               const float *speed, int count);
+#endif
+
+/*
+ * Returns the fastest kernel the CPU supports, and its name in `*name` if
+ * `name` isn't NULL.
+ */
+move_func_t move_select(const char **name);
+
+#endif // MOVEMENT_H
@@ -1,8 +1,24 @@
+// For `accept4`
+#define _GNU_SOURCE
+
 #include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "networking.h"
 
+struct send_chunk_t {
+    struct send_chunk_t *next;
+    frame_t *frame;
+    // Amount of bytes of the frame that were already sent
+    int offset;
+};
+
 int send_all(int sock, uint8_t *msg, int msg_len) {
     int sent;
     while (msg_len > 0) {
@@ -18,3 +34,332 @@ int send_all(int sock, uint8_t *msg, int msg_len) {
     }
     return 0;
 }
+
+int set_nonblocking(int sock) {
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags == -1) {
+        return -1;
+    }
+    return fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+}
+
+int listen_tcp(const char *addr, int port, int backlog, bool reuseport) {
+    struct sockaddr_in server_addr = {0};
+    int saved_errno;
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == -1) {
+        return -1;
+    }
+
+    // Not being able to reuse the address is not fatal
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int));
+    if (reuseport && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &(int){1}, sizeof(int)) == -1) {
+        goto fail;
+    }
+
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    server_addr.sin_addr.s_addr = inet_addr(addr);
+
+    if (bind(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1) {
+        goto fail;
+    }
+    if (listen(sock, backlog) == -1) {
+        goto fail;
+    }
+    if (set_nonblocking(sock) == -1) {
+        goto fail;
+    }
+
+    return sock;
+
+fail:
+    saved_errno = errno;
+    close(sock);
+    errno = saved_errno;
+    return -1;
+}
+
+int bind_udp(const char *addr, int port) {
+    struct sockaddr_in server_addr = {0};
+    int saved_errno;
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock == -1) {
+        return -1;
+    }
+
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    server_addr.sin_addr.s_addr = inet_addr(addr);
+
+    if (bind(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1) {
+        goto fail;
+    }
+    if (set_nonblocking(sock) == -1) {
+        goto fail;
+    }
+
+    return sock;
+
+fail:
+    saved_errno = errno;
+    close(sock);
+    errno = saved_errno;
+    return -1;
+}
+
+int accept_nonblocking(int server_sock) {
+#ifdef __linux__
+    return accept4(server_sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    int sock = accept(server_sock, NULL, NULL);
+    if (sock == -1) {
+        return -1;
+    }
+    if (set_nonblocking(sock) == -1) {
+        int saved_errno = errno;
+        close(sock);
+        errno = saved_errno;
+        return -1;
+    }
+    return sock;
+#endif
+}
+
+frame_t *frame_new(int capacity) {
+    frame_t *frame = malloc(sizeof(frame_t) + capacity);
+    atomic_init(&frame->refcount, 1);
+    frame->len = 0;
+    frame->capacity = capacity;
+    return frame;
+}
+
+frame_t *frame_ref(frame_t *frame) {
+    atomic_fetch_add_explicit(&frame->refcount, 1, memory_order_relaxed);
+    return frame;
+}
+
+void frame_release(frame_t *frame) {
+    if (atomic_fetch_sub_explicit(&frame->refcount, 1, memory_order_acq_rel) == 1) {
+        free(frame);
+    }
+}
+
+static void send_queue_push(send_queue_t *queue, frame_t *frame, int offset) {
+    send_chunk_t *chunk = malloc(sizeof(send_chunk_t));
+    chunk->next = NULL;
+    chunk->frame = frame_ref(frame);
+    chunk->offset = offset;
+
+    if (queue->tail) {
+        queue->tail->next = chunk;
+    } else {
+        queue->head = chunk;
+    }
+    queue->tail = chunk;
+    queue->queued_bytes += frame->len - offset;
+}
+
+/*
+ * Sends as much of `msg` as possible without blocking, if nothing is queued.
+ *
+ * Returns the number of bytes that were sent or -1 on error.
+ */
+static int send_directly(send_queue_t *queue, int sock, uint8_t *msg, int msg_len) {
+    int sent, total = 0;
+
+    // Bytes have to go out in order, so we can only send directly if nothing
+    // is queued
+    if (queue->head) {
+        return 0;
+    }
+
+    while (total < msg_len) {
+        sent = send(sock, msg + total, msg_len - total, 0);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+        total += sent;
+    }
+
+    return total;
+}
+
+int send_queue_write(send_queue_t *queue, int sock, uint8_t *msg, int msg_len) {
+    int sent;
+
+    if (msg_len <= 0) {
+        return 0;
+    }
+
+    sent = send_directly(queue, sock, msg, msg_len);
+    if (sent == -1) {
+        return -1;
+    }
+
+    if (sent < msg_len) {
+        frame_t *frame = frame_new(msg_len - sent);
+        memcpy(frame->data, msg + sent, msg_len - sent);
+        frame->len = msg_len - sent;
+        send_queue_push(queue, frame, 0);
+        frame_release(frame);
+    }
+
+    return 0;
+}
+
+int send_queue_flush(send_queue_t *queue, int sock) {
+    struct iovec iov[SEND_QUEUE_MAX_IOVECS];
+    int iov_count;
+    ssize_t sent;
+
+    while (queue->head) {
+        iov_count = send_queue_peek(queue, iov, SEND_QUEUE_MAX_IOVECS);
+
+        sent = writev(sock, iov, iov_count);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return -1;
+        }
+
+        send_queue_consume(queue, sent);
+    }
+
+    return 0;
+}
+
+void send_queue_push_frame(send_queue_t *queue, frame_t *frame) {
+    if (frame->len > 0) {
+        send_queue_push(queue, frame, 0);
+    }
+}
+
+int send_queue_peek(send_queue_t *queue, struct iovec *iov, int max_iovecs) {
+    int iov_count = 0;
+
+    for (send_chunk_t *chunk = queue->head; chunk && iov_count < max_iovecs; chunk = chunk->next) {
+        iov[iov_count].iov_base = chunk->frame->data + chunk->offset;
+        iov[iov_count].iov_len = chunk->frame->len - chunk->offset;
+        iov_count++;
+    }
+
+    return iov_count;
+}
+
+void send_queue_consume(send_queue_t *queue, int len) {
+    queue->queued_bytes -= len;
+    while (len > 0) {
+        send_chunk_t *chunk = queue->head;
+        int chunk_left = chunk->frame->len - chunk->offset;
+        if (len < chunk_left) {
+            chunk->offset += len;
+            break;
+        }
+        len -= chunk_left;
+        queue->head = chunk->next;
+        frame_release(chunk->frame);
+        free(chunk);
+    }
+    if (!queue->head) {
+        queue->tail = NULL;
+    }
+}
+
+void send_queue_clear(send_queue_t *queue) {
+    send_chunk_t *chunk = queue->head;
+    while (chunk) {
+        send_chunk_t *next = chunk->next;
+        frame_release(chunk->frame);
+        free(chunk);
+        chunk = next;
+    }
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->queued_bytes = 0;
+}
+
+void recv_buffer_init(recv_buffer_t *recv_buffer, int capacity) {
+    recv_buffer->data = malloc(capacity);
+    recv_buffer->capacity = capacity;
+    recv_buffer->start = 0;
+    recv_buffer->end = 0;
+}
+
+void recv_buffer_free(recv_buffer_t *recv_buffer) {
+    free(recv_buffer->data);
+    recv_buffer->data = NULL;
+    recv_buffer->capacity = 0;
+    recv_buffer->start = 0;
+    recv_buffer->end = 0;
+}
+
+/*
+ * Moves the unconsumed bytes to the front. Usually at most a partial message
+ * is left, so this moves only a few bytes.
+ */
+static void recv_buffer_compact(recv_buffer_t *recv_buffer) {
+    int len = recv_buffer_len(recv_buffer);
+    memmove(recv_buffer->data, recv_buffer->data + recv_buffer->start, len);
+    recv_buffer->start = 0;
+    recv_buffer->end = len;
+}
+
+int recv_buffer_read(recv_buffer_t *recv_buffer, int sock) {
+    ssize_t received;
+
+    if (recv_buffer->start > 0 && recv_buffer->end == recv_buffer->capacity) {
+        recv_buffer_compact(recv_buffer);
+    }
+
+    if (recv_buffer->end == recv_buffer->capacity) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    do {
+        received = recv(sock, recv_buffer->data + recv_buffer->end,
+                        recv_buffer->capacity - recv_buffer->end, 0);
+    } while (received == -1 && errno == EINTR);
+
+    if (received > 0) {
+        recv_buffer->end += received;
+    }
+
+    return received;
+}
+
+int recv_buffer_write(recv_buffer_t *recv_buffer, const uint8_t *data, int len) {
+    if (recv_buffer->start > 0 && recv_buffer->end + len > recv_buffer->capacity) {
+        recv_buffer_compact(recv_buffer);
+    }
+
+    int copied = recv_buffer->capacity - recv_buffer->end;
+    if (copied > len) {
+        copied = len;
+    }
+    memcpy(recv_buffer->data + recv_buffer->end, data, copied);
+    recv_buffer->end += copied;
+    return copied;
+}
+
+void recv_buffer_consume(recv_buffer_t *recv_buffer, int len) {
+    recv_buffer->start += len;
+    if (recv_buffer->start >= recv_buffer->end) {
+        // Everything was consumed, so start at the front again
+        recv_buffer->start = 0;
+        recv_buffer->end = 0;
+    }
+}
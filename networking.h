@@ -1,8 +1,161 @@
 #ifndef NETWORKING_H
 #define NETWORKING_H
 
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <sys/uio.h>
+
+// Maximum amount of chunks that are written with one `writev` call
+#define SEND_QUEUE_MAX_IOVECS 64
+
+/*
+ * Immutable, reference counted byte buffer. A message that goes to many
+ * players is serialized into one frame once, and every send queue that has to
+ * hold on to it only keeps a reference instead of a copy. The reference count
+ * is atomic, so frames can be shared between threads.
+ */
+typedef struct frame_t {
+    atomic_int refcount;
+    int len;
+    int capacity;
+    uint8_t data[];
+} frame_t;
+
+typedef struct send_chunk_t send_chunk_t;
+
+/*
+ * Queue of outbound bytes for a non-blocking socket. Bytes that the kernel
+ * doesn't accept right away are buffered here until the socket becomes
+ * writable again.
+ */
+typedef struct send_queue_t {
+    send_chunk_t *head;
+    send_chunk_t *tail;
+    int queued_bytes;
+} send_queue_t;
+
+/*
+ * Per-connection receive buffer. Bytes are read into the free space at the end
+ * and consumed from the front, so partial messages stay buffered until the
+ * rest arrives.
+ */
+typedef struct recv_buffer_t {
+    uint8_t *data;
+    int capacity;
+    // Unconsumed bytes are `data[start..end)`
+    int start;
+    int end;
+} recv_buffer_t;
 
 int send_all(int sock, uint8_t *msg, int msg_len);
 
+int set_nonblocking(int sock);
+
+/*
+ * Creates a non-blocking TCP socket that listens on `addr`:`port`. With
+ * `reuseport`, several sockets can listen on the same port (`SO_REUSEPORT`) and
+ * the kernel spreads incoming connections over them.
+ *
+ * Returns the socket or -1 on error (with `errno` set).
+ */
+int listen_tcp(const char *addr, int port, int backlog, bool reuseport);
+
+/*
+ * Creates a non-blocking UDP socket that is bound to `addr`:`port`.
+ *
+ * Returns the socket or -1 on error (with `errno` set).
+ */
+int bind_udp(const char *addr, int port);
+
+/*
+ * Accepts a connection on the non-blocking `server_sock` and puts it into
+ * non-blocking mode, with a single syscall where the OS supports it.
+ *
+ * Returns the socket or -1 on error (with `errno` set, `EAGAIN` if the backlog
+ * is empty).
+ */
+int accept_nonblocking(int server_sock);
+
+/*
+ * Allocates an empty frame that can hold `capacity` bytes, with a reference
+ * count of 1. The frame must not be modified after it was handed to a send
+ * queue.
+ */
+frame_t *frame_new(int capacity);
+frame_t *frame_ref(frame_t *frame);
+void frame_release(frame_t *frame);
+
+/*
+ * Sends `msg` on the non-blocking `sock`, or queues it if earlier bytes are
+ * still queued or the socket buffer is full.
+ *
+ * Returns 0 on success and -1 if the socket had an error (with `errno` set).
+ */
+int send_queue_write(send_queue_t *queue, int sock, uint8_t *msg, int msg_len);
+
+/*
+ * Writes as many queued bytes to `sock` as possible. Should be called when the
+ * socket becomes writable.
+ *
+ * Returns 0 on success (even if bytes remain queued) and -1 if the socket had
+ * an error (with `errno` set).
+ */
+int send_queue_flush(send_queue_t *queue, int sock);
+
+/*
+ * Queues a reference to the frame without sending anything, for queues that
+ * are written with a send that completes later (see `event_loop_send`).
+ */
+void send_queue_push_frame(send_queue_t *queue, frame_t *frame);
+
+/*
+ * Points at most `max_iovecs` entries of `iov` at the queued bytes, in order.
+ * The bytes stay queued until they are consumed.
+ *
+ * Returns the number of entries.
+ */
+int send_queue_peek(send_queue_t *queue, struct iovec *iov, int max_iovecs);
+
+/*
+ * Removes the first `len` queued bytes, after they were sent.
+ */
+void send_queue_consume(send_queue_t *queue, int len);
+
+void send_queue_clear(send_queue_t *queue);
+
+void recv_buffer_init(recv_buffer_t *recv_buffer, int capacity);
+void recv_buffer_free(recv_buffer_t *recv_buffer);
+
+/*
+ * Receives as many bytes from `sock` as fit into the buffer. Unconsumed bytes
+ * are moved to the front first, if that frees up space.
+ *
+ * Returns the number of received bytes, 0 if the peer closed the connection
+ * and -1 on error (with `errno` set, `EAGAIN` if no bytes are available).
+ */
+int recv_buffer_read(recv_buffer_t *recv_buffer, int sock);
+
+/*
+ * Copies as many of the `len` bytes into the buffer as fit, for bytes that
+ * were already received (see `event_loop_add`). Unconsumed bytes are moved to
+ * the front first, if that frees up space.
+ *
+ * Returns the number of copied bytes.
+ */
+int recv_buffer_write(recv_buffer_t *recv_buffer, const uint8_t *data, int len);
+
+static inline uint8_t *recv_buffer_data(recv_buffer_t *recv_buffer) {
+    return recv_buffer->data + recv_buffer->start;
+}
+
+static inline int recv_buffer_len(recv_buffer_t *recv_buffer) {
+    return recv_buffer->end - recv_buffer->start;
+}
+
+/*
+ * Marks the first `len` unconsumed bytes as consumed.
+ */
+void recv_buffer_consume(recv_buffer_t *recv_buffer, int len);
+
 #endif // NETWORKING_H
@@ -0,0 +1,205 @@
+#include "player_cells.h"
+
+#include <math.h>
+
+// Enough slots for a turn of the wheel to cover the usual merge delays
+#define MERGE_TIMER_SLOTS 256
+
+void player_cells_init(player_cells_t *cells, int max_players, float width, float height, float speed,
+                       uint32_t merge_ticks) {
+    int capacity = max_players * MAX_PLAYER_CELLS;
+    cell_pool_init(&cells->pool, capacity);
+    player_eating_init(&cells->eating, capacity);
+    timer_wheel_init(&cells->merge_timers, capacity, MERGE_TIMER_SLOTS);
+    cells->merge_ticks = merge_ticks;
+    cells->speed = speed;
+    cells->width = width;
+    cells->height = height;
+}
+
+void player_cells_free(player_cells_t *cells) {
+    cell_pool_free(&cells->pool);
+    player_eating_free(&cells->eating);
+    timer_wheel_free(&cells->merge_timers);
+}
+
+int player_cells_spawn(player_cells_t *cells, player_table_t *players, player_t *player, float x, float y, int mass) {
+    if (player->cell_count == MAX_PLAYER_CELLS) {
+        return -1;
+    }
+
+    cell_pool_t *pool = &cells->pool;
+    int handle = cell_pool_alloc(pool, player - players->slots);
+    int idx = pool->cells[handle].idx;
+    pool->pos_x[idx] = pool->target_x[idx] = x;
+    pool->pos_y[idx] = pool->target_y[idx] = y;
+    pool->speed[idx] = cells->speed;
+    pool->mass[idx] = mass;
+    pool->boost_x[idx] = 0;
+    pool->boost_y[idx] = 0;
+    pool->cells[handle].can_merge = true;
+    player_eating_add(&cells->eating, pool, handle);
+
+    player->cells[player->cell_count++] = handle;
+    player->target_x = x;
+    player->target_y = y;
+    return handle;
+}
+
+void player_cells_remove(player_cells_t *cells, player_t *player, int handle) {
+    for (int i = 0; i < player->cell_count; i++) {
+        if (player->cells[i] == handle) {
+            player->cells[i] = player->cells[--player->cell_count];
+            break;
+        }
+    }
+
+    player_eating_remove(&cells->eating, &cells->pool, handle);
+    timer_wheel_cancel(&cells->merge_timers, handle);
+    cell_pool_release(&cells->pool, handle);
+}
+
+void player_cells_remove_all(player_cells_t *cells, player_t *player) {
+    while (player->cell_count > 0) {
+        player_cells_remove(cells, player, player->cells[player->cell_count - 1]);
+    }
+}
+
+void player_cells_set_target(player_cells_t *cells, player_t *player, float x, float y) {
+    cell_pool_t *pool = &cells->pool;
+
+    player->target_x = x;
+    player->target_y = y;
+    for (int i = 0; i < player->cell_count; i++) {
+        int idx = pool->cells[player->cells[i]].idx;
+        pool->target_x[idx] = x;
+        pool->target_y[idx] = y;
+    }
+}
+
+static void start_merge_timer(player_cells_t *cells, int handle) {
+    cells->pool.cells[handle].can_merge = false;
+    timer_wheel_schedule(&cells->merge_timers, handle, cells->merge_ticks);
+}
+
+int player_cells_split(player_cells_t *cells, player_table_t *players, player_t *player) {
+    cell_pool_t *pool = &cells->pool;
+    int cell_count = player->cell_count;
+
+    // Cells that are split off now don't split again
+    for (int i = 0; i < cell_count && player->cell_count < MAX_PLAYER_CELLS; i++) {
+        int handle = player->cells[i];
+        int idx = pool->cells[handle].idx;
+        if (pool->mass[idx] < MIN_SPLIT_MASS) {
+            continue;
+        }
+
+        // Allocating appends to the dense array, so `idx` stays valid
+        int new_handle = cell_pool_alloc(pool, player - players->slots);
+        int new_idx = pool->cells[new_handle].idx;
+        int half = pool->mass[idx] / 2;
+        pool->mass[idx] -= half;
+        pool->mass[new_idx] = half;
+        pool->pos_x[new_idx] = pool->pos_x[idx];
+        pool->pos_y[new_idx] = pool->pos_y[idx];
+        pool->target_x[new_idx] = player->target_x;
+        pool->target_y[new_idx] = player->target_y;
+        pool->speed[new_idx] = pool->speed[idx];
+
+        // The new cell is shot towards the target, or to the right if the cell
+        // is already there
+        float dx = player->target_x - pool->pos_x[idx];
+        float dy = player->target_y - pool->pos_y[idx];
+        float distance = sqrtf(dx * dx + dy * dy);
+        if (distance < 1) {
+            dx = 1;
+            dy = 0;
+            distance = 1;
+        }
+        pool->boost_x[new_idx] = dx / distance * SPLIT_BOOST;
+        pool->boost_y[new_idx] = dy / distance * SPLIT_BOOST;
+
+        player_eating_add(&cells->eating, pool, new_handle);
+        player->cells[player->cell_count++] = new_handle;
+        start_merge_timer(cells, handle);
+        start_merge_timer(cells, new_handle);
+    }
+
+    return player->cell_count - cell_count;
+}
+
+static void fly(player_cells_t *cells) {
+    cell_pool_t *pool = &cells->pool;
+
+    for (int i = 0; i < pool->count; i++) {
+        if (pool->boost_x[i] == 0 && pool->boost_y[i] == 0) {
+            continue;
+        }
+
+        pool->pos_x[i] = fminf(fmaxf(pool->pos_x[i] + pool->boost_x[i], 0), cells->width);
+        pool->pos_y[i] = fminf(fmaxf(pool->pos_y[i] + pool->boost_y[i], 0), cells->height);
+        pool->boost_x[i] *= SPLIT_BOOST_DECAY;
+        pool->boost_y[i] *= SPLIT_BOOST_DECAY;
+        if (fabsf(pool->boost_x[i]) + fabsf(pool->boost_y[i]) < MIN_SPLIT_BOOST) {
+            pool->boost_x[i] = 0;
+            pool->boost_y[i] = 0;
+        }
+    }
+}
+
+static void allow_merge(void *udata, int handle) {
+    cell_pool_t *pool = udata;
+    pool->cells[handle].can_merge = true;
+}
+
+/*
+ * Returns whether one of the cells covers the center of the other.
+ */
+static bool cells_overlap(cell_pool_t *pool, int a, int b) {
+    float dx = pool->pos_x[a] - pool->pos_x[b];
+    float dy = pool->pos_y[a] - pool->pos_y[b];
+    float radius = player_radius(pool->mass[a] > pool->mass[b] ? pool->mass[a] : pool->mass[b]);
+    return dx * dx + dy * dy < radius * radius;
+}
+
+static void merge(player_cells_t *cells, player_t *player) {
+    cell_pool_t *pool = &cells->pool;
+
+    for (int i = 0; i < player->cell_count; i++) {
+        int handle = player->cells[i];
+        if (!pool->cells[handle].can_merge) {
+            continue;
+        }
+
+        for (int j = i + 1; j < player->cell_count;) {
+            int other = player->cells[j];
+            int idx = pool->cells[handle].idx;
+            int other_idx = pool->cells[other].idx;
+            if (!pool->cells[other].can_merge || !cells_overlap(pool, idx, other_idx)) {
+                j++;
+                continue;
+            }
+
+            // The merged cell is where the heavier one was
+            if (pool->mass[other_idx] > pool->mass[idx]) {
+                pool->pos_x[idx] = pool->pos_x[other_idx];
+                pool->pos_y[idx] = pool->pos_y[other_idx];
+            }
+            pool->mass[idx] += pool->mass[other_idx];
+            // Moves the last cell of the player to `j`, which is checked next
+            player_cells_remove(cells, player, other);
+        }
+    }
+}
+
+void player_cells_update(player_cells_t *cells, player_table_t *players) {
+    fly(cells);
+    timer_wheel_advance(&cells->merge_timers, allow_merge, &cells->pool);
+
+    for (int i = 0; i < players->joined_count; i++) {
+        player_t *player = player_table_joined(players, i);
+        if (player->cell_count > 1) {
+            merge(cells, player);
+        }
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef PLAYER_CELLS_H
+#define PLAYER_CELLS_H
+
+#include <stdint.h>
+
+#include "cell_pool.h"
+#include "player_eating.h"
+#include "player_table.h"
+#include "timer_wheel.h"
+
+// A cell needs this much mass to split, so both halves are at least as heavy
+// as a new player
+#define MIN_SPLIT_MASS 20
+
+// A cell that is split off flies towards the target of its player with this
+// speed, which decays every tick, so it flies about
+// SPLIT_BOOST / (1 - SPLIT_BOOST_DECAY) units on top of its normal movement
+#define SPLIT_BOOST 6.0f
+#define SPLIT_BOOST_DECAY 0.9f
+// Slower boosts are dropped
+#define MIN_SPLIT_BOOST 0.05f
+
+/*
+ * The cells of all players and the rules for splitting and merging them.
+ *
+ * A player starts with one cell and can split every cell that is heavy enough
+ * into two halves, up to MAX_PLAYER_CELLS cells. Both halves have to wait
+ * `merge_ticks` before they may merge with other cells of the player again.
+ * The waiting is done by a timer wheel, so the tick only touches the cells
+ * whose timer expires. Cells that may merge and overlap the center of each
+ * other are merged into the heavier one.
+ *
+ * New cells are taken from the pool, which is large enough for every player
+ * to have MAX_PLAYER_CELLS cells, so splitting never allocates memory.
+ */
+typedef struct player_cells_t {
+    cell_pool_t pool;
+    // Broadphase for eating, which has to know about every cell
+    player_eating_t eating;
+    timer_wheel_t merge_timers;
+    uint32_t merge_ticks;
+    // Speed of new cells
+    float speed;
+    // Cells never fly out of the field
+    float width;
+    float height;
+} player_cells_t;
+
+void player_cells_init(player_cells_t *cells, int max_players, float width, float height, float speed,
+                       uint32_t merge_ticks);
+void player_cells_free(player_cells_t *cells);
+
+/*
+ * Gives the player a cell at the position, and makes the position its target.
+ *
+ * Returns the handle of the cell, or -1 if the player already has
+ * MAX_PLAYER_CELLS cells.
+ */
+int player_cells_spawn(player_cells_t *cells, player_table_t *players, player_t *player, float x, float y, int mass);
+
+/*
+ * Removes one cell of the player, e.g. because it was eaten. The player is
+ * left without a cell if it was the last one.
+ */
+void player_cells_remove(player_cells_t *cells, player_t *player, int handle);
+void player_cells_remove_all(player_cells_t *cells, player_t *player);
+
+void player_cells_set_target(player_cells_t *cells, player_t *player, float x, float y);
+
+/*
+ * Splits every cell of the player that is heavy enough, as long as the player
+ * has less than MAX_PLAYER_CELLS cells.
+ *
+ * Returns the number of new cells.
+ */
+int player_cells_split(player_cells_t *cells, player_table_t *players, player_t *player);
+
+/*
+ * Moves the cells that were split off, runs the merge timers and merges the
+ * cells of the players. Has to be called once per tick.
+ */
+void player_cells_update(player_cells_t *cells, player_table_t *players);
+
+#endif // PLAYER_CELLS_H
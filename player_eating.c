@@ -0,0 +1,182 @@
+#include "player_eating.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct query_context_t {
+    player_eating_t *eating;
+    cell_pool_t *pool;
+    int eater;
+} query_context_t;
+
+typedef struct sort_context_t {
+    cell_pool_t *pool;
+    player_table_t *players;
+} sort_context_t;
+
+static aabb_t cell_box(cell_pool_t *pool, int idx) {
+    float radius = player_radius(pool->mass[idx]);
+    return (aabb_t){
+        pool->pos_x[idx] - radius, pool->pos_y[idx] - radius,
+        pool->pos_x[idx] + radius, pool->pos_y[idx] + radius,
+    };
+}
+
+void player_eating_init(player_eating_t *eating, int capacity) {
+    memset(eating, 0, sizeof(player_eating_t));
+    aabb_tree_init(&eating->tree, EAT_BROADPHASE_MARGIN);
+    // A cell is inserted when a player splits, which must not allocate
+    aabb_tree_reserve(&eating->tree, capacity);
+    eating->eaten = calloc(capacity, sizeof(bool));
+    eating->order = malloc(capacity * sizeof(int));
+}
+
+void player_eating_free(player_eating_t *eating) {
+    aabb_tree_free(&eating->tree);
+    free(eating->eats);
+    free(eating->eaten);
+    free(eating->order);
+}
+
+void player_eating_add(player_eating_t *eating, cell_pool_t *pool, int handle) {
+    cell_t *cell = cell_pool_get(pool, handle);
+    cell->proxy = aabb_tree_insert(&eating->tree, cell_box(pool, cell->idx), handle);
+}
+
+void player_eating_remove(player_eating_t *eating, cell_pool_t *pool, int handle) {
+    aabb_tree_remove(&eating->tree, cell_pool_get(pool, handle)->proxy);
+}
+
+void player_eating_update(player_eating_t *eating, cell_pool_t *pool) {
+    for (int i = 0; i < pool->count; i++) {
+        cell_t *cell = cell_pool_get(pool, pool->handles[i]);
+        aabb_tree_move(&eating->tree, cell->proxy, cell_box(pool, i));
+    }
+}
+
+bool player_can_eat(cell_pool_t *pool, int eater, int prey) {
+    if (pool->cells[pool->handles[eater]].owner == pool->cells[pool->handles[prey]].owner) {
+        return false;
+    }
+    if ((long long)pool->mass[prey] * EAT_MASS_NUMERATOR > (long long)pool->mass[eater] * EAT_MASS_DENOMINATOR) {
+        return false;
+    }
+
+    float dx = pool->pos_x[prey] - pool->pos_x[eater];
+    float dy = pool->pos_y[prey] - pool->pos_y[eater];
+    float radius = player_radius(pool->mass[eater]);
+    return dx * dx + dy * dy < radius * radius;
+}
+
+static void add_candidate(void *udata, int handle) {
+    query_context_t *ctx = udata;
+    player_eating_t *eating = ctx->eating;
+    int prey = ctx->pool->cells[handle].idx;
+
+    if (prey == ctx->eater || !player_can_eat(ctx->pool, ctx->eater, prey)) {
+        return;
+    }
+
+    if (eating->eat_count == eating->eat_capacity) {
+        eating->eat_capacity = eating->eat_capacity ? eating->eat_capacity * 2 : 64;
+        eating->eats = realloc(eating->eats, eating->eat_capacity * sizeof(player_eat_t));
+    }
+    eating->eats[eating->eat_count++] = (player_eat_t){
+        .eater = ctx->pool->handles[ctx->eater],
+        .prey = handle,
+    };
+}
+
+// `qsort` has no context argument, and the simulation is single-threaded
+static sort_context_t sort_ctx;
+
+static int compare_cells(int a, int b) {
+    cell_pool_t *pool = sort_ctx.pool;
+    cell_t *a_cell = &pool->cells[a];
+    cell_t *b_cell = &pool->cells[b];
+
+    int a_mass = pool->mass[a_cell->idx];
+    int b_mass = pool->mass[b_cell->idx];
+    if (a_mass != b_mass) {
+        return a_mass > b_mass ? -1 : 1;
+    }
+
+    int a_id = sort_ctx.players->slots[a_cell->owner].id;
+    int b_id = sort_ctx.players->slots[b_cell->owner].id;
+    if (a_id != b_id) {
+        return a_id < b_id ? -1 : 1;
+    }
+    return a < b ? -1 : (a > b);
+}
+
+static int compare_eats(const void *a_ptr, const void *b_ptr) {
+    const player_eat_t *a = a_ptr;
+    const player_eat_t *b = b_ptr;
+
+    if (a->eater != b->eater) {
+        return compare_cells(a->eater, b->eater);
+    }
+    return compare_cells(a->prey, b->prey);
+}
+
+static int compare_handles(const void *a, const void *b) {
+    return compare_cells(*(const int *)a, *(const int *)b);
+}
+
+/*
+ * Keeps the eats in `eats[start..count)` whose eater and prey weren't eaten
+ * before, and returns the new count.
+ */
+static int keep_possible_eats(player_eat_t *eats, int start, int count, bool *eaten) {
+    int kept = start;
+    for (int i = start; i < count; i++) {
+        if (eaten[eats[i].eater] || eaten[eats[i].prey]) {
+            continue;
+        }
+        eaten[eats[i].prey] = true;
+        eats[kept++] = eats[i];
+    }
+    return kept;
+}
+
+int player_eating_order(player_eat_t *eats, int count, bool *eaten, cell_pool_t *pool, player_table_t *players) {
+    sort_ctx = (sort_context_t){pool, players};
+    qsort(eats, count, sizeof(player_eat_t), compare_eats);
+
+    int kept = keep_possible_eats(eats, 0, count, eaten);
+    // Only the prey of kept eats were marked
+    for (int i = 0; i < kept; i++) {
+        eaten[eats[i].prey] = false;
+    }
+    return kept;
+}
+
+int player_eating_resolve(player_eating_t *eating, cell_pool_t *pool, player_table_t *players) {
+    query_context_t ctx = {.eating = eating, .pool = pool};
+
+    // Same order as `player_eating_order`, but eaters are visited one by one,
+    // so only the candidates of one eater are sorted at a time, and cells that
+    // were eaten already aren't searched at all
+    sort_ctx = (sort_context_t){pool, players};
+    memcpy(eating->order, pool->handles, pool->count * sizeof(int));
+    qsort(eating->order, pool->count, sizeof(int), compare_handles);
+
+    eating->eat_count = 0;
+    for (int i = 0; i < pool->count; i++) {
+        int eater = eating->order[i];
+        if (eating->eaten[eater]) {
+            continue;
+        }
+
+        int start = eating->eat_count;
+        ctx.eater = pool->cells[eater].idx;
+        aabb_tree_query(&eating->tree, cell_box(pool, ctx.eater), add_candidate, &ctx);
+        qsort(eating->eats + start, eating->eat_count - start, sizeof(player_eat_t), compare_eats);
+        eating->eat_count = keep_possible_eats(eating->eats, start, eating->eat_count, eating->eaten);
+    }
+
+    for (int i = 0; i < eating->eat_count; i++) {
+        eating->eaten[eating->eats[i].prey] = false;
+    }
+    return eating->eat_count;
+}
@@ -0,0 +1,84 @@
+#ifndef PLAYER_EATING_H
+#define PLAYER_EATING_H
+
+#include <stdbool.h>
+
+#include "aabb_tree.h"
+#include "cell_pool.h"
+#include "player_table.h"
+
+// A cell can eat a cell of another player whose mass is at most 4/5 of its
+// own, and whose center it covers
+#define EAT_MASS_NUMERATOR 5
+#define EAT_MASS_DENOMINATOR 4
+
+// How far the broadphase boxes are enlarged. Cells move 0.5 per tick, so
+// their leaves are only reinserted every few ticks.
+#define EAT_BROADPHASE_MARGIN 8
+
+typedef struct player_eat_t {
+    // Handles of the cells in the cell pool
+    int eater;
+    int prey;
+} player_eat_t;
+
+/*
+ * Finds the cells of players that eat each other. Every cell has a leaf in a
+ * dynamic AABB tree, so the candidates of a cell are found without checking
+ * all other cells.
+ *
+ * Eats are resolved in a deterministic order: heavier eaters go first, ties
+ * are broken by the player id of the owner and then by the cell handle, and an
+ * eater eats its prey in the order of decreasing mass. A cell that is eaten
+ * can't eat anymore in the same tick, and a cell is eaten at most once.
+ */
+typedef struct player_eating_t {
+    aabb_tree_t tree;
+    // Eats of the last `player_eating_resolve`
+    player_eat_t *eats;
+    int eat_count;
+    int eat_capacity;
+    // Whether the cell with the handle was eaten, during resolving
+    bool *eaten;
+    // Handles of the cells, heaviest first
+    int *order;
+} player_eating_t;
+
+/*
+ * Creates the broadphase for a cell pool with the given capacity.
+ */
+void player_eating_init(player_eating_t *eating, int capacity);
+void player_eating_free(player_eating_t *eating);
+
+/*
+ * Has to be called for a new cell after its body is set, and before the cell
+ * is released.
+ */
+void player_eating_add(player_eating_t *eating, cell_pool_t *pool, int handle);
+void player_eating_remove(player_eating_t *eating, cell_pool_t *pool, int handle);
+
+/*
+ * Updates the broadphase after cells moved or changed their mass.
+ */
+void player_eating_update(player_eating_t *eating, cell_pool_t *pool);
+
+/*
+ * Stores the eats in `eating->eats`, in the order in which they have to be
+ * applied, and returns their count. The pool is not modified.
+ */
+int player_eating_resolve(player_eating_t *eating, cell_pool_t *pool, player_table_t *players);
+
+/*
+ * Sorts eat candidates into resolution order and drops the ones that are
+ * impossible because the eater or the prey was eaten before. Returns the new
+ * count. Exposed for checking the broadphase against a brute force search.
+ */
+int player_eating_order(player_eat_t *eats, int count, bool *eaten, cell_pool_t *pool, player_table_t *players);
+
+/*
+ * Returns whether the cell at index `eater` of the pool's dense array can eat
+ * the cell at index `prey`.
+ */
+bool player_can_eat(cell_pool_t *pool, int eater, int prey);
+
+#endif // PLAYER_EATING_H
@@ -0,0 +1,129 @@
+#include "player_table.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t conn_hash(player_table_t *table, uint32_t conn_id) {
+    // Fibonacci hashing, connection ids are mostly sequential
+    return (conn_id * 2654435769u) & table->conn_mask;
+}
+
+void player_table_init(player_table_t *table, int capacity) {
+    // The hash map is kept at most half full, so probe sequences stay short
+    uint32_t map_size = 1;
+    while (map_size < (uint32_t)capacity * 2) {
+        map_size *= 2;
+    }
+
+    table->capacity = capacity;
+    table->slots = calloc(capacity, sizeof(player_t));
+    table->free_slots = malloc(capacity * sizeof(int));
+    table->joined = malloc(capacity * sizeof(int));
+    table->joined_count = 0;
+    table->slot_by_conn = malloc(map_size * sizeof(int));
+    table->conn_mask = map_size - 1;
+    memset(table->slot_by_conn, -1, map_size * sizeof(int));
+
+    // Lower slots are handed out first
+    table->free_count = capacity;
+    for (int i = 0; i < capacity; i++) {
+        table->free_slots[i] = capacity - 1 - i;
+    }
+}
+
+void player_table_free(player_table_t *table) {
+    for (uint32_t i = 0; i <= table->conn_mask; i++) {
+        if (table->slot_by_conn[i] != -1) {
+            free(table->slots[table->slot_by_conn[i]].name);
+        }
+    }
+    free(table->slots);
+    free(table->free_slots);
+    free(table->joined);
+    free(table->slot_by_conn);
+}
+
+player_t *player_table_add(player_table_t *table, uint32_t conn_id) {
+    if (table->free_count == 0) {
+        return NULL;
+    }
+
+    int slot = table->free_slots[--table->free_count];
+    player_t *player = &table->slots[slot];
+    memset(player, 0, sizeof(player_t));
+    player->conn_id = conn_id;
+
+    uint32_t bucket = conn_hash(table, conn_id);
+    while (table->slot_by_conn[bucket] != -1) {
+        bucket = (bucket + 1) & table->conn_mask;
+    }
+    table->slot_by_conn[bucket] = slot;
+
+    return player;
+}
+
+player_t *player_table_get(player_table_t *table, uint32_t conn_id) {
+    uint32_t bucket = conn_hash(table, conn_id);
+    int slot;
+
+    while ((slot = table->slot_by_conn[bucket]) != -1) {
+        if (table->slots[slot].conn_id == conn_id) {
+            return &table->slots[slot];
+        }
+        bucket = (bucket + 1) & table->conn_mask;
+    }
+    return NULL;
+}
+
+/*
+ * Deletes the bucket and moves later entries of the probe sequence back, so
+ * lookups never need tombstones.
+ */
+static void remove_bucket(player_table_t *table, uint32_t bucket) {
+    uint32_t hole = bucket;
+
+    for (;;) {
+        bucket = (bucket + 1) & table->conn_mask;
+        int slot = table->slot_by_conn[bucket];
+        if (slot == -1) {
+            break;
+        }
+
+        // An entry may only move back if the hole lies between its home
+        // bucket and its current bucket
+        uint32_t home = conn_hash(table, table->slots[slot].conn_id);
+        if (((bucket - home) & table->conn_mask) >= ((bucket - hole) & table->conn_mask)) {
+            table->slot_by_conn[hole] = slot;
+            hole = bucket;
+        }
+    }
+    table->slot_by_conn[hole] = -1;
+}
+
+void player_table_remove(player_table_t *table, player_t *player) {
+    int slot = player - table->slots;
+
+    uint32_t bucket = conn_hash(table, player->conn_id);
+    while (table->slot_by_conn[bucket] != slot) {
+        bucket = (bucket + 1) & table->conn_mask;
+    }
+    remove_bucket(table, bucket);
+
+    if (player->joined) {
+        // Swap-remove from the joined array
+        int idx = player->joined_idx;
+        int last = --table->joined_count;
+        table->joined[idx] = table->joined[last];
+        table->slots[table->joined[idx]].joined_idx = idx;
+    }
+
+    free(player->name);
+    player->name = NULL;
+    table->free_slots[table->free_count++] = slot;
+}
+
+void player_table_join(player_table_t *table, player_t *player) {
+    player->joined = true;
+    player->joined_idx = table->joined_count;
+    table->joined[table->joined_count++] = player - table->slots;
+}
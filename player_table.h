@@ -0,0 +1,99 @@
+#ifndef PLAYER_TABLE_H
+#define PLAYER_TABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+// Splitting stops once a player owns this many cells
+#define MAX_PLAYER_CELLS 16
+
+// TODO: Add way to disconnect players that don't join in time to prevent denial
+// of service attacks
+typedef struct player_t {
+    // Connection of the player in `server_io`
+    uint32_t conn_id;
+    int id;
+    char *name;
+    rejoin_token_t rejoin_token;
+    bool joined;
+    // Index in the table's joined array, only valid while `joined` is set
+    int joined_idx;
+    // Handles of the player's cells in the cell pool
+    int cells[MAX_PLAYER_CELLS];
+    int cell_count;
+    // Where the player steers its cells
+    float target_x;
+    float target_y;
+} player_t;
+
+/*
+ * Fixed-capacity storage for the players of a game. Players live in a slot
+ * array that is allocated once, so player pointers stay valid until the player
+ * is removed. All operations are O(1):
+ *
+ * - free slots are kept on a stack,
+ * - players are found by connection id through an open addressing hash map,
+ * - joined players are kept in a dense array without gaps, which is what the
+ *   tick iterates over. Removing a player moves the last joined player into
+ *   its place, so the order of the array is not stable.
+ *
+ * The bodies of the players are stored in a separate cell pool (see
+ * `cell_pool.h`).
+ */
+typedef struct player_table_t {
+    int capacity;
+    player_t *slots;
+    int *free_slots;
+    int free_count;
+    // Slot of every connection id, linear probing, -1 marks an empty bucket
+    int *slot_by_conn;
+    uint32_t conn_mask;
+    // Slots of the joined players
+    int *joined;
+    int joined_count;
+} player_table_t;
+
+void player_table_init(player_table_t *table, int capacity);
+
+/*
+ * Frees the table and all players in it.
+ */
+void player_table_free(player_table_t *table);
+
+/*
+ * Adds a player that is not joined yet for the connection.
+ *
+ * Returns NULL if the table is full.
+ */
+player_t *player_table_add(player_table_t *table, uint32_t conn_id);
+
+/*
+ * Removes the player from the table and frees its name. The pointer must not
+ * be used afterwards.
+ */
+void player_table_remove(player_table_t *table, player_t *player);
+
+/*
+ * Returns the player of the connection or NULL if there is none.
+ */
+player_t *player_table_get(player_table_t *table, uint32_t conn_id);
+
+/*
+ * Marks the player as joined and appends it to the joined array.
+ */
+void player_table_join(player_table_t *table, player_t *player);
+
+/*
+ * Returns the number of players in the table, joined or not.
+ */
+static inline int player_table_count(player_table_t *table) {
+    return table->capacity - table->free_count;
+}
+
+static inline player_t *player_table_joined(player_table_t *table, int idx) {
+    return &table->slots[table->joined[idx]];
+}
+
+#endif // PLAYER_TABLE_H
@@ -0,0 +1,75 @@
+#include "profiler.h"
+
+#include <stdlib.h>
+
+#include "log.h"
+#include "tick_scheduler.h"
+
+void profiler_init(profiler_t *profiler, int phase_count, const char *const *phase_names) {
+    profiler->phase_count = phase_count;
+    profiler->phase_names = phase_names;
+    profiler->phases = malloc(phase_count * sizeof(hdr_histogram_t));
+    for (int i = 0; i < phase_count; i++) {
+        hdr_histogram_init(&profiler->phases[i]);
+    }
+    hdr_histogram_init(&profiler->total);
+    profiler->start_nsec = 0;
+    profiler->lap_nsec = 0;
+}
+
+void profiler_free(profiler_t *profiler) {
+    for (int i = 0; i < profiler->phase_count; i++) {
+        hdr_histogram_free(&profiler->phases[i]);
+    }
+    free(profiler->phases);
+    hdr_histogram_free(&profiler->total);
+}
+
+void profiler_start(profiler_t *profiler) {
+    profiler->start_nsec = monotonic_nsec();
+    profiler->lap_nsec = profiler->start_nsec;
+}
+
+long long profiler_lap(profiler_t *profiler, int phase) {
+    long long now = monotonic_nsec();
+    long long elapsed = now - profiler->lap_nsec;
+    hdr_histogram_record(&profiler->phases[phase], elapsed);
+    profiler->lap_nsec = now;
+    return elapsed;
+}
+
+void profiler_stop(profiler_t *profiler) {
+    hdr_histogram_record(&profiler->total, profiler->lap_nsec - profiler->start_nsec);
+}
+
+void profiler_merge(profiler_t *dst, profiler_t *src) {
+    for (int i = 0; i < dst->phase_count; i++) {
+        hdr_histogram_merge(&dst->phases[i], &src->phases[i]);
+    }
+    hdr_histogram_merge(&dst->total, &src->total);
+}
+
+void profiler_reset(profiler_t *profiler) {
+    for (int i = 0; i < profiler->phase_count; i++) {
+        hdr_histogram_reset(&profiler->phases[i]);
+    }
+    hdr_histogram_reset(&profiler->total);
+}
+
+static void report_histogram(const char *name, const char *phase, hdr_histogram_t *histogram) {
+    log_info("%s %-10s n %8llu, p50 %8.1f us, p99 %8.1f us, p99.9 %8.1f us, max %8.1f us", name, phase,
+             (unsigned long long)histogram->total_count, hdr_histogram_percentile(histogram, 50) / 1e3,
+             hdr_histogram_percentile(histogram, 99) / 1e3, hdr_histogram_percentile(histogram, 99.9) / 1e3,
+             histogram->max / 1e3);
+}
+
+void profiler_report(profiler_t *profiler, const char *name) {
+    if (profiler->total.total_count > 0) {
+        report_histogram(name, "total", &profiler->total);
+    }
+    for (int i = 0; i < profiler->phase_count; i++) {
+        if (profiler->phases[i].total_count > 0) {
+            report_histogram(name, profiler->phase_names[i], &profiler->phases[i]);
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "hdr_histogram.h"
+
+/*
+ * Records how long the phases of a repeated piece of work take, e.g. of a
+ * tick. The work is timed like a stopwatch: `profiler_start` starts it, and
+ * every `profiler_lap` records the time since the previous lap into the
+ * histogram of a phase, so every phase boundary costs one `CLOCK_MONOTONIC`
+ * read.
+ *
+ * A profiler belongs to one thread.
+ */
+typedef struct profiler_t {
+    int phase_count;
+    const char *const *phase_names;
+    hdr_histogram_t *phases;
+    // From `profiler_start` to the last lap
+    hdr_histogram_t total;
+    long long start_nsec;
+    long long lap_nsec;
+} profiler_t;
+
+void profiler_init(profiler_t *profiler, int phase_count, const char *const *phase_names);
+void profiler_free(profiler_t *profiler);
+
+void profiler_start(profiler_t *profiler);
+
+/*
+ * Records the time since the previous lap, or since the start, for `phase`
+ * and returns it.
+ */
+long long profiler_lap(profiler_t *profiler, int phase);
+
+/*
+ * Records the time from the start to the last lap as the total.
+ */
+void profiler_stop(profiler_t *profiler);
+
+/*
+ * Adds the histograms of `src` to `dst`, which need the same phases.
+ */
+void profiler_merge(profiler_t *dst, profiler_t *src);
+
+void profiler_reset(profiler_t *profiler);
+
+/*
+ * Logs the percentiles of the total and all phases that were recorded.
+ */
+void profiler_report(profiler_t *profiler, const char *name);
+
+#endif // PROFILER_H
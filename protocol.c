@@ -58,6 +58,207 @@ static uint8_t *serialize_memcpy(uint8_t *buf, void *data, uint16_t len) {
     return buf + len;
 }
 
+void bit_writer_init(bit_writer_t *writer, uint8_t *buf, int len) {
+    writer->buf = buf;
+    writer->capacity = len * 8;
+    writer->pos = 0;
+    writer->overflow = false;
+}
+
+void bit_write(bit_writer_t *writer, uint32_t value, int bits) {
+    if (writer->pos + bits > writer->capacity) {
+        writer->overflow = true;
+        return;
+    }
+
+    // Fills up the current byte, then continues with the next one
+    while (bits > 0) {
+        int offset = writer->pos % 8;
+        int count = 8 - offset < bits ? 8 - offset : bits;
+        uint8_t *byte = &writer->buf[writer->pos / 8];
+        uint8_t mask = ((1 << count) - 1) << offset;
+        // Starting a byte clears it, so the padding at the end is 0
+        if (offset == 0) {
+            *byte = 0;
+        }
+        *byte = (*byte & ~mask) | ((value << offset) & mask);
+        value >>= count;
+        bits -= count;
+        writer->pos += count;
+    }
+}
+
+void bit_write_varint(bit_writer_t *writer, uint32_t value, int chunk_bits) {
+    while (value >> chunk_bits) {
+        bit_write(writer, value, chunk_bits);
+        bit_write(writer, 1, 1);
+        value >>= chunk_bits;
+    }
+    bit_write(writer, value, chunk_bits);
+    bit_write(writer, 0, 1);
+}
+
+int bit_writer_length(bit_writer_t *writer) {
+    return (writer->pos + 7) / 8;
+}
+
+void bit_reader_init(bit_reader_t *reader, uint8_t *buf, int len) {
+    reader->buf = buf;
+    reader->capacity = len * 8;
+    reader->pos = 0;
+    reader->overflow = false;
+}
+
+uint32_t bit_read(bit_reader_t *reader, int bits) {
+    if (reader->pos + bits > reader->capacity) {
+        reader->overflow = true;
+        return 0;
+    }
+
+    uint32_t value = 0;
+    for (int shift = 0; shift < bits;) {
+        int offset = reader->pos % 8;
+        int count = 8 - offset < bits - shift ? 8 - offset : bits - shift;
+        uint32_t chunk = (reader->buf[reader->pos / 8] >> offset) & ((1 << count) - 1);
+        value |= chunk << shift;
+        shift += count;
+        reader->pos += count;
+    }
+    return value;
+}
+
+uint32_t bit_read_varint(bit_reader_t *reader, int chunk_bits) {
+    uint32_t value = 0;
+    for (int shift = 0; shift < 32; shift += chunk_bits) {
+        uint32_t chunk = bit_read(reader, chunk_bits);
+        // The last chunk may have more bits than are left of the 32
+        if (shift + chunk_bits > 32 && chunk >> (32 - shift)) {
+            reader->overflow = true;
+            return 0;
+        }
+        value |= chunk << shift;
+        if (!bit_read(reader, 1)) {
+            return value;
+        }
+    }
+    // Longer than 32 bits
+    reader->overflow = true;
+    return 0;
+}
+
+static int bit_varint_length(uint32_t value, int chunk_bits) {
+    int len = chunk_bits + 1;
+    while (value >>= chunk_bits) {
+        len += chunk_bits + 1;
+    }
+    return len;
+}
+
+// Zigzag encoding maps small negative numbers to small varints as well
+static uint32_t zigzag(int32_t num) {
+    return ((uint32_t)num << 1) ^ (uint32_t)(num >> 31);
+}
+
+static int32_t unzigzag(uint32_t num) {
+    return (int32_t)(num >> 1) ^ -(int32_t)(num & 1);
+}
+
+// Positions in the units that go over the wire, clamped to what fits
+static int32_t quantize_position(float pos) {
+    int32_t quantized = pos * (1 << POSITION_FRACTION_BITS);
+    if (quantized < 0) {
+        return 0;
+    }
+    if (quantized >= 1 << POSITION_BITS) {
+        return (1 << POSITION_BITS) - 1;
+    }
+    return quantized;
+}
+
+static float dequantize_position(int32_t pos) {
+    return pos / (float)(1 << POSITION_FRACTION_BITS);
+}
+
+/*
+ * Bits per chunk of the varints in cell deltas. Ids are sent as the difference
+ * to the previous id, and changes of the position and mass are small, but
+ * player ids and the mass of new cells are bigger.
+ */
+#define CELL_ID_CHUNK_BITS 4
+#define CELL_PLAYER_CHUNK_BITS 7
+#define CELL_DIFF_CHUNK_BITS 5
+#define CELL_MASS_CHUNK_BITS 7
+
+/*
+ * A cell delta is the id difference, a removed bit, and for cells that
+ * weren't removed an added bit. Added cells are followed by all their fields,
+ * with the positions in POSITION_BITS each, the others by a mask of the
+ * changed fields and the differences of those.
+ */
+static int cell_delta_bits(cell_delta_t *delta, uint32_t prev_id) {
+    int len = bit_varint_length(delta->cell_id - prev_id, CELL_ID_CHUNK_BITS) + 1;
+    if (delta->changed & CELL_REMOVED) {
+        return len;
+    }
+    len++;
+    if (delta->changed & CELL_ADDED) {
+        return len + bit_varint_length(delta->player_id, CELL_PLAYER_CHUNK_BITS) + 2 * POSITION_BITS
+            + bit_varint_length(delta->mass, CELL_MASS_CHUNK_BITS);
+    }
+    len += 4;
+    if (delta->changed & CELL_CHANGED_PLAYER) len += bit_varint_length(delta->player_id, CELL_PLAYER_CHUNK_BITS);
+    if (delta->changed & CELL_CHANGED_X) len += bit_varint_length(zigzag(delta->x), CELL_DIFF_CHUNK_BITS);
+    if (delta->changed & CELL_CHANGED_Y) len += bit_varint_length(zigzag(delta->y), CELL_DIFF_CHUNK_BITS);
+    if (delta->changed & CELL_CHANGED_MASS) len += bit_varint_length(zigzag(delta->mass), CELL_DIFF_CHUNK_BITS);
+    return len;
+}
+
+static void write_cell_delta(bit_writer_t *writer, cell_delta_t *delta, uint32_t prev_id) {
+    bit_write_varint(writer, delta->cell_id - prev_id, CELL_ID_CHUNK_BITS);
+    bit_write(writer, (delta->changed & CELL_REMOVED) != 0, 1);
+    if (delta->changed & CELL_REMOVED) {
+        return;
+    }
+    bit_write(writer, (delta->changed & CELL_ADDED) != 0, 1);
+    if (delta->changed & CELL_ADDED) {
+        bit_write_varint(writer, delta->player_id, CELL_PLAYER_CHUNK_BITS);
+        bit_write(writer, delta->x, POSITION_BITS);
+        bit_write(writer, delta->y, POSITION_BITS);
+        bit_write_varint(writer, delta->mass, CELL_MASS_CHUNK_BITS);
+        return;
+    }
+    bit_write(writer, delta->changed & CELL_CHANGED_ALL, 4);
+    if (delta->changed & CELL_CHANGED_PLAYER) bit_write_varint(writer, delta->player_id, CELL_PLAYER_CHUNK_BITS);
+    if (delta->changed & CELL_CHANGED_X) bit_write_varint(writer, zigzag(delta->x), CELL_DIFF_CHUNK_BITS);
+    if (delta->changed & CELL_CHANGED_Y) bit_write_varint(writer, zigzag(delta->y), CELL_DIFF_CHUNK_BITS);
+    if (delta->changed & CELL_CHANGED_MASS) bit_write_varint(writer, zigzag(delta->mass), CELL_DIFF_CHUNK_BITS);
+}
+
+/*
+ * Reads the next cell delta and stores it at `*delta`. Check the reader's
+ * `overflow` for errors.
+ */
+static void read_cell_delta(bit_reader_t *reader, uint32_t prev_id, cell_delta_t *delta) {
+    *delta = (cell_delta_t){.cell_id = prev_id + bit_read_varint(reader, CELL_ID_CHUNK_BITS)};
+    if (bit_read(reader, 1)) {
+        delta->changed = CELL_REMOVED;
+        return;
+    }
+    if (bit_read(reader, 1)) {
+        delta->changed = CELL_ADDED;
+        delta->player_id = bit_read_varint(reader, CELL_PLAYER_CHUNK_BITS);
+        delta->x = bit_read(reader, POSITION_BITS);
+        delta->y = bit_read(reader, POSITION_BITS);
+        delta->mass = bit_read_varint(reader, CELL_MASS_CHUNK_BITS);
+        return;
+    }
+    delta->changed = bit_read(reader, 4);
+    if (delta->changed & CELL_CHANGED_PLAYER) delta->player_id = bit_read_varint(reader, CELL_PLAYER_CHUNK_BITS);
+    if (delta->changed & CELL_CHANGED_X) delta->x = unzigzag(bit_read_varint(reader, CELL_DIFF_CHUNK_BITS));
+    if (delta->changed & CELL_CHANGED_Y) delta->y = unzigzag(bit_read_varint(reader, CELL_DIFF_CHUNK_BITS));
+    if (delta->changed & CELL_CHANGED_MASS) delta->mass = unzigzag(bit_read_varint(reader, CELL_DIFF_CHUNK_BITS));
+}
+
 static bool is_valid_serialized_message(uint8_t *buf, uint16_t buf_len) {
     uint16_t msg_len, payload_len;
     uint8_t *payload;
@@ -99,6 +300,12 @@ static bool is_valid_serialized_message(uint8_t *buf, uint16_t buf_len) {
             break;
         }
 
+        case MSG_SPLIT:
+        {
+            if (payload_len != 0) return false;
+            break;
+        }
+
         case MSG_JOIN_ACK:
         {
             if (payload_len != 4 + REJOIN_TOKEN_LEN) return false;
@@ -183,6 +390,32 @@ static bool is_valid_serialized_message(uint8_t *buf, uint16_t buf_len) {
             break;
         }
 
+        case MSG_CELL_POSITIONS:
+        {
+            if (payload_len < 4 + 2) return false;
+            uint16_t cell_count = deserialize_uint16_t(payload + 4);
+            if (payload_len != 4 + 2 + cell_count * (4 + 4 + 4 + 4 + 4)) return false;
+            break;
+        }
+
+        case MSG_CELL_DELTA:
+        {
+            if (payload_len < 4 + 4 + 2 + 1 + 2) return false;
+            uint16_t delta_count = deserialize_uint16_t(payload + 11);
+            bit_reader_t reader;
+            uint32_t prev_id = 0;
+            cell_delta_t delta;
+            bit_reader_init(&reader, payload + 13, payload_len - 13);
+            for (int i = 0; i < delta_count && !reader.overflow; i++) {
+                read_cell_delta(&reader, prev_id, &delta);
+                prev_id = delta.cell_id;
+            }
+            if (reader.overflow) return false;
+            // Only the padding of the last byte may be left
+            if ((reader.pos + 7) / 8 != payload_len - 13u) return false;
+            break;
+        }
+
         default:
             return false;
     }
@@ -218,6 +451,11 @@ static int serialized_message_length(generic_message_t *generic_msg) {
             break;
         }
 
+        case MSG_SPLIT:
+        {
+            break;
+        }
+
         case MSG_JOIN_ACK:
         {
             len += 4 + REJOIN_TOKEN_LEN;
@@ -282,6 +520,26 @@ static int serialized_message_length(generic_message_t *generic_msg) {
             break;
         }
 
+        case MSG_CELL_POSITIONS:
+        {
+            cell_positions_message_t *msg = (cell_positions_message_t *)generic_msg;
+            len += 4 + 2 + msg->cell_count * (4 + 4 + 4 + 4 + 4);
+            break;
+        }
+
+        case MSG_CELL_DELTA:
+        {
+            cell_delta_message_t *msg = (cell_delta_message_t *)generic_msg;
+            uint32_t prev_id = 0;
+            int bits = 0;
+            for (int i = 0; i < msg->delta_count; i++) {
+                bits += cell_delta_bits(&msg->deltas[i], prev_id);
+                prev_id = msg->deltas[i].cell_id;
+            }
+            len += 4 + 4 + 2 + 1 + 2 + (bits + 7) / 8;
+            break;
+        }
+
         default:
             return 0;
     }
@@ -334,6 +592,13 @@ int deserialize_message(uint8_t *buf, uint16_t len, generic_message_t **generic_
             break;
         }
 
+        case MSG_SPLIT:
+        {
+            split_message_t *msg = malloc(sizeof(split_message_t));
+            *generic_msg = (generic_message_t *)msg;
+            break;
+        }
+
         case MSG_JOIN_ACK:
         {
             join_ack_message_t *msg = malloc(sizeof(join_ack_message_t));
@@ -463,6 +728,55 @@ int deserialize_message(uint8_t *buf, uint16_t len, generic_message_t **generic_
             break;
         }
 
+        case MSG_CELL_POSITIONS:
+        {
+            cell_positions_message_t *msg = malloc(sizeof(cell_positions_message_t));
+            msg->tick = deserialize_uint32_t(payload);
+            uint16_t cell_count = deserialize_uint16_t(payload + 4);
+            msg->cell_count = cell_count;
+            cell_position_t *cell_positions = NULL;
+            if (cell_count > 0) {
+                cell_positions = malloc(cell_count * sizeof(cell_position_t));
+                payload += 6;
+                for (int i = 0; i < cell_count; i++) {
+                    cell_positions[i].cell_id = deserialize_uint32_t(payload);
+                    cell_positions[i].player_id = deserialize_uint32_t(payload + 4);
+                    cell_positions[i].x = deserialize_float(payload + 8);
+                    cell_positions[i].y = deserialize_float(payload + 12);
+                    cell_positions[i].mass = deserialize_uint32_t(payload + 16);
+                    payload += 20;
+                }
+            }
+            msg->cell_positions = cell_positions;
+            *generic_msg = (generic_message_t *)msg;
+            break;
+        }
+
+        case MSG_CELL_DELTA:
+        {
+            cell_delta_message_t *msg = malloc(sizeof(cell_delta_message_t));
+            msg->tick = deserialize_uint32_t(payload);
+            msg->base_tick = deserialize_uint32_t(payload + 4);
+            msg->chunk = deserialize_uint16_t(payload + 8);
+            msg->flags = payload[10];
+            uint16_t delta_count = deserialize_uint16_t(payload + 11);
+            msg->delta_count = delta_count;
+            cell_delta_t *deltas = NULL;
+            if (delta_count > 0) {
+                deltas = malloc(delta_count * sizeof(cell_delta_t));
+                bit_reader_t reader;
+                uint32_t prev_id = 0;
+                bit_reader_init(&reader, payload + 13, deserialize_uint16_t(buf) - 3 - 13);
+                for (int i = 0; i < delta_count; i++) {
+                    read_cell_delta(&reader, prev_id, &deltas[i]);
+                    prev_id = deltas[i].cell_id;
+                }
+            }
+            msg->deltas = deltas;
+            *generic_msg = (generic_message_t *)msg;
+            break;
+        }
+
         default:
             return 0;
     }
@@ -474,6 +788,347 @@ int deserialize_message(uint8_t *buf, uint16_t len, generic_message_t **generic_
     return serialized_message_length(*generic_msg);
 }
 
+void message_arena_init(message_arena_t *arena, void *buf, size_t capacity) {
+    arena->buf = buf;
+    arena->capacity = capacity;
+    arena->used = 0;
+}
+
+void message_arena_reset(message_arena_t *arena) {
+    arena->used = 0;
+}
+
+void *message_arena_alloc(message_arena_t *arena, size_t size) {
+    // Every message struct and array is fine with 8-byte alignment
+    size_t start = (arena->used + 7) & ~(size_t)7;
+    if (start > arena->capacity || size > arena->capacity - start) {
+        return NULL;
+    }
+    arena->used = start + size;
+    return arena->buf + start;
+}
+
+/*
+ * Reads the fields of a message and checks that they are within it. Once a
+ * read failed, `error` is set and all further reads return 0.
+ */
+typedef struct decoder_t {
+    uint8_t *pos;
+    uint8_t *end;
+    bool error;
+} decoder_t;
+
+static bool decoder_has(decoder_t *decoder, size_t len) {
+    if (decoder->error || (size_t)(decoder->end - decoder->pos) < len) {
+        decoder->error = true;
+        return false;
+    }
+    return true;
+}
+
+static uint8_t decode_uint8(decoder_t *decoder) {
+    return decoder_has(decoder, 1) ? *decoder->pos++ : 0;
+}
+
+static uint16_t decode_uint16(decoder_t *decoder) {
+    if (!decoder_has(decoder, 2)) return 0;
+    decoder->pos += 2;
+    return deserialize_uint16_t(decoder->pos - 2);
+}
+
+static uint32_t decode_uint32(decoder_t *decoder) {
+    if (!decoder_has(decoder, 4)) return 0;
+    decoder->pos += 4;
+    return deserialize_uint32_t(decoder->pos - 4);
+}
+
+static float decode_float(decoder_t *decoder) {
+    if (!decoder_has(decoder, 4)) return 0;
+    decoder->pos += 4;
+    return deserialize_float(decoder->pos - 4);
+}
+
+/*
+ * Returns a view of the next `len` bytes, or NULL if `len` is 0, like
+ * `deserialize_string` does for empty strings.
+ */
+static char *decode_view(decoder_t *decoder, size_t len) {
+    if (len == 0 || !decoder_has(decoder, len)) return NULL;
+    decoder->pos += len;
+    return (char *)decoder->pos - len;
+}
+
+/*
+ * Allocates an array of `count` elements of `size` bytes, which take at least
+ * `wire_size` bytes each in the message. Checking that first keeps invalid
+ * counts from exhausting the arena, and lets arrays of fixed size elements be
+ * read without checking every field.
+ */
+static void *decode_array(decoder_t *decoder, message_arena_t *arena, size_t count, size_t size, size_t wire_size) {
+    if (count == 0 || !decoder_has(decoder, count * wire_size)) return NULL;
+    void *array = message_arena_alloc(arena, count * size);
+    if (!array) {
+        decoder->error = true;
+    }
+    return array;
+}
+
+static void decode_player_info(decoder_t *decoder, player_info_t *info) {
+    info->player_id = decode_uint32(decoder);
+    info->name_length = decode_uint8(decoder);
+    if (info->name_length > MAX_PLAYER_NAME_LEN) decoder->error = true;
+    info->name = decode_view(decoder, info->name_length);
+}
+
+int decode_message(uint8_t *buf, int len, message_arena_t *arena, generic_message_t **generic_msg) {
+    if (len < 3) {
+        return 0;
+    }
+    uint16_t msg_len = deserialize_uint16_t(buf);
+    if (msg_len < 3 || msg_len > len) {
+        return 0;
+    }
+
+    decoder_t decoder = {.pos = buf + 3, .end = buf + msg_len};
+    decoder_t *d = &decoder;
+    size_t arena_used = arena->used;
+    generic_message_t *msg = NULL;
+
+    switch (buf[2]) {
+        case MSG_JOIN:
+        {
+            join_message_t *join_msg = message_arena_alloc(arena, sizeof(join_message_t));
+            if (!join_msg) break;
+            join_msg->name_length = decode_uint8(d);
+            if (join_msg->name_length > MAX_PLAYER_NAME_LEN) d->error = true;
+            join_msg->name = decode_view(d, join_msg->name_length);
+            msg = (generic_message_t *)join_msg;
+            break;
+        }
+
+        case MSG_REJOIN:
+        {
+            rejoin_message_t *rejoin_msg = message_arena_alloc(arena, sizeof(rejoin_message_t));
+            if (!rejoin_msg) break;
+            rejoin_msg->player_id = decode_uint32(d);
+            if (decoder_has(d, REJOIN_TOKEN_LEN)) {
+                memcpy(rejoin_msg->rejoin_token, decode_view(d, REJOIN_TOKEN_LEN), REJOIN_TOKEN_LEN);
+            }
+            msg = (generic_message_t *)rejoin_msg;
+            break;
+        }
+
+        case MSG_LEAVE:
+            msg = message_arena_alloc(arena, sizeof(leave_message_t));
+            break;
+
+        case MSG_SET_TARGET:
+        {
+            set_target_message_t *target_msg = message_arena_alloc(arena, sizeof(set_target_message_t));
+            if (!target_msg) break;
+            target_msg->x = decode_float(d);
+            target_msg->y = decode_float(d);
+            msg = (generic_message_t *)target_msg;
+            break;
+        }
+
+        case MSG_SPLIT:
+            msg = message_arena_alloc(arena, sizeof(split_message_t));
+            break;
+
+        case MSG_JOIN_ACK:
+        {
+            join_ack_message_t *ack_msg = message_arena_alloc(arena, sizeof(join_ack_message_t));
+            if (!ack_msg) break;
+            ack_msg->player_id = decode_uint32(d);
+            if (decoder_has(d, REJOIN_TOKEN_LEN)) {
+                memcpy(ack_msg->rejoin_token, decode_view(d, REJOIN_TOKEN_LEN), REJOIN_TOKEN_LEN);
+            }
+            msg = (generic_message_t *)ack_msg;
+            break;
+        }
+
+        case MSG_CURRENT_PLAYERS:
+        {
+            current_players_message_t *players_msg = message_arena_alloc(arena, sizeof(current_players_message_t));
+            if (!players_msg) break;
+            players_msg->player_count = decode_uint16(d);
+            players_msg->player_infos = decode_array(d, arena, players_msg->player_count, sizeof(player_info_t), 5);
+            for (int i = 0; i < players_msg->player_count && !d->error; i++) {
+                decode_player_info(d, &players_msg->player_infos[i]);
+            }
+            msg = (generic_message_t *)players_msg;
+            break;
+        }
+
+        case MSG_PLAYER_JOIN:
+        {
+            player_join_message_t *join_msg = message_arena_alloc(arena, sizeof(player_join_message_t));
+            if (!join_msg) break;
+            decode_player_info(d, &join_msg->player_info);
+            msg = (generic_message_t *)join_msg;
+            break;
+        }
+
+        case MSG_PLAYER_LEAVE:
+        {
+            player_leave_message_t *leave_msg = message_arena_alloc(arena, sizeof(player_leave_message_t));
+            if (!leave_msg) break;
+            leave_msg->player_id = decode_uint32(d);
+            msg = (generic_message_t *)leave_msg;
+            break;
+        }
+
+        case MSG_PLAYER_POSITIONS:
+        {
+            player_positions_message_t *positions_msg = message_arena_alloc(arena,
+                                                                            sizeof(player_positions_message_t));
+            if (!positions_msg) break;
+            positions_msg->player_count = decode_uint16(d);
+            positions_msg->player_positions = decode_array(d, arena, positions_msg->player_count,
+                                                           sizeof(player_position_t), 16);
+            for (int i = 0; i < positions_msg->player_count && !d->error; i++) {
+                player_position_t *position = &positions_msg->player_positions[i];
+                position->player_id = deserialize_uint32_t(d->pos);
+                position->x = deserialize_float(d->pos + 4);
+                position->y = deserialize_float(d->pos + 8);
+                position->mass = deserialize_uint32_t(d->pos + 12);
+                d->pos += 16;
+            }
+            msg = (generic_message_t *)positions_msg;
+            break;
+        }
+
+        case MSG_SPAWNED_FOOD:
+        {
+            spawned_food_message_t *food_msg = message_arena_alloc(arena, sizeof(spawned_food_message_t));
+            if (!food_msg) break;
+            food_msg->food_count = decode_uint16(d);
+            food_msg->food_positions = decode_array(d, arena, food_msg->food_count, sizeof(food_position_t), 12);
+            for (int i = 0; i < food_msg->food_count && !d->error; i++) {
+                food_msg->food_positions[i].food_id = deserialize_uint32_t(d->pos);
+                food_msg->food_positions[i].x = deserialize_float(d->pos + 4);
+                food_msg->food_positions[i].y = deserialize_float(d->pos + 8);
+                d->pos += 12;
+            }
+            msg = (generic_message_t *)food_msg;
+            break;
+        }
+
+        case MSG_EATEN_FOOD:
+        {
+            eaten_food_message_t *food_msg = message_arena_alloc(arena, sizeof(eaten_food_message_t));
+            if (!food_msg) break;
+            food_msg->food_count = decode_uint16(d);
+            food_msg->food_ids = decode_array(d, arena, food_msg->food_count, sizeof(uint32_t), 4);
+            for (int i = 0; i < food_msg->food_count && !d->error; i++) {
+                food_msg->food_ids[i] = deserialize_uint32_t(d->pos);
+                d->pos += 4;
+            }
+            msg = (generic_message_t *)food_msg;
+            break;
+        }
+
+        case MSG_JOIN_ERROR:
+        {
+            join_error_message_t *error_msg = message_arena_alloc(arena, sizeof(join_error_message_t));
+            if (!error_msg) break;
+            error_msg->error_code = decode_uint8(d);
+            if (error_msg->error_code != JOIN_ERR_GAME_FULL) d->error = true;
+            error_msg->error_message_length = decode_uint8(d);
+            error_msg->error_message = decode_view(d, error_msg->error_message_length);
+            msg = (generic_message_t *)error_msg;
+            break;
+        }
+
+        case MSG_KICK:
+        {
+            kick_message_t *kick_msg = message_arena_alloc(arena, sizeof(kick_message_t));
+            if (!kick_msg) break;
+            kick_msg->reason_length = decode_uint8(d);
+            kick_msg->reason = decode_view(d, kick_msg->reason_length);
+            msg = (generic_message_t *)kick_msg;
+            break;
+        }
+
+        case MSG_CELL_POSITIONS:
+        {
+            cell_positions_message_t *cells_msg = message_arena_alloc(arena, sizeof(cell_positions_message_t));
+            if (!cells_msg) break;
+            cells_msg->tick = decode_uint32(d);
+            cells_msg->cell_count = decode_uint16(d);
+            cells_msg->cell_positions = decode_array(d, arena, cells_msg->cell_count, sizeof(cell_position_t), 20);
+            for (int i = 0; i < cells_msg->cell_count && !d->error; i++) {
+                cell_position_t *cell = &cells_msg->cell_positions[i];
+                cell->cell_id = deserialize_uint32_t(d->pos);
+                cell->player_id = deserialize_uint32_t(d->pos + 4);
+                cell->x = deserialize_float(d->pos + 8);
+                cell->y = deserialize_float(d->pos + 12);
+                cell->mass = deserialize_uint32_t(d->pos + 16);
+                d->pos += 20;
+            }
+            msg = (generic_message_t *)cells_msg;
+            break;
+        }
+
+        case MSG_CELL_DELTA:
+        {
+            cell_delta_message_t *delta_msg = message_arena_alloc(arena, sizeof(cell_delta_message_t));
+            if (!delta_msg) break;
+            delta_msg->tick = decode_uint32(d);
+            delta_msg->base_tick = decode_uint32(d);
+            delta_msg->chunk = decode_uint16(d);
+            delta_msg->flags = decode_uint8(d);
+            delta_msg->delta_count = decode_uint16(d);
+            // A delta takes at least 6 bits: a one-chunk id gap and the removed bit
+            if (d->error || delta_msg->delta_count * 6 > (d->end - d->pos) * 8) {
+                d->error = true;
+                break;
+            }
+            delta_msg->deltas = decode_array(d, arena, delta_msg->delta_count, sizeof(cell_delta_t), 0);
+            if (d->error) break;
+
+            bit_reader_t reader;
+            uint32_t prev_id = 0;
+            bit_reader_init(&reader, d->pos, d->end - d->pos);
+            for (int i = 0; i < delta_msg->delta_count && !reader.overflow; i++) {
+                read_cell_delta(&reader, prev_id, &delta_msg->deltas[i]);
+                prev_id = delta_msg->deltas[i].cell_id;
+            }
+            // Only the padding of the last byte may be left
+            if (reader.overflow || (reader.pos + 7) / 8 != reader.capacity / 8) {
+                d->error = true;
+            }
+            d->pos = d->end;
+            msg = (generic_message_t *)delta_msg;
+            break;
+        }
+    }
+
+    if (!msg || d->error || d->pos != d->end) {
+        // Nothing that was taken from the arena is used
+        arena->used = arena_used;
+        return 0;
+    }
+
+    msg->message_type = buf[2];
+    *generic_msg = msg;
+    return msg_len;
+}
+
+int peek_message_length(uint8_t *buf, int len) {
+    if (len < 2) {
+        return 0;
+    }
+
+    uint16_t msg_len = deserialize_uint16_t(buf);
+    // Every message contains at least the length and the message type
+    if (msg_len < 3) {
+        return -1;
+    }
+    return msg_len;
+}
+
 int serialize_message(generic_message_t *generic_msg, uint8_t *buf, uint16_t buf_len) {
     int msg_len = 0;
     uint8_t *orig_buf = buf;
@@ -520,6 +1175,11 @@ int serialize_message(generic_message_t *generic_msg, uint8_t *buf, uint16_t buf
             break;
         }
 
+        case MSG_SPLIT:
+        {
+            break;
+        }
+
         case MSG_JOIN_ACK:
         {
             join_ack_message_t *msg = (join_ack_message_t *)generic_msg;
@@ -609,6 +1269,40 @@ int serialize_message(generic_message_t *generic_msg, uint8_t *buf, uint16_t buf
             break;
         }
 
+        case MSG_CELL_POSITIONS:
+        {
+            cell_positions_message_t *msg = (cell_positions_message_t *)generic_msg;
+            buf = serialize_uint32_t(buf, msg->tick);
+            buf = serialize_uint16_t(buf, msg->cell_count);
+            for (int i = 0; i < msg->cell_count; i++) {
+                buf = serialize_uint32_t(buf, msg->cell_positions[i].cell_id);
+                buf = serialize_uint32_t(buf, msg->cell_positions[i].player_id);
+                buf = serialize_float(buf, msg->cell_positions[i].x);
+                buf = serialize_float(buf, msg->cell_positions[i].y);
+                buf = serialize_uint32_t(buf, msg->cell_positions[i].mass);
+            }
+            break;
+        }
+
+        case MSG_CELL_DELTA:
+        {
+            cell_delta_message_t *msg = (cell_delta_message_t *)generic_msg;
+            uint32_t prev_id = 0;
+            buf = serialize_uint32_t(buf, msg->tick);
+            buf = serialize_uint32_t(buf, msg->base_tick);
+            buf = serialize_uint16_t(buf, msg->chunk);
+            buf = serialize_uint8_t(buf, msg->flags);
+            buf = serialize_uint16_t(buf, msg->delta_count);
+            bit_writer_t writer;
+            bit_writer_init(&writer, buf, orig_buf + msg_len - buf);
+            for (int i = 0; i < msg->delta_count; i++) {
+                write_cell_delta(&writer, &msg->deltas[i], prev_id);
+                prev_id = msg->deltas[i].cell_id;
+            }
+            buf += bit_writer_length(&writer);
+            break;
+        }
+
         default:
             return -1;
     }
@@ -621,6 +1315,78 @@ int serialize_message(generic_message_t *generic_msg, uint8_t *buf, uint16_t buf
     return msg_len;
 }
 
+/*
+ * Writes the header of a message with a list of entries, up to and including
+ * the number of entries, which is filled in by `message_builder_finish`.
+ */
+static void message_builder_begin(message_builder_t *builder, uint8_t *buf, int capacity, uint8_t message_type) {
+    *builder = (message_builder_t){
+        .buf = buf,
+        // The length has to fit into 2 bytes
+        .capacity = capacity < 65535 ? capacity : 65535,
+    };
+    uint8_t *pos = serialize_uint16_t(buf, 0);
+    pos = serialize_uint8_t(pos, message_type);
+    builder->len = pos - buf;
+}
+
+void current_players_builder_begin(message_builder_t *builder, uint8_t *buf, int capacity) {
+    message_builder_begin(builder, buf, capacity, MSG_CURRENT_PLAYERS);
+    builder->count_offset = builder->len;
+    builder->len += 2;
+}
+
+bool current_players_builder_append(message_builder_t *builder, uint32_t player_id, const char *name,
+                                    uint8_t name_length) {
+    if (builder->count == UINT16_MAX || builder->len + 4 + 1 + name_length > builder->capacity) {
+        return false;
+    }
+    uint8_t *pos = builder->buf + builder->len;
+    pos = serialize_uint32_t(pos, player_id);
+    pos = serialize_uint8_t(pos, name_length);
+    if (name_length > 0) {
+        pos = serialize_memcpy(pos, (void *)name, name_length);
+    }
+    builder->len = pos - builder->buf;
+    builder->count++;
+    return true;
+}
+
+void cell_delta_builder_begin(message_builder_t *builder, uint8_t *buf, int capacity, uint32_t tick,
+                              uint32_t base_tick, uint16_t chunk, uint8_t flags) {
+    message_builder_begin(builder, buf, capacity, MSG_CELL_DELTA);
+    uint8_t *pos = buf + builder->len;
+    pos = serialize_uint32_t(pos, tick);
+    pos = serialize_uint32_t(pos, base_tick);
+    pos = serialize_uint16_t(pos, chunk);
+    pos = serialize_uint8_t(pos, flags);
+    builder->count_offset = pos - buf;
+    builder->len = CELL_DELTA_HEADER_LEN;
+    bit_writer_init(&builder->writer, buf + CELL_DELTA_HEADER_LEN, builder->capacity - CELL_DELTA_HEADER_LEN);
+}
+
+bool cell_delta_builder_append(message_builder_t *builder, cell_delta_t *delta) {
+    bit_writer_t *writer = &builder->writer;
+    if (builder->count == UINT16_MAX || writer->pos + cell_delta_bits(delta, builder->prev_id) > writer->capacity) {
+        return false;
+    }
+    write_cell_delta(writer, delta, builder->prev_id);
+    builder->prev_id = delta->cell_id;
+    builder->len = CELL_DELTA_HEADER_LEN + bit_writer_length(writer);
+    builder->count++;
+    return true;
+}
+
+void cell_delta_builder_add_flags(message_builder_t *builder, uint8_t flags) {
+    builder->buf[CELL_DELTA_HEADER_LEN - 3] |= flags;
+}
+
+int message_builder_finish(message_builder_t *builder) {
+    serialize_uint16_t(builder->buf, builder->len);
+    serialize_uint16_t(builder->buf + builder->count_offset, builder->count);
+    return builder->len;
+}
+
 void message_free(generic_message_t *generic_msg) {
     if (!generic_msg) {
         return;
@@ -685,7 +1451,225 @@ void message_free(generic_message_t *generic_msg) {
             free(msg->reason);
             break;
         }
+
+        case MSG_CELL_POSITIONS:
+        {
+            cell_positions_message_t *msg = (cell_positions_message_t *)generic_msg;
+            free(msg->cell_positions);
+            break;
+        }
+
+        case MSG_CELL_DELTA:
+        {
+            cell_delta_message_t *msg = (cell_delta_message_t *)generic_msg;
+            free(msg->deltas);
+            break;
+        }
     }
 
     free(generic_msg);
 }
+
+const char *message_type_name(uint8_t message_type) {
+    switch (message_type) {
+        case MSG_JOIN:
+            return "join";
+        case MSG_REJOIN:
+            return "rejoin";
+        case MSG_LEAVE:
+            return "leave";
+        case MSG_SET_TARGET:
+            return "set_target";
+        case MSG_SPLIT:
+            return "split";
+        case MSG_JOIN_ACK:
+            return "join_ack";
+        case MSG_CURRENT_PLAYERS:
+            return "current_players";
+        case MSG_PLAYER_JOIN:
+            return "player_join";
+        case MSG_PLAYER_LEAVE:
+            return "player_leave";
+        case MSG_PLAYER_POSITIONS:
+            return "player_positions";
+        case MSG_SPAWNED_FOOD:
+            return "spawned_food";
+        case MSG_EATEN_FOOD:
+            return "eaten_food";
+        case MSG_JOIN_ERROR:
+            return "join_error";
+        case MSG_KICK:
+            return "kick";
+        case MSG_CELL_POSITIONS:
+            return "cell_positions";
+        case MSG_CELL_DELTA:
+            return "cell_delta";
+        default:
+            return NULL;
+    }
+}
+
+void cell_snapshot_init(cell_snapshot_t *snapshot) {
+    memset(snapshot, 0, sizeof(cell_snapshot_t));
+}
+
+void cell_snapshot_free(cell_snapshot_t *snapshot) {
+    free(snapshot->cells);
+    free(snapshot->next_cells);
+}
+
+static void cell_snapshot_reserve(cell_snapshot_t *snapshot, int capacity) {
+    if (capacity <= snapshot->capacity) {
+        return;
+    }
+    if (capacity < 2 * snapshot->capacity) {
+        capacity = 2 * snapshot->capacity;
+    }
+    snapshot->cells = realloc(snapshot->cells, capacity * sizeof(cell_position_t));
+    snapshot->next_cells = realloc(snapshot->next_cells, capacity * sizeof(cell_position_t));
+    snapshot->capacity = capacity;
+}
+
+void cell_snapshot_store(cell_snapshot_t *snapshot, uint32_t tick, cell_position_t *cells, int count) {
+    cell_snapshot_reserve(snapshot, count);
+    for (int i = 0; i < count; i++) {
+        snapshot->cells[i] = cells[i];
+        snapshot->cells[i].x = dequantize_position(quantize_position(cells[i].x));
+        snapshot->cells[i].y = dequantize_position(quantize_position(cells[i].y));
+    }
+    snapshot->count = count;
+    snapshot->tick = tick;
+    snapshot->synced = true;
+    snapshot->complete = true;
+}
+
+/*
+ * Returns the delta from `old` to `cell`, or of a new cell if `old` is NULL.
+ */
+static cell_delta_t diff_cell(cell_position_t *old, cell_position_t *cell) {
+    if (!old) {
+        return (cell_delta_t){
+            .cell_id = cell->cell_id,
+            .changed = CELL_ADDED,
+            .player_id = cell->player_id,
+            .x = quantize_position(cell->x),
+            .y = quantize_position(cell->y),
+            .mass = cell->mass,
+        };
+    }
+
+    cell_delta_t delta = {
+        .cell_id = cell->cell_id,
+        .player_id = cell->player_id,
+        .x = quantize_position(cell->x) - quantize_position(old->x),
+        .y = quantize_position(cell->y) - quantize_position(old->y),
+        .mass = cell->mass - old->mass,
+    };
+    if (cell->player_id != old->player_id) delta.changed |= CELL_CHANGED_PLAYER;
+    if (delta.x != 0) delta.changed |= CELL_CHANGED_X;
+    if (delta.y != 0) delta.changed |= CELL_CHANGED_Y;
+    if (delta.mass != 0) delta.changed |= CELL_CHANGED_MASS;
+    return delta;
+}
+
+int cell_delta_diff(cell_snapshot_t *snapshot, cell_position_t *cells, int count, cell_delta_t *deltas) {
+    int old_count = snapshot ? snapshot->count : 0;
+    int delta_count = 0;
+    int i = 0, j = 0;
+
+    // Both are sorted by id, so they can be merged
+    while (i < old_count || j < count) {
+        cell_position_t *old = i < old_count ? &snapshot->cells[i] : NULL;
+        cell_position_t *cell = j < count ? &cells[j] : NULL;
+
+        if (old && (!cell || old->cell_id < cell->cell_id)) {
+            deltas[delta_count++] = (cell_delta_t){.cell_id = old->cell_id, .changed = CELL_REMOVED};
+            i++;
+        } else if (!old || cell->cell_id < old->cell_id) {
+            deltas[delta_count++] = diff_cell(NULL, cell);
+            j++;
+        } else {
+            cell_delta_t delta = diff_cell(old, cell);
+            if (delta.changed) {
+                deltas[delta_count++] = delta;
+            }
+            i++;
+            j++;
+        }
+    }
+    return delta_count;
+}
+
+static cell_position_t apply_cell_delta(cell_position_t *old, cell_delta_t *delta) {
+    if (delta->changed & CELL_ADDED) {
+        return (cell_position_t){
+            .cell_id = delta->cell_id,
+            .player_id = delta->player_id,
+            .x = dequantize_position(delta->x),
+            .y = dequantize_position(delta->y),
+            .mass = delta->mass,
+        };
+    }
+
+    cell_position_t cell = *old;
+    if (delta->changed & CELL_CHANGED_PLAYER) {
+        cell.player_id = delta->player_id;
+    }
+    // Exact, since quantized positions fit into the mantissa of a float
+    cell.x = dequantize_position(quantize_position(cell.x) + delta->x);
+    cell.y = dequantize_position(quantize_position(cell.y) + delta->y);
+    cell.mass += delta->mass;
+    return cell;
+}
+
+int cell_delta_apply(cell_snapshot_t *snapshot, cell_delta_message_t *msg) {
+    if (msg->chunk == 0 && msg->flags & CELL_DELTA_KEYFRAME) {
+        snapshot->count = 0;
+        snapshot->keyframe_tick = msg->tick;
+    } else if (msg->chunk == 0) {
+        if (!snapshot->synced || !snapshot->complete || snapshot->tick != msg->base_tick) {
+            snapshot->synced = false;
+            return -1;
+        }
+    } else if (!snapshot->synced || snapshot->tick != msg->tick || snapshot->next_chunk != msg->chunk) {
+        snapshot->synced = false;
+        return -1;
+    }
+
+    cell_snapshot_reserve(snapshot, snapshot->count + msg->delta_count);
+    cell_position_t *cells = snapshot->cells;
+    cell_position_t *next_cells = snapshot->next_cells;
+    int count = 0;
+    int i = 0, j = 0;
+
+    while (i < snapshot->count || j < msg->delta_count) {
+        cell_position_t *old = i < snapshot->count ? &cells[i] : NULL;
+        cell_delta_t *delta = j < msg->delta_count ? &msg->deltas[j] : NULL;
+
+        if (old && (!delta || old->cell_id < delta->cell_id)) {
+            next_cells[count++] = *old;
+            i++;
+        } else if (!old || delta->cell_id < old->cell_id) {
+            // Changes of cells the snapshot doesn't have can't be applied
+            if (delta->changed & CELL_ADDED) {
+                next_cells[count++] = apply_cell_delta(NULL, delta);
+            }
+            j++;
+        } else {
+            if (!(delta->changed & CELL_REMOVED)) {
+                next_cells[count++] = apply_cell_delta(old, delta);
+            }
+            i++;
+            j++;
+        }
+    }
+
+    snapshot->cells = next_cells;
+    snapshot->next_cells = cells;
+    snapshot->count = count;
+    snapshot->tick = msg->tick;
+    snapshot->synced = true;
+    snapshot->complete = msg->flags & CELL_DELTA_LAST;
+    snapshot->next_chunk = msg->chunk + 1;
+    return 0;
+}
@@ -1,6 +1,9 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define MAX_PLAYER_NAME_LEN 20
@@ -9,6 +12,8 @@
 
 #define REJOIN_TOKEN_LEN 16
 #define MAX_REASON_MESSAGE_LEN 255
+// Longest message a client sends: a join with the longest name
+#define MAX_CLIENT_MESSAGE_LEN (3 + 1 + MAX_PLAYER_NAME_LEN)
 
 typedef uint8_t rejoin_token_t[REJOIN_TOKEN_LEN];
 
@@ -45,6 +50,11 @@ typedef struct set_target_message_t {
     float y;
 } set_target_message_t;
 
+#define MSG_SPLIT 5
+typedef struct split_message_t {
+    uint8_t message_type;
+} split_message_t;
+
 // Messages from server
 #define MSG_JOIN_ACK 33
 typedef struct join_ack_message_t {
@@ -60,12 +70,20 @@ typedef struct player_info_t {
     char *name;
 } player_info_t;
 
+/*
+ * The players in the game, sent to a player that joins. Long lists are split
+ * over several messages, so clients add the players of every message to the
+ * ones they know instead of replacing them.
+ */
 typedef struct current_players_message_t {
     uint8_t message_type;
     uint16_t player_count;
     player_info_t *player_infos;
 } current_players_message_t;
 
+// Any player fits into an empty message of this length
+#define MIN_CURRENT_PLAYERS_MESSAGE_LEN (3 + 2 + 4 + 1 + MAX_PLAYER_NAME_LEN)
+
 #define MSG_PLAYER_JOIN 35
 typedef struct player_join_message_t {
     uint8_t message_type;
@@ -78,6 +96,7 @@ typedef struct player_leave_message_t {
     uint32_t player_id;
 } player_leave_message_t;
 
+// Superseded by MSG_CELL_POSITIONS, which is what the server sends
 #define MSG_PLAYER_POSITIONS 37
 typedef struct player_position_t {
     uint32_t player_id;
@@ -92,6 +111,25 @@ typedef struct player_positions_message_t {
     player_position_t *player_positions;
 } player_positions_message_t;
 
+/*
+ * Radius of a player in field units. The area grows linearly with the mass.
+ */
+static inline float player_radius(uint32_t mass) {
+    return 6 * sqrtf(mass);
+}
+
+/*
+ * Side of the square around the center of its cells that a player sees, in
+ * field units. Bigger players see further. The server only sends the cells
+ * that overlap this square.
+ */
+static inline float player_view_size(uint32_t mass) {
+    return 300 + 8 * player_radius(mass);
+}
+
+// Radius a food pellet is drawn with, in field units
+#define FOOD_RADIUS 2
+
 #define MSG_SPAWNED_FOOD 38
 typedef struct food_position_t {
     uint32_t food_id;
@@ -105,6 +143,12 @@ typedef struct spawned_food_message_t {
     food_position_t *food_positions;
 } spawned_food_message_t;
 
+// Number of food positions that fit into a message of `len` bytes, including
+// the 5 bytes of length, type and count. Messages are at most 65535 bytes long,
+// so larger batches of food have to be split.
+#define SPAWNED_FOOD_PER_MESSAGE(len) (((len) - 5) / 12)
+#define MAX_SPAWNED_FOOD_PER_MESSAGE SPAWNED_FOOD_PER_MESSAGE(65535)
+
 #define MSG_EATEN_FOOD 39
 typedef struct eaten_food_message_t {
     uint8_t message_type;
@@ -112,6 +156,9 @@ typedef struct eaten_food_message_t {
     uint32_t *food_ids;
 } eaten_food_message_t;
 
+#define EATEN_FOOD_PER_MESSAGE(len) (((len) - 5) / 4)
+#define MAX_EATEN_FOOD_PER_MESSAGE EATEN_FOOD_PER_MESSAGE(65535)
+
 #define MSG_JOIN_ERROR 40
 #define JOIN_ERR_GAME_FULL 1
 #define GAME_FULL_ERROR_MSG "The game is full"
@@ -129,6 +176,186 @@ typedef struct kick_message_t {
     char *reason;
 } kick_message_t;
 
+#define MSG_CELL_POSITIONS 42
+typedef struct cell_position_t {
+    uint32_t cell_id;
+    uint32_t player_id;
+    float x;
+    float y;
+    uint32_t mass;
+} cell_position_t;
+
+typedef struct cell_positions_message_t {
+    uint8_t message_type;
+    // All cells of a tick may not fit into one message, so the cells of a tick
+    // can be spread over several messages with the same tick
+    uint32_t tick;
+    uint16_t cell_count;
+    cell_position_t *cell_positions;
+} cell_positions_message_t;
+
+// Number of cell positions that fit into a message of `len` bytes, including
+// the 9 bytes of length, type, tick and count
+#define CELL_POSITIONS_PER_MESSAGE(len) (((len) - 9) / 20)
+
+/*
+ * The cells a player sees, sent as the difference to the previous snapshot
+ * that was sent to the player. Cells that didn't change are left out, and of
+ * the others only the fields that changed are sent, as varints of the
+ * difference. Cells are sorted by id, and ids are sent as the difference to
+ * the previous id. The deltas are packed into a bit stream (see
+ * `bit_writer_t`), so a moving cell takes about 3 bytes, and a new one, whose
+ * position is sent in full, about 6.
+ *
+ * A keyframe is a delta against the empty snapshot, i.e. it contains all
+ * cells. A client that missed a message can't apply the deltas after it, and
+ * waits for the next keyframe, which the server sends periodically.
+ */
+#define MSG_CELL_DELTA 43
+
+// Positions in cell deltas are fixed point with 4 fractional bits, far below a
+// pixel at any zoom, and 14 bits in total, so fields can't be bigger than this
+#define POSITION_FRACTION_BITS 4
+#define POSITION_BITS 14
+#define MAX_FIELD_SIZE (1 << (POSITION_BITS - POSITION_FRACTION_BITS))
+
+// Fields of a cell that changed
+#define CELL_CHANGED_PLAYER 0x01
+#define CELL_CHANGED_X 0x02
+#define CELL_CHANGED_Y 0x04
+#define CELL_CHANGED_MASS 0x08
+#define CELL_CHANGED_ALL 0x0f
+// The cell left the snapshot, so none of its fields are sent
+#define CELL_REMOVED 0x10
+// The cell is new in the snapshot, and all its fields are sent as they are
+// rather than as differences
+#define CELL_ADDED 0x20
+
+typedef struct cell_delta_t {
+    uint32_t cell_id;
+    uint8_t changed;
+    // Unlike the other fields, not a difference
+    uint32_t player_id;
+    // Differences to the cell in the snapshot, with positions in units of
+    // 1 / (1 << POSITION_FRACTION_BITS)
+    int32_t x;
+    int32_t y;
+    int32_t mass;
+} cell_delta_t;
+
+// The delta is against the empty snapshot
+#define CELL_DELTA_KEYFRAME 0x01
+// The last message of the tick
+#define CELL_DELTA_LAST 0x02
+
+typedef struct cell_delta_message_t {
+    uint8_t message_type;
+    uint32_t tick;
+    // Tick of the snapshot that the delta is against
+    uint32_t base_tick;
+    // Like cell positions, the deltas of a tick can be spread over several
+    // messages, which are numbered from 0
+    uint16_t chunk;
+    uint8_t flags;
+    uint16_t delta_count;
+    // Sorted by cell id
+    cell_delta_t *deltas;
+} cell_delta_message_t;
+
+// Length, type, ticks, chunk, flags and count
+#define CELL_DELTA_HEADER_LEN 16
+// Any delta fits into an empty message of this length, since a delta takes at
+// most 212 bits
+#define MIN_CELL_DELTA_MESSAGE_LEN (CELL_DELTA_HEADER_LEN + 27)
+
+/*
+ * The cells of the last tick, as the client knows them and the server last
+ * sent them to a client. Positions are rounded like on the wire, so both ends
+ * hold the same values.
+ */
+typedef struct cell_snapshot_t {
+    uint32_t tick;
+    // Cleared when a delta can't be applied, until the next keyframe
+    bool synced;
+    // Whether the last message of the tick was applied
+    bool complete;
+    uint16_t next_chunk;
+    // Tick of the last keyframe
+    uint32_t keyframe_tick;
+    // Sorted by cell id
+    cell_position_t *cells;
+    int count;
+    int capacity;
+    // Where deltas are merged into, swapped with `cells`
+    cell_position_t *next_cells;
+} cell_snapshot_t;
+
+void cell_snapshot_init(cell_snapshot_t *snapshot);
+void cell_snapshot_free(cell_snapshot_t *snapshot);
+
+/*
+ * Replaces the cells of the snapshot, e.g. with the cells that were just sent.
+ * The cells have to be sorted by id.
+ */
+void cell_snapshot_store(cell_snapshot_t *snapshot, uint32_t tick, cell_position_t *cells, int count);
+
+/*
+ * Stores the differences of the cells, which have to be sorted by id, to the
+ * snapshot at `deltas`, which needs room for the cells of both. Diffs against
+ * the empty snapshot if `snapshot` is NULL.
+ *
+ * Returns the number of deltas.
+ */
+int cell_delta_diff(cell_snapshot_t *snapshot, cell_position_t *cells, int count, cell_delta_t *deltas);
+
+/*
+ * Applies the message to the snapshot.
+ *
+ * Returns 0 on success, and -1 if the message doesn't follow the messages
+ * applied before, in which case the snapshot is out of sync until the next
+ * keyframe.
+ */
+int cell_delta_apply(cell_snapshot_t *snapshot, cell_delta_message_t *msg);
+
+/*
+ * Writes values of any number of bits into a buffer, least significant bit
+ * first and without any padding in between.
+ */
+typedef struct bit_writer_t {
+    uint8_t *buf;
+    // In bits
+    uint32_t capacity;
+    uint32_t pos;
+    // Set when a write didn't fit, which is then skipped
+    bool overflow;
+} bit_writer_t;
+
+void bit_writer_init(bit_writer_t *writer, uint8_t *buf, int len);
+// `bits` is at most 32
+void bit_write(bit_writer_t *writer, uint32_t value, int bits);
+/*
+ * Writes the value in chunks of `chunk_bits` bits, each followed by a bit that
+ * tells whether another chunk follows. The chunk size should fit the typical
+ * values, so that most take a single chunk.
+ */
+void bit_write_varint(bit_writer_t *writer, uint32_t value, int chunk_bits);
+// Number of bytes written, with the last one padded
+int bit_writer_length(bit_writer_t *writer);
+
+typedef struct bit_reader_t {
+    uint8_t *buf;
+    // In bits
+    uint32_t capacity;
+    uint32_t pos;
+    // Set when a read went past the end, or a varint was too long, in which
+    // case it returned 0
+    bool overflow;
+} bit_reader_t;
+
+void bit_reader_init(bit_reader_t *reader, uint8_t *buf, int len);
+uint32_t bit_read(bit_reader_t *reader, int bits);
+uint32_t bit_read_varint(bit_reader_t *reader, int chunk_bits);
+
 /*
  * Deserializes a message from the given buffer and stores it at `*generic_msg`.
  *
@@ -141,7 +368,101 @@ typedef struct kick_message_t {
  * Note: The caller should free the message and its contents.
  */
 int deserialize_message(uint8_t *buf, uint16_t len, generic_message_t **generic_msg);
+
+/*
+ * Hands out memory for decoded messages from a caller-owned buffer, which has
+ * to be aligned like one from `malloc`. Everything is freed at once by
+ * resetting the arena, e.g. after handling all messages of a receive buffer.
+ */
+typedef struct message_arena_t {
+    uint8_t *buf;
+    size_t capacity;
+    size_t used;
+} message_arena_t;
+
+// Fits any decoded message. Cell deltas expand the most: a message has at most
+// 65535 bytes, and a delta takes at least 6 bits of it.
+#define MESSAGE_ARENA_LEN (64 + (65535 * 8 / 6 + 1) * sizeof(cell_delta_t))
+
+void message_arena_init(message_arena_t *arena, void *buf, size_t capacity);
+void message_arena_reset(message_arena_t *arena);
+// Returns NULL if the arena is full
+void *message_arena_alloc(message_arena_t *arena, size_t size);
+
+/*
+ * Like `deserialize_message`, but validates and decodes the message in a
+ * single pass and never allocates: the message and its arrays are taken from
+ * `arena`, and names, reasons and error messages point into `buf`. They are
+ * not NUL-terminated, and only valid as long as `buf` is.
+ *
+ * Returns the length of the message on success, and 0 if the buffer doesn't
+ * start with a complete, valid message or the arena is too small. The message
+ * must not be freed with `message_free`.
+ */
+int decode_message(uint8_t *buf, int len, message_arena_t *arena, generic_message_t **generic_msg);
+
+/*
+ * Reads the length of the message at the start of the buffer from its header,
+ * which allows splitting a byte stream into messages.
+ *
+ * Returns the length of the whole message (including the header), 0 if the
+ * buffer is too short to contain the length, and -1 if the length is invalid.
+ */
+int peek_message_length(uint8_t *buf, int len);
 int serialize_message(generic_message_t *msg, uint8_t *buf, uint16_t buf_len);
 void message_free(generic_message_t *msg);
 
+/*
+ * Writes a message with a list of entries straight into a buffer, such as the
+ * data of a frame, while the entries are produced, instead of collecting them
+ * into a message struct for `serialize_message` first. Beginning the message
+ * writes its header, entries are appended as long as they fit, and finishing
+ * fills in the length and the number of entries.
+ *
+ * The bytes are the same as those of `serialize_message` for the same entries.
+ */
+typedef struct message_builder_t {
+    uint8_t *buf;
+    int capacity;
+    int len;
+    // Where the number of entries goes when the message is finished
+    int count_offset;
+    uint16_t count;
+    // Cell deltas are a bit stream after the header
+    bit_writer_t writer;
+    uint32_t prev_id;
+} message_builder_t;
+
+void current_players_builder_begin(message_builder_t *builder, uint8_t *buf, int capacity);
+// Returns false if the player doesn't fit into the message anymore
+bool current_players_builder_append(message_builder_t *builder, uint32_t player_id, const char *name,
+                                    uint8_t name_length);
+
+/*
+ * Begins a cell delta message. `capacity` has to be at least
+ * `MIN_CELL_DELTA_MESSAGE_LEN`, so that every delta fits into the empty
+ * message.
+ */
+void cell_delta_builder_begin(message_builder_t *builder, uint8_t *buf, int capacity, uint32_t tick,
+                              uint32_t base_tick, uint16_t chunk, uint8_t flags);
+// Returns false if the delta doesn't fit into the message anymore. Deltas have
+// to be appended in the order of their cell ids.
+bool cell_delta_builder_append(message_builder_t *builder, cell_delta_t *delta);
+// Adds `flags` to those of the message, e.g. `CELL_DELTA_LAST` once it is known
+// that no chunk follows
+void cell_delta_builder_add_flags(message_builder_t *builder, uint8_t flags);
+
+/*
+ * Fills in the length and the number of entries.
+ *
+ * Returns the length of the message.
+ */
+int message_builder_finish(message_builder_t *builder);
+
+/*
+ * Returns a snake_case name of the message type, or NULL if the type is
+ * unknown.
+ */
+const char *message_type_name(uint8_t message_type);
+
 #endif // PROTOCOL_H
@@ -0,0 +1,51 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+/*
+ * Small seeded pseudo random number generator (PCG32). Every game owns one, so
+ * that a game is fully determined by its seed and its inputs, which is what
+ * makes recorded sessions replayable (see `session.h`). Not suitable for
+ * anything that has to be unpredictable, like tokens.
+ */
+typedef struct rng_t {
+    uint64_t state;
+} rng_t;
+
+#define RNG_MULTIPLIER 6364136223846793005ULL
+#define RNG_INCREMENT 1442695040888963407ULL
+
+static inline uint32_t rng_next(rng_t *rng) {
+    uint64_t state = rng->state;
+    rng->state = state * RNG_MULTIPLIER + RNG_INCREMENT;
+
+    uint32_t xorshifted = ((state >> 18) ^ state) >> 27;
+    uint32_t rotation = state >> 59;
+    return (xorshifted >> rotation) | (xorshifted << ((-rotation) & 31));
+}
+
+static inline void rng_seed(rng_t *rng, uint64_t seed) {
+    rng->state = 0;
+    rng_next(rng);
+    rng->state += seed;
+    rng_next(rng);
+}
+
+/*
+ * Returns a float in [0, 1).
+ */
+static inline float rng_float(rng_t *rng) {
+    // A float has 24 significant bits, more would round up to 1
+    return (rng_next(rng) >> 8) * (1.0f / (1 << 24));
+}
+
+/*
+ * Returns an integer in [0, n). Slightly biased towards small numbers unless
+ * `n` is a power of two, which is fine for positions.
+ */
+static inline uint32_t rng_range(rng_t *rng, uint32_t n) {
+    return rng_next(rng) % n;
+}
+
+#endif // RNG_H
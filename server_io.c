@@ -0,0 +1,1050 @@
+#include "server_io.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "event_loop.h"
+#include "log.h"
+#include "metrics.h"
+#include "profiler.h"
+#include "spsc_queue.h"
+#include "tick_scheduler.h"
+#include "tree.h"
+#include "udp_transport.h"
+
+#define IO_MAX_EVENTS 1024
+#define INPUT_QUEUE_CAPACITY (1 << 16)
+#define OUTPUT_QUEUE_CAPACITY (1 << 16)
+
+// Connections whose send queue grows beyond this don't get droppable frames
+// until they caught up, since e.g. every position message supersedes the
+// previous one
+#define SEND_QUEUE_DEGRADE_MARK (64 * 1024)
+// Connections whose send queue grows beyond this are closed
+#define SEND_QUEUE_HIGH_WATER_MARK (1024 * 1024)
+// Has to hold at least the biggest message a client can send
+#define RECV_BUFFER_LEN 4096
+// How often UDP peers retransmit and send acks
+#define UDP_UPDATE_INTERVAL_MSEC 10
+// Every UDP connection holds a peer with its retransmission window, so a
+// client that completes handshakes from many ports can't exhaust memory
+#define MAX_UDP_CONNS_PER_THREAD 4096
+
+// What an I/O thread spent its time on, per event
+#define IO_PHASE_ACCEPT 0
+#define IO_PHASE_READ 1
+#define IO_PHASE_WRITE 2
+#define IO_PHASE_OUTPUTS 3
+#define IO_PHASE_UDP_TIMER 4
+// Freeing the connections that were closed during a batch
+#define IO_PHASE_REAP 5
+#define IO_PHASE_COUNT 6
+
+static const char *const io_phase_names[IO_PHASE_COUNT] = {
+    "accept", "read", "write", "outputs", "udp_timer", "reap",
+};
+
+#define OUTPUT_SEND 1
+#define OUTPUT_BROADCAST 2
+#define OUTPUT_SUBSCRIBE 3
+#define OUTPUT_CLOSE 4
+
+typedef struct io_output_t {
+    int type;
+    bool droppable;
+    uint32_t conn_id;
+    frame_t *frame;
+} io_output_t;
+
+typedef struct io_thread_t io_thread_t;
+
+typedef struct conn_t {
+    uint32_t id;
+    io_thread_t *thread;
+    // -1 for UDP connections, which share the UDP socket of their I/O thread
+    int sock;
+    // Index in the connection array of the I/O thread
+    int idx;
+    bool subscribed;
+    // Set when the connection should be closed. The actual close is deferred
+    // to `reap_conns`, so that a connection is never freed while it is still
+    // referenced further up the call stack.
+    bool closing;
+    // Set when the simulation thread requested the close, in which case it
+    // doesn't need to be told about the disconnect
+    bool close_requested;
+    // One of `DISCONNECT_*`, set together with `closing`
+    int close_reason;
+    // Set once the socket was closed. A connection whose send is still pending
+    // is only freed once the send was reported.
+    bool closed;
+    send_queue_t send_queue;
+    // Set while the event loop sends the queued bytes that `send_iov` points
+    // at. Bytes that are queued meanwhile go out with the next send.
+    bool sending;
+    struct iovec send_iov[SEND_QUEUE_MAX_IOVECS];
+    // Set while the connection is on the flush list of its I/O thread, at
+    // index `flush_idx`
+    bool flush_queued;
+    int flush_idx;
+    // Queued bytes that were already added to the send queue gauge
+    int reported_queued_bytes;
+    recv_buffer_t recv_buffer;
+    // Only set for UDP connections
+    udp_peer_t *udp;
+    struct sockaddr_in udp_addr;
+    // Next UDP connection whose address has the same port
+    struct conn_t *next_with_port;
+} conn_t;
+
+struct io_thread_t {
+    server_io_t *io;
+    int idx;
+    pthread_t thread;
+    event_loop_t *loop;
+    int listen_sock;
+    // Only owned by the first I/O thread, -1 for the others
+    int udp_sock;
+    // Maps ports to chains of UDP connections, see `find_udp_conn`
+    tree_t *udp_conns_by_port;
+    int udp_conn_count;
+    udp_cookie_secret_t udp_cookie_secret;
+    uint8_t *udp_packet_buf;
+    // Time spent handling events, read and reset by the simulation thread
+    atomic_llong busy_nsec;
+    // Held by the I/O thread while it records a batch of events, and by the
+    // simulation thread while it takes the recorded phases
+    pthread_mutex_t profile_lock;
+    profiler_t profile;
+    // Written only by this thread
+    metrics_shard_t *metrics;
+    // Produced by this thread, consumed by the simulation thread
+    spsc_queue_t inputs;
+    // Produced by the simulation thread, consumed by this thread
+    spsc_queue_t outputs;
+
+    // Owned by the I/O thread
+    tree_t *conns_by_id;
+    conn_t **conns;
+    int conn_count;
+    int conn_capacity;
+    uint32_t next_conn_serial;
+    // Connections with newly queued bytes. They are flushed together at the
+    // end of a batch, so that the event loop submits all sends at once.
+    conn_t **flush_conns;
+    int flush_count;
+    int flush_capacity;
+
+    // Owned by the simulation thread. Outputs that did not fit into the
+    // output queue wait here, so that the simulation thread never blocks.
+    io_output_t *backlog;
+    int backlog_len;
+    int backlog_capacity;
+    bool outputs_pending;
+};
+
+struct server_io_t {
+    int n_threads;
+    atomic_bool stopping;
+    io_thread_t *threads;
+    // I/O thread whose inputs are currently drained by `server_io_poll_input`
+    int poll_thread_idx;
+};
+
+static long long now_msec(void) {
+    return monotonic_nsec() / 1000000;
+}
+
+static void push_input(io_thread_t *thread, io_input_t *input, bool droppable) {
+    while (!spsc_queue_push(&thread->inputs, input)) {
+        // The simulation thread drains the inputs every tick, so a full queue
+        // means we are heavily overloaded. Position targets are superseded by
+        // the next one anyway, everything else has to wait.
+        if (droppable || atomic_load(&thread->io->stopping)) {
+            return;
+        }
+        sched_yield();
+    }
+}
+
+/*
+ * Marks the connection to be closed by `reap_conns`. Only the first reason is
+ * kept, since anything after it is usually a consequence.
+ */
+static void mark_closing(conn_t *conn, int reason) {
+    if (!conn->closing) {
+        conn->closing = true;
+        conn->close_reason = reason;
+    }
+}
+
+static void update_send_queue_gauge(conn_t *conn) {
+    int queued_bytes = conn->send_queue.queued_bytes;
+    metrics_add_gauge(&conn->thread->metrics->send_queue_bytes, queued_bytes - conn->reported_queued_bytes);
+    conn->reported_queued_bytes = queued_bytes;
+}
+
+static conn_t *conn_new(io_thread_t *thread, int sock) {
+    conn_t *conn = calloc(1, sizeof(conn_t));
+    conn->id = thread->idx + thread->io->n_threads * thread->next_conn_serial++;
+    conn->thread = thread;
+    conn->sock = sock;
+    metrics_add(&thread->metrics->connections_accepted, 1);
+    // UDP connections get whole messages in datagrams
+    if (sock != -1) {
+        recv_buffer_init(&conn->recv_buffer, RECV_BUFFER_LEN);
+    }
+
+    if (thread->conn_count == thread->conn_capacity) {
+        thread->conn_capacity = thread->conn_capacity ? thread->conn_capacity * 2 : 64;
+        thread->conns = realloc(thread->conns, thread->conn_capacity * sizeof(conn_t *));
+    }
+    conn->idx = thread->conn_count;
+    thread->conns[thread->conn_count++] = conn;
+    tree_insert(thread->conns_by_id, conn->id, conn);
+
+    return conn;
+}
+
+static void conn_free(io_thread_t *thread, conn_t *conn) {
+    // Swap-remove from the connection array
+    conn_t *last = thread->conns[--thread->conn_count];
+    thread->conns[conn->idx] = last;
+    last->idx = conn->idx;
+    tree_remove(thread->conns_by_id, conn->id);
+    if (conn->flush_queued) {
+        thread->flush_conns[conn->flush_idx] = NULL;
+    }
+    metrics_add_gauge(&thread->metrics->send_queue_bytes, -conn->reported_queued_bytes);
+
+    if (conn->udp) {
+        conn_t **chain_addr = NULL;
+        int port = ntohs(conn->udp_addr.sin_port);
+        conn_t *head = tree_get(thread->udp_conns_by_port, port);
+        if (head == conn) {
+            if (conn->next_with_port) {
+                tree_insert(thread->udp_conns_by_port, port, conn->next_with_port);
+            } else {
+                tree_remove(thread->udp_conns_by_port, port);
+            }
+        } else {
+            chain_addr = &head->next_with_port;
+            while (*chain_addr != conn) {
+                chain_addr = &(*chain_addr)->next_with_port;
+            }
+            *chain_addr = conn->next_with_port;
+        }
+        udp_peer_free(conn->udp);
+        free(conn->udp);
+        thread->udp_conn_count--;
+    }
+
+    send_queue_clear(&conn->send_queue);
+    recv_buffer_free(&conn->recv_buffer);
+    free(conn);
+}
+
+static conn_t *find_conn(io_thread_t *thread, uint32_t conn_id) {
+    conn_t *conn = tree_get(thread->conns_by_id, conn_id);
+    if (conn == no_node_sentinel) {
+        return NULL;
+    }
+    return conn;
+}
+
+static void close_conn(io_thread_t *thread, conn_t *conn) {
+    metrics_add(&thread->metrics->disconnects[conn->close_reason], 1);
+    conn->closed = true;
+
+    if (!conn->close_requested) {
+        io_input_t input = {
+            .type = INPUT_DISCONNECT,
+            .conn_id = conn->id,
+        };
+        push_input(thread, &input, false);
+    }
+
+    // UDP connections share the socket, so there is nothing to close. Any
+    // unacknowledged reliable messages are lost.
+    if (conn->udp) {
+        return;
+    }
+
+    // Give the frames that were queued before the close a last chance. With a
+    // send still pending, they would go out of order, and the socket is most
+    // likely full anyway.
+    if (conn->close_requested && !conn->sending) {
+        send_queue_flush(&conn->send_queue, conn->sock);
+    }
+
+    // Cancels the pending send, if any
+    event_loop_remove(thread->loop, conn->sock);
+    close(conn->sock);
+}
+
+static void reap_conns(io_thread_t *thread) {
+    // Iterate backwards, since freeing swap-removes from the array
+    for (int i = thread->conn_count - 1; i >= 0; i--) {
+        conn_t *conn = thread->conns[i];
+        if (!conn->closing) {
+            continue;
+        }
+        if (!conn->closed) {
+            close_conn(thread, conn);
+        }
+        // The event loop still uses the iovecs and the queued frames until it
+        // reported the send
+        if (!conn->sending) {
+            conn_free(thread, conn);
+        }
+    }
+}
+
+static void check_send_queue(conn_t *conn) {
+    if (conn->send_queue.queued_bytes > SEND_QUEUE_HIGH_WATER_MARK) {
+        log_warn_ratelimited("connection %u fell too far behind (%d bytes queued), closing socket", conn->id,
+                             conn->send_queue.queued_bytes);
+        mark_closing(conn, DISCONNECT_TOO_SLOW);
+    }
+}
+
+/*
+ * Puts the connection on the flush list of its I/O thread, unless it already
+ * is on it.
+ */
+static void queue_flush(conn_t *conn) {
+    io_thread_t *thread = conn->thread;
+
+    if (conn->flush_queued) {
+        return;
+    }
+    if (thread->flush_count == thread->flush_capacity) {
+        thread->flush_capacity = thread->flush_capacity ? thread->flush_capacity * 2 : 64;
+        thread->flush_conns = realloc(thread->flush_conns, thread->flush_capacity * sizeof(conn_t *));
+    }
+    conn->flush_queued = true;
+    conn->flush_idx = thread->flush_count;
+    thread->flush_conns[thread->flush_count++] = conn;
+}
+
+static void count_sent_frame(conn_t *conn, frame_t *frame) {
+    metrics_shard_t *metrics = conn->thread->metrics;
+    // Frames are attributed to the type of their first message
+    uint8_t message_type = frame->data[2];
+    metrics_add(&metrics->messages_sent[message_type], 1);
+    metrics_add(&metrics->bytes_sent[message_type], frame->len);
+}
+
+static void send_frame(conn_t *conn, frame_t *frame, bool droppable) {
+    if (conn->closing) {
+        return;
+    }
+
+    if (conn->udp) {
+        // Droppable frames are superseded by the next one, so they don't need
+        // to be retransmitted
+        if (udp_peer_send(conn->udp, frame, !droppable, now_msec()) == -1) {
+            log_warn_ratelimited("error when sending to UDP connection %u: errno %d -- %s, closing connection",
+                                 conn->id, errno, strerror(errno));
+            mark_closing(conn, DISCONNECT_SEND_ERROR);
+            return;
+        }
+        count_sent_frame(conn, frame);
+        return;
+    }
+    if (droppable && conn->send_queue.queued_bytes > SEND_QUEUE_DEGRADE_MARK) {
+        return;
+    }
+
+    send_queue_push_frame(&conn->send_queue, frame);
+    count_sent_frame(conn, frame);
+    check_send_queue(conn);
+    update_send_queue_gauge(conn);
+    queue_flush(conn);
+}
+
+/*
+ * Hands the queued bytes of the connections on the flush list to the event
+ * loop, which sends them all with the next wait.
+ */
+static void flush_conns(io_thread_t *thread) {
+    for (int i = 0; i < thread->flush_count; i++) {
+        conn_t *conn = thread->flush_conns[i];
+        // Freed connections leave a hole
+        if (!conn) {
+            continue;
+        }
+        conn->flush_queued = false;
+        if (conn->closing || conn->sending || conn->send_queue.queued_bytes == 0) {
+            continue;
+        }
+
+        int iov_count = send_queue_peek(&conn->send_queue, conn->send_iov, SEND_QUEUE_MAX_IOVECS);
+        if (event_loop_send(thread->loop, conn->sock, conn->send_iov, iov_count) == -1) {
+            log_warn_ratelimited("error when sending to connection %u: errno %d -- %s, closing socket", conn->id,
+                                 errno, strerror(errno));
+            mark_closing(conn, DISCONNECT_SEND_ERROR);
+            continue;
+        }
+        conn->sending = true;
+    }
+    thread->flush_count = 0;
+}
+
+static void finish_send(conn_t *conn, int result) {
+    conn->sending = false;
+    // Also when the send was cancelled by closing the socket
+    if (conn->closing) {
+        return;
+    }
+
+    if (result < 0) {
+        log_warn_ratelimited("error when sending to connection %u: errno %d -- %s, closing socket", conn->id,
+                             -result, strerror(-result));
+        mark_closing(conn, DISCONNECT_SEND_ERROR);
+        return;
+    }
+    send_queue_consume(&conn->send_queue, result);
+    update_send_queue_gauge(conn);
+    if (conn->send_queue.queued_bytes > 0) {
+        queue_flush(conn);
+    }
+}
+
+static void accept_conn(io_thread_t *thread, int client_sock) {
+    // If the listening socket is shared, the other I/O threads race for the
+    // same connections, so `EAGAIN` is expected
+    if (client_sock < 0) {
+        if (client_sock != -EAGAIN && client_sock != -EWOULDBLOCK) {
+            log_warn_ratelimited("couldn't accept connection: errno %d -- %s", -client_sock,
+                                 strerror(-client_sock));
+        }
+        return;
+    }
+    log_debug("accepted socket %d", client_sock);
+
+    conn_t *conn = conn_new(thread, client_sock);
+    if (event_loop_add(thread->loop, client_sock, EVENT_RECV, conn) == -1) {
+        log_warn_ratelimited("adding socket %d to event loop failed: errno %d -- %s, closing socket", client_sock,
+                             errno, strerror(errno));
+        conn_free(thread, conn);
+        close(client_sock);
+        return;
+    }
+
+    io_input_t input = {
+        .type = INPUT_CONNECT,
+        .conn_id = conn->id,
+    };
+    push_input(thread, &input, false);
+}
+
+/*
+ * Validates the message and hands a copy of it to the simulation thread.
+ *
+ * Returns false if the message is invalid.
+ */
+static bool push_message(io_thread_t *thread, conn_t *conn, uint8_t *data, int msg_len) {
+    uint64_t arena_buf[8];
+    message_arena_t arena;
+    generic_message_t *generic_msg;
+
+    // Clients only send small messages, which decode without arrays
+    message_arena_init(&arena, arena_buf, sizeof(arena_buf));
+    if (msg_len > MAX_CLIENT_MESSAGE_LEN || decode_message(data, msg_len, &arena, &generic_msg) == 0) {
+        return false;
+    }
+    metrics_add(&thread->metrics->messages_received[generic_msg->message_type], 1);
+    metrics_add(&thread->metrics->bytes_received[generic_msg->message_type], msg_len);
+
+    io_input_t input = {
+        .type = INPUT_MESSAGE,
+        .conn_id = conn->id,
+        .len = msg_len,
+    };
+    memcpy(input.data, data, msg_len);
+    push_input(thread, &input, generic_msg->message_type == MSG_SET_TARGET);
+    return true;
+}
+
+/*
+ * Decodes all complete messages in the connection's receive buffer. A trailing
+ * partial message stays in the buffer until the rest of it arrives.
+ */
+static void decode_messages(io_thread_t *thread, conn_t *conn) {
+    recv_buffer_t *recv_buffer = &conn->recv_buffer;
+
+    while (!conn->closing) {
+        uint8_t *data = recv_buffer_data(recv_buffer);
+        int len = recv_buffer_len(recv_buffer);
+        int msg_len = peek_message_length(data, len);
+
+        if (msg_len == 0 || msg_len > len) {
+            if (msg_len > recv_buffer->capacity) {
+                log_warn_ratelimited("connection %u sent a message that is too long, closing socket", conn->id);
+                mark_closing(conn, DISCONNECT_INVALID_MESSAGE);
+            }
+            return;
+        }
+
+        if (msg_len == -1 || !push_message(thread, conn, data, msg_len)) {
+            log_warn_ratelimited("connection %u sent an invalid message, closing socket", conn->id);
+            mark_closing(conn, DISCONNECT_INVALID_MESSAGE);
+            return;
+        }
+        recv_buffer_consume(recv_buffer, msg_len);
+    }
+}
+
+static void receive(io_thread_t *thread, conn_t *conn, event_t *event) {
+    uint8_t *data = event->data;
+    int len = event->result;
+
+    if (conn->closing) {
+        return;
+    }
+    if (len < 0) {
+        log_warn_ratelimited("error when receiving from connection %u: errno %d -- %s, closing socket", conn->id,
+                             -len, strerror(-len));
+        mark_closing(conn, DISCONNECT_RECV_ERROR);
+        return;
+    }
+    // Closed orderly by peer
+    if (len == 0) {
+        mark_closing(conn, DISCONNECT_PEER);
+        return;
+    }
+
+    log_debug("received %d bytes from connection %u", len, conn->id);
+    // The received bytes may not fit next to a partial message, so they are
+    // copied and decoded piece by piece
+    while (len > 0 && !conn->closing) {
+        int copied = recv_buffer_write(&conn->recv_buffer, data, len);
+        data += copied;
+        len -= copied;
+        decode_messages(thread, conn);
+    }
+}
+
+static int send_udp_packet(void *udata, const struct iovec *iov, int iov_count) {
+    conn_t *conn = udata;
+    struct msghdr msg = {
+        .msg_name = &conn->udp_addr,
+        .msg_namelen = sizeof(conn->udp_addr),
+        .msg_iov = (struct iovec *)iov,
+        .msg_iovlen = iov_count,
+    };
+
+    // If the socket buffer is full, the packet is lost like any other, and
+    // the reliable channel retransmits it
+    return sendmsg(conn->thread->udp_sock, &msg, 0) == -1 ? -1 : 0;
+}
+
+static void deliver_udp_message(void *udata, uint8_t *msg, int msg_len) {
+    conn_t *conn = udata;
+
+    if (conn->closing) {
+        return;
+    }
+
+    // Every datagram carries exactly one message
+    if (peek_message_length(msg, msg_len) != msg_len || !push_message(conn->thread, conn, msg, msg_len)) {
+        log_warn_ratelimited("connection %u sent an invalid message, closing connection", conn->id);
+        mark_closing(conn, DISCONNECT_INVALID_MESSAGE);
+    }
+}
+
+static conn_t *find_udp_conn(io_thread_t *thread, struct sockaddr_in *addr) {
+    conn_t *conn = tree_get(thread->udp_conns_by_port, ntohs(addr->sin_port));
+    if (conn == no_node_sentinel) {
+        return NULL;
+    }
+
+    // Clients behind different addresses can use the same port
+    while (conn && conn->udp_addr.sin_addr.s_addr != addr->sin_addr.s_addr) {
+        conn = conn->next_with_port;
+    }
+    return conn;
+}
+
+static conn_t *udp_conn_new(io_thread_t *thread, struct sockaddr_in *addr) {
+    conn_t *conn = conn_new(thread, -1);
+    int port = ntohs(addr->sin_port);
+
+    conn->udp = malloc(sizeof(udp_peer_t));
+    udp_peer_init(conn->udp, send_udp_packet, deliver_udp_message, conn, now_msec());
+    conn->udp_addr = *addr;
+
+    conn_t *head = tree_get(thread->udp_conns_by_port, port);
+    conn->next_with_port = head == no_node_sentinel ? NULL : head;
+    tree_insert(thread->udp_conns_by_port, port, conn);
+    thread->udp_conn_count++;
+
+    io_input_t input = {
+        .type = INPUT_CONNECT,
+        .conn_id = conn->id,
+    };
+    push_input(thread, &input, false);
+
+    return conn;
+}
+
+/*
+ * Handles a datagram from an address without a connection. Only handshake
+ * packets are answered, see `udp_transport.h`.
+ */
+static void handle_udp_handshake(io_thread_t *thread, struct sockaddr_in *addr, int packet_len) {
+    uint32_t ip = ntohl(addr->sin_addr.s_addr);
+    uint16_t port = ntohs(addr->sin_port);
+    uint64_t cookie;
+
+    switch (udp_handshake_read(thread->udp_packet_buf, packet_len, &cookie)) {
+        case UDP_PACKET_HELLO: {
+            // The cookie is stateless and no longer than the hello, so spoofed
+            // hellos neither take up memory nor amplify traffic
+            uint8_t reply[UDP_HANDSHAKE_LEN];
+            udp_handshake_write(reply, UDP_PACKET_COOKIE, udp_cookie(&thread->udp_cookie_secret, ip, port, now_msec()));
+            // A lost cookie is like a lost hello, which the client repeats
+            sendto(thread->udp_sock, reply, sizeof(reply), 0, (struct sockaddr *)addr, sizeof(*addr));
+            break;
+        }
+
+        case UDP_PACKET_CONNECT:
+            if (!udp_cookie_valid(&thread->udp_cookie_secret, ip, port, cookie, now_msec())) {
+                break;
+            }
+            if (thread->udp_conn_count >= MAX_UDP_CONNS_PER_THREAD) {
+                log_warn_ratelimited("too many UDP connections (%d), ignoring connect", thread->udp_conn_count);
+                break;
+            }
+            udp_conn_new(thread, addr);
+            break;
+    }
+}
+
+static void read_udp(io_thread_t *thread) {
+    struct sockaddr_in addr;
+    socklen_t addr_len;
+    int packet_len;
+
+    // The socket is edge-triggered, so we have to read until there is no more
+    // data
+    while (1) {
+        addr_len = sizeof(addr);
+        packet_len = recvfrom(thread->udp_sock, thread->udp_packet_buf, UDP_MAX_PACKET_LEN, 0,
+                              (struct sockaddr *)&addr, &addr_len);
+        if (packet_len == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_warn_ratelimited("error when receiving from UDP socket: errno %d -- %s", errno, strerror(errno));
+            }
+            return;
+        }
+
+        conn_t *conn = find_udp_conn(thread, &addr);
+        if (!conn) {
+            handle_udp_handshake(thread, &addr, packet_len);
+        } else if (!conn->closing) {
+            // Malformed datagrams are ignored, since anyone can send them
+            udp_peer_receive(conn->udp, thread->udp_packet_buf, packet_len, now_msec());
+        }
+    }
+}
+
+static void update_udp_conns(io_thread_t *thread) {
+    long long now = now_msec();
+
+    for (int i = 0; i < thread->conn_count; i++) {
+        conn_t *conn = thread->conns[i];
+        if (conn->udp && !conn->closing && udp_peer_update(conn->udp, now) == -1) {
+            log_warn_ratelimited("UDP connection %u timed out, closing connection", conn->id);
+            mark_closing(conn, DISCONNECT_UDP_TIMEOUT);
+        }
+    }
+}
+
+static void process_outputs(io_thread_t *thread) {
+    io_output_t output;
+    conn_t *conn;
+
+    while (spsc_queue_pop(&thread->outputs, &output)) {
+        switch (output.type) {
+            case OUTPUT_SEND:
+                conn = find_conn(thread, output.conn_id);
+                if (conn) {
+                    send_frame(conn, output.frame, output.droppable);
+                }
+                frame_release(output.frame);
+                break;
+
+            case OUTPUT_BROADCAST:
+                for (int i = 0; i < thread->conn_count; i++) {
+                    if (thread->conns[i]->subscribed) {
+                        send_frame(thread->conns[i], output.frame, output.droppable);
+                    }
+                }
+                frame_release(output.frame);
+                break;
+
+            case OUTPUT_SUBSCRIBE:
+                conn = find_conn(thread, output.conn_id);
+                if (conn) {
+                    conn->subscribed = true;
+                }
+                break;
+
+            case OUTPUT_CLOSE:
+                conn = find_conn(thread, output.conn_id);
+                if (conn) {
+                    mark_closing(conn, DISCONNECT_SERVER);
+                    conn->close_requested = true;
+                }
+                break;
+        }
+    }
+}
+
+/*
+ * Returns the phase the event belongs to.
+ */
+static int handle_event(io_thread_t *thread, event_t *event) {
+    if (event->events & EVENT_NOTIFY) {
+        process_outputs(thread);
+        return IO_PHASE_OUTPUTS;
+    }
+    if (event->events & EVENT_TIMER) {
+        update_udp_conns(thread);
+        return IO_PHASE_UDP_TIMER;
+    }
+    if (event->events & EVENT_ACCEPT) {
+        accept_conn(thread, event->result);
+        return IO_PHASE_ACCEPT;
+    }
+    if (event->fd == thread->udp_sock) {
+        read_udp(thread);
+        return IO_PHASE_READ;
+    }
+
+    conn_t *conn = event->udata;
+    if (event->events & EVENT_SEND) {
+        finish_send(conn, event->result);
+        return IO_PHASE_WRITE;
+    }
+    receive(thread, conn, event);
+    return IO_PHASE_READ;
+}
+
+static void *io_thread_main(void *arg) {
+    io_thread_t *thread = arg;
+    server_io_t *io = thread->io;
+    event_t events[IO_MAX_EVENTS];
+    int event_count;
+
+    while (!atomic_load(&io->stopping)) {
+        event_count = event_loop_wait(thread->loop, events, IO_MAX_EVENTS, -1);
+        if (event_count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("waiting for events failed: errno %d -- %s", errno, strerror(errno));
+            break;
+        }
+        long long batch_start = monotonic_nsec();
+        // The batch isn't recorded if the simulation thread is taking the
+        // recorded phases right now, so the I/O thread never waits for it
+        bool profiling = pthread_mutex_trylock(&thread->profile_lock) == 0;
+        if (profiling) {
+            profiler_start(&thread->profile);
+        }
+
+        for (int i = 0; i < event_count; i++) {
+            int phase = handle_event(thread, &events[i]);
+            if (profiling) {
+                profiler_lap(&thread->profile, phase);
+            }
+        }
+
+        // Connections are only freed here, so the connection pointers of the
+        // events above stay valid for the whole batch
+        reap_conns(thread);
+        if (profiling) {
+            profiler_lap(&thread->profile, IO_PHASE_REAP);
+        }
+        flush_conns(thread);
+        if (profiling) {
+            profiler_lap(&thread->profile, IO_PHASE_WRITE);
+            profiler_stop(&thread->profile);
+            pthread_mutex_unlock(&thread->profile_lock);
+        }
+
+        atomic_fetch_add_explicit(&thread->busy_nsec, monotonic_nsec() - batch_start, memory_order_relaxed);
+    }
+
+    for (int i = 0; i < thread->conn_count; i++) {
+        mark_closing(thread->conns[i], DISCONNECT_SHUTDOWN);
+        thread->conns[i]->close_requested = true;
+    }
+    reap_conns(thread);
+    // Closing the sockets cancelled the pending sends, which are reported
+    // right away
+    while (thread->conn_count > 0) {
+        event_count = event_loop_wait(thread->loop, events, IO_MAX_EVENTS, -1);
+        if (event_count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("waiting for cancelled sends failed: errno %d -- %s", errno, strerror(errno));
+            break;
+        }
+        for (int i = 0; i < event_count; i++) {
+            if (events[i].events & EVENT_SEND) {
+                finish_send(events[i].udata, events[i].result);
+            }
+        }
+        reap_conns(thread);
+    }
+
+    return NULL;
+}
+
+static io_thread_t *thread_of(server_io_t *io, uint32_t conn_id) {
+    return &io->threads[conn_id % io->n_threads];
+}
+
+static void push_output(io_thread_t *thread, io_output_t *output) {
+    // Outputs must stay in order, so once there is a backlog everything goes
+    // there until `server_io_flush` moved it to the queue
+    if (thread->backlog_len > 0 || !spsc_queue_push(&thread->outputs, output)) {
+        if (thread->backlog_len == thread->backlog_capacity) {
+            thread->backlog_capacity = thread->backlog_capacity ? thread->backlog_capacity * 2 : 1024;
+            thread->backlog = realloc(thread->backlog, thread->backlog_capacity * sizeof(io_output_t));
+        }
+        thread->backlog[thread->backlog_len++] = *output;
+    }
+    thread->outputs_pending = true;
+}
+
+/*
+ * Stops the first `n_started` threads and frees the first `n_initialized`
+ * threads (whose event loop may be missing if creating it failed) and `io`.
+ */
+static void shutdown_threads(server_io_t *io, int n_initialized, int n_started) {
+    atomic_store(&io->stopping, true);
+    for (int i = 0; i < n_started; i++) {
+        event_loop_notify(io->threads[i].loop);
+    }
+
+    for (int i = 0; i < n_initialized; i++) {
+        io_thread_t *thread = &io->threads[i];
+        io_output_t output;
+
+        if (i < n_started) {
+            pthread_join(thread->thread, NULL);
+        }
+
+        while (spsc_queue_pop(&thread->outputs, &output)) {
+            if (output.frame) {
+                frame_release(output.frame);
+            }
+        }
+        for (int j = 0; j < thread->backlog_len; j++) {
+            if (thread->backlog[j].frame) {
+                frame_release(thread->backlog[j].frame);
+            }
+        }
+
+        if (thread->loop) {
+            event_loop_free(thread->loop);
+        }
+        spsc_queue_free(&thread->inputs);
+        spsc_queue_free(&thread->outputs);
+        tree_free(thread->conns_by_id, NULL);
+        tree_free(thread->udp_conns_by_port, NULL);
+        free(thread->udp_packet_buf);
+        free(thread->conns);
+        free(thread->flush_conns);
+        free(thread->backlog);
+        pthread_mutex_destroy(&thread->profile_lock);
+        profiler_free(&thread->profile);
+    }
+
+    free(io->threads);
+    free(io);
+}
+
+server_io_t *server_io_start(const int *listen_socks, int n_listen_socks, int udp_sock, int n_threads,
+                             metrics_t *metrics) {
+    server_io_t *io = calloc(1, sizeof(server_io_t));
+    int n_initialized = 0, n_started = 0;
+
+    io->n_threads = n_threads;
+    atomic_init(&io->stopping, false);
+    io->threads = calloc(n_threads, sizeof(io_thread_t));
+
+    for (int i = 0; i < n_threads; i++) {
+        io_thread_t *thread = &io->threads[i];
+        thread->io = io;
+        thread->idx = i;
+        atomic_init(&thread->busy_nsec, 0);
+        pthread_mutex_init(&thread->profile_lock, NULL);
+        server_io_profiler_init(&thread->profile);
+        // The first shard belongs to the simulation thread
+        thread->metrics = &metrics->shards[i + 1];
+        thread->listen_sock = listen_socks[i % n_listen_socks];
+        thread->udp_sock = i == 0 ? udp_sock : -1;
+        thread->conns_by_id = tree_new();
+        thread->udp_conns_by_port = tree_new();
+        spsc_queue_init(&thread->inputs, INPUT_QUEUE_CAPACITY, sizeof(io_input_t));
+        spsc_queue_init(&thread->outputs, OUTPUT_QUEUE_CAPACITY, sizeof(io_output_t));
+        n_initialized++;
+
+        thread->loop = event_loop_new();
+        if (!thread->loop) {
+            perror("creating event loop for I/O thread failed");
+            goto fail;
+        }
+        if (event_loop_add(thread->loop, thread->listen_sock, EVENT_ACCEPT, NULL) == -1) {
+            perror("adding listening socket to event loop failed");
+            goto fail;
+        }
+
+        if (thread->udp_sock != -1) {
+            thread->udp_packet_buf = malloc(UDP_MAX_PACKET_LEN);
+            if (udp_cookie_secret_init(&thread->udp_cookie_secret) == -1) {
+                perror("generating UDP cookie secret failed");
+                goto fail;
+            }
+            if (event_loop_add(thread->loop, thread->udp_sock, EVENT_READ, NULL) == -1) {
+                perror("adding UDP socket to event loop failed");
+                goto fail;
+            }
+            // Drives retransmissions and acks
+            if (event_loop_set_timer(thread->loop, UDP_UPDATE_INTERVAL_MSEC * 1000000L, NULL) == -1) {
+                perror("adding timer to event loop failed");
+                goto fail;
+            }
+        }
+    }
+
+    for (int i = 0; i < n_threads; i++) {
+        io_thread_t *thread = &io->threads[i];
+        int err = pthread_create(&thread->thread, NULL, io_thread_main, thread);
+        if (err != 0) {
+            errno = err;
+            perror("starting I/O thread failed");
+            goto fail;
+        }
+        n_started++;
+    }
+
+    return io;
+
+fail:
+    // The threads that are already running have to be stopped before
+    // anything they use can be freed
+    shutdown_threads(io, n_initialized, n_started);
+    return NULL;
+}
+
+void server_io_stop(server_io_t *io) {
+    shutdown_threads(io, io->n_threads, io->n_threads);
+}
+
+bool server_io_poll_input(server_io_t *io, io_input_t *input) {
+    while (io->poll_thread_idx < io->n_threads) {
+        if (spsc_queue_pop(&io->threads[io->poll_thread_idx].inputs, input)) {
+            return true;
+        }
+        io->poll_thread_idx++;
+    }
+
+    io->poll_thread_idx = 0;
+    return false;
+}
+
+void server_io_send(server_io_t *io, uint32_t conn_id, frame_t *frame, bool droppable) {
+    io_output_t output = {
+        .type = OUTPUT_SEND,
+        .droppable = droppable,
+        .conn_id = conn_id,
+        .frame = frame_ref(frame),
+    };
+    push_output(thread_of(io, conn_id), &output);
+}
+
+void server_io_broadcast(server_io_t *io, frame_t *frame, bool droppable) {
+    for (int i = 0; i < io->n_threads; i++) {
+        io_output_t output = {
+            .type = OUTPUT_BROADCAST,
+            .droppable = droppable,
+            .frame = frame_ref(frame),
+        };
+        push_output(&io->threads[i], &output);
+    }
+}
+
+void server_io_subscribe(server_io_t *io, uint32_t conn_id) {
+    io_output_t output = {
+        .type = OUTPUT_SUBSCRIBE,
+        .conn_id = conn_id,
+    };
+    push_output(thread_of(io, conn_id), &output);
+}
+
+void server_io_close(server_io_t *io, uint32_t conn_id) {
+    io_output_t output = {
+        .type = OUTPUT_CLOSE,
+        .conn_id = conn_id,
+    };
+    push_output(thread_of(io, conn_id), &output);
+}
+
+long long server_io_take_busy_nsec(server_io_t *io) {
+    long long busy_nsec = 0;
+    for (int i = 0; i < io->n_threads; i++) {
+        busy_nsec += atomic_exchange_explicit(&io->threads[i].busy_nsec, 0, memory_order_relaxed);
+    }
+    return busy_nsec;
+}
+
+void server_io_profiler_init(profiler_t *profiler) {
+    profiler_init(profiler, IO_PHASE_COUNT, io_phase_names);
+}
+
+void server_io_take_profile(server_io_t *io, profiler_t *profiler) {
+    for (int i = 0; i < io->n_threads; i++) {
+        io_thread_t *thread = &io->threads[i];
+        pthread_mutex_lock(&thread->profile_lock);
+        profiler_merge(profiler, &thread->profile);
+        profiler_reset(&thread->profile);
+        pthread_mutex_unlock(&thread->profile_lock);
+    }
+}
+
+void server_io_flush(server_io_t *io) {
+    for (int i = 0; i < io->n_threads; i++) {
+        io_thread_t *thread = &io->threads[i];
+        int moved = 0;
+
+        while (moved < thread->backlog_len && spsc_queue_push(&thread->outputs, &thread->backlog[moved])) {
+            moved++;
+        }
+        thread->backlog_len -= moved;
+        memmove(thread->backlog, thread->backlog + moved, thread->backlog_len * sizeof(io_output_t));
+
+        if (thread->outputs_pending) {
+            event_loop_notify(thread->loop);
+            // Whatever is still in the backlog has to be retried next time
+            thread->outputs_pending = thread->backlog_len > 0;
+        }
+    }
+}
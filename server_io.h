@@ -0,0 +1,126 @@
+#ifndef SERVER_IO_H
+#define SERVER_IO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "metrics.h"
+#include "networking.h"
+#include "profiler.h"
+#include "protocol.h"
+
+/*
+ * Network side of the server. Connections are sharded over a number of I/O
+ * threads, each of which runs its own event loop and owns the sockets, send
+ * queues and receive buffers of its connections.
+ *
+ * The I/O threads validate incoming messages and hand them to the simulation
+ * thread as inputs through lock-free queues. Inputs carry the raw bytes of the
+ * message, which the simulation thread decodes with `decode_message`, so
+ * nothing is allocated for them on either side. The simulation thread answers
+ * with outputs (frames to send, connections to close), which go back through
+ * one queue per I/O thread.
+ *
+ * All functions in this header must only be called from the simulation thread.
+ */
+
+// A new connection was accepted
+#define INPUT_CONNECT 1
+// A message was received on a connection
+#define INPUT_MESSAGE 2
+// A connection was closed by the peer or because of an error. The connection
+// id is not valid anymore.
+#define INPUT_DISCONNECT 3
+
+typedef struct io_input_t {
+    int type;
+    uint32_t conn_id;
+    // Only set for `INPUT_MESSAGE`: the message as received, which is known
+    // to be valid
+    uint8_t len;
+    uint8_t data[MAX_CLIENT_MESSAGE_LEN];
+} io_input_t;
+
+typedef struct server_io_t server_io_t;
+
+/*
+ * Starts `n_threads` I/O threads. Thread `i` accepts connections on the
+ * non-blocking listening socket `listen_socks[i % n_listen_socks]`, so either
+ * all threads share one socket, or each thread owns its own `SO_REUSEPORT`
+ * socket and the kernel spreads the connections over them.
+ *
+ * Unless `udp_sock` is -1, the first thread also serves connections over the
+ * UDP transport (see `udp_transport.h`) on that non-blocking socket. Droppable
+ * frames go over the unreliable channel, all others over the reliable one.
+ *
+ * Thread `i` records its counters in `metrics->shards[i + 1]`, so `metrics`
+ * needs at least `n_threads + 1` shards and has to outlive the I/O threads.
+ *
+ * Returns NULL on error.
+ */
+server_io_t *server_io_start(const int *listen_socks, int n_listen_socks, int udp_sock, int n_threads,
+                             metrics_t *metrics);
+
+/*
+ * Stops and joins all I/O threads and closes all connections.
+ */
+void server_io_stop(server_io_t *io);
+
+/*
+ * Pops the next input. Inputs of one I/O thread are returned in the order they
+ * were received, and the I/O threads are drained in a fixed order.
+ *
+ * Returns false if there are no more inputs.
+ */
+bool server_io_poll_input(server_io_t *io, io_input_t *input);
+
+/*
+ * Queues the frame to be sent on the connection. A reference to the frame is
+ * taken, so the caller can release its own reference right away.
+ *
+ * `droppable` frames are skipped for connections that can't keep up.
+ */
+void server_io_send(server_io_t *io, uint32_t conn_id, frame_t *frame, bool droppable);
+
+/*
+ * Queues the frame to be sent on all subscribed connections.
+ */
+void server_io_broadcast(server_io_t *io, frame_t *frame, bool droppable);
+
+/*
+ * Subscribes the connection to broadcasts.
+ */
+void server_io_subscribe(server_io_t *io, uint32_t conn_id);
+
+/*
+ * Closes the connection after the frames that were queued before were sent.
+ * No `INPUT_DISCONNECT` is generated for it.
+ */
+void server_io_close(server_io_t *io, uint32_t conn_id);
+
+/*
+ * Returns the time all I/O threads together spent handling events since the
+ * last call, as opposed to waiting for them.
+ */
+long long server_io_take_busy_nsec(server_io_t *io);
+
+/*
+ * Initializes a profiler with the phases of the I/O threads, for
+ * `server_io_take_profile`.
+ */
+void server_io_profiler_init(profiler_t *profiler);
+
+/*
+ * Adds what the I/O threads recorded since the last call to `profiler`. A
+ * batch of events is a sample of the total, and every event a sample of its
+ * phase. Waits for the batches the I/O threads are recording.
+ */
+void server_io_take_profile(server_io_t *io, profiler_t *profiler);
+
+/*
+ * Wakes up the I/O threads that have pending outputs. Outputs are not
+ * guaranteed to be processed before this is called.
+ */
+void server_io_flush(server_io_t *io);
+
+#endif // SERVER_IO_H
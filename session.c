@@ -0,0 +1,204 @@
+#include "session.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RECORD_TICK 1
+#define RECORD_CONNECT 2
+#define RECORD_MESSAGE 3
+#define RECORD_DISCONNECT 4
+#define RECORD_END 5
+
+#define WRITE_BUFFER_LEN (1 << 20)
+// Magic, version, seed, max players and food count
+#define HEADER_LEN (4 + 1 + 8 + 2 + 2)
+
+static void write_u8(FILE *file, uint8_t value) {
+    fputc(value, file);
+}
+
+static void write_u32(FILE *file, uint32_t value) {
+    uint32_t network_value = htonl(value);
+    fwrite(&network_value, 4, 1, file);
+}
+
+static bool read_u32(FILE *file, uint32_t *value) {
+    uint32_t network_value;
+    if (fread(&network_value, 4, 1, file) != 1) {
+        return false;
+    }
+    *value = ntohl(network_value);
+    return true;
+}
+
+int session_writer_open(session_writer_t *writer, const char *path, const session_header_t *header) {
+    uint8_t buf[HEADER_LEN];
+
+    writer->file = fopen(path, "wb");
+    if (!writer->file) {
+        return -1;
+    }
+    writer->file_buf = malloc(WRITE_BUFFER_LEN);
+    setvbuf(writer->file, writer->file_buf, _IOFBF, WRITE_BUFFER_LEN);
+    writer->has_tick = false;
+
+    memcpy(buf, SESSION_MAGIC, 4);
+    buf[4] = SESSION_VERSION;
+    for (int i = 0; i < 8; i++) {
+        buf[5 + i] = header->seed >> (56 - 8 * i);
+    }
+    buf[13] = header->max_players >> 8;
+    buf[14] = header->max_players;
+    buf[15] = header->food_count >> 8;
+    buf[16] = header->food_count;
+    fwrite(buf, HEADER_LEN, 1, writer->file);
+
+    return 0;
+}
+
+void session_writer_input(session_writer_t *writer, uint32_t tick, io_input_t *input) {
+    FILE *file = writer->file;
+
+    if (!writer->has_tick || tick != writer->tick) {
+        write_u8(file, RECORD_TICK);
+        write_u32(file, tick);
+        writer->tick = tick;
+        writer->has_tick = true;
+    }
+
+    switch (input->type) {
+        case INPUT_CONNECT:
+            write_u8(file, RECORD_CONNECT);
+            write_u32(file, input->conn_id);
+            break;
+
+        case INPUT_MESSAGE:
+            write_u8(file, RECORD_MESSAGE);
+            write_u32(file, input->conn_id);
+            fwrite(input->data, input->len, 1, file);
+            break;
+
+        case INPUT_DISCONNECT:
+            write_u8(file, RECORD_DISCONNECT);
+            write_u32(file, input->conn_id);
+            break;
+    }
+}
+
+int session_writer_close(session_writer_t *writer, uint32_t end_tick) {
+    write_u8(writer->file, RECORD_END);
+    write_u32(writer->file, end_tick);
+
+    // Also reports write errors that the buffer delayed
+    bool failed = ferror(writer->file);
+    int ret = fclose(writer->file);
+    free(writer->file_buf);
+    return failed || ret != 0 ? -1 : 0;
+}
+
+int session_reader_open(session_reader_t *reader, const char *path) {
+    uint8_t buf[HEADER_LEN];
+
+    memset(reader, 0, sizeof(session_reader_t));
+    reader->file = fopen(path, "rb");
+    if (!reader->file) {
+        return -1;
+    }
+
+    if (fread(buf, HEADER_LEN, 1, reader->file) != 1 || memcmp(buf, SESSION_MAGIC, 4) != 0
+            || buf[4] != SESSION_VERSION) {
+        fclose(reader->file);
+        errno = EINVAL;
+        return -1;
+    }
+    for (int i = 0; i < 8; i++) {
+        reader->header.seed = reader->header.seed << 8 | buf[5 + i];
+    }
+    reader->header.max_players = buf[13] << 8 | buf[14];
+    reader->header.food_count = buf[15] << 8 | buf[16];
+
+    return 0;
+}
+
+/*
+ * Reads the message of a message record into `input`.
+ *
+ * Returns false if the record is incomplete or the message is invalid.
+ */
+static bool read_message(session_reader_t *reader, io_input_t *input) {
+    uint8_t *buf = input->data;
+    uint64_t arena_buf[8];
+    message_arena_t arena;
+    generic_message_t *msg;
+
+    if (!read_u32(reader->file, &input->conn_id) || fread(buf, 2, 1, reader->file) != 1) {
+        return false;
+    }
+    int len = peek_message_length(buf, 2);
+    if (len < 3 || len > MAX_CLIENT_MESSAGE_LEN || fread(buf + 2, len - 2, 1, reader->file) != 1) {
+        return false;
+    }
+
+    input->type = INPUT_MESSAGE;
+    input->len = len;
+    message_arena_init(&arena, arena_buf, sizeof(arena_buf));
+    return decode_message(buf, len, &arena, &msg) != 0;
+}
+
+bool session_reader_next(session_reader_t *reader, uint32_t tick, io_input_t *input) {
+    while (!reader->done && reader->input_tick == tick) {
+        bool complete;
+
+        switch (fgetc(reader->file)) {
+            case RECORD_TICK:
+                complete = read_u32(reader->file, &reader->input_tick);
+                break;
+
+            case RECORD_CONNECT:
+                input->type = INPUT_CONNECT;
+                if (read_u32(reader->file, &input->conn_id)) {
+                    return true;
+                }
+                complete = false;
+                break;
+
+            case RECORD_MESSAGE:
+                if (read_message(reader, input)) {
+                    return true;
+                }
+                complete = false;
+                break;
+
+            case RECORD_DISCONNECT:
+                input->type = INPUT_DISCONNECT;
+                if (read_u32(reader->file, &input->conn_id)) {
+                    return true;
+                }
+                complete = false;
+                break;
+
+            case RECORD_END:
+                reader->done = read_u32(reader->file, &reader->end_tick);
+                complete = reader->done;
+                break;
+
+            default:
+                complete = false;
+                break;
+        }
+
+        // Everything up to the damaged record is still replayed
+        if (!complete) {
+            reader->done = true;
+            reader->truncated = true;
+            reader->end_tick = reader->input_tick;
+        }
+    }
+    return false;
+}
+
+void session_reader_close(session_reader_t *reader) {
+    fclose(reader->file);
+}
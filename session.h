@@ -0,0 +1,90 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "server_io.h"
+
+/*
+ * Binary log of everything that goes into a game: the seed of its random
+ * number generator, the settings that change the simulation, and every input
+ * with the tick it was applied in. Since the simulation only depends on
+ * these, replaying the inputs into a fresh game reproduces the session tick
+ * for tick, without any sockets.
+ *
+ * The log is a header followed by records. A tick record starts the inputs of
+ * a tick, and is only written for ticks that had inputs. Messages are stored
+ * in their wire format. All numbers are in network byte order, like in the
+ * protocol.
+ */
+
+#define SESSION_MAGIC "AGSS"
+#define SESSION_VERSION 1
+
+typedef struct session_header_t {
+    uint64_t seed;
+    int max_players;
+    int food_count;
+} session_header_t;
+
+typedef struct session_writer_t {
+    FILE *file;
+    // Tick of the last tick record
+    uint32_t tick;
+    bool has_tick;
+    char *file_buf;
+} session_writer_t;
+
+typedef struct session_reader_t {
+    FILE *file;
+    session_header_t header;
+    // Tick the next inputs belong to
+    uint32_t input_tick;
+    // Set once all records were read. The session ends at `end_tick`.
+    bool done;
+    // Set if the log ended without an end record, e.g. because the server
+    // crashed. The session then ends with the last tick that had inputs.
+    bool truncated;
+    uint32_t end_tick;
+} session_reader_t;
+
+/*
+ * Creates the log at `path` and writes the header. The log is written through
+ * a large buffer, so recording rarely costs a syscall.
+ *
+ * Returns 0 on success and -1 on error (with `errno` set).
+ */
+int session_writer_open(session_writer_t *writer, const char *path, const session_header_t *header);
+
+/*
+ * Appends an input that is applied in `tick`. Ticks must not decrease.
+ */
+void session_writer_input(session_writer_t *writer, uint32_t tick, io_input_t *input);
+
+/*
+ * Writes the end record with the last tick of the session and closes the log.
+ *
+ * Returns 0 on success and -1 on error (with `errno` set).
+ */
+int session_writer_close(session_writer_t *writer, uint32_t end_tick);
+
+/*
+ * Opens the log at `path` and reads its header.
+ *
+ * Returns 0 on success and -1 if the file can't be read or isn't a session log.
+ */
+int session_reader_open(session_reader_t *reader, const char *path);
+
+/*
+ * Reads the next input of `tick`. Ticks must be passed in increasing order,
+ * starting with the first tick of the session.
+ *
+ * Returns false if there are no more inputs for the tick.
+ */
+bool session_reader_next(session_reader_t *reader, uint32_t tick, io_input_t *input);
+
+void session_reader_close(session_reader_t *reader);
+
+#endif // SESSION_H
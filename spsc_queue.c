@@ -0,0 +1,60 @@
+#include "spsc_queue.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void spsc_queue_init(spsc_queue_t *queue, size_t capacity, size_t elem_size) {
+    size_t rounded_capacity = 1;
+    while (rounded_capacity < capacity) {
+        rounded_capacity *= 2;
+    }
+
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    queue->capacity = rounded_capacity;
+    queue->elem_size = elem_size;
+    queue->elems = malloc(rounded_capacity * elem_size);
+}
+
+void spsc_queue_free(spsc_queue_t *queue) {
+    free(queue->elems);
+    queue->elems = NULL;
+}
+
+bool spsc_queue_push(spsc_queue_t *queue, const void *elem) {
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+    if (tail - head == queue->capacity) {
+        return false;
+    }
+
+    memcpy(queue->elems + (tail & (queue->capacity - 1)) * queue->elem_size, elem, queue->elem_size);
+    // Publishes the element to the consumer
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+bool spsc_queue_pop(spsc_queue_t *queue, void *elem) {
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+    if (head == tail) {
+        return false;
+    }
+
+    memcpy(elem, queue->elems + (head & (queue->capacity - 1)) * queue->elem_size, queue->elem_size);
+    // Hands the slot back to the producer
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return true;
+}
+
+const void *spsc_queue_peek(spsc_queue_t *queue, size_t idx) {
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+    if (tail - head <= idx) {
+        return NULL;
+    }
+    return queue->elems + ((head + idx) & (queue->capacity - 1)) * queue->elem_size;
+}
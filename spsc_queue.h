@@ -0,0 +1,53 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SPSC_QUEUE_CACHE_LINE 64
+
+/*
+ * Bounded, lock-free queue for exactly one producer thread and one consumer
+ * thread. Elements have a fixed size and are copied in and out.
+ */
+typedef struct spsc_queue_t {
+    // Written by the producer, read by the consumer
+    _Alignas(SPSC_QUEUE_CACHE_LINE) atomic_size_t tail;
+    // Written by the consumer, read by the producer
+    _Alignas(SPSC_QUEUE_CACHE_LINE) atomic_size_t head;
+    _Alignas(SPSC_QUEUE_CACHE_LINE) size_t capacity;
+    size_t elem_size;
+    unsigned char *elems;
+} spsc_queue_t;
+
+/*
+ * `capacity` is rounded up to the next power of two.
+ */
+void spsc_queue_init(spsc_queue_t *queue, size_t capacity, size_t elem_size);
+void spsc_queue_free(spsc_queue_t *queue);
+
+/*
+ * Copies `elem` into the queue. Must only be called by the producer.
+ *
+ * Returns false if the queue is full.
+ */
+bool spsc_queue_push(spsc_queue_t *queue, const void *elem);
+
+/*
+ * Copies the oldest element into `elem` and removes it from the queue. Must
+ * only be called by the consumer.
+ *
+ * Returns false if the queue is empty.
+ */
+bool spsc_queue_pop(spsc_queue_t *queue, void *elem);
+
+/*
+ * Returns the `idx`-th oldest element without removing it, or NULL if there
+ * are fewer elements. Only safe for the consumer, except for best-effort
+ * inspection (e.g. while crashing), where the producer may overwrite elements
+ * that a concurrent consumer just removed.
+ */
+const void *spsc_queue_peek(spsc_queue_t *queue, size_t idx);
+
+#endif // SPSC_QUEUE_H
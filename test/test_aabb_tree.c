@@ -0,0 +1,136 @@
+#include "unity/unity.h"
+#include "../aabb_tree.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define OBJECT_COUNT 500
+#define FIELD_SIZE 1000
+
+static aabb_tree_t tree;
+static aabb_t boxes[OBJECT_COUNT];
+static int leaves[OBJECT_COUNT];
+static bool found[OBJECT_COUNT];
+
+void setUp(void) {
+    aabb_tree_init(&tree, 4);
+    srand(1);
+}
+
+void tearDown(void) {
+    aabb_tree_free(&tree);
+}
+
+static aabb_t random_box(void) {
+    float x = rand() % FIELD_SIZE, y = rand() % FIELD_SIZE, radius = 1 + rand() % 30;
+    return (aabb_t){x - radius, y - radius, x + radius, y + radius};
+}
+
+static bool overlaps(aabb_t a, aabb_t b) {
+    return a.min_x <= b.max_x && b.min_x <= a.max_x && a.min_y <= b.max_y && b.min_y <= a.max_y;
+}
+
+static void mark_found(void *udata, int data) {
+    (void)udata;
+    TEST_ASSERT_FALSE(found[data]);
+    found[data] = true;
+}
+
+/*
+ * Every object whose box overlaps the query box has to be found. Leaves are
+ * enlarged, so objects that are close by may be found too, but nothing that is
+ * further away than the margin.
+ */
+static void check_query(aabb_t box, bool *removed) {
+    for (int i = 0; i < OBJECT_COUNT; i++) {
+        found[i] = false;
+    }
+    aabb_tree_query(&tree, box, mark_found, NULL);
+
+    aabb_t enlarged = {box.min_x - 2 * tree.margin, box.min_y - 2 * tree.margin, box.max_x + 2 * tree.margin,
+                       box.max_y + 2 * tree.margin};
+    for (int i = 0; i < OBJECT_COUNT; i++) {
+        if (removed && removed[i]) {
+            TEST_ASSERT_FALSE(found[i]);
+        } else if (overlaps(boxes[i], box)) {
+            TEST_ASSERT_TRUE(found[i]);
+        } else if (!overlaps(boxes[i], enlarged)) {
+            TEST_ASSERT_FALSE(found[i]);
+        }
+    }
+}
+
+static void insert_all(void) {
+    for (int i = 0; i < OBJECT_COUNT; i++) {
+        boxes[i] = random_box();
+        leaves[i] = aabb_tree_insert(&tree, boxes[i], i);
+    }
+}
+
+void test_empty_tree(void) {
+    for (int i = 0; i < OBJECT_COUNT; i++) {
+        found[i] = false;
+    }
+    aabb_tree_query(&tree, (aabb_t){0, 0, FIELD_SIZE, FIELD_SIZE}, mark_found, NULL);
+    TEST_ASSERT_EQUAL(0, aabb_tree_height(&tree));
+
+    int leaf = aabb_tree_insert(&tree, (aabb_t){0, 0, 1, 1}, 0);
+    aabb_tree_remove(&tree, leaf);
+    aabb_tree_query(&tree, (aabb_t){0, 0, FIELD_SIZE, FIELD_SIZE}, mark_found, NULL);
+    TEST_ASSERT_FALSE(found[0]);
+}
+
+void test_query_matches_brute_force(void) {
+    insert_all();
+    for (int i = 0; i < 100; i++) {
+        check_query(random_box(), NULL);
+    }
+}
+
+void test_move_and_remove(void) {
+    static bool removed[OBJECT_COUNT];
+    insert_all();
+
+    for (int step = 0; step < 20; step++) {
+        int reinserted = 0;
+        for (int i = 0; i < OBJECT_COUNT; i++) {
+            if (removed[i]) {
+                continue;
+            }
+            float dx = rand() % 11 - 5, dy = rand() % 11 - 5;
+            boxes[i] = (aabb_t){boxes[i].min_x + dx, boxes[i].min_y + dy, boxes[i].max_x + dx, boxes[i].max_y + dy};
+            reinserted += aabb_tree_move(&tree, leaves[i], boxes[i]);
+        }
+        // Small moves mostly stay inside the enlarged leaves
+        TEST_ASSERT_LESS_THAN(OBJECT_COUNT - step * 10, reinserted);
+
+        for (int i = step * 10; i < step * 10 + 10; i++) {
+            aabb_tree_remove(&tree, leaves[i]);
+            removed[i] = true;
+        }
+        for (int i = 0; i < 10; i++) {
+            check_query(random_box(), removed);
+        }
+    }
+}
+
+void test_stays_balanced(void) {
+    // Inserting sorted boxes would make an unbalanced tree a list
+    for (int i = 0; i < OBJECT_COUNT; i++) {
+        boxes[i] = (aabb_t){i * 10, 0, i * 10 + 5, 5};
+        leaves[i] = aabb_tree_insert(&tree, boxes[i], i);
+    }
+
+    // A balanced tree with 500 leaves is 9 levels high
+    TEST_ASSERT_LESS_OR_EQUAL(18, aabb_tree_height(&tree));
+    check_query((aabb_t){1000, 0, 1100, 5}, NULL);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_tree);
+    RUN_TEST(test_query_matches_brute_force);
+    RUN_TEST(test_move_and_remove);
+    RUN_TEST(test_stays_balanced);
+    return UNITY_END();
+}
@@ -0,0 +1,127 @@
+#include "unity/unity.h"
+#include "../food.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define FIELD_SIZE 1000
+
+static food_grid_t grid;
+
+void setUp(void) {
+    food_grid_init(&grid, FIELD_SIZE, FIELD_SIZE, FOOD_CELL_SIZE);
+}
+
+void tearDown(void) {
+    food_grid_free(&grid);
+}
+
+void test_spawn_records_changes(void) {
+    uint32_t a = food_spawn(&grid, 10, 10);
+    uint32_t b = food_spawn(&grid, FIELD_SIZE, FIELD_SIZE);
+    TEST_ASSERT_NOT_EQUAL(a, b);
+    TEST_ASSERT_EQUAL(2, grid.count);
+    TEST_ASSERT_EQUAL(2, grid.spawned_count);
+    TEST_ASSERT_EQUAL(a, grid.spawned[0].food_id);
+    TEST_ASSERT_EQUAL_FLOAT(FIELD_SIZE, grid.spawned[1].x);
+
+    food_clear_changes(&grid);
+    TEST_ASSERT_EQUAL(0, grid.spawned_count);
+    TEST_ASSERT_EQUAL(2, grid.count);
+}
+
+void test_eat_only_inside_radius(void) {
+    // Around a cell corner, so the circle covers several cells
+    float x = FOOD_CELL_SIZE * 3, y = FOOD_CELL_SIZE * 3;
+    uint32_t inside[] = {
+        food_spawn(&grid, x, y),
+        food_spawn(&grid, x - 9, y),
+        food_spawn(&grid, x + 6, y + 6),
+        food_spawn(&grid, x - 1, y - 9.9f),
+    };
+    food_spawn(&grid, x + 10, y);
+    food_spawn(&grid, x + 8, y - 8);
+    food_spawn(&grid, x - 200, y);
+    food_clear_changes(&grid);
+
+    TEST_ASSERT_EQUAL(4, food_eat(&grid, x, y, 10));
+    TEST_ASSERT_EQUAL(3, grid.count);
+    TEST_ASSERT_EQUAL(4, grid.eaten_count);
+    for (int i = 0; i < 4; i++) {
+        bool found = false;
+        for (int j = 0; j < grid.eaten_count; j++) {
+            found |= grid.eaten[j] == inside[i];
+        }
+        TEST_ASSERT_TRUE(found);
+    }
+
+    // Eaten pellets are gone
+    TEST_ASSERT_EQUAL(0, food_eat(&grid, x, y, 10));
+}
+
+void test_eat_near_field_border(void) {
+    food_spawn(&grid, 0, 0);
+    food_spawn(&grid, FIELD_SIZE, FIELD_SIZE);
+
+    TEST_ASSERT_EQUAL(1, food_eat(&grid, 1, 1, 20));
+    TEST_ASSERT_EQUAL(1, food_eat(&grid, FIELD_SIZE - 1, FIELD_SIZE, 20));
+    TEST_ASSERT_EQUAL(0, grid.count);
+}
+
+void test_collect_matches_brute_force(void) {
+    srand(1);
+    for (int i = 0; i < 5000; i++) {
+        food_spawn(&grid, (float)rand() / RAND_MAX * FIELD_SIZE, (float)rand() / RAND_MAX * FIELD_SIZE);
+    }
+
+    int expected = grid.count;
+    for (int i = 0; i < 50; i++) {
+        float x = rand() % FIELD_SIZE, y = rand() % FIELD_SIZE, radius = 5 + rand() % 100;
+        int in_circle = 0;
+        food_position_t *foods = malloc(grid.count * sizeof(food_position_t));
+        food_collect(&grid, foods);
+        for (int j = 0; j < grid.count; j++) {
+            float dx = foods[j].x - x, dy = foods[j].y - y;
+            in_circle += dx * dx + dy * dy < radius * radius;
+        }
+        free(foods);
+
+        TEST_ASSERT_EQUAL(in_circle, food_eat(&grid, x, y, radius));
+        expected -= in_circle;
+        TEST_ASSERT_EQUAL(expected, grid.count);
+    }
+}
+
+void test_batches_fit_into_a_message(void) {
+    static uint8_t buf[65535];
+    static food_position_t foods[MAX_SPAWNED_FOOD_PER_MESSAGE + 1];
+    static uint32_t food_ids[MAX_EATEN_FOOD_PER_MESSAGE + 1];
+
+    spawned_food_message_t spawned_msg = {
+        .message_type = MSG_SPAWNED_FOOD,
+        .food_count = MAX_SPAWNED_FOOD_PER_MESSAGE,
+        .food_positions = foods,
+    };
+    TEST_ASSERT_GREATER_THAN(0, serialize_message((generic_message_t *)&spawned_msg, buf, sizeof(buf)));
+    spawned_msg.food_count++;
+    TEST_ASSERT_EQUAL(-1, serialize_message((generic_message_t *)&spawned_msg, buf, sizeof(buf)));
+
+    eaten_food_message_t eaten_msg = {
+        .message_type = MSG_EATEN_FOOD,
+        .food_count = MAX_EATEN_FOOD_PER_MESSAGE,
+        .food_ids = food_ids,
+    };
+    TEST_ASSERT_GREATER_THAN(0, serialize_message((generic_message_t *)&eaten_msg, buf, sizeof(buf)));
+    eaten_msg.food_count++;
+    TEST_ASSERT_EQUAL(-1, serialize_message((generic_message_t *)&eaten_msg, buf, sizeof(buf)));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_spawn_records_changes);
+    RUN_TEST(test_eat_only_inside_radius);
+    RUN_TEST(test_eat_near_field_border);
+    RUN_TEST(test_collect_matches_brute_force);
+    RUN_TEST(test_batches_fit_into_a_message);
+    return UNITY_END();
+}
@@ -0,0 +1,101 @@
+#include "unity/unity.h"
+#include "../hdr_histogram.h"
+
+#include <stdlib.h>
+
+#define VALUE_COUNT 10000
+
+static hdr_histogram_t histogram;
+
+void setUp(void) {
+    hdr_histogram_init(&histogram);
+    srand(1);
+}
+
+void tearDown(void) {
+    hdr_histogram_free(&histogram);
+}
+
+static int compare_values(const void *a, const void *b) {
+    long long a_value = *(const long long *)a;
+    long long b_value = *(const long long *)b;
+    return a_value < b_value ? -1 : (a_value > b_value);
+}
+
+void test_small_values_are_exact(void) {
+    TEST_ASSERT_EQUAL(0, hdr_histogram_percentile(&histogram, 50));
+
+    for (int i = 0; i < 100; i++) {
+        hdr_histogram_record(&histogram, i);
+    }
+    TEST_ASSERT_EQUAL(0, hdr_histogram_percentile(&histogram, 0));
+    TEST_ASSERT_EQUAL(49, hdr_histogram_percentile(&histogram, 50));
+    TEST_ASSERT_EQUAL(98, hdr_histogram_percentile(&histogram, 99));
+    TEST_ASSERT_EQUAL(99, hdr_histogram_percentile(&histogram, 100));
+    TEST_ASSERT_EQUAL(0, histogram.min);
+    TEST_ASSERT_EQUAL(99, histogram.max);
+    TEST_ASSERT_EQUAL_FLOAT(49.5, hdr_histogram_mean(&histogram));
+}
+
+void test_percentiles_match_sorted_values(void) {
+    static long long values[VALUE_COUNT];
+    static const double percentiles[] = {1, 10, 50, 90, 99, 99.9, 100};
+
+    // Spread over many powers of two
+    for (int i = 0; i < VALUE_COUNT; i++) {
+        values[i] = (long long)rand() >> (rand() % 31);
+        hdr_histogram_record(&histogram, values[i]);
+    }
+    qsort(values, VALUE_COUNT, sizeof(long long), compare_values);
+
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+        int rank = percentiles[i] / 100 * VALUE_COUNT + 0.5;
+        long long expected = values[rank > 0 ? rank - 1 : 0];
+        long long actual = hdr_histogram_percentile(&histogram, percentiles[i]);
+        TEST_ASSERT_GREATER_OR_EQUAL(expected, actual);
+        TEST_ASSERT_LESS_OR_EQUAL(expected + expected / (HDR_SUB_BUCKET_COUNT / 2), actual);
+    }
+}
+
+void test_merge(void) {
+    hdr_histogram_t other, combined;
+    hdr_histogram_init(&other);
+    hdr_histogram_init(&combined);
+
+    for (int i = 0; i < VALUE_COUNT; i++) {
+        long long value = rand() % 1000000;
+        hdr_histogram_record(i % 2 ? &histogram : &other, value);
+        hdr_histogram_record(&combined, value);
+    }
+    hdr_histogram_merge(&histogram, &other);
+
+    TEST_ASSERT_EQUAL(combined.total_count, histogram.total_count);
+    TEST_ASSERT_EQUAL(combined.min, histogram.min);
+    TEST_ASSERT_EQUAL(combined.max, histogram.max);
+    TEST_ASSERT_EQUAL(combined.sum, histogram.sum);
+    TEST_ASSERT_EQUAL_MEMORY(combined.counts, histogram.counts, HDR_BUCKET_COUNT * sizeof(uint64_t));
+
+    hdr_histogram_reset(&histogram);
+    TEST_ASSERT_EQUAL(0, histogram.total_count);
+    TEST_ASSERT_EQUAL(0, hdr_histogram_percentile(&histogram, 99));
+
+    hdr_histogram_free(&other);
+    hdr_histogram_free(&combined);
+}
+
+void test_out_of_range_values_are_clamped(void) {
+    hdr_histogram_record(&histogram, -5);
+    hdr_histogram_record(&histogram, 1LL << 50);
+
+    TEST_ASSERT_EQUAL(0, hdr_histogram_percentile(&histogram, 50));
+    TEST_ASSERT_EQUAL((1LL << HDR_MAX_VALUE_BITS) - 1, hdr_histogram_percentile(&histogram, 100));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_small_values_are_exact);
+    RUN_TEST(test_percentiles_match_sorted_values);
+    RUN_TEST(test_merge);
+    RUN_TEST(test_out_of_range_values_are_clamped);
+    return UNITY_END();
+}
@@ -0,0 +1,129 @@
+#include "unity/unity.h"
+#include "../interest.h"
+
+#define FIELD_SIZE 5000
+#define CAPACITY 16
+#define MAX_PLAYERS 2
+// View side used by the tests, so the view spans 500 around its center
+#define VIEW 1000
+
+static cell_pool_t pool;
+static interest_t interest;
+
+void setUp(void) {
+    cell_pool_init(&pool, CAPACITY);
+    interest_init(&interest, FIELD_SIZE, FIELD_SIZE, INTEREST_CELL_SIZE, CAPACITY, MAX_PLAYERS);
+}
+
+void tearDown(void) {
+    interest_free(&interest);
+    cell_pool_free(&pool);
+}
+
+static int add_cell(float x, float y, int mass) {
+    int handle = cell_pool_alloc(&pool, 0);
+    int idx = cell_pool_get(&pool, handle)->idx;
+    pool.pos_x[idx] = x;
+    pool.pos_y[idx] = y;
+    pool.mass[idx] = mass;
+    return handle;
+}
+
+static void move_cell(int handle, float x, float y) {
+    int idx = cell_pool_get(&pool, handle)->idx;
+    pool.pos_x[idx] = x;
+    pool.pos_y[idx] = y;
+}
+
+static interest_set_t *update(int slot, float x, float y) {
+    interest_build(&interest, &pool);
+    return interest_update(&interest, &pool, slot, x, y, VIEW);
+}
+
+static bool contains(interest_set_t *set, int handle) {
+    for (int i = 0; i < set->count; i++) {
+        if (set->handles[i] == handle) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void test_only_cells_in_view_are_visible(void) {
+    int near = add_cell(1200, 1300, 10);
+    int edge = add_cell(1490, 1000, 10);
+    int far = add_cell(3000, 3000, 10);
+    int behind = add_cell(400, 1000, 10);
+
+    interest_set_t *set = update(0, 1000, 1000);
+    TEST_ASSERT_EQUAL(2, set->count);
+    TEST_ASSERT_TRUE(contains(set, near));
+    TEST_ASSERT_TRUE(contains(set, edge));
+    TEST_ASSERT_FALSE(contains(set, far));
+    TEST_ASSERT_FALSE(contains(set, behind));
+    for (int i = 1; i < set->count; i++) {
+        TEST_ASSERT_LESS_THAN(set->handles[i], set->handles[i - 1]);
+    }
+}
+
+void test_big_cells_overlapping_the_view_are_visible(void) {
+    // Radius 300, so it reaches into the view from 200 outside of it
+    int big = add_cell(1700, 1000, 2500);
+    int small = add_cell(1700, 1000 + 400, 10);
+
+    interest_set_t *set = update(0, 1000, 1000);
+    TEST_ASSERT_TRUE(contains(set, big));
+    TEST_ASSERT_FALSE(contains(set, small));
+}
+
+void test_visible_cells_leave_only_beyond_the_margin(void) {
+    int cell = add_cell(1400, 1000, 10);
+    interest_set_t *set = update(0, 1000, 1000);
+    TEST_ASSERT_TRUE(contains(set, cell));
+
+    // Within the margin of 100 around the view
+    move_cell(cell, 1560, 1000);
+    set = update(0, 1000, 1000);
+    TEST_ASSERT_TRUE(contains(set, cell));
+
+    move_cell(cell, 1650, 1000);
+    set = update(0, 1000, 1000);
+    TEST_ASSERT_FALSE(contains(set, cell));
+
+    // Not visible before, so the margin doesn't let it in again
+    move_cell(cell, 1560, 1000);
+    set = update(0, 1000, 1000);
+    TEST_ASSERT_FALSE(contains(set, cell));
+}
+
+void test_players_have_their_own_views(void) {
+    int cell = add_cell(1000, 1000, 10);
+
+    TEST_ASSERT_TRUE(contains(update(0, 1000, 1000), cell));
+    TEST_ASSERT_FALSE(contains(update(1, 3000, 3000), cell));
+
+    // Only the first player saw the cell before, so only it keeps it in the
+    // margin
+    move_cell(cell, 1000, 1560);
+    TEST_ASSERT_TRUE(contains(update(0, 1000, 1000), cell));
+    TEST_ASSERT_FALSE(contains(update(1, 1000, 1000), cell));
+}
+
+void test_cleared_slots_forget_their_cells(void) {
+    int cell = add_cell(1400, 1000, 10);
+    TEST_ASSERT_TRUE(contains(update(0, 1000, 1000), cell));
+
+    interest_clear(&interest, 0);
+    move_cell(cell, 1560, 1000);
+    TEST_ASSERT_FALSE(contains(update(0, 1000, 1000), cell));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_only_cells_in_view_are_visible);
+    RUN_TEST(test_big_cells_overlapping_the_view_are_visible);
+    RUN_TEST(test_visible_cells_leave_only_beyond_the_margin);
+    RUN_TEST(test_players_have_their_own_views);
+    RUN_TEST(test_cleared_slots_forget_their_cells);
+    return UNITY_END();
+}
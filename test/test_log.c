@@ -0,0 +1,151 @@
+#include "unity/unity.h"
+#include "../log.h"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define OUTPUT_LEN 1000000
+
+static FILE *out;
+static char output[OUTPUT_LEN];
+static int calls;
+
+void setUp(void) {
+    out = tmpfile();
+    TEST_ASSERT_EQUAL(0, log_start(out, LOG_LEVEL_INFO));
+}
+
+void tearDown(void) {
+    log_stop();
+    fclose(out);
+}
+
+/*
+ * Waits for the writer and reads everything it wrote so far.
+ */
+static char *read_output(void) {
+    log_flush();
+    // Doesn't move the file position the writer appends at
+    ssize_t len = pread(fileno(out), output, OUTPUT_LEN - 1, 0);
+    TEST_ASSERT_GREATER_OR_EQUAL(0, len);
+    output[len] = 0;
+    return output;
+}
+
+static int count_matches(const char *text, const char *needle) {
+    int count = 0;
+    for (const char *line = strstr(text, needle); line; line = strstr(line + 1, needle)) {
+        count++;
+    }
+    return count;
+}
+
+static int count_call(void) {
+    return ++calls;
+}
+
+static void flood(int i) {
+    log_warn_ratelimited("flood %d", i);
+}
+
+void test_writes_records_of_output_level(void) {
+    log_info("hello %d", 42);
+    log_write(LOG_LEVEL_DEBUG, "hidden");
+    log_error("bye");
+
+    char *text = read_output();
+    TEST_ASSERT_NOT_NULL(strstr(text, "INFO  [0] hello 42\n"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "ERROR [0] bye\n"));
+    TEST_ASSERT_NULL(strstr(text, "hidden"));
+    TEST_ASSERT_TRUE(strstr(text, "hello") < strstr(text, "bye"));
+}
+
+void test_debug_is_compiled_out(void) {
+    calls = 0;
+    log_debug("%d", count_call());
+    log_info("%d", count_call());
+    TEST_ASSERT_EQUAL(1, calls);
+}
+
+void test_rate_limit(void) {
+    for (int i = 0; i < 100; i++) {
+        flood(i);
+    }
+    TEST_ASSERT_EQUAL(LOG_RATE_LIMIT, count_matches(read_output(), "flood"));
+}
+
+void test_truncates_long_messages(void) {
+    char message[2 * LOG_MESSAGE_LEN + 1];
+    memset(message, 'x', 2 * LOG_MESSAGE_LEN);
+    message[2 * LOG_MESSAGE_LEN] = 0;
+    log_info("%s", message);
+
+    char *line = strstr(read_output(), "xxx");
+    TEST_ASSERT_NOT_NULL(line);
+    TEST_ASSERT_EQUAL(LOG_MESSAGE_LEN - 1, strchr(line, '\n') - line);
+}
+
+void test_dump_recent(void) {
+    log_write(LOG_LEVEL_DEBUG, "hidden");
+    log_dump_recent(10);
+
+    char *text = read_output();
+    char *dump = strstr(text, "--- flight recorder: 1 records ---");
+    TEST_ASSERT_NOT_NULL(dump);
+    TEST_ASSERT_NOT_NULL(strstr(dump, "DEBUG [0] hidden\n"));
+}
+
+void test_crash_dumps_undrained_records(void) {
+    log_info("drained");
+    read_output();
+
+    // Only the forking thread survives the fork, so the writer never drains
+    // the record in the child
+    pid_t pid = fork();
+    TEST_ASSERT_NOT_EQUAL(-1, pid);
+    if (pid == 0) {
+        log_error("last words");
+        raise(SIGABRT);
+        _exit(0);
+    }
+    int status;
+    TEST_ASSERT_EQUAL(pid, waitpid(pid, &status, 0));
+    TEST_ASSERT_TRUE(WIFSIGNALED(status));
+
+    char *dump = strstr(read_output(), "--- crashed, flight recorder: ---\n");
+    TEST_ASSERT_NOT_NULL(dump);
+    char *last_words = strstr(dump, "ERROR last words\n");
+    TEST_ASSERT_NOT_NULL(last_words);
+    TEST_ASSERT_TRUE(strstr(dump, "INFO drained\n") < last_words);
+    TEST_ASSERT_NOT_NULL(strstr(last_words, "--- end of flight recorder ---\n"));
+}
+
+void test_drops_when_ring_is_full(void) {
+    // Nobody drains the ring while the writer is stopped
+    log_stop();
+    uint64_t dropped = log_dropped();
+    for (int i = 0; i < LOG_RING_CAPACITY + 10; i++) {
+        log_info("record %d", i);
+    }
+    TEST_ASSERT_EQUAL(dropped + 10, log_dropped());
+
+    log_start(out, LOG_LEVEL_INFO);
+    char *text = read_output();
+    TEST_ASSERT_EQUAL(LOG_RING_CAPACITY, count_matches(text, "] record "));
+    TEST_ASSERT_NOT_NULL(strstr(text, "log: dropped 10 records of thread 0"));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_writes_records_of_output_level);
+    RUN_TEST(test_debug_is_compiled_out);
+    RUN_TEST(test_rate_limit);
+    RUN_TEST(test_truncates_long_messages);
+    RUN_TEST(test_dump_recent);
+    RUN_TEST(test_crash_dumps_undrained_records);
+    RUN_TEST(test_drops_when_ring_is_full);
+    return UNITY_END();
+}
@@ -0,0 +1,107 @@
+#include "unity/unity.h"
+#include "../metrics.h"
+#include "../protocol.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SHARD_COUNT 3
+
+static metrics_t metrics;
+static char *text;
+static int text_capacity;
+
+void setUp(void) {
+    metrics_init(&metrics, SHARD_COUNT);
+    text = NULL;
+    text_capacity = 0;
+}
+
+void tearDown(void) {
+    metrics_free(&metrics);
+    free(text);
+}
+
+static void format(void) {
+    int len = metrics_format(&metrics, &text, &text_capacity);
+    TEST_ASSERT_EQUAL(strlen(text), len);
+}
+
+static void assert_line(const char *line) {
+    char expected[256];
+    snprintf(expected, sizeof(expected), "\n%s\n", line);
+    if (!strstr(text, expected)) {
+        TEST_FAIL_MESSAGE(line);
+    }
+}
+
+void test_empty_metrics(void) {
+    format();
+
+    assert_line("agario_players_connected 0");
+    assert_line("agario_connections_accepted_total 0");
+    assert_line("agario_disconnects_total{reason=\"too_slow\"} 0");
+    assert_line("agario_tick_duration_seconds_bucket{le=\"+Inf\"} 0");
+    assert_line("agario_tick_duration_seconds_count 0");
+    // Message types that were never counted are left out
+    TEST_ASSERT_NULL(strstr(text, "agario_messages_received_total{"));
+}
+
+void test_shards_are_summed(void) {
+    metrics_add(&metrics.shards[1].connections_accepted, 2);
+    metrics_add(&metrics.shards[2].connections_accepted, 3);
+    metrics_add(&metrics.shards[1].disconnects[DISCONNECT_PEER], 1);
+    metrics_add(&metrics.shards[2].disconnects[DISCONNECT_INVALID_MESSAGE], 4);
+    metrics_add_gauge(&metrics.shards[1].send_queue_bytes, 100);
+    metrics_add_gauge(&metrics.shards[2].send_queue_bytes, 50);
+    metrics_add_gauge(&metrics.shards[2].send_queue_bytes, -20);
+    metrics_set_gauge(&metrics.shards[0].players_joined, 7);
+    format();
+
+    assert_line("agario_connections_accepted_total 5");
+    assert_line("agario_disconnects_total{reason=\"peer\"} 1");
+    assert_line("agario_disconnects_total{reason=\"invalid_message\"} 4");
+    assert_line("agario_send_queue_bytes 130");
+    assert_line("agario_players_joined 7");
+}
+
+void test_messages_by_type(void) {
+    metrics_add(&metrics.shards[1].messages_received[MSG_JOIN], 1);
+    metrics_add(&metrics.shards[2].messages_received[MSG_JOIN], 1);
+    metrics_add(&metrics.shards[1].bytes_received[MSG_JOIN], 40);
+    metrics_add(&metrics.shards[1].messages_sent[MSG_SPAWNED_FOOD], 3);
+    // Types without a name are added up
+    metrics_add(&metrics.shards[1].messages_received[250], 2);
+    metrics_add(&metrics.shards[2].messages_received[251], 1);
+    format();
+
+    assert_line("agario_messages_received_total{type=\"join\"} 2");
+    assert_line("agario_received_bytes_total{type=\"join\"} 40");
+    assert_line("agario_messages_sent_total{type=\"spawned_food\"} 3");
+    assert_line("agario_messages_received_total{type=\"unknown\"} 3");
+}
+
+void test_tick_histogram_is_cumulative(void) {
+    metrics_observe_tick(&metrics.shards[0], 100000);
+    metrics_observe_tick(&metrics.shards[0], 3000000);
+    metrics_observe_tick(&metrics.shards[0], 3000000);
+    metrics_observe_tick(&metrics.shards[0], 1000000000);
+    format();
+
+    assert_line("agario_tick_duration_seconds_bucket{le=\"0.00025\"} 1");
+    assert_line("agario_tick_duration_seconds_bucket{le=\"0.0025\"} 1");
+    assert_line("agario_tick_duration_seconds_bucket{le=\"0.005\"} 3");
+    assert_line("agario_tick_duration_seconds_bucket{le=\"0.25\"} 3");
+    assert_line("agario_tick_duration_seconds_bucket{le=\"+Inf\"} 4");
+    assert_line("agario_tick_duration_seconds_count 4");
+    assert_line("agario_tick_duration_seconds_sum 1.006100000");
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_metrics);
+    RUN_TEST(test_shards_are_summed);
+    RUN_TEST(test_messages_by_type);
+    RUN_TEST(test_tick_histogram_is_cumulative);
+    return UNITY_END();
+}
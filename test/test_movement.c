@@ -0,0 +1,88 @@
+#include "unity/unity.h"
+#include "../movement.h"
+
+#include <math.h>
+#include <string.h>
+
+#define COUNT 19
+
+static float pos_x[COUNT], pos_y[COUNT], target_x[COUNT], target_y[COUNT], speed[COUNT];
+
+void setUp(void) {
+    for (int i = 0; i < COUNT; i++) {
+        pos_x[i] = i * 10;
+        pos_y[i] = 100 - i * 3.7f;
+        target_x[i] = 50 + i * 1.3f;
+        target_y[i] = 20;
+        speed[i] = 0.5f + i;
+    }
+    // Already at the target, within a distance of 1, and exactly 1 away
+    target_x[0] = pos_x[0];
+    target_y[0] = pos_y[0];
+    target_x[1] = pos_x[1] + 0.6f;
+    target_y[1] = pos_y[1] + 0.6f;
+    target_x[2] = pos_x[2] + 1;
+    target_y[2] = pos_y[2];
+    // Negative zero must survive for players that don't move
+    pos_x[3] = target_x[3] = -0.0f;
+    pos_y[3] = target_y[3] = 0;
+}
+
+void tearDown(void) {
+}
+
+void test_scalar_moves_towards_target(void) {
+    move_scalar(pos_x, pos_y, target_x, target_y, speed, COUNT);
+
+    TEST_ASSERT_EQUAL_FLOAT(0, pos_x[0]);
+    TEST_ASSERT_EQUAL_FLOAT(10, pos_x[1]);
+    TEST_ASSERT_EQUAL_FLOAT(20, pos_x[2]);
+    TEST_ASSERT_TRUE(signbit(pos_x[3]));
+    // Everyone else moved by its speed towards the target
+    for (int i = 4; i < COUNT; i++) {
+        float dx = target_x[i] - i * 10;
+        float dy = target_y[i] - (100 - i * 3.7f);
+        float moved_x = pos_x[i] - i * 10;
+        float moved_y = pos_y[i] - (100 - i * 3.7f);
+        TEST_ASSERT_FLOAT_WITHIN(1e-3, speed[i] * speed[i], moved_x * moved_x + moved_y * moved_y);
+        // Same direction as the target
+        TEST_ASSERT_TRUE(moved_x * dx >= 0 && moved_y * dy >= 0);
+    }
+}
+
+void test_kernels_match_scalar(void) {
+    float ref_x[COUNT], ref_y[COUNT];
+    memcpy(ref_x, pos_x, sizeof(pos_x));
+    memcpy(ref_y, pos_y, sizeof(pos_y));
+    move_scalar(ref_x, ref_y, target_x, target_y, speed, COUNT);
+
+    move_func_t kernel = move_select(NULL);
+    kernel(pos_x, pos_y, target_x, target_y, speed, COUNT);
+
+    TEST_ASSERT_EQUAL_MEMORY(ref_x, pos_x, sizeof(pos_x));
+    TEST_ASSERT_EQUAL_MEMORY(ref_y, pos_y, sizeof(pos_y));
+}
+
+#ifdef MOVEMENT_X86
+void test_sse_matches_scalar(void) {
+    float ref_x[COUNT], ref_y[COUNT];
+    memcpy(ref_x, pos_x, sizeof(pos_x));
+    memcpy(ref_y, pos_y, sizeof(pos_y));
+    move_scalar(ref_x, ref_y, target_x, target_y, speed, COUNT);
+
+    move_sse(pos_x, pos_y, target_x, target_y, speed, COUNT);
+
+    TEST_ASSERT_EQUAL_MEMORY(ref_x, pos_x, sizeof(pos_x));
+    TEST_ASSERT_EQUAL_MEMORY(ref_y, pos_y, sizeof(pos_y));
+}
+#endif
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_scalar_moves_towards_target);
+    RUN_TEST(test_kernels_match_scalar);
+#ifdef MOVEMENT_X86
+    RUN_TEST(test_sse_matches_scalar);
+#endif
+    return UNITY_END();
+}
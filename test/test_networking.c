@@ -0,0 +1,248 @@
+#include "unity/unity.h"
+#include "../networking.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define BUF_SIZE 65536
+static uint8_t buf[BUF_SIZE];
+static uint8_t recv_buf[BUF_SIZE];
+static int socks[2];
+static send_queue_t queue;
+
+void setUp(void) {
+    for (int i = 0; i < BUF_SIZE; i++) {
+        buf[i] = i % 251;
+    }
+    memset(&queue, 0, sizeof(queue));
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, socks));
+    TEST_ASSERT_EQUAL(0, set_nonblocking(socks[0]));
+    TEST_ASSERT_EQUAL(0, set_nonblocking(socks[1]));
+}
+
+void tearDown(void) {
+    send_queue_clear(&queue);
+    close(socks[0]);
+    close(socks[1]);
+}
+
+// Reads everything that is currently available on the receiving socket
+static int drain(uint8_t *dest, int dest_len) {
+    int total = 0, n;
+    while (total < dest_len && (n = recv(socks[1], dest + total, dest_len - total, 0)) > 0) {
+        total += n;
+    }
+    return total;
+}
+
+void test_send_queue_writes_directly_when_empty(void) {
+    TEST_ASSERT_EQUAL(0, send_queue_write(&queue, socks[0], buf, 100));
+    TEST_ASSERT_EQUAL(0, queue.queued_bytes);
+    TEST_ASSERT_NULL(queue.head);
+
+    TEST_ASSERT_EQUAL(100, drain(recv_buf, BUF_SIZE));
+    TEST_ASSERT_EQUAL_MEMORY(buf, recv_buf, 100);
+}
+
+void test_send_queue_queues_when_socket_is_full(void) {
+    int written = 0;
+
+    // Fill the socket buffer until bytes have to be queued
+    while (queue.queued_bytes == 0) {
+        TEST_ASSERT_EQUAL(0, send_queue_write(&queue, socks[0], buf, 1000));
+        written += 1000;
+    }
+    // Queued bytes must not overtake each other
+    TEST_ASSERT_EQUAL(0, send_queue_write(&queue, socks[0], buf + 1000, 1000));
+    written += 1000;
+    TEST_ASSERT_GREATER_THAN(1000, queue.queued_bytes);
+
+    int total = 0;
+    uint8_t *expected = malloc(written);
+    for (int i = 0; i < written - 1000; i += 1000) {
+        memcpy(expected + i, buf, 1000);
+    }
+    memcpy(expected + written - 1000, buf + 1000, 1000);
+
+    uint8_t *received = malloc(written);
+    while (total < written) {
+        total += drain(received + total, written - total);
+        TEST_ASSERT_EQUAL(0, send_queue_flush(&queue, socks[0]));
+    }
+    TEST_ASSERT_EQUAL(0, queue.queued_bytes);
+    TEST_ASSERT_NULL(queue.head);
+    TEST_ASSERT_NULL(queue.tail);
+    TEST_ASSERT_EQUAL_MEMORY(expected, received, written);
+
+    free(expected);
+    free(received);
+}
+
+void test_send_queue_reports_errors(void) {
+    close(socks[1]);
+    socks[1] = -1;
+
+    TEST_ASSERT_EQUAL(-1, send_queue_write(&queue, socks[0], buf, 100));
+    TEST_ASSERT_EQUAL(EPIPE, errno);
+}
+
+void test_send_queue_clear(void) {
+    while (queue.queued_bytes == 0) {
+        TEST_ASSERT_EQUAL(0, send_queue_write(&queue, socks[0], buf, 1000));
+    }
+
+    send_queue_clear(&queue);
+    TEST_ASSERT_EQUAL(0, queue.queued_bytes);
+    TEST_ASSERT_NULL(queue.head);
+    TEST_ASSERT_NULL(queue.tail);
+}
+
+void test_send_queue_references_frames(void) {
+    frame_t *frame = frame_new(1000);
+    memcpy(frame->data, buf, 1000);
+    frame->len = 1000;
+
+    // Queued twice without copying
+    send_queue_push_frame(&queue, frame);
+    send_queue_push_frame(&queue, frame);
+    TEST_ASSERT_EQUAL(3, frame->refcount);
+
+    // Empty frames are not queued at all
+    frame_t *empty = frame_new(16);
+    send_queue_push_frame(&queue, empty);
+    TEST_ASSERT_EQUAL(1, empty->refcount);
+    frame_release(empty);
+
+    // Flushing releases the references once the frame was sent
+    while (queue.head) {
+        TEST_ASSERT_EQUAL(0, send_queue_flush(&queue, socks[0]));
+        drain(recv_buf, BUF_SIZE);
+    }
+    TEST_ASSERT_EQUAL(1, frame->refcount);
+
+    frame_release(frame);
+}
+
+void test_send_queue_peek_and_consume(void) {
+    frame_t *frame = frame_new(1000);
+    memcpy(frame->data, buf, 1000);
+    frame->len = 1000;
+    struct iovec iov[SEND_QUEUE_MAX_IOVECS];
+
+    send_queue_push_frame(&queue, frame);
+    send_queue_push_frame(&queue, frame);
+    TEST_ASSERT_EQUAL(2000, queue.queued_bytes);
+    TEST_ASSERT_EQUAL(3, frame->refcount);
+
+    // Nothing is removed until the bytes were sent
+    TEST_ASSERT_EQUAL(2, send_queue_peek(&queue, iov, SEND_QUEUE_MAX_IOVECS));
+    TEST_ASSERT_EQUAL(2, send_queue_peek(&queue, iov, SEND_QUEUE_MAX_IOVECS));
+    TEST_ASSERT_EQUAL_PTR(frame->data, iov[1].iov_base);
+    TEST_ASSERT_EQUAL(1000, iov[1].iov_len);
+
+    // A partial send leaves the rest of the frame at the front
+    send_queue_consume(&queue, 1200);
+    TEST_ASSERT_EQUAL(800, queue.queued_bytes);
+    TEST_ASSERT_EQUAL(2, frame->refcount);
+    TEST_ASSERT_EQUAL(1, send_queue_peek(&queue, iov, SEND_QUEUE_MAX_IOVECS));
+    TEST_ASSERT_EQUAL_PTR(frame->data + 200, iov[0].iov_base);
+    TEST_ASSERT_EQUAL(800, iov[0].iov_len);
+
+    send_queue_consume(&queue, 800);
+    TEST_ASSERT_EQUAL(0, queue.queued_bytes);
+    TEST_ASSERT_NULL(queue.head);
+    TEST_ASSERT_EQUAL(0, send_queue_peek(&queue, iov, SEND_QUEUE_MAX_IOVECS));
+    TEST_ASSERT_EQUAL(1, frame->refcount);
+
+    frame_release(frame);
+}
+
+void test_recv_buffer_write(void) {
+    recv_buffer_t recv_buffer;
+    recv_buffer_init(&recv_buffer, 16);
+
+    TEST_ASSERT_EQUAL(10, recv_buffer_write(&recv_buffer, buf, 10));
+    recv_buffer_consume(&recv_buffer, 8);
+
+    // The remaining bytes are moved to the front, and only what fits is copied
+    TEST_ASSERT_EQUAL(14, recv_buffer_write(&recv_buffer, buf + 10, 20));
+    TEST_ASSERT_EQUAL(16, recv_buffer_len(&recv_buffer));
+    TEST_ASSERT_EQUAL_MEMORY(buf + 8, recv_buffer_data(&recv_buffer), 16);
+    TEST_ASSERT_EQUAL(0, recv_buffer_write(&recv_buffer, buf, 1));
+
+    recv_buffer_free(&recv_buffer);
+}
+
+void test_recv_buffer_keeps_partial_data(void) {
+    recv_buffer_t recv_buffer;
+    recv_buffer_init(&recv_buffer, 16);
+
+    TEST_ASSERT_EQUAL(10, send(socks[0], buf, 10, 0));
+    TEST_ASSERT_EQUAL(10, recv_buffer_read(&recv_buffer, socks[1]));
+    TEST_ASSERT_EQUAL(10, recv_buffer_len(&recv_buffer));
+
+    recv_buffer_consume(&recv_buffer, 8);
+    TEST_ASSERT_EQUAL(2, recv_buffer_len(&recv_buffer));
+    TEST_ASSERT_EQUAL_MEMORY(buf + 8, recv_buffer_data(&recv_buffer), 2);
+
+    // Only 6 bytes are free at the end, so the remaining bytes have to be
+    // moved to the front to fit the next 14 bytes
+    TEST_ASSERT_EQUAL(14, send(socks[0], buf + 10, 14, 0));
+    TEST_ASSERT_EQUAL(6, recv_buffer_read(&recv_buffer, socks[1]));
+    TEST_ASSERT_EQUAL(8, recv_buffer_read(&recv_buffer, socks[1]));
+    TEST_ASSERT_EQUAL(16, recv_buffer_len(&recv_buffer));
+    TEST_ASSERT_EQUAL_MEMORY(buf + 8, recv_buffer_data(&recv_buffer), 16);
+
+    recv_buffer_consume(&recv_buffer, 16);
+    TEST_ASSERT_EQUAL(0, recv_buffer_len(&recv_buffer));
+
+    recv_buffer_free(&recv_buffer);
+}
+
+void test_recv_buffer_reports_would_block_and_close(void) {
+    recv_buffer_t recv_buffer;
+    recv_buffer_init(&recv_buffer, 16);
+
+    TEST_ASSERT_EQUAL(-1, recv_buffer_read(&recv_buffer, socks[1]));
+    TEST_ASSERT_TRUE(errno == EAGAIN || errno == EWOULDBLOCK);
+
+    close(socks[0]);
+    socks[0] = -1;
+    TEST_ASSERT_EQUAL(0, recv_buffer_read(&recv_buffer, socks[1]));
+
+    recv_buffer_free(&recv_buffer);
+}
+
+void test_recv_buffer_full(void) {
+    recv_buffer_t recv_buffer;
+    recv_buffer_init(&recv_buffer, 16);
+
+    TEST_ASSERT_EQUAL(20, send(socks[0], buf, 20, 0));
+    TEST_ASSERT_EQUAL(16, recv_buffer_read(&recv_buffer, socks[1]));
+    TEST_ASSERT_EQUAL(-1, recv_buffer_read(&recv_buffer, socks[1]));
+    TEST_ASSERT_EQUAL(ENOBUFS, errno);
+
+    recv_buffer_free(&recv_buffer);
+}
+
+int main(void) {
+    // Like the server, handle broken connections via `EPIPE` instead of dying
+    signal(SIGPIPE, SIG_IGN);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_send_queue_writes_directly_when_empty);
+    RUN_TEST(test_send_queue_queues_when_socket_is_full);
+    RUN_TEST(test_send_queue_reports_errors);
+    RUN_TEST(test_send_queue_clear);
+    RUN_TEST(test_send_queue_references_frames);
+    RUN_TEST(test_send_queue_peek_and_consume);
+    RUN_TEST(test_recv_buffer_keeps_partial_data);
+    RUN_TEST(test_recv_buffer_reports_would_block_and_close);
+    RUN_TEST(test_recv_buffer_full);
+    RUN_TEST(test_recv_buffer_write);
+    return UNITY_END();
+}
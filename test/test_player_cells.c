@@ -0,0 +1,179 @@
+#include "unity/unity.h"
+#include "../player_cells.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_PLAYERS 10
+#define FIELD_SIZE 1000
+#define MERGE_TICKS 20
+
+static player_table_t table;
+static player_cells_t cells;
+
+// The test is linked with `--wrap=malloc` etc., so allocations can be counted
+static int alloc_count;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    alloc_count++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    alloc_count++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    alloc_count++;
+    return __real_realloc(ptr, size);
+}
+
+void setUp(void) {
+    player_table_init(&table, MAX_PLAYERS);
+    player_cells_init(&cells, MAX_PLAYERS, FIELD_SIZE, FIELD_SIZE, 0.5, MERGE_TICKS);
+}
+
+void tearDown(void) {
+    player_cells_free(&cells);
+    player_table_free(&table);
+}
+
+static player_t *add_player(uint32_t conn_id, float x, float y, int mass) {
+    player_t *player = player_table_add(&table, conn_id);
+    player->id = conn_id;
+    player->name = strdup("player");
+    player_table_join(&table, player);
+    TEST_ASSERT_NOT_EQUAL(-1, player_cells_spawn(&cells, &table, player, x, y, mass));
+    return player;
+}
+
+static int cell_mass(player_t *player, int i) {
+    return cells.pool.mass[cells.pool.cells[player->cells[i]].idx];
+}
+
+static int total_mass(player_t *player) {
+    int mass = 0;
+    for (int i = 0; i < player->cell_count; i++) {
+        mass += cell_mass(player, i);
+    }
+    return mass;
+}
+
+void test_split_halves_mass(void) {
+    player_t *player = add_player(1, 500, 500, 41);
+    player_cells_set_target(&cells, player, 600, 500);
+
+    TEST_ASSERT_EQUAL(1, player_cells_split(&cells, &table, player));
+    TEST_ASSERT_EQUAL(2, player->cell_count);
+    TEST_ASSERT_EQUAL(21, cell_mass(player, 0));
+    TEST_ASSERT_EQUAL(20, cell_mass(player, 1));
+    TEST_ASSERT_EQUAL(2, cells.pool.count);
+
+    // The new cell flies towards the target
+    int idx = cells.pool.cells[player->cells[1]].idx;
+    TEST_ASSERT_GREATER_THAN(0, cells.pool.boost_x[idx]);
+    TEST_ASSERT_EQUAL_FLOAT(0, cells.pool.boost_y[idx]);
+    player_cells_update(&cells, &table);
+    TEST_ASSERT_FLOAT_WITHIN(1e-3, 500 + SPLIT_BOOST, cells.pool.pos_x[idx]);
+    TEST_ASSERT_EQUAL_FLOAT(600, cells.pool.target_x[idx]);
+
+    // Both halves are too light now
+    TEST_ASSERT_EQUAL(2, player_cells_split(&cells, &table, player));
+    TEST_ASSERT_EQUAL(0, player_cells_split(&cells, &table, player));
+    TEST_ASSERT_EQUAL(41, total_mass(player));
+}
+
+void test_split_stops_at_max_cells(void) {
+    player_t *player = add_player(1, 500, 500, 1000000);
+
+    for (int i = 0; i < 10; i++) {
+        player_cells_split(&cells, &table, player);
+    }
+    TEST_ASSERT_EQUAL(MAX_PLAYER_CELLS, player->cell_count);
+    TEST_ASSERT_EQUAL(1000000, total_mass(player));
+    TEST_ASSERT_EQUAL(-1, player_cells_spawn(&cells, &table, player, 0, 0, 10));
+}
+
+void test_split_does_not_allocate(void) {
+    player_t *players[MAX_PLAYERS];
+    for (int i = 0; i < MAX_PLAYERS; i++) {
+        players[i] = add_player(i, 100 * i, 100 * i, 1 << 20);
+    }
+
+    alloc_count = 0;
+    for (int round = 0; round < 4; round++) {
+        for (int i = 0; i < MAX_PLAYERS; i++) {
+            player_cells_split(&cells, &table, players[i]);
+        }
+        player_cells_update(&cells, &table);
+    }
+    TEST_ASSERT_EQUAL(MAX_PLAYERS * MAX_PLAYER_CELLS, cells.pool.count);
+    TEST_ASSERT_EQUAL(0, alloc_count);
+}
+
+void test_merge_after_timer(void) {
+    player_t *player = add_player(1, 500, 500, 100);
+    player_cells_split(&cells, &table, player);
+    player_cells_split(&cells, &table, player);
+    TEST_ASSERT_EQUAL(4, player->cell_count);
+
+    // Far enough apart that they don't overlap
+    for (int i = 0; i < cells.pool.count; i++) {
+        cells.pool.pos_x[i] = 100 * i;
+        cells.pool.boost_x[i] = 0;
+    }
+    for (int tick = 1; tick < MERGE_TICKS; tick++) {
+        player_cells_update(&cells, &table);
+        TEST_ASSERT_FALSE(cells.pool.cells[player->cells[0]].can_merge);
+    }
+
+    // The cells may merge now, but they have to come together first
+    player_cells_update(&cells, &table);
+    TEST_ASSERT_EQUAL(4, player->cell_count);
+    for (int i = 0; i < player->cell_count; i++) {
+        TEST_ASSERT_TRUE(cells.pool.cells[player->cells[i]].can_merge);
+    }
+
+    player_cells_set_target(&cells, player, 500, 500);
+    for (int i = 0; i < cells.pool.count; i++) {
+        cells.pool.pos_x[i] = 500;
+    }
+    player_cells_update(&cells, &table);
+    TEST_ASSERT_EQUAL(1, player->cell_count);
+    TEST_ASSERT_EQUAL(100, total_mass(player));
+    TEST_ASSERT_EQUAL(1, cells.pool.count);
+}
+
+void test_remove_cells(void) {
+    player_t *a = add_player(1, 500, 500, 100);
+    player_t *b = add_player(2, 100, 100, 100);
+    player_cells_split(&cells, &table, a);
+    int removed = a->cells[0];
+
+    player_cells_remove(&cells, a, removed);
+    TEST_ASSERT_EQUAL(1, a->cell_count);
+    TEST_ASSERT_FALSE(timer_wheel_pending(&cells.merge_timers, removed));
+    TEST_ASSERT_EQUAL(2, cells.pool.count);
+
+    player_cells_remove_all(&cells, a);
+    TEST_ASSERT_EQUAL(0, a->cell_count);
+    TEST_ASSERT_EQUAL(1, cells.pool.count);
+    TEST_ASSERT_EQUAL(b->cells[0], cells.pool.handles[0]);
+    TEST_ASSERT_EQUAL(0, cells.pool.cells[b->cells[0]].idx);
+    TEST_ASSERT_EQUAL_FLOAT(100, cells.pool.pos_x[0]);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_split_halves_mass);
+    RUN_TEST(test_split_stops_at_max_cells);
+    RUN_TEST(test_split_does_not_allocate);
+    RUN_TEST(test_merge_after_timer);
+    RUN_TEST(test_remove_cells);
+    return UNITY_END();
+}
@@ -0,0 +1,145 @@
+#include "unity/unity.h"
+#include "../player_eating.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define CAPACITY 300
+
+static player_table_t table;
+static cell_pool_t pool;
+static player_eating_t eating;
+static int next_id;
+
+void setUp(void) {
+    player_table_init(&table, CAPACITY);
+    cell_pool_init(&pool, CAPACITY);
+    player_eating_init(&eating, CAPACITY);
+    next_id = 0;
+    srand(1);
+}
+
+void tearDown(void) {
+    player_eating_free(&eating);
+    cell_pool_free(&pool);
+    player_table_free(&table);
+}
+
+static int add_cell(player_t *player, float x, float y, int mass) {
+    int handle = cell_pool_alloc(&pool, player - table.slots);
+    TEST_ASSERT_NOT_EQUAL(-1, handle);
+
+    int idx = pool.cells[handle].idx;
+    pool.pos_x[idx] = pool.target_x[idx] = x;
+    pool.pos_y[idx] = pool.target_y[idx] = y;
+    pool.speed[idx] = 0.5;
+    pool.mass[idx] = mass;
+    player_eating_add(&eating, &pool, handle);
+    return handle;
+}
+
+/*
+ * Adds a player with a single cell and returns the handle of the cell.
+ */
+static int add_player(float x, float y, int mass) {
+    player_t *player = player_table_add(&table, next_id);
+    TEST_ASSERT_NOT_NULL(player);
+    player->id = next_id++;
+    player->name = strdup("player");
+    player_table_join(&table, player);
+    return add_cell(player, x, y, mass);
+}
+
+static int idx(int handle) {
+    return pool.cells[handle].idx;
+}
+
+void test_mass_and_overlap_rules(void) {
+    int big = add_player(100, 100, 100);
+    int close = add_player(110, 100, 80);
+    int too_heavy = add_player(90, 100, 81);
+    int far = add_player(200, 100, 10);
+
+    TEST_ASSERT_TRUE(player_can_eat(&pool, idx(big), idx(close)));
+    TEST_ASSERT_FALSE(player_can_eat(&pool, idx(close), idx(big)));
+    TEST_ASSERT_FALSE(player_can_eat(&pool, idx(big), idx(too_heavy)));
+    TEST_ASSERT_FALSE(player_can_eat(&pool, idx(big), idx(far)));
+
+    TEST_ASSERT_EQUAL(1, player_eating_resolve(&eating, &pool, &table));
+    TEST_ASSERT_EQUAL(big, eating.eats[0].eater);
+    TEST_ASSERT_EQUAL(close, eating.eats[0].prey);
+}
+
+void test_own_cells_are_not_eaten(void) {
+    int big = add_player(100, 100, 100);
+    player_t *owner = &table.slots[pool.cells[big].owner];
+    add_cell(owner, 105, 100, 10);
+
+    TEST_ASSERT_EQUAL(0, player_eating_resolve(&eating, &pool, &table));
+}
+
+void test_eaten_player_does_not_eat(void) {
+    // The heaviest player eats the middle one first, so the middle one can't
+    // eat the smallest one anymore
+    int small = add_player(100, 100, 10);
+    int middle = add_player(102, 100, 50);
+    int big = add_player(104, 100, 200);
+
+    TEST_ASSERT_EQUAL(2, player_eating_resolve(&eating, &pool, &table));
+    TEST_ASSERT_EQUAL(big, eating.eats[0].eater);
+    TEST_ASSERT_EQUAL(middle, eating.eats[0].prey);
+    TEST_ASSERT_EQUAL(big, eating.eats[1].eater);
+    TEST_ASSERT_EQUAL(small, eating.eats[1].prey);
+}
+
+void test_ties_are_broken_by_id(void) {
+    int prey = add_player(100, 100, 10);
+    int first = add_player(101, 100, 100);
+    add_player(99, 100, 100);
+
+    TEST_ASSERT_EQUAL(1, player_eating_resolve(&eating, &pool, &table));
+    TEST_ASSERT_EQUAL(first, eating.eats[0].eater);
+    TEST_ASSERT_EQUAL(prey, eating.eats[0].prey);
+}
+
+void test_broadphase_matches_brute_force(void) {
+    static player_eat_t expected[CAPACITY * CAPACITY];
+    static bool eaten[CAPACITY];
+
+    // Clustered, so that many players overlap
+    for (int i = 0; i < CAPACITY; i++) {
+        add_player(rand() % 200, rand() % 200, 5 + rand() % 200);
+    }
+
+    for (int step = 0; step < 10; step++) {
+        for (int i = 0; i < pool.count; i++) {
+            pool.pos_x[i] += rand() % 21 - 10;
+            pool.pos_y[i] += rand() % 21 - 10;
+        }
+        player_eating_update(&eating, &pool);
+
+        int count = 0;
+        for (int i = 0; i < pool.count; i++) {
+            for (int j = 0; j < pool.count; j++) {
+                if (i != j && player_can_eat(&pool, i, j)) {
+                    expected[count++] = (player_eat_t){pool.handles[i], pool.handles[j]};
+                }
+            }
+        }
+        count = player_eating_order(expected, count, eaten, &pool, &table);
+
+        TEST_ASSERT_GREATER_THAN(0, count);
+        TEST_ASSERT_EQUAL(count, player_eating_resolve(&eating, &pool, &table));
+        TEST_ASSERT_EQUAL_MEMORY(expected, eating.eats, count * sizeof(player_eat_t));
+    }
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_mass_and_overlap_rules);
+    RUN_TEST(test_own_cells_are_not_eaten);
+    RUN_TEST(test_eaten_player_does_not_eat);
+    RUN_TEST(test_ties_are_broken_by_id);
+    RUN_TEST(test_broadphase_matches_brute_force);
+    return UNITY_END();
+}
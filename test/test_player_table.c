@@ -0,0 +1,128 @@
+#include "unity/unity.h"
+#include "../player_table.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define CAPACITY 100
+
+static player_table_t table;
+
+void setUp(void) {
+    player_table_init(&table, CAPACITY);
+}
+
+void tearDown(void) {
+    player_table_free(&table);
+}
+
+static player_t *add_joined(uint32_t conn_id) {
+    player_t *player = player_table_add(&table, conn_id);
+    TEST_ASSERT_NOT_NULL(player);
+    player->name = strdup("player");
+    player_table_join(&table, player);
+    return player;
+}
+
+void test_add_get_remove(void) {
+    player_t *a = player_table_add(&table, 7);
+    player_t *b = player_table_add(&table, 1007);
+    TEST_ASSERT_NOT_NULL(a);
+    TEST_ASSERT_NOT_NULL(b);
+    TEST_ASSERT_EQUAL(2, player_table_count(&table));
+    TEST_ASSERT_FALSE(a->joined);
+
+    TEST_ASSERT_EQUAL_PTR(a, player_table_get(&table, 7));
+    TEST_ASSERT_EQUAL_PTR(b, player_table_get(&table, 1007));
+    TEST_ASSERT_NULL(player_table_get(&table, 8));
+
+    player_table_remove(&table, a);
+    TEST_ASSERT_NULL(player_table_get(&table, 7));
+    TEST_ASSERT_EQUAL_PTR(b, player_table_get(&table, 1007));
+    TEST_ASSERT_EQUAL(1, player_table_count(&table));
+}
+
+void test_full_table(void) {
+    for (uint32_t i = 0; i < CAPACITY; i++) {
+        TEST_ASSERT_NOT_NULL(player_table_add(&table, i * 3));
+    }
+    TEST_ASSERT_NULL(player_table_add(&table, 1000));
+
+    // A freed slot is reused
+    player_table_remove(&table, player_table_get(&table, 42));
+    TEST_ASSERT_NOT_NULL(player_table_add(&table, 1000));
+    TEST_ASSERT_NULL(player_table_add(&table, 1001));
+}
+
+void test_joined_array_stays_dense(void) {
+    for (uint32_t i = 0; i < 10; i++) {
+        add_joined(i);
+    }
+    // Not joined players are not in the joined array
+    player_table_add(&table, 10);
+    TEST_ASSERT_EQUAL(10, table.joined_count);
+
+    player_table_remove(&table, player_table_get(&table, 0));
+    player_table_remove(&table, player_table_get(&table, 5));
+    player_table_remove(&table, player_table_get(&table, 9));
+    player_table_remove(&table, player_table_get(&table, 10));
+    TEST_ASSERT_EQUAL(7, table.joined_count);
+
+    bool seen[10] = {false};
+    for (int i = 0; i < table.joined_count; i++) {
+        player_t *player = player_table_joined(&table, i);
+        TEST_ASSERT_TRUE(player->joined);
+        TEST_ASSERT_EQUAL(i, player->joined_idx);
+        TEST_ASSERT_FALSE(seen[player->conn_id]);
+        seen[player->conn_id] = true;
+    }
+    for (int i = 0; i < 10; i++) {
+        TEST_ASSERT_EQUAL(i != 0 && i != 5 && i != 9, seen[i]);
+    }
+}
+
+void test_random_churn(void) {
+    // Compares the table with a plain array over many adds and removes, which
+    // exercises the backward shift deletion of the hash map
+    bool present[CAPACITY * 10] = {false};
+    int count = 0;
+    srand(1);
+
+    for (int i = 0; i < 100000; i++) {
+        uint32_t conn_id = rand() % (CAPACITY * 10);
+        player_t *player = player_table_get(&table, conn_id);
+        TEST_ASSERT_EQUAL(present[conn_id], player != NULL);
+
+        if (player) {
+            player_table_remove(&table, player);
+            present[conn_id] = false;
+            count--;
+        } else if (count < CAPACITY) {
+            if (rand() % 2) {
+                add_joined(conn_id);
+            } else {
+                player_table_add(&table, conn_id);
+            }
+            present[conn_id] = true;
+            count++;
+        }
+        TEST_ASSERT_EQUAL(count, player_table_count(&table));
+    }
+
+    for (uint32_t i = 0; i < CAPACITY * 10; i++) {
+        player_t *player = player_table_get(&table, i);
+        TEST_ASSERT_EQUAL(present[i], player != NULL);
+        if (player) {
+            TEST_ASSERT_EQUAL(i, player->conn_id);
+        }
+    }
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_add_get_remove);
+    RUN_TEST(test_full_table);
+    RUN_TEST(test_joined_array_stays_dense);
+    RUN_TEST(test_random_churn);
+    return UNITY_END();
+}
@@ -5,6 +5,7 @@
 #include <string.h>
 
 #define BUF_SIZE 65535
+#define CELL_COUNT 500
 static uint8_t buf[BUF_SIZE];
 static uint32_t player_id;
 static rejoin_token_t rejoin_token;
@@ -101,6 +102,23 @@ void test_set_target_message(void) {
     message_free((generic_message_t *)msg2);
 }
 
+void test_split_message(void) {
+    size_t len;
+    split_message_t *msg = malloc(sizeof(split_message_t));
+
+    msg->message_type = MSG_SPLIT;
+
+    len = serialize_message((generic_message_t *)msg, buf, BUF_SIZE);
+    TEST_ASSERT_EQUAL(3, len);
+
+    split_message_t *msg2 = NULL;
+    (void)deserialize_message(buf, len, (generic_message_t **)&msg2);
+    TEST_ASSERT_EQUAL(MSG_SPLIT, msg2->message_type);
+
+    message_free((generic_message_t *)msg);
+    message_free((generic_message_t *)msg2);
+}
+
 void test_join_ack_message(void) {
     size_t len;
     join_ack_message_t *msg = malloc(sizeof(join_ack_message_t));
@@ -291,6 +309,72 @@ void test_empty_player_positions_message(void) {
     message_free((generic_message_t *)msg2);
 }
 
+void test_cell_positions_message(void) {
+    size_t len;
+    cell_positions_message_t *msg = malloc(sizeof(cell_positions_message_t));
+
+    msg->message_type = MSG_CELL_POSITIONS;
+    msg->tick = 0xdeadbeef;
+    msg->cell_count = 2;
+    msg->cell_positions = malloc(2 * sizeof(cell_position_t));
+    msg->cell_positions[0].cell_id = 7;
+    msg->cell_positions[0].player_id = 0x12345678;
+    msg->cell_positions[0].x = 1.0;
+    msg->cell_positions[0].y = 2.0;
+    msg->cell_positions[0].mass = 100;
+    msg->cell_positions[1].cell_id = 0x87654321;
+    msg->cell_positions[1].player_id = 0x12345678;
+    msg->cell_positions[1].x = 3.0;
+    msg->cell_positions[1].y = 4.0;
+    msg->cell_positions[1].mass = 200;
+
+    len = serialize_message((generic_message_t *)msg, buf, BUF_SIZE);
+    TEST_ASSERT_EQUAL(49, len);
+    TEST_ASSERT_EQUAL(2, CELL_POSITIONS_PER_MESSAGE(len));
+
+    cell_positions_message_t *msg2 = NULL;
+    (void)deserialize_message(buf, len, (generic_message_t **)&msg2);
+    TEST_ASSERT_EQUAL(MSG_CELL_POSITIONS, msg2->message_type);
+    TEST_ASSERT_EQUAL_HEX32(0xdeadbeef, msg2->tick);
+    TEST_ASSERT_EQUAL(2, msg2->cell_count);
+    TEST_ASSERT_EQUAL(7, msg2->cell_positions[0].cell_id);
+    TEST_ASSERT_EQUAL(0x12345678, msg2->cell_positions[0].player_id);
+    TEST_ASSERT_FLOAT_WITHIN(5e-2, 1.0, msg2->cell_positions[0].x);
+    TEST_ASSERT_FLOAT_WITHIN(5e-2, 2.0, msg2->cell_positions[0].y);
+    TEST_ASSERT_EQUAL(100, msg2->cell_positions[0].mass);
+    TEST_ASSERT_EQUAL(0x87654321, msg2->cell_positions[1].cell_id);
+    TEST_ASSERT_EQUAL(0x12345678, msg2->cell_positions[1].player_id);
+    TEST_ASSERT_FLOAT_WITHIN(5e-2, 3.0, msg2->cell_positions[1].x);
+    TEST_ASSERT_FLOAT_WITHIN(5e-2, 4.0, msg2->cell_positions[1].y);
+    TEST_ASSERT_EQUAL(200, msg2->cell_positions[1].mass);
+
+    message_free((generic_message_t *)msg);
+    message_free((generic_message_t *)msg2);
+}
+
+void test_empty_cell_positions_message(void) {
+    size_t len;
+    cell_positions_message_t *msg = malloc(sizeof(cell_positions_message_t));
+
+    msg->message_type = MSG_CELL_POSITIONS;
+    msg->tick = 1;
+    msg->cell_count = 0;
+    msg->cell_positions = NULL;
+
+    len = serialize_message((generic_message_t *)msg, buf, BUF_SIZE);
+    TEST_ASSERT_EQUAL(9, len);
+
+    cell_positions_message_t *msg2 = NULL;
+    (void)deserialize_message(buf, len, (generic_message_t **)&msg2);
+    TEST_ASSERT_EQUAL(MSG_CELL_POSITIONS, msg2->message_type);
+    TEST_ASSERT_EQUAL(1, msg2->tick);
+    TEST_ASSERT_EQUAL(0, msg2->cell_count);
+    TEST_ASSERT_NULL(msg2->cell_positions);
+
+    message_free((generic_message_t *)msg);
+    message_free((generic_message_t *)msg2);
+}
+
 void test_spawned_food_message(void) {
     size_t len;
     spawned_food_message_t *msg = malloc(sizeof(spawned_food_message_t));
@@ -487,12 +571,625 @@ void test_empty_kick_message(void) {
     message_free((generic_message_t *)msg2);
 }
 
+void test_peek_message_length(void) {
+    set_target_message_t msg = {
+        .message_type = MSG_SET_TARGET,
+        .x = 1.0,
+        .y = 2.0,
+    };
+
+    int len = serialize_message((generic_message_t *)&msg, buf, BUF_SIZE);
+    TEST_ASSERT_EQUAL(11, len);
+
+    TEST_ASSERT_EQUAL(0, peek_message_length(buf, 0));
+    TEST_ASSERT_EQUAL(0, peek_message_length(buf, 1));
+    TEST_ASSERT_EQUAL(11, peek_message_length(buf, 2));
+    TEST_ASSERT_EQUAL(11, peek_message_length(buf, len));
+
+    // A message can't be shorter than its header
+    buf[0] = 0;
+    buf[1] = 2;
+    TEST_ASSERT_EQUAL(-1, peek_message_length(buf, 2));
+}
+
+void test_deserialize_coalesced_messages(void) {
+    set_target_message_t msg = {
+        .message_type = MSG_SET_TARGET,
+        .x = 1.0,
+        .y = 2.0,
+    };
+
+    int len = serialize_message((generic_message_t *)&msg, buf, BUF_SIZE);
+    msg.x = 3.0;
+    len += serialize_message((generic_message_t *)&msg, buf + len, BUF_SIZE - len);
+    TEST_ASSERT_EQUAL(22, len);
+
+    set_target_message_t *msg2 = NULL;
+    TEST_ASSERT_EQUAL(11, deserialize_message(buf, len, (generic_message_t **)&msg2));
+    TEST_ASSERT_FLOAT_WITHIN(5e-2, 1.0, msg2->x);
+    message_free((generic_message_t *)msg2);
+
+    msg2 = NULL;
+    TEST_ASSERT_EQUAL(11, deserialize_message(buf + 11, len - 11, (generic_message_t **)&msg2));
+    TEST_ASSERT_FLOAT_WITHIN(5e-2, 3.0, msg2->x);
+    message_free((generic_message_t *)msg2);
+
+    // A partial message is not deserialized
+    msg2 = NULL;
+    TEST_ASSERT_EQUAL(0, deserialize_message(buf, 10, (generic_message_t **)&msg2));
+    TEST_ASSERT_NULL(msg2);
+}
+
+void test_cell_delta_message(void) {
+    cell_delta_t deltas[] = {
+        {.cell_id = 3, .changed = CELL_ADDED, .player_id = 7, .x = 1600, .y = 16000, .mass = 10},
+        {.cell_id = 5, .changed = CELL_REMOVED},
+        {.cell_id = 6, .changed = CELL_CHANGED_ALL, .player_id = 0x12345678, .x = 64000, .y = 1, .mass = 100},
+        {.cell_id = 0x87654321, .changed = CELL_CHANGED_X | CELL_CHANGED_MASS, .x = -3, .mass = -2147483647 - 1},
+    };
+    cell_delta_message_t msg = {
+        .message_type = MSG_CELL_DELTA,
+        .tick = 0x01020304,
+        .base_tick = 0x01020303,
+        .chunk = 2,
+        .flags = CELL_DELTA_LAST,
+        .delta_count = 4,
+        .deltas = deltas,
+    };
+
+    int len = serialize_message((generic_message_t *)&msg, buf, BUF_SIZE);
+    // Header, then the bits of the id, flags and fields of every delta
+    int bits = (5 + 2 + 8 + 14 + 14 + 8) + (5 + 1) + (5 + 2 + 4 + 40 + 24 + 6 + 12)
+        + (40 + 2 + 4 + 6 + 42);
+    TEST_ASSERT_EQUAL(16 + (bits + 7) / 8, len);
+
+    cell_delta_message_t *msg2 = NULL;
+    TEST_ASSERT_EQUAL(len, deserialize_message(buf, len, (generic_message_t **)&msg2));
+    TEST_ASSERT_EQUAL(MSG_CELL_DELTA, msg2->message_type);
+    TEST_ASSERT_EQUAL_UINT32(0x01020304, msg2->tick);
+    TEST_ASSERT_EQUAL_UINT32(0x01020303, msg2->base_tick);
+    TEST_ASSERT_EQUAL(2, msg2->chunk);
+    TEST_ASSERT_EQUAL(CELL_DELTA_LAST, msg2->flags);
+    TEST_ASSERT_EQUAL(4, msg2->delta_count);
+    for (int i = 0; i < 4; i++) {
+        TEST_ASSERT_EQUAL_UINT32(deltas[i].cell_id, msg2->deltas[i].cell_id);
+        TEST_ASSERT_EQUAL(deltas[i].changed, msg2->deltas[i].changed);
+        TEST_ASSERT_EQUAL_UINT32(deltas[i].player_id, msg2->deltas[i].player_id);
+        TEST_ASSERT_EQUAL_INT32(deltas[i].x, msg2->deltas[i].x);
+        TEST_ASSERT_EQUAL_INT32(deltas[i].y, msg2->deltas[i].y);
+        TEST_ASSERT_EQUAL_INT32(deltas[i].mass, msg2->deltas[i].mass);
+    }
+    message_free((generic_message_t *)msg2);
+
+    // Cut off in the middle of the last varint
+    msg2 = NULL;
+    buf[1] = len - 1;
+    TEST_ASSERT_EQUAL(0, deserialize_message(buf, len - 1, (generic_message_t **)&msg2));
+    TEST_ASSERT_NULL(msg2);
+}
+
+void test_invalid_cell_delta_message(void) {
+    cell_delta_t delta = {.cell_id = 1, .changed = CELL_CHANGED_X, .x = 1};
+    cell_delta_message_t msg = {.message_type = MSG_CELL_DELTA, .delta_count = 1, .deltas = &delta};
+    cell_delta_message_t *msg2 = NULL;
+
+    int len = serialize_message((generic_message_t *)&msg, buf, BUF_SIZE);
+    TEST_ASSERT_EQUAL(19, len);
+
+    // More than the padding left over
+    buf[1] = len + 1;
+    buf[len] = 0;
+    TEST_ASSERT_EQUAL(0, deserialize_message(buf, len + 1, (generic_message_t **)&msg2));
+    // An id that doesn't fit into 32 bits
+    buf[1] = len;
+    memset(buf + 16, 0xff, len - 16);
+    TEST_ASSERT_EQUAL(0, deserialize_message(buf, len, (generic_message_t **)&msg2));
+    TEST_ASSERT_NULL(msg2);
+}
+
+/*
+ * Sends the cells from the server's snapshot to the client's, as it would go
+ * over the wire, or loses them if `received` is NULL. Returns the number of
+ * bytes sent.
+ */
+static int send_cell_delta(cell_snapshot_t *sent, cell_snapshot_t *received, uint32_t tick, cell_position_t *cells,
+                           int count, bool keyframe) {
+    cell_delta_t deltas[64];
+    int delta_count = cell_delta_diff(keyframe ? NULL : sent, cells, count, deltas);
+    cell_delta_message_t msg = {
+        .message_type = MSG_CELL_DELTA,
+        .tick = tick,
+        .base_tick = sent->tick,
+        .flags = (keyframe ? CELL_DELTA_KEYFRAME : 0) | CELL_DELTA_LAST,
+        .delta_count = delta_count,
+        .deltas = deltas,
+    };
+    int len = serialize_message((generic_message_t *)&msg, buf, BUF_SIZE);
+    cell_snapshot_store(sent, tick, cells, count);
+    if (!received) {
+        return len;
+    }
+
+    cell_delta_message_t *msg2 = NULL;
+    TEST_ASSERT_EQUAL(len, deserialize_message(buf, len, (generic_message_t **)&msg2));
+    TEST_ASSERT_EQUAL(0, cell_delta_apply(received, msg2));
+    message_free((generic_message_t *)msg2);
+    return len;
+}
+
+static void assert_snapshots_equal(cell_snapshot_t *expected, cell_snapshot_t *actual) {
+    TEST_ASSERT_EQUAL_UINT32(expected->tick, actual->tick);
+    TEST_ASSERT_EQUAL(expected->count, actual->count);
+    for (int i = 0; i < expected->count; i++) {
+        TEST_ASSERT_EQUAL_UINT32(expected->cells[i].cell_id, actual->cells[i].cell_id);
+        TEST_ASSERT_EQUAL_UINT32(expected->cells[i].player_id, actual->cells[i].player_id);
+        TEST_ASSERT_EQUAL_FLOAT(expected->cells[i].x, actual->cells[i].x);
+        TEST_ASSERT_EQUAL_FLOAT(expected->cells[i].y, actual->cells[i].y);
+        TEST_ASSERT_EQUAL_UINT32(expected->cells[i].mass, actual->cells[i].mass);
+    }
+}
+
+void test_cell_deltas_reconstruct_the_cells(void) {
+    cell_snapshot_t sent, received;
+    cell_snapshot_init(&sent);
+    cell_snapshot_init(&received);
+    cell_position_t cells[] = {
+        {.cell_id = 1, .player_id = 7, .x = 100.3, .y = 200.7, .mass = 10},
+        {.cell_id = 4, .player_id = 8, .x = 999.99, .y = 0, .mass = 20},
+        {.cell_id = 9, .player_id = 7, .x = 500, .y = 500, .mass = 30},
+    };
+
+    send_cell_delta(&sent, &received, 1, cells, 3, true);
+    assert_snapshots_equal(&sent, &received);
+    TEST_ASSERT_FLOAT_WITHIN(1.0 / (1 << POSITION_FRACTION_BITS), 100.3, received.cells[0].x);
+
+    // Moves one cell, lets another one grow, and replaces the first one with
+    // two new ones
+    cells[1].x -= 0.5;
+    cells[2].mass += 5;
+    cell_position_t next_cells[] = {
+        {.cell_id = 2, .player_id = 9, .x = 1, .y = 2, .mass = 10},
+        {.cell_id = 3, .player_id = 9, .x = 3, .y = 4, .mass = 10},
+        cells[1],
+        cells[2],
+    };
+    send_cell_delta(&sent, &received, 2, next_cells, 4, false);
+    assert_snapshots_equal(&sent, &received);
+
+    // Nothing changed
+    TEST_ASSERT_EQUAL(16, send_cell_delta(&sent, &received, 3, next_cells, 4, false));
+    assert_snapshots_equal(&sent, &received);
+
+    cell_snapshot_free(&sent);
+    cell_snapshot_free(&received);
+}
+
+void test_cell_deltas_wait_for_keyframe_after_a_gap(void) {
+    cell_snapshot_t sent, received;
+    cell_snapshot_init(&sent);
+    cell_snapshot_init(&received);
+    cell_position_t cell = {.cell_id = 1, .player_id = 7, .x = 100, .y = 200, .mass = 10};
+    cell_delta_t delta = {.cell_id = 1, .changed = CELL_CHANGED_X, .x = 64};
+
+    send_cell_delta(&sent, &received, 1, &cell, 1, true);
+    // The message of tick 2 gets lost
+    cell.x = 101;
+    send_cell_delta(&sent, NULL, 2, &cell, 1, false);
+
+    cell_delta_message_t msg = {
+        .message_type = MSG_CELL_DELTA,
+        .tick = 3,
+        .base_tick = 2,
+        .flags = CELL_DELTA_LAST,
+        .delta_count = 1,
+        .deltas = &delta,
+    };
+    TEST_ASSERT_EQUAL(-1, cell_delta_apply(&received, &msg));
+    TEST_ASSERT_FALSE(received.synced);
+    TEST_ASSERT_EQUAL_FLOAT(100, received.cells[0].x);
+
+    // A later chunk of a tick doesn't apply without the first one either
+    msg.chunk = 1;
+    msg.base_tick = 3;
+    msg.tick = 4;
+    TEST_ASSERT_EQUAL(-1, cell_delta_apply(&received, &msg));
+
+    cell.x = 103;
+    send_cell_delta(&sent, &received, 5, &cell, 1, true);
+    TEST_ASSERT_TRUE(received.synced);
+    assert_snapshots_equal(&sent, &received);
+
+    cell_snapshot_free(&sent);
+    cell_snapshot_free(&received);
+}
+
+void test_bit_writer(void) {
+    bit_writer_t writer;
+    bit_reader_t reader;
+    uint32_t values[] = {1, 0, 5, 0x3fff, 0xffffffff, 17, 0, 1000000, 3};
+    int widths[] = {1, 3, 3, 14, 32, 5, 1, 20, 2};
+
+    bit_writer_init(&writer, buf, BUF_SIZE);
+    for (int i = 0; i < 9; i++) {
+        bit_write(&writer, values[i], widths[i]);
+    }
+    for (int chunk_bits = 1; chunk_bits <= 8; chunk_bits++) {
+        for (int i = 0; i < 9; i++) {
+            bit_write_varint(&writer, values[i], chunk_bits);
+        }
+    }
+    TEST_ASSERT_FALSE(writer.overflow);
+
+    bit_reader_init(&reader, buf, bit_writer_length(&writer));
+    for (int i = 0; i < 9; i++) {
+        TEST_ASSERT_EQUAL_UINT32(values[i], bit_read(&reader, widths[i]));
+    }
+    for (int chunk_bits = 1; chunk_bits <= 8; chunk_bits++) {
+        for (int i = 0; i < 9; i++) {
+            TEST_ASSERT_EQUAL_UINT32(values[i], bit_read_varint(&reader, chunk_bits));
+        }
+    }
+    TEST_ASSERT_FALSE(reader.overflow);
+    // Only padding is left
+    TEST_ASSERT_EQUAL(bit_writer_length(&writer), (reader.pos + 7) / 8);
+    TEST_ASSERT_EQUAL_UINT32(0, bit_read(&reader, 8 - reader.pos % 8));
+    TEST_ASSERT_EQUAL_UINT32(0, bit_read(&reader, 1));
+    TEST_ASSERT_TRUE(reader.overflow);
+}
+
+void test_bit_reader_varint_overflow(void) {
+    bit_writer_t writer;
+    bit_reader_t reader;
+
+    // With 7-bit chunks, the fifth chunk only has room for 4 bits
+    for (uint32_t last_chunk = 0x0f; last_chunk <= 0x1f; last_chunk += 0x10) {
+        bit_writer_init(&writer, buf, BUF_SIZE);
+        for (int i = 0; i < 4; i++) {
+            bit_write(&writer, 0x7f, 7);
+            bit_write(&writer, 1, 1);
+        }
+        bit_write(&writer, last_chunk, 7);
+        bit_write(&writer, 0, 1);
+
+        bit_reader_init(&reader, buf, bit_writer_length(&writer));
+        uint32_t value = bit_read_varint(&reader, 7);
+        if (last_chunk == 0x0f) {
+            TEST_ASSERT_EQUAL_UINT32(0xffffffff, value);
+            TEST_ASSERT_FALSE(reader.overflow);
+        } else {
+            TEST_ASSERT_TRUE(reader.overflow);
+        }
+    }
+}
+
+void test_bit_writer_overflow(void) {
+    bit_writer_t writer;
+    bit_writer_init(&writer, buf, 2);
+
+    bit_write(&writer, 0x3ff, 10);
+    bit_write_varint(&writer, 15, 4);
+    TEST_ASSERT_FALSE(writer.overflow);
+    bit_write(&writer, 1, 2);
+    TEST_ASSERT_TRUE(writer.overflow);
+    TEST_ASSERT_EQUAL(2, bit_writer_length(&writer));
+}
+
+void test_cell_keyframe_size(void) {
+    static cell_position_t cells[CELL_COUNT];
+    static cell_delta_t deltas[CELL_COUNT];
+    // Like in a game with up to a hundred players, each with a few cells
+    for (int i = 0; i < CELL_COUNT; i++) {
+        cells[i] = (cell_position_t){
+            .cell_id = i * 3,
+            .player_id = i % 100 + 1,
+            .x = (i * 37) % 1000 + 0.3,
+            .y = (i * 91) % 1000 + 0.7,
+            .mass = 10 + i % 100,
+        };
+    }
+
+    cell_delta_message_t msg = {
+        .message_type = MSG_CELL_DELTA,
+        .flags = CELL_DELTA_KEYFRAME | CELL_DELTA_LAST,
+        .delta_count = cell_delta_diff(NULL, cells, CELL_COUNT, deltas),
+        .deltas = deltas,
+    };
+    int len = serialize_message((generic_message_t *)&msg, buf, BUF_SIZE);
+    TEST_ASSERT_LESS_THAN(16 + CELL_COUNT * 7, len);
+
+    cell_snapshot_t received;
+    cell_snapshot_init(&received);
+    cell_delta_message_t *msg2 = NULL;
+    TEST_ASSERT_EQUAL(len, deserialize_message(buf, len, (generic_message_t **)&msg2));
+    TEST_ASSERT_EQUAL(0, cell_delta_apply(&received, msg2));
+    TEST_ASSERT_EQUAL(CELL_COUNT, received.count);
+    for (int i = 0; i < CELL_COUNT; i++) {
+        TEST_ASSERT_EQUAL_UINT32(cells[i].cell_id, received.cells[i].cell_id);
+        TEST_ASSERT_FLOAT_WITHIN(1.0 / (1 << POSITION_FRACTION_BITS), cells[i].x, received.cells[i].x);
+        TEST_ASSERT_FLOAT_WITHIN(1.0 / (1 << POSITION_FRACTION_BITS), cells[i].y, received.cells[i].y);
+        TEST_ASSERT_EQUAL_UINT32(cells[i].mass, received.cells[i].mass);
+    }
+    message_free((generic_message_t *)msg2);
+    cell_snapshot_free(&received);
+}
+
+void test_cell_delta_compression_ratio(void) {
+    static cell_position_t cells[CELL_COUNT];
+    static cell_delta_t deltas[2 * CELL_COUNT];
+    cell_snapshot_t sent;
+    cell_snapshot_init(&sent);
+    for (int i = 0; i < CELL_COUNT; i++) {
+        cells[i] = (cell_position_t){
+            .cell_id = i * 3,
+            .player_id = i + 1,
+            .x = (i * 37) % 1000,
+            .y = (i * 91) % 1000,
+            .mass = 10 + i,
+        };
+    }
+    cell_snapshot_store(&sent, 1, cells, CELL_COUNT);
+    cell_positions_message_t full_msg = {
+        .message_type = MSG_CELL_POSITIONS,
+        .cell_count = CELL_COUNT,
+        .cell_positions = cells,
+    };
+    int full_len = serialize_message((generic_message_t *)&full_msg, buf, BUF_SIZE);
+    cell_delta_message_t msg = {.message_type = MSG_CELL_DELTA, .deltas = deltas};
+
+    // A tenth of the players move at full speed, the others stand still
+    for (int i = 0; i < CELL_COUNT; i += 10) {
+        cells[i].x += 0.5;
+        cells[i].y -= 0.25;
+    }
+    msg.delta_count = cell_delta_diff(&sent, cells, CELL_COUNT, deltas);
+    TEST_ASSERT_EQUAL(CELL_COUNT / 10, msg.delta_count);
+    int len = serialize_message((generic_message_t *)&msg, buf, BUF_SIZE);
+    TEST_ASSERT_LESS_THAN(full_len / 20, len);
+
+    // Everyone moves
+    cell_snapshot_store(&sent, 2, cells, CELL_COUNT);
+    for (int i = 0; i < CELL_COUNT; i++) {
+        cells[i].x -= 0.5;
+        cells[i].y += 0.5;
+    }
+    msg.delta_count = cell_delta_diff(&sent, cells, CELL_COUNT, deltas);
+    len = serialize_message((generic_message_t *)&msg, buf, BUF_SIZE);
+    TEST_ASSERT_LESS_THAN(full_len / 2, len);
+
+    cell_snapshot_free(&sent);
+}
+
+void test_decode_message_points_into_the_buffer(void) {
+    player_info_t infos[] = {
+        {.player_id = 1, .name_length = 5, .name = "Simon"},
+        {.player_id = 2, .name_length = 0, .name = NULL},
+    };
+    current_players_message_t msg = {
+        .message_type = MSG_CURRENT_PLAYERS,
+        .player_count = 2,
+        .player_infos = infos,
+    };
+    uint64_t arena_buf[16];
+    message_arena_t arena;
+    current_players_message_t *msg2 = NULL;
+
+    int len = serialize_message((generic_message_t *)&msg, buf, BUF_SIZE);
+    message_arena_init(&arena, arena_buf, sizeof(arena_buf));
+    TEST_ASSERT_EQUAL(len, decode_message(buf, len, &arena, (generic_message_t **)&msg2));
+    TEST_ASSERT_EQUAL(MSG_CURRENT_PLAYERS, msg2->message_type);
+    TEST_ASSERT_EQUAL(2, msg2->player_count);
+    TEST_ASSERT_EQUAL_UINT32(1, msg2->player_infos[0].player_id);
+    TEST_ASSERT_EQUAL(5, msg2->player_infos[0].name_length);
+    TEST_ASSERT_EQUAL_PTR(buf + 3 + 2 + 5, msg2->player_infos[0].name);
+    TEST_ASSERT_EQUAL_STRING_LEN("Simon", msg2->player_infos[0].name, 5);
+    TEST_ASSERT_EQUAL_UINT32(2, msg2->player_infos[1].player_id);
+    TEST_ASSERT_NULL(msg2->player_infos[1].name);
+    // The message and its array come from the arena
+    TEST_ASSERT_TRUE((uint8_t *)msg2 >= arena.buf && (uint8_t *)msg2 < arena.buf + arena.used);
+    TEST_ASSERT_TRUE((uint8_t *)msg2->player_infos >= arena.buf
+                     && (uint8_t *)(msg2->player_infos + 2) <= arena.buf + arena.used);
+
+    // Decoding more messages appends to the arena
+    size_t used = arena.used;
+    TEST_ASSERT_EQUAL(len, decode_message(buf, len, &arena, (generic_message_t **)&msg2));
+    TEST_ASSERT_GREATER_THAN(used, arena.used);
+    message_arena_reset(&arena);
+    TEST_ASSERT_EQUAL(0, arena.used);
+}
+
+void test_decode_message_fails_when_the_arena_is_full(void) {
+    food_position_t foods[10] = {0};
+    spawned_food_message_t msg = {
+        .message_type = MSG_SPAWNED_FOOD,
+        .food_count = 10,
+        .food_positions = foods,
+    };
+    uint64_t arena_buf[16];
+    message_arena_t arena;
+    generic_message_t *msg2 = NULL;
+
+    int len = serialize_message((generic_message_t *)&msg, buf, BUF_SIZE);
+    message_arena_init(&arena, arena_buf, sizeof(arena_buf));
+    TEST_ASSERT_NOT_NULL(message_arena_alloc(&arena, 8));
+    TEST_ASSERT_EQUAL(0, decode_message(buf, len, &arena, &msg2));
+    TEST_ASSERT_NULL(msg2);
+    // Nothing is left taken from the arena
+    TEST_ASSERT_EQUAL(8, arena.used);
+
+    message_arena_reset(&arena);
+    msg.food_count = 5;
+    len = serialize_message((generic_message_t *)&msg, buf, BUF_SIZE);
+    TEST_ASSERT_EQUAL(len, decode_message(buf, len, &arena, &msg2));
+}
+
+void test_decode_message_accepts_what_deserialize_accepts(void) {
+    player_info_t info = {.player_id = 7, .name_length = 3, .name = "bob"};
+    cell_delta_t deltas[] = {
+        {.cell_id = 3, .changed = CELL_ADDED, .player_id = 7, .x = 1600, .y = 16000, .mass = 10},
+        {.cell_id = 5, .changed = CELL_REMOVED},
+        {.cell_id = 6, .changed = CELL_CHANGED_X | CELL_CHANGED_MASS, .x = -3, .mass = 20},
+    };
+    food_position_t food = {.food_id = 1, .x = 2, .y = 3};
+    uint32_t food_id = 4;
+    join_message_t join = {.message_type = MSG_JOIN, .name_length = 3, .name = "bob"};
+    current_players_message_t players = {.message_type = MSG_CURRENT_PLAYERS, .player_count = 1, .player_infos = &info};
+    player_join_message_t player_join = {.message_type = MSG_PLAYER_JOIN, .player_info = info};
+    cell_delta_message_t cell_delta = {.message_type = MSG_CELL_DELTA, .delta_count = 3, .deltas = deltas};
+    spawned_food_message_t spawned = {.message_type = MSG_SPAWNED_FOOD, .food_count = 1, .food_positions = &food};
+    eaten_food_message_t eaten = {.message_type = MSG_EATEN_FOOD, .food_count = 1, .food_ids = &food_id};
+    join_error_message_t join_error = {.message_type = MSG_JOIN_ERROR, .error_code = JOIN_ERR_GAME_FULL,
+                                       .error_message_length = 4, .error_message = "full"};
+    generic_message_t *messages[] = {
+        (generic_message_t *)&join, (generic_message_t *)&players, (generic_message_t *)&player_join,
+        (generic_message_t *)&cell_delta, (generic_message_t *)&spawned, (generic_message_t *)&eaten,
+        (generic_message_t *)&join_error,
+    };
+    static uint64_t arena_buf[MESSAGE_ARENA_LEN / 8];
+    message_arena_t arena;
+    uint8_t original[64];
+
+    srand(1);
+    message_arena_init(&arena, arena_buf, sizeof(arena_buf));
+    for (size_t i = 0; i < sizeof(messages) / sizeof(messages[0]); i++) {
+        int len = serialize_message(messages[i], original, sizeof(original));
+        TEST_ASSERT_GREATER_THAN(0, len);
+
+        // Flip random bits, also in the length and the counts
+        for (int round = 0; round < 2000; round++) {
+            memcpy(buf, original, len);
+            for (int flips = 1 + rand() % 3; flips > 0; flips--) {
+                buf[rand() % len] ^= 1 << rand() % 8;
+            }
+
+            // Only compares whether the message is accepted: for a varint
+            // that isn't as short as possible, `deserialize_message` returns
+            // the length that it would be serialized with
+            generic_message_t *msg = NULL;
+            bool deserialized = deserialize_message(buf, len, &msg) != 0;
+            message_free(msg);
+            message_arena_reset(&arena);
+            TEST_ASSERT_EQUAL(deserialized, decode_message(buf, len, &arena, &msg) != 0);
+        }
+    }
+}
+
+void test_current_players_builder(void) {
+    player_info_t infos[] = {
+        {.player_id = 0x12345678, .name_length = 5, .name = "Simon"},
+        {.player_id = 0x87654321, .name_length = 0, .name = NULL},
+        {.player_id = 3, .name_length = 4, .name = "John"},
+    };
+    current_players_message_t msg = {
+        .message_type = MSG_CURRENT_PLAYERS,
+        .player_count = 3,
+        .player_infos = infos,
+    };
+    uint8_t built[64];
+    message_builder_t builder;
+
+    int len = serialize_message((generic_message_t *)&msg, buf, BUF_SIZE);
+    current_players_builder_begin(&builder, built, sizeof(built));
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_TRUE(current_players_builder_append(&builder, infos[i].player_id, infos[i].name,
+                                                        infos[i].name_length));
+    }
+    TEST_ASSERT_EQUAL(len, message_builder_finish(&builder));
+    TEST_ASSERT_EQUAL_MEMORY(buf, built, len);
+
+    // A player that doesn't fit is left out
+    current_players_builder_begin(&builder, built, 3 + 2 + 10 + 8);
+    TEST_ASSERT_TRUE(current_players_builder_append(&builder, 1, "Simon", 5));
+    TEST_ASSERT_FALSE(current_players_builder_append(&builder, 2, "John", 4));
+    len = message_builder_finish(&builder);
+    TEST_ASSERT_EQUAL(3 + 2 + 10, len);
+
+    current_players_message_t *msg2 = NULL;
+    TEST_ASSERT_EQUAL(len, deserialize_message(built, len, (generic_message_t **)&msg2));
+    TEST_ASSERT_EQUAL(1, msg2->player_count);
+    TEST_ASSERT_EQUAL_STRING("Simon", msg2->player_infos[0].name);
+    message_free((generic_message_t *)msg2);
+}
+
+void test_cell_delta_builder(void) {
+    cell_position_t cells[CELL_COUNT];
+    cell_delta_t deltas[CELL_COUNT];
+    static uint8_t built[BUF_SIZE];
+    message_builder_t builder;
+
+    for (int i = 0; i < CELL_COUNT; i++) {
+        cells[i] = (cell_position_t){.cell_id = i * 2, .player_id = i, .x = i, .y = 1000 - i, .mass = 10 + i};
+    }
+    int delta_count = cell_delta_diff(NULL, cells, CELL_COUNT, deltas);
+    cell_delta_message_t msg = {
+        .message_type = MSG_CELL_DELTA,
+        .tick = 5,
+        .base_tick = 4,
+        .chunk = 1,
+        .flags = CELL_DELTA_KEYFRAME | CELL_DELTA_LAST,
+        .delta_count = delta_count,
+        .deltas = deltas,
+    };
+
+    int len = serialize_message((generic_message_t *)&msg, buf, BUF_SIZE);
+    cell_delta_builder_begin(&builder, built, BUF_SIZE, 5, 4, 1, CELL_DELTA_KEYFRAME);
+    for (int i = 0; i < delta_count; i++) {
+        TEST_ASSERT_TRUE(cell_delta_builder_append(&builder, &deltas[i]));
+    }
+    cell_delta_builder_add_flags(&builder, CELL_DELTA_LAST);
+    TEST_ASSERT_EQUAL(len, message_builder_finish(&builder));
+    TEST_ASSERT_EQUAL_MEMORY(buf, built, len);
+}
+
+void test_cell_delta_builder_splits_into_chunks(void) {
+    cell_position_t cells[CELL_COUNT];
+    cell_delta_t deltas[CELL_COUNT];
+    uint8_t built[256];
+    message_builder_t builder;
+    cell_snapshot_t received;
+    uint16_t chunk = 0;
+
+    for (int i = 0; i < CELL_COUNT; i++) {
+        cells[i] = (cell_position_t){.cell_id = i + 1, .player_id = i, .x = i, .y = i, .mass = 10};
+    }
+    int delta_count = cell_delta_diff(NULL, cells, CELL_COUNT, deltas);
+    cell_snapshot_init(&received);
+
+    // Fills every message as far as it goes, like the server does
+    int i = 0;
+    while (i < delta_count) {
+        cell_delta_builder_begin(&builder, built, sizeof(built), 1, 0, chunk++, CELL_DELTA_KEYFRAME);
+        while (i < delta_count && cell_delta_builder_append(&builder, &deltas[i])) {
+            i++;
+        }
+        TEST_ASSERT_GREATER_THAN(0, builder.count);
+        if (i == delta_count) {
+            cell_delta_builder_add_flags(&builder, CELL_DELTA_LAST);
+        }
+        int len = message_builder_finish(&builder);
+        TEST_ASSERT_LESS_OR_EQUAL(sizeof(built), len);
+
+        cell_delta_message_t *msg = NULL;
+        TEST_ASSERT_EQUAL(len, deserialize_message(built, len, (generic_message_t **)&msg));
+        TEST_ASSERT_EQUAL(0, cell_delta_apply(&received, msg));
+        message_free((generic_message_t *)msg);
+    }
+    TEST_ASSERT_GREATER_THAN(1, chunk);
+    TEST_ASSERT_TRUE(received.complete);
+    TEST_ASSERT_EQUAL(CELL_COUNT, received.count);
+    for (int j = 0; j < CELL_COUNT; j++) {
+        TEST_ASSERT_EQUAL_UINT32(cells[j].cell_id, received.cells[j].cell_id);
+        TEST_ASSERT_EQUAL_FLOAT(cells[j].x, received.cells[j].x);
+    }
+    cell_snapshot_free(&received);
+}
+
 int main(void) {
     UNITY_BEGIN();
     RUN_TEST(test_join_message);
     RUN_TEST(test_rejoin_message);
     RUN_TEST(test_leave_message);
     RUN_TEST(test_set_target_message);
+    RUN_TEST(test_split_message);
     RUN_TEST(test_join_ack_message);
     RUN_TEST(test_current_players_message);
     RUN_TEST(test_empty_current_players_message);
@@ -500,6 +1197,17 @@ int main(void) {
     RUN_TEST(test_player_leave_message);
     RUN_TEST(test_player_positions_message);
     RUN_TEST(test_empty_player_positions_message);
+    RUN_TEST(test_cell_positions_message);
+    RUN_TEST(test_empty_cell_positions_message);
+    RUN_TEST(test_cell_delta_message);
+    RUN_TEST(test_invalid_cell_delta_message);
+    RUN_TEST(test_cell_deltas_reconstruct_the_cells);
+    RUN_TEST(test_cell_deltas_wait_for_keyframe_after_a_gap);
+    RUN_TEST(test_cell_delta_compression_ratio);
+    RUN_TEST(test_bit_writer);
+    RUN_TEST(test_bit_writer_overflow);
+    RUN_TEST(test_bit_reader_varint_overflow);
+    RUN_TEST(test_cell_keyframe_size);
     RUN_TEST(test_spawned_food_message);
     RUN_TEST(test_empty_spawned_food_message);
     RUN_TEST(test_eaten_food_message);
@@ -508,5 +1216,13 @@ int main(void) {
     RUN_TEST(test_empty_join_error_message);
     RUN_TEST(test_kick_message);
     RUN_TEST(test_empty_kick_message);
+    RUN_TEST(test_peek_message_length);
+    RUN_TEST(test_deserialize_coalesced_messages);
+    RUN_TEST(test_decode_message_points_into_the_buffer);
+    RUN_TEST(test_decode_message_fails_when_the_arena_is_full);
+    RUN_TEST(test_decode_message_accepts_what_deserialize_accepts);
+    RUN_TEST(test_current_players_builder);
+    RUN_TEST(test_cell_delta_builder);
+    RUN_TEST(test_cell_delta_builder_splits_into_chunks);
     return UNITY_END();
 }
@@ -0,0 +1,70 @@
+#include "unity/unity.h"
+#include "../rng.h"
+
+#define SAMPLES 100000
+#define BUCKETS 10
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_same_seed_gives_same_sequence(void) {
+    rng_t a, b;
+    rng_seed(&a, 42);
+    rng_seed(&b, 42);
+
+    for (int i = 0; i < 1000; i++) {
+        TEST_ASSERT_EQUAL_UINT32(rng_next(&a), rng_next(&b));
+    }
+}
+
+void test_different_seeds_give_different_sequences(void) {
+    rng_t a, b;
+    rng_seed(&a, 1);
+    rng_seed(&b, 2);
+
+    int equal = 0;
+    for (int i = 0; i < 1000; i++) {
+        equal += rng_next(&a) == rng_next(&b);
+    }
+    TEST_ASSERT_LESS_THAN(2, equal);
+}
+
+void test_floats_are_uniform_in_unit_interval(void) {
+    int counts[BUCKETS] = {0};
+    rng_t rng;
+    rng_seed(&rng, 7);
+
+    for (int i = 0; i < SAMPLES; i++) {
+        float value = rng_float(&rng);
+        TEST_ASSERT_TRUE(value >= 0 && value < 1);
+        counts[(int)(value * BUCKETS)]++;
+    }
+    for (int i = 0; i < BUCKETS; i++) {
+        TEST_ASSERT_INT_WITHIN(SAMPLES / BUCKETS / 20, SAMPLES / BUCKETS, counts[i]);
+    }
+}
+
+void test_range_stays_in_bounds(void) {
+    int counts[BUCKETS] = {0};
+    rng_t rng;
+    rng_seed(&rng, 7);
+
+    for (int i = 0; i < SAMPLES; i++) {
+        uint32_t value = rng_range(&rng, BUCKETS);
+        TEST_ASSERT_LESS_THAN_UINT32(BUCKETS, value);
+        counts[value]++;
+    }
+    for (int i = 0; i < BUCKETS; i++) {
+        TEST_ASSERT_INT_WITHIN(SAMPLES / BUCKETS / 20, SAMPLES / BUCKETS, counts[i]);
+    }
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_same_seed_gives_same_sequence);
+    RUN_TEST(test_different_seeds_give_different_sequences);
+    RUN_TEST(test_floats_are_uniform_in_unit_interval);
+    RUN_TEST(test_range_stays_in_bounds);
+    return UNITY_END();
+}
@@ -0,0 +1,137 @@
+#include "unity/unity.h"
+#include "../session.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char path[] = "/tmp/test_session_XXXXXX";
+static session_writer_t writer;
+static session_reader_t reader;
+static uint64_t arena_buf[8];
+static message_arena_t arena;
+
+void setUp(void) {
+    strcpy(path, "/tmp/test_session_XXXXXX");
+    close(mkstemp(path));
+}
+
+void tearDown(void) {
+    unlink(path);
+}
+
+static void write_header(uint64_t seed) {
+    session_header_t header = {
+        .seed = seed,
+        .max_players = 2048,
+        .food_count = 5000,
+    };
+    TEST_ASSERT_EQUAL(0, session_writer_open(&writer, path, &header));
+}
+
+static void write_input(uint32_t tick, int type, uint32_t conn_id, generic_message_t *msg) {
+    io_input_t input = {
+        .type = type,
+        .conn_id = conn_id,
+    };
+    if (msg) {
+        input.len = serialize_message(msg, input.data, MAX_CLIENT_MESSAGE_LEN);
+    }
+    session_writer_input(&writer, tick, &input);
+}
+
+static void assert_input(uint32_t tick, int type, uint32_t conn_id, io_input_t *input) {
+    TEST_ASSERT_TRUE(session_reader_next(&reader, tick, input));
+    TEST_ASSERT_EQUAL(type, input->type);
+    TEST_ASSERT_EQUAL_UINT32(conn_id, input->conn_id);
+}
+
+static generic_message_t *decode_input(io_input_t *input) {
+    generic_message_t *msg;
+    message_arena_init(&arena, arena_buf, sizeof(arena_buf));
+    TEST_ASSERT_EQUAL(input->len, decode_message(input->data, input->len, &arena, &msg));
+    return msg;
+}
+
+void test_inputs_are_replayed_in_their_ticks(void) {
+    io_input_t input;
+    join_message_t join = {.message_type = MSG_JOIN, .name_length = 3, .name = "bob"};
+    set_target_message_t target = {.message_type = MSG_SET_TARGET, .x = 1.5, .y = 200};
+
+    write_header(0x0102030405060708ULL);
+    write_input(0, INPUT_CONNECT, 7, NULL);
+    write_input(0, INPUT_MESSAGE, 7, (generic_message_t *)&join);
+    write_input(3, INPUT_MESSAGE, 7, (generic_message_t *)&target);
+    write_input(3, INPUT_DISCONNECT, 7, NULL);
+    TEST_ASSERT_EQUAL(0, session_writer_close(&writer, 10));
+
+    TEST_ASSERT_EQUAL(0, session_reader_open(&reader, path));
+    TEST_ASSERT_EQUAL_UINT64(0x0102030405060708ULL, reader.header.seed);
+    TEST_ASSERT_EQUAL(2048, reader.header.max_players);
+    TEST_ASSERT_EQUAL(5000, reader.header.food_count);
+
+    assert_input(0, INPUT_CONNECT, 7, &input);
+    assert_input(0, INPUT_MESSAGE, 7, &input);
+    join_message_t *read_join = (join_message_t *)decode_input(&input);
+    TEST_ASSERT_EQUAL(MSG_JOIN, read_join->message_type);
+    TEST_ASSERT_EQUAL_STRING_LEN("bob", read_join->name, 3);
+    TEST_ASSERT_FALSE(session_reader_next(&reader, 0, &input));
+
+    for (uint32_t tick = 1; tick < 3; tick++) {
+        TEST_ASSERT_FALSE(session_reader_next(&reader, tick, &input));
+    }
+
+    assert_input(3, INPUT_MESSAGE, 7, &input);
+    set_target_message_t *read_target = (set_target_message_t *)decode_input(&input);
+    TEST_ASSERT_EQUAL_FLOAT(1.5, read_target->x);
+    TEST_ASSERT_EQUAL_FLOAT(200, read_target->y);
+    assert_input(3, INPUT_DISCONNECT, 7, &input);
+    TEST_ASSERT_FALSE(session_reader_next(&reader, 3, &input));
+
+    TEST_ASSERT_TRUE(reader.done);
+    TEST_ASSERT_FALSE(reader.truncated);
+    TEST_ASSERT_EQUAL_UINT32(10, reader.end_tick);
+    session_reader_close(&reader);
+}
+
+void test_truncated_session_is_replayed_up_to_the_damage(void) {
+    io_input_t input;
+    leave_message_t leave = {.message_type = MSG_LEAVE};
+
+    write_header(1);
+    write_input(2, INPUT_CONNECT, 1, NULL);
+    write_input(5, INPUT_MESSAGE, 1, (generic_message_t *)&leave);
+    TEST_ASSERT_EQUAL(0, session_writer_close(&writer, 6));
+    // Cuts off the end record and the last byte of the message
+    TEST_ASSERT_EQUAL(0, truncate(path, 17 + 5 + 5 + 5 + 5 + 2));
+
+    TEST_ASSERT_EQUAL(0, session_reader_open(&reader, path));
+    for (uint32_t tick = 0; tick < 2; tick++) {
+        TEST_ASSERT_FALSE(session_reader_next(&reader, tick, &input));
+    }
+    assert_input(2, INPUT_CONNECT, 1, &input);
+    for (uint32_t tick = 2; tick < 6; tick++) {
+        TEST_ASSERT_FALSE(session_reader_next(&reader, tick, &input));
+    }
+
+    TEST_ASSERT_TRUE(reader.done);
+    TEST_ASSERT_TRUE(reader.truncated);
+    TEST_ASSERT_EQUAL_UINT32(5, reader.end_tick);
+    session_reader_close(&reader);
+}
+
+void test_other_files_are_rejected(void) {
+    FILE *file = fopen(path, "w");
+    fputs("not a session log", file);
+    fclose(file);
+
+    TEST_ASSERT_EQUAL(-1, session_reader_open(&reader, path));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_inputs_are_replayed_in_their_ticks);
+    RUN_TEST(test_truncated_session_is_replayed_up_to_the_damage);
+    RUN_TEST(test_other_files_are_rejected);
+    return UNITY_END();
+}
@@ -0,0 +1,105 @@
+#include "unity/unity.h"
+#include "../spsc_queue.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define THREADED_ELEM_COUNT 100000
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+void test_spsc_queue_fifo(void) {
+    spsc_queue_t queue;
+    int value;
+
+    spsc_queue_init(&queue, 4, sizeof(int));
+
+    TEST_ASSERT_FALSE(spsc_queue_pop(&queue, &value));
+
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_TRUE(spsc_queue_push(&queue, &i));
+    }
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_TRUE(spsc_queue_pop(&queue, &value));
+        TEST_ASSERT_EQUAL(i, value);
+    }
+    TEST_ASSERT_FALSE(spsc_queue_pop(&queue, &value));
+
+    spsc_queue_free(&queue);
+}
+
+void test_spsc_queue_full(void) {
+    spsc_queue_t queue;
+    int value;
+
+    // Rounded up to 4
+    spsc_queue_init(&queue, 3, sizeof(int));
+
+    for (int i = 0; i < 4; i++) {
+        TEST_ASSERT_TRUE(spsc_queue_push(&queue, &i));
+    }
+    value = 4;
+    TEST_ASSERT_FALSE(spsc_queue_push(&queue, &value));
+
+    TEST_ASSERT_TRUE(spsc_queue_pop(&queue, &value));
+    TEST_ASSERT_EQUAL(0, value);
+
+    // Wraps around
+    value = 4;
+    TEST_ASSERT_TRUE(spsc_queue_push(&queue, &value));
+    for (int i = 1; i < 5; i++) {
+        TEST_ASSERT_TRUE(spsc_queue_pop(&queue, &value));
+        TEST_ASSERT_EQUAL(i, value);
+    }
+
+    spsc_queue_free(&queue);
+}
+
+static void *produce(void *arg) {
+    spsc_queue_t *queue = arg;
+    for (uint64_t i = 0; i < THREADED_ELEM_COUNT; i++) {
+        // Yield, so that this also finishes quickly on a single core
+        while (!spsc_queue_push(queue, &i)) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+void test_spsc_queue_threaded(void) {
+    spsc_queue_t queue;
+    pthread_t producer;
+    uint64_t value, received = 0;
+    bool ordered = true;
+
+    spsc_queue_init(&queue, 64, sizeof(uint64_t));
+    pthread_create(&producer, NULL, produce, &queue);
+
+    while (received < THREADED_ELEM_COUNT) {
+        if (spsc_queue_pop(&queue, &value)) {
+            ordered = ordered && value == received;
+            received++;
+        } else {
+            sched_yield();
+        }
+    }
+
+    pthread_join(producer, NULL);
+    TEST_ASSERT_TRUE(ordered);
+
+    spsc_queue_free(&queue);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_spsc_queue_fifo);
+    RUN_TEST(test_spsc_queue_full);
+    RUN_TEST(test_spsc_queue_threaded);
+    return UNITY_END();
+}
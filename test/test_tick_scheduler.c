@@ -0,0 +1,86 @@
+#include "unity/unity.h"
+#include "../tick_scheduler.h"
+
+#define INTERVAL 50000000LL
+#define MAX_CATCH_UP 3
+
+static tick_scheduler_t scheduler;
+
+void setUp(void) {
+    tick_scheduler_init(&scheduler, INTERVAL, MAX_CATCH_UP, 0);
+}
+
+void tearDown(void) {
+}
+
+static void run_ticks(int count, long long now, long long duration) {
+    for (int i = 0; i < count; i++) {
+        tick_scheduler_tick_started(&scheduler, now);
+        tick_scheduler_tick_finished(&scheduler, now + duration);
+    }
+}
+
+void test_first_tick_after_one_interval(void) {
+    TEST_ASSERT_EQUAL(0, tick_scheduler_poll(&scheduler, 0));
+    TEST_ASSERT_EQUAL(0, tick_scheduler_poll(&scheduler, INTERVAL - 1));
+    TEST_ASSERT_EQUAL(1, tick_scheduler_poll(&scheduler, INTERVAL));
+    TEST_ASSERT_EQUAL(INTERVAL - 10, tick_scheduler_time_until_next(&scheduler, 10));
+    TEST_ASSERT_EQUAL(0, tick_scheduler_time_until_next(&scheduler, INTERVAL + 10));
+}
+
+void test_deadlines_dont_drift(void) {
+    // Every tick starts a bit late, but the deadlines stay on the grid
+    for (int i = 1; i <= 100; i++) {
+        long long now = i * INTERVAL + INTERVAL / 4;
+        TEST_ASSERT_EQUAL(1, tick_scheduler_poll(&scheduler, now));
+        run_ticks(1, now, 1000);
+        TEST_ASSERT_EQUAL(0, tick_scheduler_poll(&scheduler, now));
+        TEST_ASSERT_EQUAL(INTERVAL - INTERVAL / 4, tick_scheduler_time_until_next(&scheduler, now));
+    }
+
+    tick_stats_t stats;
+    tick_scheduler_take_stats(&scheduler, &stats);
+    TEST_ASSERT_EQUAL(100, stats.ticks);
+    TEST_ASSERT_EQUAL(0, stats.missed_ticks);
+    TEST_ASSERT_EQUAL(100 * (INTERVAL / 4), stats.jitter_sum_nsec);
+    TEST_ASSERT_EQUAL(INTERVAL / 4, stats.jitter_max_nsec);
+    TEST_ASSERT_EQUAL(100 * 1000, stats.duration_sum_nsec);
+    TEST_ASSERT_EQUAL(1000, stats.duration_max_nsec);
+}
+
+void test_catch_up_is_capped(void) {
+    // Woken up 10 intervals late
+    long long now = 10 * INTERVAL + 5;
+    TEST_ASSERT_EQUAL(MAX_CATCH_UP, tick_scheduler_poll(&scheduler, now));
+    run_ticks(MAX_CATCH_UP, now, 0);
+
+    // The skipped ticks are not run later
+    TEST_ASSERT_EQUAL(0, tick_scheduler_poll(&scheduler, now));
+    TEST_ASSERT_EQUAL(INTERVAL - 5, tick_scheduler_time_until_next(&scheduler, now));
+
+    tick_stats_t stats;
+    tick_scheduler_take_stats(&scheduler, &stats);
+    TEST_ASSERT_EQUAL(MAX_CATCH_UP, stats.ticks);
+    TEST_ASSERT_EQUAL(10 - MAX_CATCH_UP, stats.missed_ticks);
+}
+
+void test_take_stats_resets(void) {
+    TEST_ASSERT_EQUAL(1, tick_scheduler_poll(&scheduler, INTERVAL));
+    run_ticks(1, INTERVAL, 10);
+
+    tick_stats_t stats;
+    tick_scheduler_take_stats(&scheduler, &stats);
+    TEST_ASSERT_EQUAL(1, stats.ticks);
+    tick_scheduler_take_stats(&scheduler, &stats);
+    TEST_ASSERT_EQUAL(0, stats.ticks);
+    TEST_ASSERT_EQUAL(0, stats.duration_max_nsec);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_first_tick_after_one_interval);
+    RUN_TEST(test_deadlines_dont_drift);
+    RUN_TEST(test_catch_up_is_capped);
+    RUN_TEST(test_take_stats_resets);
+    return UNITY_END();
+}
@@ -0,0 +1,128 @@
+#include "unity/unity.h"
+#include "../timer_wheel.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define CAPACITY 100
+#define SLOTS 16
+
+static timer_wheel_t wheel;
+static int expired[CAPACITY];
+static int expired_count;
+
+void setUp(void) {
+    timer_wheel_init(&wheel, CAPACITY, SLOTS);
+    expired_count = 0;
+}
+
+void tearDown(void) {
+    timer_wheel_free(&wheel);
+}
+
+static void record(void *udata, int id) {
+    (void)udata;
+    expired[expired_count++] = id;
+}
+
+/*
+ * Advances the wheel until the id expired and returns the number of ticks.
+ */
+static int ticks_until_expired(int id) {
+    for (int ticks = 1; ticks < 1000; ticks++) {
+        expired_count = 0;
+        timer_wheel_advance(&wheel, record, NULL);
+        for (int i = 0; i < expired_count; i++) {
+            if (expired[i] == id) {
+                return ticks;
+            }
+        }
+    }
+    return -1;
+}
+
+void test_expires_after_delay(void) {
+    timer_wheel_schedule(&wheel, 3, 5);
+    TEST_ASSERT_TRUE(timer_wheel_pending(&wheel, 3));
+    TEST_ASSERT_EQUAL(5, ticks_until_expired(3));
+    TEST_ASSERT_FALSE(timer_wheel_pending(&wheel, 3));
+
+    // A delay of 0 expires on the next tick
+    timer_wheel_schedule(&wheel, 3, 0);
+    TEST_ASSERT_EQUAL(1, ticks_until_expired(3));
+}
+
+void test_delays_longer_than_a_turn(void) {
+    timer_wheel_schedule(&wheel, 1, SLOTS * 3 + 2);
+    timer_wheel_schedule(&wheel, 2, 2);
+    TEST_ASSERT_EQUAL(2, ticks_until_expired(2));
+    TEST_ASSERT_EQUAL(SLOTS * 3, ticks_until_expired(1));
+}
+
+void test_cancel_and_reschedule(void) {
+    timer_wheel_schedule(&wheel, 1, 4);
+    timer_wheel_schedule(&wheel, 2, 4);
+    timer_wheel_schedule(&wheel, 3, 4);
+    timer_wheel_cancel(&wheel, 2);
+    // Moves the timer to a later slot
+    timer_wheel_schedule(&wheel, 3, 10);
+
+    for (int i = 0; i < 4; i++) {
+        expired_count = 0;
+        timer_wheel_advance(&wheel, record, NULL);
+    }
+    TEST_ASSERT_EQUAL(1, expired_count);
+    TEST_ASSERT_EQUAL(1, expired[0]);
+    TEST_ASSERT_EQUAL(6, ticks_until_expired(3));
+
+    // Cancelling without a pending timer does nothing
+    timer_wheel_cancel(&wheel, 2);
+    TEST_ASSERT_EQUAL(-1, ticks_until_expired(2));
+}
+
+void test_matches_brute_force(void) {
+    // Deadline of every id, or -1
+    int deadlines[CAPACITY];
+    srand(1);
+    for (int i = 0; i < CAPACITY; i++) {
+        deadlines[i] = -1;
+    }
+
+    for (int now = 1; now < 2000; now++) {
+        for (int i = 0; i < 5; i++) {
+            int id = rand() % CAPACITY;
+            if (rand() % 4 == 0) {
+                timer_wheel_cancel(&wheel, id);
+                deadlines[id] = -1;
+            } else {
+                int delay = 1 + rand() % (SLOTS * 4);
+                timer_wheel_schedule(&wheel, id, delay);
+                deadlines[id] = now - 1 + delay;
+            }
+        }
+
+        expired_count = 0;
+        timer_wheel_advance(&wheel, record, NULL);
+        bool seen[CAPACITY] = {false};
+        for (int i = 0; i < expired_count; i++) {
+            TEST_ASSERT_EQUAL(now, deadlines[expired[i]]);
+            seen[expired[i]] = true;
+        }
+        for (int id = 0; id < CAPACITY; id++) {
+            if (deadlines[id] == now) {
+                TEST_ASSERT_TRUE(seen[id]);
+                deadlines[id] = -1;
+            }
+            TEST_ASSERT_EQUAL(deadlines[id] != -1, timer_wheel_pending(&wheel, id));
+        }
+    }
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_expires_after_delay);
+    RUN_TEST(test_delays_longer_than_a_turn);
+    RUN_TEST(test_cancel_and_reschedule);
+    RUN_TEST(test_matches_brute_force);
+    return UNITY_END();
+}
@@ -0,0 +1,311 @@
+#include "unity/unity.h"
+#include "../udp_transport.h"
+#include "../udp_emulator.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define MAX_DELIVERED 4096
+#define UPDATE_INTERVAL_MSEC 10
+
+/*
+ * One side of a loopback UDP link. Datagrams of the peer go through the
+ * emulator before they are written to the socket.
+ */
+typedef struct endpoint_t {
+    int sock;
+    udp_peer_t peer;
+    udp_emulator_t emulator;
+    uint32_t delivered[MAX_DELIVERED];
+    int delivered_count;
+} endpoint_t;
+
+static endpoint_t a, b;
+static long long now_msec;
+static uint8_t packet_buf[UDP_MAX_PACKET_LEN];
+
+static int socket_send(void *udata, const struct iovec *iov, int iov_count) {
+    endpoint_t *endpoint = udata;
+    return writev(endpoint->sock, iov, iov_count) == -1 ? -1 : 0;
+}
+
+static int emulated_send(void *udata, const struct iovec *iov, int iov_count) {
+    endpoint_t *endpoint = udata;
+    return udp_emulator_send(&endpoint->emulator, iov, iov_count);
+}
+
+static void deliver(void *udata, uint8_t *msg, int msg_len) {
+    endpoint_t *endpoint = udata;
+    uint32_t value;
+
+    TEST_ASSERT_EQUAL(sizeof(value), msg_len);
+    TEST_ASSERT_LESS_THAN(MAX_DELIVERED, endpoint->delivered_count);
+    memcpy(&value, msg, sizeof(value));
+    endpoint->delivered[endpoint->delivered_count++] = value;
+}
+
+static int bind_loopback(struct sockaddr_in *addr) {
+    socklen_t addr_len = sizeof(*addr);
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    TEST_ASSERT_NOT_EQUAL(-1, sock);
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    TEST_ASSERT_EQUAL(0, bind(sock, (struct sockaddr *)addr, sizeof(*addr)));
+    TEST_ASSERT_EQUAL(0, getsockname(sock, (struct sockaddr *)addr, &addr_len));
+    TEST_ASSERT_EQUAL(0, set_nonblocking(sock));
+    return sock;
+}
+
+static void endpoint_init(endpoint_t *endpoint, int sock, double loss, int latency_msec, int jitter_msec,
+                          uint32_t seed) {
+    memset(endpoint, 0, sizeof(endpoint_t));
+    endpoint->sock = sock;
+    udp_emulator_init(&endpoint->emulator, socket_send, endpoint, loss, latency_msec, jitter_msec, seed);
+    udp_peer_init(&endpoint->peer, emulated_send, deliver, endpoint, now_msec);
+}
+
+static void setup_link(double loss, int latency_msec, int jitter_msec) {
+    struct sockaddr_in addr_a, addr_b;
+    int sock_a = bind_loopback(&addr_a);
+    int sock_b = bind_loopback(&addr_b);
+    TEST_ASSERT_EQUAL(0, connect(sock_a, (struct sockaddr *)&addr_b, sizeof(addr_b)));
+    TEST_ASSERT_EQUAL(0, connect(sock_b, (struct sockaddr *)&addr_a, sizeof(addr_a)));
+
+    now_msec = 0;
+    endpoint_init(&a, sock_a, loss, latency_msec, jitter_msec, 1);
+    endpoint_init(&b, sock_b, loss, latency_msec, jitter_msec, 2);
+}
+
+static void receive_all(endpoint_t *endpoint) {
+    int len;
+    while ((len = recv(endpoint->sock, packet_buf, sizeof(packet_buf), 0)) > 0) {
+        udp_peer_receive(&endpoint->peer, packet_buf, len, now_msec);
+    }
+}
+
+/*
+ * Advances the emulated time in steps of one millisecond and moves all due
+ * datagrams over the loopback sockets.
+ */
+static void run_link(int duration_msec) {
+    for (int i = 0; i < duration_msec; i++) {
+        now_msec++;
+        udp_emulator_poll(&a.emulator, now_msec);
+        udp_emulator_poll(&b.emulator, now_msec);
+        receive_all(&a);
+        receive_all(&b);
+        if (now_msec % UPDATE_INTERVAL_MSEC == 0) {
+            udp_peer_update(&a.peer, now_msec);
+            udp_peer_update(&b.peer, now_msec);
+        }
+    }
+}
+
+static void send_value(endpoint_t *endpoint, uint32_t value, bool reliable) {
+    frame_t *frame = frame_new(sizeof(value));
+    memcpy(frame->data, &value, sizeof(value));
+    frame->len = sizeof(value);
+    TEST_ASSERT_EQUAL(0, udp_peer_send(&endpoint->peer, frame, reliable, now_msec));
+    frame_release(frame);
+}
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+    udp_peer_free(&a.peer);
+    udp_peer_free(&b.peer);
+    udp_emulator_free(&a.emulator);
+    udp_emulator_free(&b.emulator);
+    close(a.sock);
+    close(b.sock);
+}
+
+void test_reliable_in_order_over_perfect_link(void) {
+    setup_link(0, 0, 0);
+
+    for (uint32_t i = 0; i < 10; i++) {
+        send_value(&a, i, true);
+    }
+    run_link(50);
+
+    TEST_ASSERT_EQUAL(10, b.delivered_count);
+    for (uint32_t i = 0; i < 10; i++) {
+        TEST_ASSERT_EQUAL(i, b.delivered[i]);
+    }
+    TEST_ASSERT_EQUAL(0, udp_peer_unacked_count(&a.peer));
+    TEST_ASSERT_EQUAL(0, a.peer.retransmit_count);
+}
+
+void test_reliable_in_order_over_lossy_link(void) {
+    setup_link(0.3, 20, 15);
+
+    // More messages than fit into the window, sent in bursts
+    for (uint32_t i = 0; i < 1000; i++) {
+        send_value(&a, i, true);
+        if (i % 100 == 99) {
+            run_link(300);
+        }
+    }
+    run_link(5000);
+
+    TEST_ASSERT_GREATER_THAN(0, a.emulator.dropped_count);
+    TEST_ASSERT_GREATER_THAN(0, a.peer.retransmit_count);
+    TEST_ASSERT_EQUAL(1000, b.delivered_count);
+    for (uint32_t i = 0; i < 1000; i++) {
+        TEST_ASSERT_EQUAL(i, b.delivered[i]);
+    }
+    TEST_ASSERT_EQUAL(0, udp_peer_unacked_count(&a.peer));
+}
+
+void test_unreliable_drops_stale_messages(void) {
+    // The jitter is much larger than the send interval, so the messages arrive
+    // heavily reordered
+    setup_link(0.1, 10, 50);
+
+    for (uint32_t i = 0; i < 500; i++) {
+        send_value(&a, i, false);
+        run_link(1);
+    }
+    run_link(200);
+
+    TEST_ASSERT_GREATER_THAN(0, b.delivered_count);
+    TEST_ASSERT_LESS_THAN(500, b.delivered_count);
+    for (int i = 1; i < b.delivered_count; i++) {
+        TEST_ASSERT_GREATER_THAN(b.delivered[i - 1], b.delivered[i]);
+    }
+    // Unreliable messages are never retransmitted
+    TEST_ASSERT_EQUAL(0, a.peer.retransmit_count);
+}
+
+void test_both_directions_and_channels(void) {
+    setup_link(0.2, 5, 5);
+
+    for (uint32_t i = 0; i < 100; i++) {
+        send_value(&a, i, i % 2 == 0);
+        send_value(&b, 1000 + i, true);
+        run_link(2);
+    }
+    run_link(2000);
+
+    TEST_ASSERT_EQUAL(100, a.delivered_count);
+    for (uint32_t i = 0; i < 100; i++) {
+        TEST_ASSERT_EQUAL(1000 + i, a.delivered[i]);
+    }
+
+    // All reliable (even) values arrive in order, interleaved with some of the
+    // odd ones
+    uint32_t next_even = 0;
+    for (int i = 0; i < b.delivered_count; i++) {
+        if (b.delivered[i] % 2 == 0) {
+            TEST_ASSERT_EQUAL(next_even, b.delivered[i]);
+            next_even += 2;
+        }
+    }
+    TEST_ASSERT_EQUAL(100, next_even);
+}
+
+void test_reliable_window_full(void) {
+    setup_link(0, 0, 0);
+
+    frame_t *frame = frame_new(4);
+    memset(frame->data, 0, 4);
+    frame->len = 4;
+    for (int i = 0; i < UDP_RELIABLE_WINDOW; i++) {
+        TEST_ASSERT_EQUAL(0, udp_peer_send(&a.peer, frame, true, now_msec));
+    }
+    TEST_ASSERT_EQUAL(-1, udp_peer_send(&a.peer, frame, true, now_msec));
+    TEST_ASSERT_EQUAL(ENOBUFS, errno);
+    // Unreliable messages are not limited by the window
+    TEST_ASSERT_EQUAL(0, udp_peer_send(&a.peer, frame, false, now_msec));
+    frame_release(frame);
+
+    // The burst may overflow the socket buffer, in which case the lost
+    // messages are retransmitted
+    run_link(UDP_RETRANSMIT_MSEC * 3);
+    TEST_ASSERT_GREATER_OR_EQUAL(UDP_RELIABLE_WINDOW, b.delivered_count);
+    TEST_ASSERT_EQUAL(0, udp_peer_unacked_count(&a.peer));
+}
+
+void test_malformed_packets(void) {
+    setup_link(0, 0, 0);
+
+    uint8_t too_short[] = {UDP_PACKET_RELIABLE, 0, 0, 0};
+    uint8_t unknown_type[] = {42, 0, 0, 0, 0, 1};
+    uint8_t empty_message[] = {UDP_PACKET_UNRELIABLE, 0, 0, 0, 0};
+    TEST_ASSERT_EQUAL(-1, udp_peer_receive(&a.peer, too_short, sizeof(too_short), now_msec));
+    TEST_ASSERT_EQUAL(-1, udp_peer_receive(&a.peer, unknown_type, sizeof(unknown_type), now_msec));
+    TEST_ASSERT_EQUAL(-1, udp_peer_receive(&a.peer, empty_message, sizeof(empty_message), now_msec));
+
+    // Acks for messages that were never sent are ignored
+    uint8_t bogus_ack[] = {UDP_PACKET_ACK, 0, 0, 0, 5};
+    TEST_ASSERT_EQUAL(0, udp_peer_receive(&a.peer, bogus_ack, sizeof(bogus_ack), now_msec));
+    TEST_ASSERT_EQUAL(0, udp_peer_unacked_count(&a.peer));
+    TEST_ASSERT_EQUAL(0, a.delivered_count);
+}
+
+void test_timeout(void) {
+    setup_link(1.0, 0, 0);
+
+    send_value(&a, 1, true);
+    now_msec += UDP_TIMEOUT_MSEC;
+    TEST_ASSERT_EQUAL(0, udp_peer_update(&a.peer, now_msec));
+    now_msec++;
+    TEST_ASSERT_EQUAL(-1, udp_peer_update(&a.peer, now_msec));
+    TEST_ASSERT_EQUAL(ETIMEDOUT, errno);
+}
+
+void test_cookie(void) {
+    udp_cookie_secret_t secret, other_secret;
+    TEST_ASSERT_EQUAL(0, udp_cookie_secret_init(&secret));
+    TEST_ASSERT_EQUAL(0, udp_cookie_secret_init(&other_secret));
+    uint32_t addr = 0x7f000001;
+    long long start = 3 * UDP_COOKIE_BUCKET_MSEC;
+
+    uint64_t cookie = udp_cookie(&secret, addr, 4000, start);
+    TEST_ASSERT_TRUE(udp_cookie_valid(&secret, addr, 4000, cookie, start));
+    // Only valid for the address it was made for, and with the same secret
+    TEST_ASSERT_FALSE(udp_cookie_valid(&secret, addr, 4001, cookie, start));
+    TEST_ASSERT_FALSE(udp_cookie_valid(&secret, addr + 1, 4000, cookie, start));
+    TEST_ASSERT_FALSE(udp_cookie_valid(&other_secret, addr, 4000, cookie, start));
+
+    // Valid until the end of the next bucket
+    TEST_ASSERT_TRUE(udp_cookie_valid(&secret, addr, 4000, cookie, start + 2 * UDP_COOKIE_BUCKET_MSEC - 1));
+    TEST_ASSERT_FALSE(udp_cookie_valid(&secret, addr, 4000, cookie, start + 2 * UDP_COOKIE_BUCKET_MSEC));
+}
+
+void test_handshake_packets(void) {
+    uint8_t packet[UDP_HANDSHAKE_LEN + 1];
+    uint64_t cookie;
+
+    udp_handshake_write(packet, UDP_PACKET_CONNECT, 0x0123456789abcdefULL);
+    TEST_ASSERT_EQUAL(UDP_PACKET_CONNECT, udp_handshake_read(packet, UDP_HANDSHAKE_LEN, &cookie));
+    TEST_ASSERT_TRUE(cookie == 0x0123456789abcdefULL);
+
+    // Shorter or longer datagrams could be used for amplification
+    TEST_ASSERT_EQUAL(-1, udp_handshake_read(packet, UDP_HANDSHAKE_LEN - 1, &cookie));
+    TEST_ASSERT_EQUAL(-1, udp_handshake_read(packet, UDP_HANDSHAKE_LEN + 1, &cookie));
+    TEST_ASSERT_EQUAL(-1, udp_handshake_read(packet, 0, &cookie));
+
+    udp_handshake_write(packet, UDP_PACKET_RELIABLE, 0);
+    TEST_ASSERT_EQUAL(-1, udp_handshake_read(packet, UDP_HANDSHAKE_LEN, &cookie));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_reliable_in_order_over_perfect_link);
+    RUN_TEST(test_reliable_in_order_over_lossy_link);
+    RUN_TEST(test_unreliable_drops_stale_messages);
+    RUN_TEST(test_both_directions_and_channels);
+    RUN_TEST(test_reliable_window_full);
+    RUN_TEST(test_malformed_packets);
+    RUN_TEST(test_timeout);
+    RUN_TEST(test_cookie);
+    RUN_TEST(test_handshake_packets);
+    return UNITY_END();
+}
@@ -0,0 +1,69 @@
+#include "tick_scheduler.h"
+
+#include <string.h>
+#include <time.h>
+
+long long monotonic_nsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void tick_scheduler_init(tick_scheduler_t *scheduler, long long interval_nsec, int max_catch_up_ticks,
+                         long long now_nsec) {
+    memset(scheduler, 0, sizeof(tick_scheduler_t));
+    scheduler->interval_nsec = interval_nsec;
+    scheduler->max_catch_up_ticks = max_catch_up_ticks;
+    scheduler->deadline_nsec = now_nsec + interval_nsec;
+}
+
+int tick_scheduler_poll(tick_scheduler_t *scheduler, long long now_nsec) {
+    if (now_nsec < scheduler->deadline_nsec) {
+        return 0;
+    }
+
+    long long due = (now_nsec - scheduler->deadline_nsec) / scheduler->interval_nsec + 1;
+    if (due > scheduler->max_catch_up_ticks) {
+        long long skipped = due - scheduler->max_catch_up_ticks;
+        scheduler->stats.missed_ticks += skipped;
+        scheduler->deadline_nsec += skipped * scheduler->interval_nsec;
+        due = scheduler->max_catch_up_ticks;
+    }
+
+    return due;
+}
+
+long long tick_scheduler_time_until_next(tick_scheduler_t *scheduler, long long now_nsec) {
+    long long remaining = scheduler->deadline_nsec - now_nsec;
+    return remaining > 0 ? remaining : 0;
+}
+
+void tick_scheduler_tick_started(tick_scheduler_t *scheduler, long long now_nsec) {
+    long long jitter = now_nsec - scheduler->deadline_nsec;
+    if (jitter < 0) {
+        jitter = 0;
+    }
+
+    scheduler->stats.jitter_sum_nsec += jitter;
+    if (jitter > scheduler->stats.jitter_max_nsec) {
+        scheduler->stats.jitter_max_nsec = jitter;
+    }
+
+    scheduler->tick_start_nsec = now_nsec;
+    scheduler->deadline_nsec += scheduler->interval_nsec;
+}
+
+void tick_scheduler_tick_finished(tick_scheduler_t *scheduler, long long now_nsec) {
+    long long duration = now_nsec - scheduler->tick_start_nsec;
+
+    scheduler->stats.ticks++;
+    scheduler->stats.duration_sum_nsec += duration;
+    if (duration > scheduler->stats.duration_max_nsec) {
+        scheduler->stats.duration_max_nsec = duration;
+    }
+}
+
+void tick_scheduler_take_stats(tick_scheduler_t *scheduler, tick_stats_t *stats) {
+    *stats = scheduler->stats;
+    memset(&scheduler->stats, 0, sizeof(tick_stats_t));
+}
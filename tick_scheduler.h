@@ -0,0 +1,73 @@
+#ifndef TICK_SCHEDULER_H
+#define TICK_SCHEDULER_H
+
+#include <stdint.h>
+
+/*
+ * Fixed timestep scheduler. Tick deadlines are absolute points on the
+ * `CLOCK_MONOTONIC` clock (`start + n * interval`), so late wakeups don't make
+ * the tick rate drift.
+ *
+ * When the server falls behind, at most `max_catch_up_ticks` ticks are run
+ * back-to-back. The remaining ticks are skipped and reported as missed, so an
+ * overload doesn't turn into a spiral of ever longer catch-up bursts.
+ *
+ * The caller passes the current time to every function, which keeps the
+ * scheduler deterministic in tests.
+ */
+
+typedef struct tick_stats_t {
+    uint64_t ticks;
+    uint64_t missed_ticks;
+    long long duration_sum_nsec;
+    long long duration_max_nsec;
+    // How late ticks started compared to their deadline
+    long long jitter_sum_nsec;
+    long long jitter_max_nsec;
+} tick_stats_t;
+
+typedef struct tick_scheduler_t {
+    long long interval_nsec;
+    int max_catch_up_ticks;
+    // Deadline of the next tick to run
+    long long deadline_nsec;
+    long long tick_start_nsec;
+    // Accumulated since the last `tick_scheduler_take_stats`
+    tick_stats_t stats;
+} tick_scheduler_t;
+
+/*
+ * Returns the current time of the `CLOCK_MONOTONIC` clock in nanoseconds.
+ */
+long long monotonic_nsec(void);
+
+/*
+ * The first tick is due one interval after `now_nsec`.
+ */
+void tick_scheduler_init(tick_scheduler_t *scheduler, long long interval_nsec, int max_catch_up_ticks,
+                         long long now_nsec);
+
+/*
+ * Returns the number of ticks that have to be run now, which is at most
+ * `max_catch_up_ticks`. Ticks beyond that are skipped and counted as missed.
+ */
+int tick_scheduler_poll(tick_scheduler_t *scheduler, long long now_nsec);
+
+/*
+ * Returns the time until the next tick is due, or 0 if it is due already.
+ */
+long long tick_scheduler_time_until_next(tick_scheduler_t *scheduler, long long now_nsec);
+
+/*
+ * Have to be called around every tick that `tick_scheduler_poll` returned, to
+ * advance the deadline and to record the tick duration and jitter.
+ */
+void tick_scheduler_tick_started(tick_scheduler_t *scheduler, long long now_nsec);
+void tick_scheduler_tick_finished(tick_scheduler_t *scheduler, long long now_nsec);
+
+/*
+ * Copies the stats that were accumulated since the last call and resets them.
+ */
+void tick_scheduler_take_stats(tick_scheduler_t *scheduler, tick_stats_t *stats);
+
+#endif // TICK_SCHEDULER_H
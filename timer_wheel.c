@@ -0,0 +1,88 @@
+#include "timer_wheel.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void timer_wheel_init(timer_wheel_t *wheel, int capacity, int slot_count) {
+    uint32_t size = 1;
+    while (size < (uint32_t)slot_count) {
+        size *= 2;
+    }
+
+    wheel->capacity = capacity;
+    wheel->slot_count = size;
+    wheel->slots = malloc(size * sizeof(int));
+    memset(wheel->slots, -1, size * sizeof(int));
+    wheel->next = malloc(capacity * sizeof(int));
+    wheel->prev = malloc(capacity * sizeof(int));
+    wheel->deadline = malloc(capacity * sizeof(uint32_t));
+    wheel->pending = calloc(capacity, sizeof(bool));
+    wheel->now = 0;
+}
+
+void timer_wheel_free(timer_wheel_t *wheel) {
+    free(wheel->slots);
+    free(wheel->next);
+    free(wheel->prev);
+    free(wheel->deadline);
+    free(wheel->pending);
+}
+
+static void unlink_timer(timer_wheel_t *wheel, int id) {
+    int next = wheel->next[id];
+    int prev = wheel->prev[id];
+
+    if (prev == -1) {
+        wheel->slots[wheel->deadline[id] & (wheel->slot_count - 1)] = next;
+    } else {
+        wheel->next[prev] = next;
+    }
+    if (next != -1) {
+        wheel->prev[next] = prev;
+    }
+    wheel->pending[id] = false;
+}
+
+void timer_wheel_schedule(timer_wheel_t *wheel, int id, uint32_t ticks) {
+    if (wheel->pending[id]) {
+        unlink_timer(wheel, id);
+    }
+    if (ticks == 0) {
+        ticks = 1;
+    }
+
+    uint32_t deadline = wheel->now + ticks;
+    int *slot = &wheel->slots[deadline & (wheel->slot_count - 1)];
+    wheel->deadline[id] = deadline;
+    wheel->prev[id] = -1;
+    wheel->next[id] = *slot;
+    if (*slot != -1) {
+        wheel->prev[*slot] = id;
+    }
+    *slot = id;
+    wheel->pending[id] = true;
+}
+
+void timer_wheel_cancel(timer_wheel_t *wheel, int id) {
+    if (wheel->pending[id]) {
+        unlink_timer(wheel, id);
+    }
+}
+
+int timer_wheel_advance(timer_wheel_t *wheel, timer_wheel_func_t func, void *udata) {
+    int expired = 0;
+    wheel->now++;
+
+    int id = wheel->slots[wheel->now & (wheel->slot_count - 1)];
+    while (id != -1) {
+        int next = wheel->next[id];
+        // Timers of later turns stay in the slot
+        if (wheel->deadline[id] == wheel->now) {
+            unlink_timer(wheel, id);
+            func(udata, id);
+            expired++;
+        }
+        id = next;
+    }
+    return expired;
+}
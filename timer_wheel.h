@@ -0,0 +1,66 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Hashed timer wheel for timers that are counted in ticks. Every timer belongs
+ * to an id in [0, capacity), e.g. a cell handle, and an id has at most one
+ * pending timer. Timers hang in doubly linked lists through per-id arrays, so
+ * scheduling and cancelling is O(1) and never allocates memory.
+ *
+ * A timer is stored in the slot of its deadline modulo the number of slots.
+ * Advancing the wheel by a tick only visits one slot, so the cost doesn't
+ * depend on how many timers are pending. Timers that lie more than a turn of
+ * the wheel ahead stay in their slot until a later turn reaches their
+ * deadline.
+ */
+typedef struct timer_wheel_t {
+    int capacity;
+    // Power of two
+    uint32_t slot_count;
+    // First id in every slot, -1 for an empty slot
+    int *slots;
+    // Neighbours of every id in its slot
+    int *next;
+    int *prev;
+    // Deadline of every id, only valid while its timer is pending
+    uint32_t *deadline;
+    bool *pending;
+    uint32_t now;
+} timer_wheel_t;
+
+typedef void (*timer_wheel_func_t)(void *udata, int id);
+
+/*
+ * Creates a wheel for the ids [0, capacity). `slot_count` is rounded up to a
+ * power of two, and should be larger than most delays.
+ */
+void timer_wheel_init(timer_wheel_t *wheel, int capacity, int slot_count);
+void timer_wheel_free(timer_wheel_t *wheel);
+
+/*
+ * Makes the timer of `id` expire `ticks` ticks from now, at least 1. A pending
+ * timer of the id is replaced.
+ */
+void timer_wheel_schedule(timer_wheel_t *wheel, int id, uint32_t ticks);
+
+/*
+ * Cancels the timer of `id`, if it has one.
+ */
+void timer_wheel_cancel(timer_wheel_t *wheel, int id);
+
+static inline bool timer_wheel_pending(timer_wheel_t *wheel, int id) {
+    return wheel->pending[id];
+}
+
+/*
+ * Advances the wheel by one tick and calls `func` for every timer that
+ * expires. The callback must not schedule or cancel timers.
+ *
+ * Returns the number of expired timers.
+ */
+int timer_wheel_advance(timer_wheel_t *wheel, timer_wheel_func_t func, void *udata);
+
+#endif // TIMER_WHEEL_H
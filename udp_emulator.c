@@ -0,0 +1,95 @@
+#include "udp_emulator.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct udp_emulated_packet_t {
+    udp_emulated_packet_t *next;
+    long long due_msec;
+    int len;
+    uint8_t data[];
+};
+
+// xorshift32, which is good enough for emulating loss and jitter
+static uint32_t next_random(udp_emulator_t *emulator) {
+    uint32_t x = emulator->rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    emulator->rng_state = x;
+    return x;
+}
+
+void udp_emulator_init(udp_emulator_t *emulator, udp_send_func_t send_func, void *udata,
+                       double loss, int latency_msec, int jitter_msec, uint32_t seed) {
+    memset(emulator, 0, sizeof(udp_emulator_t));
+    emulator->send_func = send_func;
+    emulator->udata = udata;
+    emulator->loss = loss;
+    emulator->latency_msec = latency_msec;
+    emulator->jitter_msec = jitter_msec;
+    // xorshift must not be seeded with 0
+    emulator->rng_state = seed ? seed : 1;
+}
+
+void udp_emulator_free(udp_emulator_t *emulator) {
+    while (emulator->head) {
+        udp_emulated_packet_t *packet = emulator->head;
+        emulator->head = packet->next;
+        free(packet);
+    }
+}
+
+int udp_emulator_send(void *udata, const struct iovec *iov, int iov_count) {
+    udp_emulator_t *emulator = udata;
+    int len = 0;
+
+    if (next_random(emulator) < emulator->loss * UINT32_MAX) {
+        emulator->dropped_count++;
+        return 0;
+    }
+
+    for (int i = 0; i < iov_count; i++) {
+        len += iov[i].iov_len;
+    }
+
+    udp_emulated_packet_t *packet = malloc(sizeof(udp_emulated_packet_t) + len);
+    packet->len = len;
+    packet->due_msec = emulator->now_msec + emulator->latency_msec;
+    if (emulator->jitter_msec > 0) {
+        packet->due_msec += next_random(emulator) % (emulator->jitter_msec + 1);
+    }
+
+    len = 0;
+    for (int i = 0; i < iov_count; i++) {
+        memcpy(packet->data + len, iov[i].iov_base, iov[i].iov_len);
+        len += iov[i].iov_len;
+    }
+
+    // Insert after all packets that are due at the same time or earlier
+    udp_emulated_packet_t **next_addr = &emulator->head;
+    while (*next_addr && (*next_addr)->due_msec <= packet->due_msec) {
+        next_addr = &(*next_addr)->next;
+    }
+    packet->next = *next_addr;
+    *next_addr = packet;
+
+    return 0;
+}
+
+void udp_emulator_poll(udp_emulator_t *emulator, long long now_msec) {
+    emulator->now_msec = now_msec;
+
+    while (emulator->head && emulator->head->due_msec <= now_msec) {
+        udp_emulated_packet_t *packet = emulator->head;
+        emulator->head = packet->next;
+
+        struct iovec iov = {
+            .iov_base = packet->data,
+            .iov_len = packet->len,
+        };
+        emulator->send_func(emulator->udata, &iov, 1);
+        emulator->sent_count++;
+        free(packet);
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef UDP_EMULATOR_H
+#define UDP_EMULATOR_H
+
+#include <stdint.h>
+
+#include "udp_transport.h"
+
+/*
+ * In-process emulation of a bad network link, for testing the UDP transport.
+ * Datagrams that are sent through the emulator are dropped with the given
+ * probability and otherwise delayed by the latency plus a random jitter, which
+ * also reorders them. Due datagrams are passed on to `send_func` by
+ * `udp_emulator_poll`.
+ *
+ * The random generator is seeded explicitly, so runs are reproducible.
+ */
+
+typedef struct udp_emulated_packet_t udp_emulated_packet_t;
+
+typedef struct udp_emulator_t {
+    udp_send_func_t send_func;
+    void *udata;
+    // Probability in [0, 1] that a datagram is lost
+    double loss;
+    int latency_msec;
+    int jitter_msec;
+    uint32_t rng_state;
+    long long now_msec;
+    // Delayed datagrams, ordered by delivery time
+    udp_emulated_packet_t *head;
+    int sent_count;
+    int dropped_count;
+} udp_emulator_t;
+
+void udp_emulator_init(udp_emulator_t *emulator, udp_send_func_t send_func, void *udata,
+                       double loss, int latency_msec, int jitter_msec, uint32_t seed);
+void udp_emulator_free(udp_emulator_t *emulator);
+
+/*
+ * Has the signature of `udp_send_func_t`, with the emulator as `udata`, so it
+ * can be plugged into a `udp_peer_t`. The datagram is sent at the time of the
+ * last `udp_emulator_poll` plus the delay.
+ */
+int udp_emulator_send(void *udata, const struct iovec *iov, int iov_count);
+
+/*
+ * Passes all datagrams that are due at `now_msec` on to `send_func`.
+ */
+void udp_emulator_poll(udp_emulator_t *emulator, long long now_msec);
+
+#endif // UDP_EMULATOR_H
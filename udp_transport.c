@@ -0,0 +1,292 @@
+#include "udp_transport.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/random.h>
+
+// SipHash-2-4 rounds
+#define SIPHASH_C_ROUNDS 2
+#define SIPHASH_D_ROUNDS 4
+
+// Whether sequence number `a` is newer than `b`, taking wrap-around into account
+static inline bool seq_newer(uint16_t a, uint16_t b) {
+    return (int16_t)(a - b) > 0;
+}
+
+static void write_header(uint8_t *header, int type, uint16_t seq, uint16_t ack) {
+    header[0] = type;
+    header[1] = seq >> 8;
+    header[2] = seq & 0xff;
+    header[3] = ack >> 8;
+    header[4] = ack & 0xff;
+}
+
+static int transmit(udp_peer_t *peer, int type, uint16_t seq, frame_t *frame) {
+    uint8_t header[UDP_HEADER_LEN];
+    struct iovec iov[2];
+    int iov_count = 1;
+
+    write_header(header, type, seq, peer->reliable_receive_seq);
+    iov[0].iov_base = header;
+    iov[0].iov_len = UDP_HEADER_LEN;
+    if (frame) {
+        iov[1].iov_base = frame->data;
+        iov[1].iov_len = frame->len;
+        iov_count = 2;
+    }
+
+    // Every packet carries the ack
+    peer->ack_pending = false;
+    return peer->send_func(peer->udata, iov, iov_count);
+}
+
+void udp_peer_init(udp_peer_t *peer, udp_send_func_t send_func, udp_deliver_func_t deliver_func,
+                   void *udata, long long now_msec) {
+    memset(peer, 0, sizeof(udp_peer_t));
+    peer->send_func = send_func;
+    peer->deliver_func = deliver_func;
+    peer->udata = udata;
+    peer->last_receive_msec = now_msec;
+}
+
+void udp_peer_free(udp_peer_t *peer) {
+    for (int i = 0; i < UDP_RELIABLE_WINDOW; i++) {
+        if (peer->unacked[i]) {
+            frame_release(peer->unacked[i]);
+            peer->unacked[i] = NULL;
+        }
+        if (peer->out_of_order[i]) {
+            frame_release(peer->out_of_order[i]);
+            peer->out_of_order[i] = NULL;
+        }
+    }
+}
+
+int udp_peer_send(udp_peer_t *peer, frame_t *frame, bool reliable, long long now_msec) {
+    if (frame->len > UDP_MAX_MESSAGE_LEN) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    if (!reliable) {
+        transmit(peer, UDP_PACKET_UNRELIABLE, peer->unreliable_send_seq++, frame);
+        return 0;
+    }
+
+    if (udp_peer_unacked_count(peer) == UDP_RELIABLE_WINDOW) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    uint16_t seq = peer->reliable_send_seq++;
+    peer->unacked[seq % UDP_RELIABLE_WINDOW] = frame_ref(frame);
+    peer->unacked_sent_msec[seq % UDP_RELIABLE_WINDOW] = now_msec;
+    transmit(peer, UDP_PACKET_RELIABLE, seq, frame);
+    return 0;
+}
+
+static void process_ack(udp_peer_t *peer, uint16_t ack) {
+    // Acks for messages we never sent are bogus
+    if (seq_newer(ack, peer->reliable_send_seq)) {
+        return;
+    }
+
+    while (seq_newer(ack, peer->reliable_ack_seq)) {
+        int idx = peer->reliable_ack_seq % UDP_RELIABLE_WINDOW;
+        frame_release(peer->unacked[idx]);
+        peer->unacked[idx] = NULL;
+        peer->reliable_ack_seq++;
+    }
+}
+
+static void receive_reliable(udp_peer_t *peer, uint16_t seq, uint8_t *msg, int msg_len) {
+    uint16_t distance = seq - peer->reliable_receive_seq;
+
+    // Even duplicates have to be acknowledged, since the ack for the original
+    // might have been lost
+    peer->ack_pending = true;
+
+    if (distance >= UDP_RELIABLE_WINDOW) {
+        // Either a duplicate or too far ahead to buffer
+        return;
+    }
+
+    if (distance > 0) {
+        int idx = seq % UDP_RELIABLE_WINDOW;
+        if (!peer->out_of_order[idx]) {
+            frame_t *frame = frame_new(msg_len);
+            memcpy(frame->data, msg, msg_len);
+            frame->len = msg_len;
+            peer->out_of_order[idx] = frame;
+        }
+        return;
+    }
+
+    peer->deliver_func(peer->udata, msg, msg_len);
+    peer->reliable_receive_seq++;
+
+    // The message may have closed a gap, so deliver everything that was
+    // waiting for it
+    while (1) {
+        int idx = peer->reliable_receive_seq % UDP_RELIABLE_WINDOW;
+        frame_t *frame = peer->out_of_order[idx];
+        if (!frame) {
+            break;
+        }
+        peer->out_of_order[idx] = NULL;
+        peer->deliver_func(peer->udata, frame->data, frame->len);
+        frame_release(frame);
+        peer->reliable_receive_seq++;
+    }
+}
+
+int udp_peer_receive(udp_peer_t *peer, uint8_t *packet, int packet_len, long long now_msec) {
+    if (packet_len < UDP_HEADER_LEN) {
+        return -1;
+    }
+
+    int type = packet[0];
+    uint16_t seq = (packet[1] << 8) | packet[2];
+    uint16_t ack = (packet[3] << 8) | packet[4];
+    uint8_t *msg = packet + UDP_HEADER_LEN;
+    int msg_len = packet_len - UDP_HEADER_LEN;
+
+    if (type != UDP_PACKET_UNRELIABLE && type != UDP_PACKET_RELIABLE && type != UDP_PACKET_ACK) {
+        return -1;
+    }
+    if (type != UDP_PACKET_ACK && msg_len == 0) {
+        return -1;
+    }
+
+    peer->last_receive_msec = now_msec;
+    process_ack(peer, ack);
+
+    switch (type) {
+        case UDP_PACKET_UNRELIABLE:
+            if (peer->unreliable_received && !seq_newer(seq, peer->unreliable_receive_seq)) {
+                // Superseded by a message that was already delivered
+                break;
+            }
+            peer->unreliable_received = true;
+            peer->unreliable_receive_seq = seq;
+            peer->deliver_func(peer->udata, msg, msg_len);
+            break;
+
+        case UDP_PACKET_RELIABLE:
+            receive_reliable(peer, seq, msg, msg_len);
+            break;
+    }
+
+    return 0;
+}
+
+int udp_peer_update(udp_peer_t *peer, long long now_msec) {
+    if (now_msec - peer->last_receive_msec > UDP_TIMEOUT_MSEC) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
+    for (uint16_t seq = peer->reliable_ack_seq; seq != peer->reliable_send_seq; seq++) {
+        int idx = seq % UDP_RELIABLE_WINDOW;
+        if (now_msec - peer->unacked_sent_msec[idx] >= UDP_RETRANSMIT_MSEC) {
+            peer->unacked_sent_msec[idx] = now_msec;
+            peer->retransmit_count++;
+            transmit(peer, UDP_PACKET_RELIABLE, seq, peer->unacked[idx]);
+        }
+    }
+
+    if (peer->ack_pending) {
+        transmit(peer, UDP_PACKET_ACK, 0, NULL);
+    }
+
+    return 0;
+}
+
+static inline uint64_t rotl64(uint64_t x, int b) {
+    return (x << b) | (x >> (64 - b));
+}
+
+static inline void sip_round(uint64_t v[4]) {
+    v[0] += v[1];
+    v[1] = rotl64(v[1], 13);
+    v[1] ^= v[0];
+    v[0] = rotl64(v[0], 32);
+    v[2] += v[3];
+    v[3] = rotl64(v[3], 16);
+    v[3] ^= v[2];
+    v[0] += v[3];
+    v[3] = rotl64(v[3], 21);
+    v[3] ^= v[0];
+    v[2] += v[1];
+    v[1] = rotl64(v[1], 17);
+    v[1] ^= v[2];
+    v[2] = rotl64(v[2], 32);
+}
+
+// SipHash-2-4 of a message of two little-endian words
+static uint64_t siphash_words(const uint64_t key[2], uint64_t m0, uint64_t m1) {
+    uint64_t v[4] = {
+        key[0] ^ 0x736f6d6570736575ULL,
+        key[1] ^ 0x646f72616e646f6dULL,
+        key[0] ^ 0x6c7967656e657261ULL,
+        key[1] ^ 0x7465646279746573ULL,
+    };
+    // The final block only holds the message length of 16 bytes
+    uint64_t blocks[3] = {m0, m1, (uint64_t)16 << 56};
+
+    for (int i = 0; i < 3; i++) {
+        v[3] ^= blocks[i];
+        for (int j = 0; j < SIPHASH_C_ROUNDS; j++) {
+            sip_round(v);
+        }
+        v[0] ^= blocks[i];
+    }
+
+    v[2] ^= 0xff;
+    for (int j = 0; j < SIPHASH_D_ROUNDS; j++) {
+        sip_round(v);
+    }
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+static uint64_t bucket_cookie(const udp_cookie_secret_t *secret, uint32_t addr, uint16_t port, long long bucket) {
+    return siphash_words(secret->key, ((uint64_t)addr << 16) | port, (uint64_t)bucket);
+}
+
+int udp_cookie_secret_init(udp_cookie_secret_t *secret) {
+    return getentropy(secret->key, sizeof(secret->key));
+}
+
+uint64_t udp_cookie(const udp_cookie_secret_t *secret, uint32_t addr, uint16_t port, long long now_msec) {
+    return bucket_cookie(secret, addr, port, now_msec / UDP_COOKIE_BUCKET_MSEC);
+}
+
+bool udp_cookie_valid(const udp_cookie_secret_t *secret, uint32_t addr, uint16_t port, uint64_t cookie,
+                      long long now_msec) {
+    long long bucket = now_msec / UDP_COOKIE_BUCKET_MSEC;
+    return cookie == bucket_cookie(secret, addr, port, bucket) ||
+           cookie == bucket_cookie(secret, addr, port, bucket - 1);
+}
+
+void udp_handshake_write(uint8_t *packet, int type, uint64_t cookie) {
+    packet[0] = type;
+    for (int i = 0; i < 8; i++) {
+        packet[1 + i] = cookie >> (56 - 8 * i);
+    }
+}
+
+int udp_handshake_read(const uint8_t *packet, int packet_len, uint64_t *cookie) {
+    int type = packet_len > 0 ? packet[0] : -1;
+    if (packet_len != UDP_HANDSHAKE_LEN ||
+        (type != UDP_PACKET_HELLO && type != UDP_PACKET_COOKIE && type != UDP_PACKET_CONNECT)) {
+        return -1;
+    }
+
+    *cookie = 0;
+    for (int i = 0; i < 8; i++) {
+        *cookie = (*cookie << 8) | packet[1 + i];
+    }
+    return type;
+}
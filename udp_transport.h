@@ -0,0 +1,188 @@
+#ifndef UDP_TRANSPORT_H
+#define UDP_TRANSPORT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "networking.h"
+
+/*
+ * Message transport over UDP, so that a lost packet doesn't stall every later
+ * message like a lost TCP segment does. Every datagram carries one message in
+ * the encoding of `protocol.c`, on one of two channels per peer:
+ *
+ *  - The unreliable channel is sequenced: messages may be lost, but a message
+ *    that is older than one that was already delivered is dropped. It carries
+ *    messages that are superseded by the next one, like position snapshots and
+ *    targets.
+ *  - The reliable channel delivers every message exactly once and in order.
+ *    Messages are retransmitted until the peer acknowledged them.
+ *
+ * Every datagram starts with a header:
+ *
+ *   uint8  packet type (`UDP_PACKET_*`)
+ *   uint16 sequence number on the packet's channel
+ *   uint16 cumulative ack: the next reliable sequence number the sender
+ *          expects from the peer
+ *
+ * The peer doesn't do any I/O itself. Datagrams go out through `send_func`, and
+ * the owner passes received datagrams to `udp_peer_receive`, so the peer can
+ * be used with a socket just as well as with an in-memory link.
+ *
+ * Before a server opens a connection, the client has to prove that it receives
+ * packets sent to its source address, so that spoofed addresses can't open
+ * connections or make the server flood someone else:
+ *
+ *  1. The client sends `UDP_PACKET_HELLO`.
+ *  2. The server answers with `UDP_PACKET_COOKIE`, which carries a cookie that
+ *     is derived from the client's address, the time and a secret. The server
+ *     doesn't keep any state for it.
+ *  3. The client echoes the cookie in `UDP_PACKET_CONNECT`, and the server
+ *     opens the connection if the cookie is valid. The client repeats the
+ *     connect until the first packet of the connection arrives.
+ *
+ * Handshake packets are `UDP_HANDSHAKE_LEN` bytes long, the type followed by
+ * the cookie (zero in a hello), so the server never answers with more bytes
+ * than it received.
+ */
+
+#define UDP_PACKET_UNRELIABLE 1
+#define UDP_PACKET_RELIABLE 2
+// Carries only the ack, when there was no other packet to piggyback it on
+#define UDP_PACKET_ACK 3
+#define UDP_PACKET_HELLO 4
+#define UDP_PACKET_COOKIE 5
+#define UDP_PACKET_CONNECT 6
+
+#define UDP_HEADER_LEN 5
+// Largest payload of an IPv4 UDP datagram
+#define UDP_MAX_PACKET_LEN 65507
+#define UDP_MAX_MESSAGE_LEN (UDP_MAX_PACKET_LEN - UDP_HEADER_LEN)
+
+// Maximum number of unacknowledged reliable messages. This is also the window
+// in which out-of-order reliable messages are buffered by the receiver.
+#define UDP_RELIABLE_WINDOW 256
+#define UDP_RETRANSMIT_MSEC 100
+// Peers that didn't send anything for this long are considered gone
+#define UDP_TIMEOUT_MSEC 10000
+
+#define UDP_HANDSHAKE_LEN 9
+// Cookies are valid in the time bucket they were made in and the next one
+#define UDP_COOKIE_BUCKET_MSEC 5000
+
+/*
+ * Sends the datagram that is made up of the `iov_count` buffers.
+ *
+ * Returns 0 on success and -1 on error. Datagrams may be lost anyway, so errors
+ * like a full socket buffer can be ignored.
+ */
+typedef int (*udp_send_func_t)(void *udata, const struct iovec *iov, int iov_count);
+
+/*
+ * Called for every message that is delivered to the owner of the peer.
+ */
+typedef void (*udp_deliver_func_t)(void *udata, uint8_t *msg, int msg_len);
+
+typedef struct udp_peer_t {
+    udp_send_func_t send_func;
+    udp_deliver_func_t deliver_func;
+    void *udata;
+    long long last_receive_msec;
+
+    uint16_t unreliable_send_seq;
+    uint16_t unreliable_receive_seq;
+    bool unreliable_received;
+
+    // Sequence number of the next new reliable message
+    uint16_t reliable_send_seq;
+    // Oldest reliable message that was not acknowledged yet
+    uint16_t reliable_ack_seq;
+    // Unacknowledged reliable messages, indexed by sequence number
+    frame_t *unacked[UDP_RELIABLE_WINDOW];
+    long long unacked_sent_msec[UDP_RELIABLE_WINDOW];
+
+    // Next reliable sequence number we expect
+    uint16_t reliable_receive_seq;
+    // Reliable messages that arrived before the ones preceding them
+    frame_t *out_of_order[UDP_RELIABLE_WINDOW];
+    // Set when reliable messages were received that we didn't acknowledge yet
+    bool ack_pending;
+
+    int retransmit_count;
+} udp_peer_t;
+
+void udp_peer_init(udp_peer_t *peer, udp_send_func_t send_func, udp_deliver_func_t deliver_func,
+                   void *udata, long long now_msec);
+void udp_peer_free(udp_peer_t *peer);
+
+/*
+ * Sends the message in `frame` on the reliable or the unreliable channel. A
+ * reference to the frame is kept until a reliable message was acknowledged.
+ *
+ * Returns 0 on success and -1 if the message is too long (`EMSGSIZE`) or too
+ * many reliable messages are unacknowledged (`ENOBUFS`).
+ */
+int udp_peer_send(udp_peer_t *peer, frame_t *frame, bool reliable, long long now_msec);
+
+/*
+ * Processes a received datagram and delivers the messages that became
+ * available through `deliver_func`.
+ *
+ * Returns 0 on success and -1 if the datagram is malformed, in which case it is
+ * ignored.
+ */
+int udp_peer_receive(udp_peer_t *peer, uint8_t *packet, int packet_len, long long now_msec);
+
+/*
+ * Retransmits reliable messages that were not acknowledged in time and sends
+ * pending acks. Has to be called regularly, e.g. every 10 milliseconds.
+ *
+ * Returns 0 on success and -1 if the peer timed out (`ETIMEDOUT`).
+ */
+int udp_peer_update(udp_peer_t *peer, long long now_msec);
+
+// Key of the cookies, random for every server
+typedef struct udp_cookie_secret_t {
+    uint64_t key[2];
+} udp_cookie_secret_t;
+
+/*
+ * Fills the secret with random bytes from the OS.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int udp_cookie_secret_init(udp_cookie_secret_t *secret);
+
+/*
+ * Returns the cookie for the IPv4 address and port (in host byte order) at the
+ * given time. It is a SipHash of the address and the time bucket, so it can't
+ * be forged without the secret.
+ */
+uint64_t udp_cookie(const udp_cookie_secret_t *secret, uint32_t addr, uint16_t port, long long now_msec);
+
+/*
+ * Whether the cookie was made for the address and port in the current or the
+ * previous time bucket.
+ */
+bool udp_cookie_valid(const udp_cookie_secret_t *secret, uint32_t addr, uint16_t port, uint64_t cookie,
+                      long long now_msec);
+
+/*
+ * Writes a handshake packet of `UDP_HANDSHAKE_LEN` bytes into `packet`.
+ */
+void udp_handshake_write(uint8_t *packet, int type, uint64_t cookie);
+
+/*
+ * Reads a handshake packet.
+ *
+ * Returns the packet type and stores the cookie in `cookie`, or returns -1 if
+ * the datagram isn't a handshake packet of the right length.
+ */
+int udp_handshake_read(const uint8_t *packet, int packet_len, uint64_t *cookie);
+
+static inline int udp_peer_unacked_count(udp_peer_t *peer) {
+    return (uint16_t)(peer->reliable_send_seq - peer->reliable_ack_seq);
+}
+
+#endif // UDP_TRANSPORT_H